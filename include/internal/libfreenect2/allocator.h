@@ -54,6 +54,10 @@ public:
    */
   virtual Buffer *allocate(size_t size) = 0;
   virtual void free(Buffer *b) = 0;
+  /* Share b: it stays allocated until one more free().
+   * Returns false if the allocator can not share buffers.
+   */
+  virtual bool hold(Buffer * /*b*/) { return false; }
   virtual ~Allocator() {}
 };
 
@@ -68,6 +72,12 @@ public:
   /* This inner allocator will be freed by PoolAllocator. */
   PoolAllocator(Allocator *inner);
 
+  /* Pool of count buffers instead of two. If inner is NULL, new is used. */
+  PoolAllocator(Allocator *inner, size_t count);
+
+  /* Buffers shared with hold() stay valid until their last free(),
+   * the others are freed now.
+   */
   virtual ~PoolAllocator();
 
   /* allocate() will block until an allocation is possible.
@@ -91,6 +101,14 @@ public:
    * free() can be called from different threads than allocate().
    */
   virtual void free(Buffer *b);
+
+  /* Buffers are counted, each hold() needs a matching free().
+   * A shared buffer may outlive the PoolAllocator.
+   */
+  virtual bool hold(Buffer *b);
+
+  /* Number of buffers allocate() can return without waiting. */
+  size_t available();
 private:
   PoolAllocatorImpl *impl_;
 };
@@ -75,7 +75,8 @@ public:
       packet_mutex_.unlock();
     }
 
-    return locked;
+    // the processor may be short of packet buffers
+    return locked && processor_->ready();
   }
 
   virtual bool good()
@@ -130,7 +131,9 @@ private:
 
     while(!shutdown_)
     {
-      WAIT_CONDITION(packet_condition_, packet_mutex_, l);
+      // a packet may have been stored before this thread first waited
+      if(!current_packet_available_)
+        WAIT_CONDITION(packet_condition_, packet_mutex_, l);
 
       if(current_packet_available_)
       {
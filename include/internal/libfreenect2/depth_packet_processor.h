@@ -116,7 +116,24 @@ public:
   virtual void loadXZTables(const float *xtable, const float *ztable) = 0;
   virtual void loadLookupTable(const short *lut) = 0;
 
+  /**
+   * Load the table used by Config::EnableUndistortion.
+   * @param map TABLE_SIZE entries from computeDistortMap().
+   */
+  virtual void loadDistortMap(const int * /*map*/) {}
+
+  /**
+   * Load the table used by Config::EnablePointCloud.
+   * @param rays TABLE_SIZE pairs of x/z and y/z of the ray through each pixel of the depth frame.
+   */
+  virtual void loadRayTable(const float * /*rays*/) {}
+
 protected:
+  /** Whether the processor honors Config::EnableUndistortion. */
+  virtual bool supportsUndistortion() const { return false; }
+  /** Whether the processor honors Config::EnablePointCloud. */
+  virtual bool supportsPointCloud() const { return false; }
+
   libfreenect2::DepthPacketProcessor::Config config_;
   libfreenect2::FrameListener *listener_;
 };
@@ -159,14 +176,31 @@ public:
 
   virtual void loadXZTables(const float *xtable, const float *ztable);
   virtual void loadLookupTable(const short *lut);
+  virtual void loadDistortMap(const int *map);
+  virtual void loadRayTable(const float *rays);
 
   virtual const char *name() { return "CPU"; }
   virtual void process(const DepthPacket &packet);
+protected:
+  virtual bool supportsUndistortion() const { return true; }
+  virtual bool supportsPointCloud() const { return true; }
 private:
   CpuDepthPacketProcessorImpl *impl_;
 };
 
 #ifdef LIBFREENECT2_WITH_OPENCL_SUPPORT
+} /* namespace libfreenect2 */
+
+namespace cl
+{
+class Context;
+class Device;
+class Buffer;
+} /* namespace cl */
+
+namespace libfreenect2
+{
+
 class OpenCLDepthPacketProcessorImpl;
 
 /** Depth packet processor using OpenCL. */
@@ -181,13 +215,31 @@ public:
 
   virtual void loadXZTables(const float *xtable, const float *ztable);
   virtual void loadLookupTable(const short *lut);
+  virtual void loadDistortMap(const int *map);
+  virtual void loadRayTable(const float *rays);
 
   virtual bool good();
   virtual const char *name() { return "OpenCL"; }
 
   virtual void process(const DepthPacket &packet);
+
+  /**
+   * Get the OpenCL context the processor runs in, so other OpenCL stages can share its buffers.
+   * @return false if the device could not be initialized.
+   */
+  bool getContext(cl::Context &context, cl::Device &device);
+
+  /**
+   * Look up the device copy of a depth frame emitted by this processor.
+   * It stays valid as long as the frame is not deleted.
+   * @return false if the frame was not produced by this processor, or if its buffer
+   * no longer holds the frame with the same sequence number.
+   */
+  bool getDepthBuffer(const Frame *frame, cl::Buffer &buffer);
 protected:
   virtual Allocator *getAllocator();
+  virtual bool supportsUndistortion() const { return true; }
+  virtual bool supportsPointCloud() const { return true; }
 private:
   OpenCLDepthPacketProcessorImpl *impl_;
 };
@@ -35,6 +35,7 @@
 #include <libfreenect2/config.h>
 
 #include <libfreenect2/depth_packet_processor.h>
+#include <libfreenect2/threading.h>
 
 #include <libfreenect2/data_callback.h>
 
@@ -64,10 +65,14 @@ public:
   virtual ~DepthPacketStreamParser();
 
   void setPacketProcessor(libfreenect2::BaseDepthPacketProcessor *processor);
+  /** Set the packet observer. The previous one is no longer called once this returns. */
+  void setPacketTap(PacketTap<DepthPacket> *tap);
 
   virtual void onDataReceived(unsigned char* buffer, size_t length);
 private:
   libfreenect2::BaseDepthPacketProcessor *processor_;
+  PacketTap<DepthPacket> *tap_; ///< Observer of all parsed packets, may be NULL.
+  libfreenect2::mutex tap_mutex_; ///< Guards #tap_, which is replaced while the USB thread uses it.
 
   size_t buffer_size_;
   DepthPacket packet_;
@@ -0,0 +1,61 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+
+/** @file distortion.h Pixel mapping tables of the depth camera. */
+
+#ifndef DISTORTION_H_
+#define DISTORTION_H_
+
+#include <libfreenect2/libfreenect2.hpp>
+
+namespace libfreenect2
+{
+
+/**
+ * Map every pixel of the undistorted depth image to the depth frame pixel it samples.
+ * Registration and the depth processors share this table so that their undistorted
+ * frames are identical.
+ * @param depth Depth camera parameters.
+ * @param[out] map 512*424 entries, indexing the distorted depth frame, or -1 for pixels outside of it.
+ * @param y_begin First row to compute; rows are independent, so the table can be built in parts.
+ * @param y_end Row after the last one to compute.
+ */
+void computeDistortMap(const Freenect2Device::IrCameraParams &depth, int *map, int y_begin = 0, int y_end = 424);
+
+/**
+ * Map every pixel of the undistorted depth image into the color camera, without the depth dependent shift.
+ * @param depth Depth camera parameters.
+ * @param color Color camera parameters.
+ * @param[out] map_x 512*424 x coordinates, normalized; shift_m / z is added before scaling by fx.
+ * @param[out] map_y 512*424 y coordinates (pixel).
+ * @param y_begin First row to compute.
+ * @param y_end Row after the last one to compute.
+ */
+void computeDepthToColorMap(const Freenect2Device::IrCameraParams &depth, const Freenect2Device::ColorCameraParams &color, float *map_x, float *map_y, int y_begin = 0, int y_end = 424);
+
+} /* namespace libfreenect2 */
+#endif /* DISTORTION_H_ */
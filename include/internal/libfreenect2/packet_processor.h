@@ -82,6 +82,25 @@ private:
   PoolAllocator default_allocator_;
 };
 
+/**
+ * Observer of the complete packets found by a stream parser.
+ * It sees every packet, including those skipped because the processor is busy.
+ * It is called from the USB thread, and must not block.
+ * @tparam PacketT Type of the packet being observed.
+ */
+template<typename PacketT>
+class PacketTap
+{
+public:
+  virtual ~PacketTap() {}
+
+  /**
+   * A new packet has been parsed. The packet data is only valid during the call.
+   * @param packet Parsed packet.
+   */
+  virtual void onPacket(const PacketT &packet) = 0;
+};
+
 /**
  * Dummy processor class.
  * @tparam PacketT Type of the packet being processed.
@@ -0,0 +1,140 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+/** @file packet_recorder_impl.h Memory rings of raw packets for PacketRingRecorder. */
+
+#ifndef PACKET_RECORDER_IMPL_H_
+#define PACKET_RECORDER_IMPL_H_
+
+#include <string>
+#include <vector>
+#include <libfreenect2/threading.h>
+#include <libfreenect2/rgb_packet_processor.h>
+#include <libfreenect2/depth_packet_processor.h>
+
+namespace libfreenect2
+{
+
+/** Preallocated ring of variable size packets of a single stream.
+ * Not thread safe; PacketRingRecorderImpl serializes access.
+ */
+class PacketRing
+{
+public:
+  /** Metadata of a packet stored in the ring. */
+  struct Record
+  {
+    size_t offset;
+    size_t length;
+    uint32_t timestamp;
+    uint32_t sequence;
+  };
+
+  /**
+   * @param capacity Size of the data ring in bytes.
+   * @param max_records Maximum number of packets in the ring.
+   */
+  PacketRing(size_t capacity, size_t max_records);
+  ~PacketRing();
+
+  /** Copy a packet into the ring, evicting the oldest packets before @p protect.
+   * @return false if the packet does not fit without evicting protected packets.
+   */
+  bool push(const unsigned char *data, size_t length, uint32_t timestamp, uint32_t sequence, size_t protect);
+
+  /** Id of the oldest packet in the ring. Ids increase by one per packet. */
+  size_t begin() const { return begin_; }
+  /** Id past the newest packet in the ring. */
+  size_t end() const { return end_; }
+
+  const Record &record(size_t id) const { return records_[id % records_.size()]; }
+  const unsigned char *data(size_t id) const { return data_ + record(id).offset; }
+
+private:
+  unsigned char *data_;
+  size_t capacity_;
+  std::vector<Record> records_;
+  size_t begin_;
+  size_t end_;
+};
+
+/** State of PacketRingRecorder. Receives the packets from the stream parsers. */
+class PacketRingRecorderImpl: public PacketTap<RgbPacket>, public PacketTap<DepthPacket>
+{
+public:
+  PacketRingRecorderImpl(const std::string &directory, float pre_trigger_seconds, float post_trigger_seconds, size_t max_bytes);
+  virtual ~PacketRingRecorderImpl();
+
+  virtual void onPacket(const RgbPacket &packet);
+  virtual void onPacket(const DepthPacket &packet);
+
+  bool trigger();
+  /** Stop adding packets to the capture being collected, if any. */
+  void endCapture();
+  bool isCapturing();
+  size_t getWrittenPackets();
+  size_t getDroppedPackets();
+
+private:
+  /** A ring plus its position in the current capture. */
+  struct Stream
+  {
+    PacketRing *ring;
+    const char *tag;
+    const char *suffix;
+    size_t next_write; ///< Id of the next packet to write.
+    size_t end_write;  ///< Id past the last packet to write.
+  };
+
+  enum { DepthStream, RgbStream, NumStreams };
+
+  void push(Stream &stream, const unsigned char *data, size_t length, uint32_t timestamp, uint32_t sequence);
+
+  void run();
+  static void static_execute(void *arg);
+
+  std::string directory_;
+  uint32_t pre_trigger_ticks_;
+  uint32_t post_trigger_ticks_;
+
+  Stream streams_[NumStreams];
+  bool capturing_;
+  bool collecting_;        ///< Packets are still added to the capture.
+  bool have_timestamp_;
+  uint32_t last_timestamp_;
+  uint32_t capture_end_;
+  size_t received_;        ///< Packets pushed so far, to notice that the stream stopped.
+  size_t written_;
+  size_t dropped_;
+  bool shutdown_;
+
+  libfreenect2::mutex mutex_;
+  libfreenect2::condition_variable condition_;
+  libfreenect2::thread *thread_;
+};
+
+} /* namespace libfreenect2 */
+#endif /* PACKET_RECORDER_IMPL_H_ */
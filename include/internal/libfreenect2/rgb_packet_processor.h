@@ -31,8 +31,10 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <vector>
 
 #include <libfreenect2/config.h>
+#include <libfreenect2/libfreenect2.hpp>
 #include <libfreenect2/frame_listener.hpp>
 #include <libfreenect2/packet_processor.h>
 
@@ -56,16 +58,70 @@ struct RgbPacket
 
 typedef PacketProcessor<RgbPacket> BaseRgbPacketProcessor;
 
+/** Observer of the JPEG of a color packet while it is being received, before the packet is complete and checked.
+ * It is called from the USB thread.
+ */
+class RgbStreamTap
+{
+public:
+  virtual ~RgbStreamTap() {}
+
+  /** More of the JPEG arrived. Must not block.
+   * @param jpeg Start of the JPEG, the same for all calls until the packet is processed or dropped.
+   * @param length Bytes received so far, which can run past the end of the JPEG.
+   */
+  virtual void onStreamData(const unsigned char *jpeg, size_t length) = 0;
+
+  /** The bytes given so far are discarded instead of being processed.
+   * The buffer is overwritten after the call, so return only when done reading it.
+   * @param jpeg Start of the discarded JPEG. Bytes streamed into other buffers are not affected.
+   */
+  virtual void onStreamDropped(const unsigned char *jpeg) = 0;
+};
+
 /** JPEG processor. */
 class RgbPacketProcessor : public BaseRgbPacketProcessor
 {
 public:
+  typedef Freenect2Device::Config Config;
+
   RgbPacketProcessor();
   virtual ~RgbPacketProcessor();
 
   virtual void setFrameListener(libfreenect2::FrameListener *listener);
+  virtual void setConfiguration(const libfreenect2::RgbPacketProcessor::Config &config);
+
+  /** Whether process() only queues the packet, so the pipeline needs no thread of its own to call it. */
+  virtual bool isAsynchronous() const { return false; }
+
+  /** False while Frame::Raw frames hold so many packet buffers that the next packet could not be parsed. */
+  virtual bool ready();
+
+  /** Observer for the stream parser to pass packets to while they are received, NULL if not needed. */
+  virtual RgbStreamTap *getStreamTap() { return 0; }
 protected:
+  /** Whether the processor honors Config::ColorDownscale. */
+  virtual bool supportsDownscale() const { return false; }
+  /** Whether the processor can output Config::ColorFormat in this format, BGRX is always accepted. */
+  virtual bool supportsFormat(Frame::Format /*format*/) const { return false; }
+  /** Whether the processor calls passthrough() for Frame::Raw output. */
+  virtual bool supportsPassthrough() const { return false; }
+  /** Whether the processor honors the color region of Config::ColorRoiWidth. */
+  virtual bool supportsRoi() const { return false; }
+
+  /** Deliver the JPEG of the packet as a Frame::Raw frame if Config::ColorFormat asks for it.
+   * The frame shares the packet buffer if its allocator can share buffers, the JPEG is copied otherwise.
+   * @return Whether the packet was handled.
+   */
+  bool passthrough(const libfreenect2::RgbPacket &packet);
+
+  virtual Allocator *getAllocator();
+
+  libfreenect2::RgbPacketProcessor::Config config_;
   libfreenect2::FrameListener *listener_;
+private:
+  /** Packet buffers: one parsed into, one processed, and two for Frame::Raw frames kept by the listener. */
+  PoolAllocator packet_allocator_;
 };
 
 /** Class for dumping the JPEG information, eg to file. */
@@ -77,6 +133,59 @@ public:
   virtual void process(const libfreenect2::RgbPacket &packet);
 };
 
+class ParallelRgbPacketProcessorImpl;
+
+/** Decode with several processors in parallel, delivering the frames in packet order.
+ * Each decoder runs on a thread of its own, so packets are only skipped if all decoders are busy.
+ * process() returns once a decoder has the packet; the decoder keeps its own hold on the buffer.
+ */
+class ParallelRgbPacketProcessor : public RgbPacketProcessor
+{
+public:
+  /** @param decoders Processors of the same kind, each with its own decoder state. They are deleted with this object. */
+  ParallelRgbPacketProcessor(const std::vector<RgbPacketProcessor *> &decoders);
+  virtual ~ParallelRgbPacketProcessor();
+  virtual bool ready();
+  virtual bool good();
+  virtual const char *name();
+  virtual void process(const libfreenect2::RgbPacket &packet);
+  virtual void setFrameListener(libfreenect2::FrameListener *listener);
+  virtual void setConfiguration(const libfreenect2::RgbPacketProcessor::Config &config);
+protected:
+  virtual Allocator *getAllocator();
+private:
+  ParallelRgbPacketProcessorImpl *impl_;
+};
+
+#ifdef LIBFREENECT2_WITH_STREAMING_JPEG_SUPPORT
+class StreamingJpegRgbPacketProcessorImpl;
+
+/** Decode with libjpeg while the packet is still being received.
+ * Decoding runs on a thread of its own and keeps pace with the USB transfers, so a
+ * frame is ready shortly after the last bytes of its packet instead of a whole
+ * decoding time later. Packets that were not streamed are decoded when they arrive.
+ */
+class StreamingJpegRgbPacketProcessor : public RgbPacketProcessor
+{
+public:
+  StreamingJpegRgbPacketProcessor();
+  virtual ~StreamingJpegRgbPacketProcessor();
+  virtual bool ready();
+  virtual const char *name() { return "libjpeg streaming"; }
+  virtual void process(const libfreenect2::RgbPacket &packet);
+  virtual void setFrameListener(libfreenect2::FrameListener *listener);
+  virtual void setConfiguration(const libfreenect2::RgbPacketProcessor::Config &config);
+  virtual bool isAsynchronous() const { return true; }
+  virtual RgbStreamTap *getStreamTap();
+protected:
+  virtual bool supportsDownscale() const { return true; }
+  virtual bool supportsFormat(Frame::Format format) const;
+  virtual bool supportsPassthrough() const { return true; }
+private:
+  StreamingJpegRgbPacketProcessorImpl *impl_;
+};
+#endif // LIBFREENECT2_WITH_STREAMING_JPEG_SUPPORT
+
 #ifdef LIBFREENECT2_WITH_TURBOJPEG_SUPPORT
 class TurboJpegRgbPacketProcessorImpl;
 
@@ -88,6 +197,13 @@ public:
   virtual ~TurboJpegRgbPacketProcessor();
   virtual void process(const libfreenect2::RgbPacket &packet);
   virtual const char *name() { return "TurboJPEG"; }
+protected:
+  virtual bool supportsDownscale() const { return true; }
+  virtual bool supportsFormat(Frame::Format format) const;
+  virtual bool supportsPassthrough() const { return true; }
+#ifdef LIBFREENECT2_WITH_JPEG_ROI_SUPPORT
+  virtual bool supportsRoi() const { return true; }
+#endif
 private:
   TurboJpegRgbPacketProcessorImpl *impl_; ///< Decoder implementation.
 };
@@ -33,6 +33,7 @@
 
 #include <libfreenect2/config.h>
 #include <libfreenect2/rgb_packet_processor.h>
+#include <libfreenect2/threading.h>
 
 #include <libfreenect2/data_callback.h>
 
@@ -47,12 +48,23 @@ public:
   virtual ~RgbPacketStreamParser();
 
   void setPacketProcessor(BaseRgbPacketProcessor *processor);
+  /** Set the packet observer. The previous one is no longer called once this returns. */
+  void setPacketTap(PacketTap<RgbPacket> *tap);
+  void setStreamTap(RgbStreamTap *tap);
 
   virtual void onDataReceived(unsigned char* buffer, size_t length);
 private:
+  /** Tell the stream tap the bytes received into the packet buffer are discarded. */
+  void dropStream();
+  /** Discard the bytes received into the packet buffer. */
+  void resetBuffer();
+
   size_t buffer_size_;
   RgbPacket packet_;
   BaseRgbPacketProcessor *processor_; ///< Parser implementation.
+  PacketTap<RgbPacket> *tap_; ///< Observer of all parsed packets, may be NULL.
+  libfreenect2::mutex tap_mutex_; ///< Guards #tap_, which is replaced while the USB thread uses it.
+  RgbStreamTap *stream_tap_; ///< Observer of packets while they are received, may be NULL.
 };
 
 } /* namespace libfreenect2 */
@@ -0,0 +1,99 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+/** @file worker_pool.h Fork-join thread pool for splitting image passes. */
+
+#ifndef WORKER_POOL_H_
+#define WORKER_POOL_H_
+
+#include <vector>
+#include <libfreenect2/threading.h>
+
+namespace libfreenect2
+{
+
+/** Runs a task in parallel on a fixed set of threads and waits for it.
+ * The calling thread takes part in the work, so a pool without threads
+ * runs everything inline. The pool can be shared: while it works on one
+ * caller's task, concurrent callers run their tasks on their own thread.
+ */
+class WorkerPool
+{
+public:
+  /** Unit of work split into a number of independent parts. */
+  class Task
+  {
+  public:
+    virtual ~Task() {}
+
+    /**
+     * Process one part. Parts run concurrently and in no particular order.
+     * @param index Part to process, from 0 to @p count - 1.
+     * @param count Number of parts.
+     */
+    virtual void run(size_t index, size_t count) = 0;
+  };
+
+  /**
+   * @param num_threads Number of threads besides the calling thread.
+   * @param name Thread name, for debuggers.
+   */
+  WorkerPool(size_t num_threads, const char *name = "WorkerPool");
+  ~WorkerPool();
+
+  /** Number of threads working on a task, including the caller. */
+  size_t size() const;
+
+  /** Run all parts of @p task and return when they are done.
+   * Parts are handed out one at a time, so more parts than threads balance uneven work.
+   * If the pool is busy with another task, the parts run on the calling thread only.
+   */
+  void run(Task &task, size_t count);
+
+  /** Number of threads worth using for image processing on this machine, including the caller. */
+  static size_t defaultSize();
+
+private:
+  static void static_execute(void *arg);
+  void execute();
+  void work();
+
+  std::vector<libfreenect2::thread *> threads_;
+  const char *name_;
+
+  libfreenect2::mutex mutex_;
+  libfreenect2::condition_variable start_condition_;
+  libfreenect2::condition_variable done_condition_;
+  Task *task_;
+  size_t count_;
+  size_t next_;
+  size_t pending_;
+  unsigned generation_;
+  bool shutdown_;
+};
+
+} /* namespace libfreenect2 */
+#endif /* WORKER_POOL_H_ */
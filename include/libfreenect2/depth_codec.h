@@ -0,0 +1,119 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+/** @file depth_codec.h Lossless compression of depth frames. */
+
+#ifndef DEPTH_CODEC_H_
+#define DEPTH_CODEC_H_
+
+#include <stddef.h>
+#include <libfreenect2/config.h>
+#include <libfreenect2/frame_listener.hpp>
+
+namespace libfreenect2
+{
+
+/** @defgroup codec Depth Compression
+ * Compact encoding of depth frames for storage and network transfer. */
+///@{
+
+class DepthCodecImpl;
+
+/** Encode depth frames with a run-length/variable-length scheme.
+ *
+ * The scheme follows RVL (A. D. Wilson, "Fast Lossless Depth Image
+ * Compression", ISS 2017): depth is quantized to 16-bit millimeters, runs of
+ * invalid (zero) pixels are coded by their length and valid pixels are coded
+ * as zigzag deltas to the previous valid pixel, 3 bits per nibble. Typical
+ * 512x424 depth frames shrink to 20%-40% of their 16-bit size.
+ *
+ * Depth values are rounded to the nearest millimeter. Values that are not
+ * positive, not finite, or not representable in 16 bits are decoded as 0
+ * (invalid). Otherwise the round trip is exact.
+ *
+ * The encoded buffer starts with a header that carries width, height,
+ * timestamp and sequence of the frame, so encoded frames can be decoded
+ * without other context.
+ *
+ * An instance keeps the working memory of encode() between frames; use one
+ * instance per encoding thread.
+ */
+class LIBFREENECT2_API DepthCodec
+{
+public:
+  /** Size of the header in front of the encoded data in bytes. */
+  static const size_t HeaderSize = 20;
+
+  DepthCodec();
+  ~DepthCodec();
+
+  /** Upper bound on the encoded size of a frame.
+   * A buffer of this size can always hold the result of encode().
+   * @param width Frame width in pixels.
+   * @param height Frame height in pixels.
+   */
+  static size_t maxEncodedSize(size_t width, size_t height);
+
+  /** Encode a depth frame.
+   * @param depth Depth frame (Frame::Float format, millimeter).
+   * @param[out] buffer Output buffer.
+   * @param capacity Size of the output buffer in bytes.
+   * @return Number of bytes written, or 0 if the frame is not a valid depth frame or @p capacity is too small.
+   */
+  size_t encode(const Frame *depth, unsigned char *buffer, size_t capacity);
+
+  /** Read the frame dimensions from an encoded buffer.
+   * Use it to allocate a Frame of the correct size for decode().
+   * @param buffer Encoded data.
+   * @param length Size of the encoded data in bytes.
+   * @param[out] width Frame width in pixels.
+   * @param[out] height Frame height in pixels.
+   * @return true if @p buffer starts with a valid header.
+   */
+  static bool getFrameSize(const unsigned char *buffer, size_t length, size_t &width, size_t &height);
+
+  /** Decode a depth frame.
+   * The frame must be allocated with 4 bytes per pixel and the width and
+   * height of the encoded frame. Timestamp and sequence are restored;
+   * Frame::format is set to Frame::Float.
+   * @param buffer Encoded data.
+   * @param length Size of the encoded data in bytes.
+   * @param[out] depth Decoded depth frame (millimeter).
+   * @return true on success, false if the data is corrupted or does not match the frame.
+   */
+  static bool decode(const unsigned char *buffer, size_t length, Frame *depth);
+
+private:
+  DepthCodecImpl *impl_;
+
+  /* Disable copy and assignment constructors */
+  DepthCodec(const DepthCodec&);
+  DepthCodec& operator=(const DepthCodec&);
+};
+
+///@}
+} /* namespace libfreenect2 */
+#endif /* DEPTH_CODEC_H_ */
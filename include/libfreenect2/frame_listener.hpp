@@ -47,20 +47,33 @@ class LIBFREENECT2_API Frame
   /** Available types of frames. */
   enum Type
   {
-    Color = 1, ///< 1920x1080. BGRX or RGBX.
+    Color = 1, ///< 1920x1080. BGRX or RGBX, or as set by Freenect2Device::Config::ColorDownscale and ColorFormat.
     Ir = 2,    ///< 512x424 float. Range is [0.0, 65535.0].
-    Depth = 4  ///< 512x424 float, unit: millimeter. Non-positive, NaN, and infinity are invalid or missing data.
+    Depth = 4, ///< 512x424 float, unit: millimeter. Non-positive, NaN, and infinity are invalid or missing data.
+    PointCloud = 8 ///< 512x424 Float4 of x, y, z (meter) and 1, one point per depth pixel. Invalid points are NaN.
   };
 
   /** Pixel format. */
   enum Format
   {
     Invalid = 0, ///< Invalid format.
-    Raw = 1, ///< Raw bitstream. 'bytes_per_pixel' defines the number of bytes
+    /** Raw bitstream. 'bytes_per_pixel' defines the number of bytes.
+     * A Raw color frame may share its buffer with the color processor. The buffer stays valid
+     * until the frame is deleted, also after the device is closed and the pipeline deleted.
+     */
+    Raw = 1,
     Float = 2, ///< A 4-byte float per pixel
     BGRX = 4, ///< 4 bytes of B, G, R, and unused per pixel
     RGBX = 5, ///< 4 bytes of R, G, B, and unused per pixel
     Gray = 6, ///< 1 byte of gray per pixel
+    Float4 = 7, ///< 4 floats per pixel
+    RGB = 8, ///< 3 bytes of R, G, B per pixel
+    /** Planar YUV 4:2:0: a plane of 1 byte of Y per pixel, followed by planes of U and V at half width and height.
+     * 'bytes_per_pixel' is 1, but the planes take 1.5 bytes per pixel: 'data' holds width * height * 3 / 2 bytes.
+     * To allocate one, construct the frame with height * 3 / 2 rows, then set 'height' back.
+     */
+    I420 = 9,
+    UInt16 = 10, ///< A 2-byte unsigned integer per pixel
   };
 
   size_t width;           ///< Length of a line (in pixels).
@@ -74,6 +87,8 @@ class LIBFREENECT2_API Frame
   float gamma;            ///< From 1.0 (bright) to 6.4 (covered)
   uint32_t status;        ///< zero if ok; non-zero for errors.
   Format format;          ///< Byte format. Informative only, doesn't indicate errors.
+  size_t x_offset;        ///< Column of the first pixel in the uncropped image, see Freenect2Device::Config::ColorRoiWidth.
+  size_t y_offset;        ///< Row of the first pixel in the uncropped image.
 
   /** Construct a new frame.
    * @param width Width in pixel
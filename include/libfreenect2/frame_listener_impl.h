@@ -81,6 +81,164 @@ private:
   SyncMultiFrameListener& operator=(const SyncMultiFrameListener&);
 };
 
+class TimestampSyncFrameListenerImpl;
+
+/** Collect multiple types of frames whose device timestamps match.
+ *
+ * Unlike SyncMultiFrameListener, which bundles the last frame of each type, the
+ * frames of a set are taken within a tolerance of each other's Frame::timestamp.
+ * Each type has a small queue of frames waiting for a match. A frame is deleted,
+ * releasing its buffer, as soon as it cannot be matched anymore: when a newer
+ * set is formed, when its queue is full, or when another type has moved past it.
+ * A set not taken before the next one is formed is deleted as well.
+ */
+class LIBFREENECT2_API TimestampSyncFrameListener : public FrameListener
+{
+public:
+  /**
+   * @param frame_types Use bitwise or to combine multiple types, e.g. `Frame::Color | Frame::Depth`.
+   * @param tolerance Largest difference of the timestamps in a set, in the unit of Frame::timestamp (0.125 ms).
+   *   The default is half a frame period at 30 Hz.
+   * @param queue_size Frames of each type waiting for a match.
+   */
+  TimestampSyncFrameListener(unsigned int frame_types, uint32_t tolerance = 133, size_t queue_size = 4);
+  virtual ~TimestampSyncFrameListener();
+
+  /** Test if there is a new set of frames. Non-blocking. */
+  bool hasNewFrame() const;
+
+  /** Wait milliseconds for a new set of frames.
+   * @param[out] frame Caller is responsible to release the frames in `frame`.
+   * @param milliseconds Timeout. This parameter is ignored if not built with C++11 threading support.
+   * @return true if a set is received; false if not.
+   */
+  bool waitForNewFrame(FrameMap &frame, int milliseconds);
+
+  /** Wait indefinitely for a new set of frames.
+   * @param[out] frame Caller is responsible to release the frames in `frame`.
+   */
+  void waitForNewFrame(FrameMap &frame);
+
+  /** Shortcut to delete all frames in `frame`. */
+  void release(FrameMap &frame);
+
+  /** Largest difference of the timestamps in the set last returned by waitForNewFrame(). */
+  uint32_t getLastSkew() const;
+
+  /** Number of frames deleted without being returned in a set. */
+  size_t getDroppedFrames() const;
+
+  virtual bool onNewFrame(Frame::Type type, Frame *frame);
+private:
+  TimestampSyncFrameListenerImpl *impl_;
+
+  /* Disable copy and assignment constructors */
+  TimestampSyncFrameListener(const TimestampSyncFrameListener&);
+  TimestampSyncFrameListener& operator=(const TimestampSyncFrameListener&);
+};
+
+class FanOutFrameListenerImpl;
+
+/** Share frames between several subscribers without copying them.
+ *
+ * Each subscriber has its own queue and takes frames from it on its own thread.
+ * All subscribers get the same Frame object, which they must not modify. A frame
+ * is deleted once every subscriber it was queued for has released it, or had it
+ * dropped from a full queue. A frame no subscriber wants is left to the caller.
+ */
+class LIBFREENECT2_API FanOutFrameListener : public FrameListener
+{
+public:
+  /** What to do with a new frame for a subscriber whose queue is full. */
+  enum DropPolicy
+  {
+    DropOldest, ///< Drop the oldest queued frame; the subscriber sees the latest frames.
+    DropNewest  ///< Drop the new frame; the subscriber sees consecutive frames until it falls behind.
+  };
+
+  FanOutFrameListener();
+  /** Frames still held by subscribers are deleted too, release them first. */
+  virtual ~FanOutFrameListener();
+
+  /** Add a subscriber. It only gets frames arriving after the call.
+   * @param frame_types Use bitwise or to combine multiple types, e.g. `Frame::Ir | Frame::Depth`.
+   * @param queue_depth Most frames queued for the subscriber.
+   * @param policy What to drop when the queue is full.
+   * @return Identifier of the subscriber.
+   */
+  size_t subscribe(unsigned int frame_types, size_t queue_depth = 2, DropPolicy policy = DropOldest);
+
+  /** Remove a subscriber, dropping its queued frames. A thread waiting for it returns false. */
+  void unsubscribe(size_t subscriber);
+
+  /** Take the next frame of a subscriber.
+   * @param subscriber Identifier returned by subscribe().
+   * @param[out] type Type of the frame.
+   * @param[out] frame The frame, shared with other subscribers. Give it back with release().
+   * @param milliseconds Timeout; 0 does not wait, negative waits indefinitely. Other values wait
+   *   indefinitely if not built with C++11 threading support.
+   * @return true if a frame was taken; false on timeout or if the subscriber was removed.
+   */
+  bool waitForNewFrame(size_t subscriber, Frame::Type &type, const Frame *&frame, int milliseconds = -1);
+
+  /** Give back a frame taken by waitForNewFrame(). */
+  void release(const Frame *frame);
+
+  /** Number of frames dropped from the queue of a subscriber. */
+  size_t getDroppedFrames(size_t subscriber) const;
+
+  virtual bool onNewFrame(Frame::Type type, Frame *frame);
+private:
+  FanOutFrameListenerImpl *impl_;
+
+  /* Disable copy and assignment constructors */
+  FanOutFrameListener(const FanOutFrameListener&);
+  FanOutFrameListener& operator=(const FanOutFrameListener&);
+};
+
+class PollableFrameListenerImpl;
+
+/** Queue frames for an event loop to take without blocking.
+ *
+ * getFd() gives a file descriptor that is readable while frames are queued, so
+ * one thread can poll() or epoll_wait() on many devices and sockets, and take
+ * frames with tryPop() when it is readable. It is an eventfd on Linux and a pipe
+ * on other POSIX systems.
+ */
+class LIBFREENECT2_API PollableFrameListener : public FrameListener
+{
+public:
+  /**
+   * @param frame_types Use bitwise or to combine multiple types, e.g. `Frame::Ir | Frame::Depth`.
+   * @param queue_depth Most frames queued. A new frame on a full queue deletes the oldest one.
+   */
+  PollableFrameListener(unsigned int frame_types, size_t queue_depth = 4);
+  virtual ~PollableFrameListener();
+
+  /** File descriptor that is readable while frames are queued; -1 on Windows or if it could not be created.
+   * Only poll it; it is read and closed by the listener.
+   */
+  int getFd() const;
+
+  /** Take the oldest queued frame. Non-blocking.
+   * @param[out] type Type of the frame.
+   * @param[out] frame Caller is responsible to delete the frame.
+   * @return true if a frame was taken; false if the queue is empty.
+   */
+  bool tryPop(Frame::Type &type, Frame *&frame);
+
+  /** Number of frames deleted because the queue was full. */
+  size_t getDroppedFrames() const;
+
+  virtual bool onNewFrame(Frame::Type type, Frame *frame);
+private:
+  PollableFrameListenerImpl *impl_;
+
+  /* Disable copy and assignment constructors */
+  PollableFrameListener(const PollableFrameListener&);
+  PollableFrameListener& operator=(const PollableFrameListener&);
+};
+
 ///@}
 } /* namespace libfreenect2 */
 #endif /* FRAME_LISTENER_IMPL_H_ */
@@ -0,0 +1,78 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+
+/** @file lazy_color_frame.h Decoding color frames on demand. */
+
+#ifndef LAZY_COLOR_FRAME_H_
+#define LAZY_COLOR_FRAME_H_
+
+#include <libfreenect2/config.h>
+#include <libfreenect2/frame_listener.hpp>
+
+#ifdef LIBFREENECT2_WITH_TURBOJPEG_SUPPORT
+
+namespace libfreenect2
+{
+
+class LazyColorFrameImpl;
+
+/** Color frame that is decoded when its pixels are first needed. @ingroup frame
+ *
+ * Set Freenect2Device::Config::ColorFormat to Frame::Raw, so color frames arrive as the JPEG from the device,
+ * and wrap the ones worth looking at. Frames that are dropped or never looked at cost no decoding.
+ */
+class LIBFREENECT2_API LazyColorFrame
+{
+public:
+  /**
+   * @param jpeg Frame::Raw color frame. This object takes ownership, which keeps the packet buffer it points
+   *   into alive; remove the frame from the FrameMap before SyncMultiFrameListener::release().
+   * @param format Format of the decoded frame, see Freenect2Device::Config::ColorFormat. Not Frame::Raw.
+   * @param downscale Decode at 1920x1080 divided by 1, 2 or 4, see Freenect2Device::Config::ColorDownscale.
+   */
+  LazyColorFrame(Frame *jpeg, Frame::Format format = Frame::BGRX, int downscale = 1);
+  ~LazyColorFrame();
+
+  /** The compressed frame. */
+  const Frame *jpeg() const;
+
+  /** Decoded frame, decoded by the first call. Owned by this object.
+   * @return NULL if the frame is not Frame::Raw, the format is Frame::Raw, or the frame could not be decoded.
+   */
+  Frame *get();
+
+private:
+  LazyColorFrameImpl *impl_;
+
+  /* Disable copy and assignment constructors */
+  LazyColorFrame(const LazyColorFrame&);
+  LazyColorFrame& operator=(const LazyColorFrame&);
+};
+
+} /* namespace libfreenect2 */
+#endif // LIBFREENECT2_WITH_TURBOJPEG_SUPPORT
+#endif /* LAZY_COLOR_FRAME_H_ */
@@ -122,8 +122,46 @@ public:
 
     bool EnableBilateralFilter; ///< Remove some "flying pixels".
     bool EnableEdgeAwareFilter; ///< Remove pixels on edges because ToF cameras produce noisy edges.
+    /** Remove lens distortion from depth frames while they are computed, as Registration::undistortDepth() would.
+     * Registration::apply() expects distorted depth; pass such frames to the methods that take an undistorted frame instead.
+     * IR frames are not affected. Only the CPU and OpenCL pipelines support it.
+     */
+    bool EnableUndistortion;
+    /** Also emit Frame::PointCloud frames computed from the depth frames.
+     * Each point lies on the ray of the pixel its depth was measured at, which also holds for undistorted depth.
+     * Only the CPU and OpenCL pipelines support it.
+     */
+    bool EnablePointCloud;
 
-    /** Default is 0.5, 4.5, true, true */
+    /** Decode color frames at 1920x1080 divided by this factor: 1, 2 or 4.
+     * Scaled decoding is much cheaper than decoding at full size and resizing.
+     * Registration takes frames of all three sizes with the unscaled ColorCameraParams.
+     * Only the TurboJPEG color processor supports it.
+     */
+    int ColorDownscale;
+    /** Format of color frames: Frame::BGRX, RGBX, RGB, Gray (luma only), I420, or Raw.
+     * Gray and I420 skip the color conversion, and all but the 4 byte formats write less memory.
+     * Raw frames are the JPEG from the device without decoding, in the buffer it was received in;
+     * keep at most two of them at a time, or color packets are skipped until they are deleted.
+     * Registration needs BGRX or RGBX. Only the TurboJPEG color processor supports other formats than BGRX,
+     * and I420 only when built with libjpeg-turbo 1.4 or newer.
+     */
+    Frame::Format ColorFormat;
+
+    /** Decode only a region of color frames, given in pixels of the 1920x1080 image.
+     * Frames are the region clipped to the image, for I420 rounded out to even pixels.
+     * Frame::x_offset and Frame::y_offset tell where they are in the full image, both divided by ColorDownscale.
+     * The rows above the region are still entropy decoded, so a small region takes about a third
+     * of the time of a whole frame, and a quarter of the image a little over half. The region may change between frames
+     * with setConfiguration(). A width or height of 0 decodes whole frames. Registration does not take cropped frames.
+     * Only the TurboJPEG color processor supports it, when built with libjpeg-turbo 1.5 or newer.
+     */
+    int ColorRoiX;
+    int ColorRoiY;      ///< @copybrief ColorRoiX
+    int ColorRoiWidth;  ///< @copybrief ColorRoiX
+    int ColorRoiHeight; ///< @copybrief ColorRoiX
+
+    /** Default is 0.5, 4.5, true, true, false, false, 1, BGRX, and no color region */
     LIBFREENECT2_API Config();
   };
 
@@ -365,6 +403,78 @@ private:
   Freenect2Replay& operator=(const Freenect2Replay&);
 };
 
+class Freenect2BatchReplayImpl;
+
+/**
+ * Re-process recorded depth packets on several pipelines in parallel.
+ *
+ * Stored `.depth` packets (same filename format as Freenect2Replay) are
+ * distributed over independent depth packet processors, each running on its
+ * own thread. The IR, depth and point cloud frames are delivered to the listener in the
+ * order of the file list, from the thread calling run(). Other files are
+ * skipped.
+ *
+ * Unlike Freenect2ReplayDevice, no packet is dropped when processors are busy;
+ * reading stops instead until the listener catches up.
+ */
+class LIBFREENECT2_API Freenect2BatchReplay
+{
+public:
+  /** Creates the pipeline of each worker. */
+  class LIBFREENECT2_API PipelineFactory
+  {
+  public:
+    virtual ~PipelineFactory();
+
+    /** Called once on each worker thread, so pipelines bound to a thread
+     * (e.g. OpenGL) work.
+     * @return New PacketPipeline instance. It is freed by Freenect2BatchReplay.
+     */
+    virtual PacketPipeline *createPipeline() = 0;
+  };
+
+  /**
+   * @param factory Creates the pipeline of each worker. If NULL, CpuPacketPipeline is used. Must outlive this object.
+   * @param num_workers Number of parallel pipelines, 0 for one per hardware thread.
+   */
+  Freenect2BatchReplay(PipelineFactory *factory = 0, size_t num_workers = 0);
+  virtual ~Freenect2BatchReplay();
+
+  /** Number of parallel pipelines. */
+  size_t getNumWorkers() const;
+
+  /** Depth camera parameters used when the recording was made. */
+  void setIrCameraParams(const Freenect2Device::IrCameraParams &params);
+
+  /** Configure depth processing of all pipelines. */
+  void setConfiguration(const Freenect2Device::Config &config);
+
+  /** Load P0 tables stored from the device (the raw P0 tables command response).
+   * @param buffer P0 tables data.
+   * @param buffer_length Size of @p buffer in bytes.
+   */
+  void loadP0Tables(const unsigned char *buffer, size_t buffer_length);
+
+  /** Provide your listener to receive IR and depth frames.
+   * Frames the listener does not take ownership of are freed after the call.
+   */
+  void setIrAndDepthFrameListener(FrameListener *listener);
+
+  /** Process stored packets and block until all frames are delivered.
+   * Configuration must not change while running.
+   * @param frame_filenames Stored packets, in delivery order.
+   * @return Number of packets successfully processed.
+   */
+  size_t run(const std::vector<std::string> &frame_filenames);
+
+private:
+  Freenect2BatchReplayImpl *impl_;
+
+  /* Disable copy and assignment constructors */
+  Freenect2BatchReplay(const Freenect2BatchReplay&);
+  Freenect2BatchReplay& operator=(const Freenect2BatchReplay&);
+};
+
 ///@}
 } /* namespace libfreenect2 */
 #endif /* LIBFREENECT2_HPP_ */
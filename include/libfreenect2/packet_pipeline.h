@@ -40,6 +40,7 @@ class DataCallback;
 class RgbPacketProcessor;
 class DepthPacketProcessor;
 class PacketPipelineComponents;
+class PacketRingRecorder;
 
 /** @defgroup pipeline Packet Pipelines
  * Implement various methods to decode color and depth images with different performance and platform support
@@ -48,6 +49,17 @@ class PacketPipelineComponents;
  */
 ///@{
 
+/** Choice of color decoder for pipelines that decode with TurboJPEG.
+ * The LIBFREENECT2_RGB_DECODERS and LIBFREENECT2_RGB_STREAMING environment variables override these settings.
+ */
+struct LIBFREENECT2_API RgbDecoderConfig
+{
+  int decoders;    ///< Frames decoded at the same time, each on its own thread. Default is 1.
+  bool streaming;  ///< Decode with libjpeg while the packet is received, if built with it; ignores @ref decoders. Default is false.
+
+  RgbDecoderConfig();
+};
+
 /** Base class for other pipeline classes.
  * Methods in this class are reserved for internal use.
  */
@@ -64,6 +76,13 @@ public:
 
   virtual RgbPacketProcessor *getRgbPacketProcessor() const;
   virtual DepthPacketProcessor *getDepthPacketProcessor() const;
+
+  /** Record raw packets before they are decoded.
+   * The recorder must stay valid until it is detached by passing NULL or another recorder,
+   * which ends its capture in progress.
+   * @param recorder Recorder to receive all parsed packets, or NULL.
+   */
+  void setPacketRecorder(PacketRingRecorder *recorder);
 protected:
   PacketPipelineComponents *comp_;
 };
@@ -87,6 +106,7 @@ class LIBFREENECT2_API CpuPacketPipeline : public PacketPipeline
 {
 public:
   CpuPacketPipeline();
+  explicit CpuPacketPipeline(const RgbDecoderConfig &rgb_config);
   virtual ~CpuPacketPipeline();
 };
 
@@ -99,6 +119,7 @@ protected:
   bool debug_;
 public:
   OpenGLPacketPipeline(void *parent_opengl_context = 0, bool debug = false);
+  OpenGLPacketPipeline(void *parent_opengl_context, bool debug, const RgbDecoderConfig &rgb_config);
   virtual ~OpenGLPacketPipeline();
 };
 #endif // LIBFREENECT2_WITH_OPENGL_SUPPORT
@@ -111,6 +132,7 @@ protected:
   const int deviceId;
 public:
   OpenCLPacketPipeline(const int deviceId = -1);
+  OpenCLPacketPipeline(const int deviceId, const RgbDecoderConfig &rgb_config);
   virtual ~OpenCLPacketPipeline();
 };
 
@@ -126,6 +148,7 @@ protected:
   const int deviceId;
 public:
   OpenCLKdePacketPipeline(const int deviceId = -1);
+  OpenCLKdePacketPipeline(const int deviceId, const RgbDecoderConfig &rgb_config);
   virtual ~OpenCLKdePacketPipeline();
 };
 #endif // LIBFREENECT2_WITH_OPENCL_SUPPORT
@@ -137,6 +160,7 @@ protected:
   const int deviceId;
 public:
   CudaPacketPipeline(const int deviceId = -1);
+  CudaPacketPipeline(const int deviceId, const RgbDecoderConfig &rgb_config);
   virtual ~CudaPacketPipeline();
 };
 
@@ -152,6 +176,7 @@ protected:
   const int deviceId;
 public:
   CudaKdePacketPipeline(const int deviceId = -1);
+  CudaKdePacketPipeline(const int deviceId, const RgbDecoderConfig &rgb_config);
   virtual ~CudaKdePacketPipeline();
 };
 #endif // LIBFREENECT2_WITH_CUDA_SUPPORT
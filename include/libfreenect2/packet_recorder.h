@@ -0,0 +1,96 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+/** @file packet_recorder.h In-memory pre-trigger recording of raw packets. */
+
+#ifndef PACKET_RECORDER_H_
+#define PACKET_RECORDER_H_
+
+#include <string>
+#include <libfreenect2/config.h>
+
+namespace libfreenect2
+{
+
+class PacketRingRecorderImpl;
+
+/** Keep the latest raw packets in memory, and store them on demand. @ingroup pipeline
+ *
+ * Raw depth packets and JPEG color packets are copied into preallocated
+ * memory rings as they are parsed from the USB stream, before any decoding.
+ * Nothing is written until trigger() is called. Then the packets of the last
+ * @p pre_trigger_seconds and of the following @p post_trigger_seconds (by
+ * device timestamp) are written by a background thread in the format read by
+ * Freenect2Replay: `<timestamp>_depth_<sequence>.depth` and
+ * `<timestamp>_rgb_<sequence>.jpg`.
+ *
+ * Attach it with PacketPipeline::setPacketRecorder(). Packets are recorded even
+ * if no frame listener is set, in which case nothing is decoded.
+ *
+ * If the rings are full of packets not yet written, new packets are dropped
+ * from the recording rather than blocking the USB thread.
+ *
+ * A capture also ends early when the recorder is detached from the pipeline,
+ * or when no packets arrive for a second, e.g. because the device was stopped.
+ */
+class LIBFREENECT2_API PacketRingRecorder
+{
+public:
+  /**
+   * @param directory Existing directory to write captures to.
+   * @param pre_trigger_seconds Seconds of packets kept before a trigger.
+   * @param post_trigger_seconds Seconds of packets captured after a trigger.
+   * @param max_bytes Memory of both rings together. If 0, the rings are sized for
+   * @p pre_trigger_seconds at 30 Hz, assuming up to 400 KB per JPEG packet.
+   */
+  PacketRingRecorder(const std::string &directory, float pre_trigger_seconds, float post_trigger_seconds, size_t max_bytes = 0);
+  ~PacketRingRecorder();
+
+  /** Start a capture of the packets around now.
+   * @return false if a capture is still being written.
+   */
+  bool trigger();
+
+  /** @return true while a capture is being collected or written. */
+  bool isCapturing() const;
+
+  /** Number of packets written to disk so far. */
+  size_t getWrittenPackets() const;
+
+  /** Number of packets that could not be captured because the rings were full. */
+  size_t getDroppedPackets() const;
+
+private:
+  friend class PacketPipeline;
+  PacketRingRecorderImpl *impl_;
+
+  /* Disable copy and assignment constructors */
+  PacketRingRecorder(const PacketRingRecorder&);
+  PacketRingRecorder& operator=(const PacketRingRecorder&);
+};
+
+} /* namespace libfreenect2 */
+#endif /* PACKET_RECORDER_H_ */
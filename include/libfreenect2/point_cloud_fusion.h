@@ -0,0 +1,101 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+/** @file point_cloud_fusion.h Merging point clouds of several devices. */
+
+#ifndef POINT_CLOUD_FUSION_H_
+#define POINT_CLOUD_FUSION_H_
+
+#include <stddef.h>
+#include <libfreenect2/config.h>
+#include <libfreenect2/libfreenect2.hpp>
+#include <libfreenect2/frame_listener.hpp>
+
+namespace libfreenect2
+{
+
+class PointCloudFusionImpl;
+
+/** Merge the point clouds of several devices into one world frame. @ingroup registration
+ *
+ * Each device contributes an undistorted depth frame, as returned by
+ * Registration::apply() or Registration::undistortDepth(). Its points are
+ * transformed by the extrinsics of the device and collected in a voxel grid;
+ * every occupied voxel yields one point, the average of the points in it.
+ *
+ * Devices are processed in parallel. All memory is allocated when devices are
+ * added, and the grid holds at most a fixed number of voxels. The order of
+ * the fused points does not depend on the number of threads, and neither do
+ * the voxels dropped when the grid is full.
+ */
+class LIBFREENECT2_API PointCloudFusion
+{
+public:
+  /**
+   * @param leaf_size Edge length of the voxels in meter.
+   * @param max_voxels Most voxels, and thus points, of a fused cloud. If more voxels are occupied,
+   *   those at the end of the cloud are dropped; far more also drop points in every part of the grid.
+   */
+  PointCloudFusion(float leaf_size = 0.01f, size_t max_voxels = 512 * 424);
+  ~PointCloudFusion();
+
+  /** Add a device.
+   * @param depth_p Depth camera parameters of the device, the same as given to its Registration.
+   * @param extrinsics Row-major 4x4 rigid or affine transform from the depth camera to the world frame,
+   *   in meter; the last row is ignored. Depth camera coordinates are those of Registration::getPointXYZ().
+   * @return Index of the device, its position in the frame arrays of fuse().
+   */
+  size_t addDevice(const Freenect2Device::IrCameraParams &depth_p, const float extrinsics[16]);
+
+  /** Replace the extrinsics of a device, see addDevice(). */
+  void setExtrinsics(size_t device, const float extrinsics[16]);
+
+  /** Number of devices added. */
+  size_t getDeviceCount() const;
+
+  /** Fuse a synchronized frame set.
+   * @param undistorted One undistorted depth frame (512x424 float) per device; NULL entries are skipped.
+   * @param registered One registered color frame (512x424 BGRX) per device, NULL entries for devices
+   *   without color, or NULL for no color at all.
+   * @param[out] cloud Buffer for up to max_voxels points of 4 floats: x, y, z and the color packed as in
+   *   Registration::getPointXYZRGB(). The color is averaged over the points with color, 0 if there are none.
+   * @return Number of points written.
+   */
+  size_t fuse(const Frame *const *undistorted, const Frame *const *registered, float *cloud);
+
+  /** Number of valid points the last fuse() dropped because the grid was full. */
+  size_t getDroppedPoints() const;
+
+private:
+  PointCloudFusionImpl *impl_;
+
+  /* Disable copy and assignment constructors */
+  PointCloudFusion(const PointCloudFusion&);
+  PointCloudFusion& operator=(const PointCloudFusion&);
+};
+
+} /* namespace libfreenect2 */
+#endif /* POINT_CLOUD_FUSION_H_ */
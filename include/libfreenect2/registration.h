@@ -54,6 +54,14 @@ class RegistrationImpl;
 class LIBFREENECT2_API Registration
 {
 public:
+  /** Memory layouts of getPointCloud(). */
+  enum PointCloudLayout
+  {
+    XYZ,    ///< 3 floats per point: x, y, z.
+    XYZRGB, ///< 4 floats per point: x, y, z and the color as returned by getPointXYZRGB().
+    Planes  ///< Structure of arrays: 512x424 x values, then 512x424 y, z and, if colors are given, colors.
+  };
+
   /**
    * @param depth_p Depth camera parameters. You can use the factory values, or use your own.
    * @param rgb_p Color camera parameters. Probably use the factory values for now.
@@ -71,16 +79,31 @@ public:
   void apply(int dx, int dy, float dz, float& cx, float &cy) const;
 
   /** Map color images onto depth images
-   * @param rgb Color image (1920x1080 BGRX)
+   * The work is split across threads shared by all registrations, and scratch buffers are kept
+   * between calls; concurrent calls may use the same object, each with its own output frames.
+   * @param rgb Color image (1920x1080 BGRX), or one decoded with Freenect2Device::Config::ColorDownscale (960x540 or 480x270).
+   *   The color of a depth pixel is that of the downscaled pixel covering its full resolution position.
    * @param depth Depth image (512x424 float)
    * @param[out] undistorted Undistorted depth image
    * @param[out] registered Color image for the depth image (512x424)
    * @param enable_filter Filter out pixels not visible to both cameras.
    * @param[out] bigdepth If not `NULL`, return mapping of depth onto colors (1920x1082 float). **1082** not 1080, with a blank top and bottom row.
-   * @param[out] color_depth_map Index of mapped color pixel for each depth pixel (512x424).
+   * @param[out] color_depth_map Index of mapped color pixel for each depth pixel (512x424), always at 1920x1080.
    */
   void apply(const Frame* rgb, const Frame* depth, Frame* undistorted, Frame* registered, const bool enable_filter = true, Frame* bigdepth = 0, int* color_depth_map = 0) const;
 
+  /** Render depth as seen by the color camera.
+   * Each depth pixel is splatted over its whole footprint in the color image, nearer depth wins,
+   * and small gaps along rows (disocclusions, as the cameras sit side by side) are filled from
+   * the farther side. Unlike bigdepth from apply(), the result is dense and unpadded.
+   * @param depth Depth image (512x424 float)
+   * @param[out] color_depth 1920x1080, or 960x540 for half resolution. With 4 bytes per pixel
+   *   it receives float millimeters (Frame::Float), with 2 bytes per pixel uint16 millimeters (Frame::UInt16).
+   *   0 where no depth is available.
+   * @param max_hole Longest gap in output pixels that is filled, 0 to disable hole filling.
+   */
+  void mapDepthToColor(const Frame* depth, Frame* color_depth, int max_hole = 8) const;
+
   /** Undistort depth
    * @param depth Depth image (512x424 float)
    * @param[out] undistorted Undistorted depth image
@@ -114,6 +137,34 @@ public:
    */
   void getPointXYZ (const Frame* undistorted, int r, int c, float& x, float& y, float& z) const;
 
+  /** Construct the point cloud of a whole frame.
+   * Much faster than calling getPointXYZ() for every pixel: the rays are precomputed and
+   * several pixels are processed at once. Points equal getPointXYZ() and getPointXYZRGB()
+   * up to float rounding.
+   * @param undistorted Undistorted depth frame from apply().
+   * @param registered Registered color frame from apply(), or NULL. Required for XYZRGB.
+   * @param[out] cloud Buffer for 512x424 points in @p layout (3 or 4 floats per point).
+   * @param layout Memory layout of @p cloud.
+   * @param compact If true, only valid points are written, in row-major order.
+   *   Otherwise the cloud stays organized, with NaN coordinates and color 0 for invalid points.
+   * @return Number of points written, or 0 if the arguments are invalid.
+   */
+  size_t getPointCloud(const Frame* undistorted, const Frame* registered, float* cloud, PointCloudLayout layout = XYZ, bool compact = false) const;
+
+  /** Estimate the surface normals of a whole frame.
+   * Each normal is the cross product of the tangents to the neighbouring points in the same row
+   * and column, which uses the grid of the depth image instead of a nearest neighbour search.
+   * Neighbours on another surface are skipped, falling back to the tangent from the center point.
+   * @param undistorted Undistorted depth frame from apply().
+   * @param[out] normals Buffer for 512x424 normals of 3 floats, ordered as the points of
+   *   getPointCloud() with the XYZ layout. They have unit length and face the camera;
+   *   NaN where the depth or all neighbours along a row or column are invalid.
+   * @param step Distance of the neighbours in pixels, up to 64. Larger values smooth more.
+   * @param max_depth_change Largest depth difference to a neighbour on the same surface, relative to the depth.
+   * @return Number of valid normals, or 0 if the arguments are invalid.
+   */
+  size_t getNormals(const Frame* undistorted, float* normals, int step = 2, float max_depth_change = 0.02f) const;
+
 private:
   RegistrationImpl *impl_;
 
@@ -122,5 +173,51 @@ private:
   Registration& operator=(const Registration&);
 };
 
+#ifdef LIBFREENECT2_WITH_OPENCL_SUPPORT
+class OpenCLPacketPipeline;
+class OpenCLRegistrationImpl;
+
+/** Registration::apply() on an OpenCL device. @ingroup registration
+ * When constructed with the OpenCLPacketPipeline that decodes the depth, it shares the
+ * pipeline's OpenCL context and reads the depth frames from their device copies,
+ * so only the color frame is uploaded. Results equal Registration::apply(), up to
+ * float rounding of the device.
+ */
+class LIBFREENECT2_API OpenCLRegistration
+{
+public:
+  /**
+   * @param depth_p Depth camera parameters. You can use the factory values, or use your own.
+   * @param rgb_p Color camera parameters. Probably use the factory values for now.
+   * @param pipeline Pipeline whose depth frames are registered, or NULL to use a device of its own.
+   *   It must outlive this object.
+   * @param deviceId OpenCL device to use when @p pipeline is NULL, -1 for the default device.
+   */
+  OpenCLRegistration(Freenect2Device::IrCameraParams depth_p, Freenect2Device::ColorCameraParams rgb_p, OpenCLPacketPipeline *pipeline = 0, const int deviceId = -1);
+  ~OpenCLRegistration();
+
+  /** Whether the OpenCL device and program are ready. */
+  bool good() const;
+
+  /** Map color images onto depth images, see Registration::apply().
+   * Depth frames of the pipeline are read from the device, as long as their data is not modified.
+   * @param rgb Color image (1920x1080 BGRX)
+   * @param depth Depth image (512x424 float)
+   * @param[out] undistorted Undistorted depth image
+   * @param[out] registered Color image for the depth image (512x424)
+   * @param enable_filter Filter out pixels not visible to both cameras.
+   * @return false if the frames are invalid or the device failed.
+   */
+  bool apply(const Frame* rgb, const Frame* depth, Frame* undistorted, Frame* registered, const bool enable_filter = true) const;
+
+private:
+  OpenCLRegistrationImpl *impl_;
+
+  /* Disable copy and assignment constructors */
+  OpenCLRegistration(const OpenCLRegistration&);
+  OpenCLRegistration& operator=(const OpenCLRegistration&);
+};
+#endif // LIBFREENECT2_WITH_OPENCL_SUPPORT
+
 } /* namespace libfreenect2 */
 #endif /* REGISTRATION_H_ */
@@ -1,8 +1,8 @@
 #ifndef LIBFREENECT2_CONFIG_H
 #define LIBFREENECT2_CONFIG_H
 
-#define LIBFREENECT2_VERSION "0.2.0"
-#define LIBFREENECT2_API_VERSION ((0 << 16) | 2)
+#define LIBFREENECT2_VERSION "0.3.0"
+#define LIBFREENECT2_API_VERSION ((0 << 16) | 3)
 
 #define LIBFREENECT2_PACK( __Declaration__ ) __Declaration__ __attribute__((__packed__))
 
@@ -29,6 +29,8 @@
 #include "libfreenect2/allocator.h"
 #include "libfreenect2/threading.h"
 
+#include <vector>
+
 namespace libfreenect2
 {
 class NewAllocator: public Allocator
@@ -57,72 +59,124 @@ class PoolAllocatorImpl: public Allocator
 {
 private:
   Allocator *allocator;
-  Buffer *buffers[2];
-  bool used[2];
+  std::vector<Buffer *> buffers;
+  std::vector<int> refs;
+  std::vector<bool> shared;
+  bool detached;
   mutex used_lock;
   condition_variable available_cond;
+
+  /* Whether a buffer shared with hold() is still in use. Call with used_lock held. */
+  bool sharing() const
+  {
+    for (size_t i = 0; i < buffers.size(); i++)
+      if (refs[i] > 0 && shared[i])
+        return true;
+    return false;
+  }
 public:
-  PoolAllocatorImpl(Allocator *a): allocator(a), buffers(), used() {}
+  PoolAllocatorImpl(Allocator *a, size_t count): allocator(a), buffers(count, (Buffer *)NULL), refs(count, 0), shared(count, false), detached(false) {}
 
   Buffer *allocate(size_t size)
   {
     unique_lock guard(used_lock);
-    while (used[0] && used[1])
+    for (;;) {
+      for (size_t i = 0; i < buffers.size(); i++) {
+        if (refs[i] > 0)
+          continue;
+        if (buffers[i] == NULL)
+          buffers[i] = allocator->allocate(size);
+        buffers[i]->length = 0;
+        buffers[i]->allocator = this;
+        refs[i] = 1;
+        shared[i] = false;
+        return buffers[i];
+      }
       WAIT_CONDITION(available_cond, used_lock, guard);
-
-    if (!used[0]) {
-      if (buffers[0] == NULL)
-        buffers[0] = allocator->allocate(size);
-      buffers[0]->length = 0;
-      buffers[0]->allocator = this;
-      used[0] = true;
-      return buffers[0];
-    } else if (!used[1]) {
-      if (buffers[1] == NULL)
-        buffers[1] = allocator->allocate(size);
-      buffers[1]->length = 0;
-      buffers[1]->allocator = this;
-      used[1] = true;
-      return buffers[1];
-    } else {
-      // should never happen
-      return NULL;
     }
   }
 
   void free(Buffer *b)
+  {
+    bool last = false;
+    {
+      lock_guard guard(used_lock);
+      for (size_t i = 0; i < buffers.size(); i++) {
+        if (b == buffers[i]) {
+          if (refs[i] > 0 && --refs[i] == 0)
+            available_cond.notify_one();
+          break;
+        }
+      }
+      last = detached && !sharing();
+    }
+    if (last)
+      delete this;
+  }
+
+  bool hold(Buffer *b)
+  {
+    lock_guard guard(used_lock);
+    for (size_t i = 0; i < buffers.size(); i++) {
+      if (b == buffers[i] && refs[i] > 0) {
+        refs[i]++;
+        shared[i] = true;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  size_t available()
   {
     lock_guard guard(used_lock);
-    if (b == buffers[0]) {
-      used[0] = false;
-      available_cond.notify_one();
-    } else if (b == buffers[1]) {
-      used[1] = false;
-      available_cond.notify_one();
+    size_t n = 0;
+    for (size_t i = 0; i < refs.size(); i++)
+      n += refs[i] == 0;
+    return n;
+  }
+
+  /* Called instead of delete by the owning PoolAllocator.
+   * Buffers shared with hold() keep the pool until their last free().
+   */
+  void detach()
+  {
+    bool last;
+    {
+      lock_guard guard(used_lock);
+      detached = true;
+      last = !sharing();
     }
+    if (last)
+      delete this;
   }
 
   ~PoolAllocatorImpl()
   {
-    allocator->free(buffers[0]);
-    allocator->free(buffers[1]);
+    for (size_t i = 0; i < buffers.size(); i++)
+      allocator->free(buffers[i]);
     delete allocator;
   }
 };
 
 PoolAllocator::PoolAllocator():
-  impl_(new PoolAllocatorImpl(new NewAllocator))
+  impl_(new PoolAllocatorImpl(new NewAllocator, 2))
 {
 }
 
 PoolAllocator::PoolAllocator(Allocator *a):
-  impl_(new PoolAllocatorImpl(a))
+  impl_(new PoolAllocatorImpl(a, 2))
+{
+}
+
+PoolAllocator::PoolAllocator(Allocator *a, size_t count):
+  impl_(new PoolAllocatorImpl(a != NULL ? a : new NewAllocator, count))
 {
 }
 
 PoolAllocator::~PoolAllocator()
 {
-  delete impl_;
+  impl_->detach();
 }
 
 Buffer *PoolAllocator::allocate(size_t size)
@@ -134,4 +188,14 @@ void PoolAllocator::free(Buffer *b)
 {
   impl_->free(b);
 }
+
+bool PoolAllocator::hold(Buffer *b)
+{
+  return impl_->hold(b);
+}
+
+size_t PoolAllocator::available()
+{
+  return impl_->available();
+}
 } // namespace libfreenect2
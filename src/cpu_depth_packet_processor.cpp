@@ -32,6 +32,7 @@
 #include <libfreenect2/logging.h>
 
 #include <fstream>
+#include <vector>
 
 #include <limits>
 
@@ -107,7 +108,7 @@ private:
 
 public:
   /** Default constructor. */
-  Mat():buffer_(0), buffer_end_(0)
+  Mat():owns_buffer(false), buffer_(0), buffer_end_(0)
   {
   }
 
@@ -279,10 +280,15 @@ public:
   float trig_table1[512*424][6];
   float trig_table2[512*424][6];
 
-  bool enable_bilateral_filter, enable_edge_filter;
+  bool enable_bilateral_filter, enable_edge_filter, enable_undistortion, enable_point_cloud;
   DepthPacketProcessor::Parameters params;
 
-  Frame *ir_frame, *depth_frame;
+  /** Distorted pixel of each undistorted one, or empty until loaded. */
+  std::vector<int> distort_map;
+  /** x/z and y/z of the ray through each depth pixel, or empty until loaded. */
+  std::vector<float> rays;
+
+  Frame *ir_frame, *depth_frame, *point_cloud_frame;
 
   bool flip_ptables;
 
@@ -290,9 +296,12 @@ public:
   {
     newIrFrame();
     newDepthFrame();
+    point_cloud_frame = 0;
 
     enable_bilateral_filter = true;
     enable_edge_filter = true;
+    enable_undistortion = false;
+    enable_point_cloud = false;
 
     flip_ptables = true;
   }
@@ -309,6 +318,7 @@ public:
   {
     delete ir_frame;
     delete depth_frame;
+    delete point_cloud_frame;
   }
 
   /** Allocate a new depth frame. */
@@ -318,6 +328,35 @@ public:
     depth_frame->format = Frame::Float;
   }
 
+  /** Allocate a new point cloud frame. */
+  void newPointCloudFrame()
+  {
+    point_cloud_frame = new Frame(512, 424, 16);
+    point_cloud_frame->format = Frame::Float4;
+  }
+
+  /**
+   * Write the point of a final depth value, with the same scaling and validity check as Registration::getPointXYZ().
+   * @param depth Depth value (millimeter).
+   * @param ray_index Depth frame pixel the value was measured at.
+   * @param [out] point_out x, y, z and 1, or NaN.
+   */
+  void computePoint(float depth, int ray_index, float *point_out)
+  {
+    const float z = depth / 1000.0f;
+
+    if(!(z > 0.001f))
+    {
+      point_out[0] = point_out[1] = point_out[2] = point_out[3] = std::numeric_limits<float>::quiet_NaN();
+      return;
+    }
+
+    point_out[0] = rays[2 * ray_index] * z;
+    point_out[1] = rays[2 * ray_index + 1] * z;
+    point_out[2] = z;
+    point_out[3] = 1.0f;
+  }
+
   int32_t decodePixelMeasurement(unsigned char* data, int sub, int x, int y)
   {
     if (x < 1 || y < 0 || 510 < x || 423 < y)
@@ -821,6 +860,8 @@ void CpuDepthPacketProcessor::setConfiguration(const libfreenect2::DepthPacketPr
   impl_->params.max_depth = config.MaxDepth * 1000.0f;
   impl_->enable_bilateral_filter = config.EnableBilateralFilter;
   impl_->enable_edge_filter = config.EnableEdgeAwareFilter;
+  impl_->enable_undistortion = config.EnableUndistortion;
+  impl_->enable_point_cloud = config.EnablePointCloud;
 }
 
 /**
@@ -872,6 +913,16 @@ void CpuDepthPacketProcessor::loadLookupTable(const short *lut)
   std::copy(lut, lut + LUT_SIZE, impl_->lut11to16);
 }
 
+void CpuDepthPacketProcessor::loadDistortMap(const int *map)
+{
+  impl_->distort_map.assign(map, map + TABLE_SIZE);
+}
+
+void CpuDepthPacketProcessor::loadRayTable(const float *rays)
+{
+  impl_->rays.assign(rays, rays + 2 * TABLE_SIZE);
+}
+
 /**
  * Process a packet.
  * @param packet Packet to process.
@@ -923,6 +974,18 @@ void CpuDepthPacketProcessor::process(const DepthPacket &packet)
   }
 
   Mat<float> out_ir(424, 512, impl_->ir_frame->data), out_depth(424, 512, impl_->depth_frame->data);
+  const bool undistort = impl_->enable_undistortion && !impl_->distort_map.empty();
+  const bool points = impl_->enable_point_cloud && !impl_->rays.empty();
+  float *out_points = 0;
+
+  if(points)
+  {
+    if(impl_->point_cloud_frame == 0)
+      impl_->newPointCloudFrame();
+    impl_->point_cloud_frame->timestamp = packet.timestamp;
+    impl_->point_cloud_frame->sequence = packet.sequence;
+    out_points = reinterpret_cast<float *>(impl_->point_cloud_frame->data);
+  }
 
   if(impl_->enable_edge_filter)
   {
@@ -942,20 +1005,80 @@ void CpuDepthPacketProcessor::process(const DepthPacket &packet)
         depth_ir_sum_ptr->val[2] = ir_sum;
       }
 
-    m_max_edge_test_ptr = m_max_edge_test.ptr(0, 0);
+    if(undistort)
+    {
+      // filter only the pixels sampled by the undistorted image, straight into it
+      const int *map_dist = &impl_->distort_map[0];
+      float *depth_out = out_depth.ptr(0, 0);
+
+      for(size_t i = 0; i < TABLE_SIZE; ++i, ++map_dist, ++depth_out)
+      {
+        const int index = *map_dist;
+
+        if(index < 0)
+        {
+          *depth_out = 0.0f;
+          if(points)
+            impl_->computePoint(0.0f, 0, out_points + 4 * i);
+          continue;
+        }
+
+        // the map indexes the output frame, which is upside-down
+        const int x = index % 512, y = 423 - index / 512;
+        impl_->filterPixelStage2(x, y, depth_ir_sum, *m_max_edge_test.ptr(y, x) == 1, depth_out);
+
+        if(points)
+          impl_->computePoint(*depth_out, index, out_points + 4 * i);
+      }
+    }
+    else
+    {
+      m_max_edge_test_ptr = m_max_edge_test.ptr(0, 0);
+
+      for(int y = 0; y < 424; ++y)
+        for(int x = 0; x < 512; ++x, ++m_max_edge_test_ptr)
+        {
+          float *depth_out = out_depth.ptr(423 - y, x);
+          impl_->filterPixelStage2(x, y, depth_ir_sum, *m_max_edge_test_ptr == 1, depth_out);
+
+          if(points)
+            impl_->computePoint(*depth_out, (423 - y) * 512 + x, out_points + 4 * ((423 - y) * 512 + x));
+        }
+    }
+  }
+  else if(undistort)
+  {
+    // stage 2 also writes the ir frame, so it runs on every pixel before the depth is gathered
+    Mat<float> raw_depth(424, 512);
 
     for(int y = 0; y < 424; ++y)
-      for(int x = 0; x < 512; ++x, ++m_max_edge_test_ptr)
+      for(int x = 0; x < 512; ++x, m_ptr += 9)
       {
-        impl_->filterPixelStage2(x, y, depth_ir_sum, *m_max_edge_test_ptr == 1, out_depth.ptr(423 - y, x));
+        impl_->processPixelStage2(x, y, m_ptr + 0, m_ptr + 3, m_ptr + 6, out_ir.ptr(423 - y, x), raw_depth.ptr(423 - y, x), 0);
       }
+
+    const int *map_dist = &impl_->distort_map[0];
+    const float *raw_depth_data = raw_depth.ptr(0, 0);
+    float *depth_out = out_depth.ptr(0, 0);
+
+    for(size_t i = 0; i < TABLE_SIZE; ++i)
+    {
+      depth_out[i] = map_dist[i] < 0 ? 0.0f : raw_depth_data[map_dist[i]];
+
+      if(points)
+        impl_->computePoint(depth_out[i], std::max(map_dist[i], 0), out_points + 4 * i);
+    }
   }
   else
   {
     for(int y = 0; y < 424; ++y)
       for(int x = 0; x < 512; ++x, m_ptr += 9)
       {
-        impl_->processPixelStage2(x, y, m_ptr + 0, m_ptr + 3, m_ptr + 6, out_ir.ptr(423 - y, x), out_depth.ptr(423 - y, x), 0);
+        float *depth_out = out_depth.ptr(423 - y, x);
+        impl_->processPixelStage2(x, y, m_ptr + 0, m_ptr + 3, m_ptr + 6, out_ir.ptr(423 - y, x), depth_out, 0);
+
+        if(points)
+          impl_->computePoint(*depth_out, (423 - y) * 512 + x, out_points + 4 * ((423 - y) * 512 + x));
       }
   }
 
@@ -971,6 +1094,11 @@ void CpuDepthPacketProcessor::process(const DepthPacket &packet)
     {
       impl_->newDepthFrame();
     }
+
+    if(points && listener_->onNewFrame(Frame::PointCloud, impl_->point_cloud_frame))
+    {
+      impl_->newPointCloudFrame();
+    }
   }
 
 }
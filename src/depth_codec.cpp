@@ -0,0 +1,662 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+/** @file depth_codec.cpp Run-length/variable-length depth codec. */
+
+#include <libfreenect2/depth_codec.h>
+#include <libfreenect2/logging.h>
+#include <libfreenect2/simd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace libfreenect2
+{
+
+const size_t DepthCodec::HeaderSize;
+
+namespace
+{
+
+static const unsigned char magic[4] = {'R', 'V', 'L', '1'};
+
+inline void writeU16(unsigned char *p, unsigned int v)
+{
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+}
+
+inline void writeU32(unsigned char *p, uint32_t v)
+{
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+  p[2] = (v >> 16) & 0xff;
+  p[3] = (v >> 24) & 0xff;
+}
+
+inline unsigned int readU16(const unsigned char *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+inline uint32_t readU32(const unsigned char *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+inline unsigned int countTrailingZeros(unsigned int v)
+{
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward(&index, v);
+  return index;
+#else
+  return __builtin_ctz(v);
+#endif
+}
+
+inline unsigned int countTrailingZeros64(uint64_t v)
+{
+#if defined(__GNUC__) && defined(__x86_64__)
+  return __builtin_ctzll(v);
+#else
+  const uint32_t low = (uint32_t)v;
+  return low != 0 ? countTrailingZeros(low) : 32 + countTrailingZeros((uint32_t)(v >> 32));
+#endif
+}
+
+/** Nibbles of a value below 2^18, as NibbleWriter::writeVLE() writes them. @return Length of the code in bits. */
+inline unsigned int shortCode(uint32_t v, uint32_t &code)
+{
+  code = (v & 0x7) | ((v << 1) & 0x70) | ((v << 2) & 0x700) | ((v << 3) & 0x7000) | ((v << 4) & 0x70000) | ((v << 5) & 0x700000);
+  // comparisons rather than a loop, the lengths vary from pixel to pixel
+  const uint32_t more1 = v > 0x7, more2 = v > 0x3f, more3 = v > 0x1ff, more4 = v > 0xfff, more5 = v > 0x7fff;
+  code |= more1 << 3 | more2 << 7 | more3 << 11 | more4 << 15 | more5 << 19;
+  return 4 * (1 + more1 + more2 + more3 + more4 + more5);
+}
+
+/** Inverse of the zigzag mapping. */
+inline int32_t unzigzag(uint32_t v)
+{
+  return (int32_t)((v >> 1) ^ (0u - (v & 1)));
+}
+
+/** Continuation bit of each nibble. */
+static const uint64_t STOP_BITS = ((uint64_t)0x88888888 << 32) | 0x88888888;
+
+/** Value of a code of at most 8 nibbles: the 3 low bits of each nibble. */
+inline uint32_t gatherNibbles(uint32_t x)
+{
+  x = (x & 0x07070707) | ((x >> 1) & 0x38383838);
+  x = (x & 0x003f003f) | ((x >> 2) & 0x0fc00fc0);
+  return (x & 0x00000fff) | ((x >> 4) & 0x00fff000);
+}
+
+/** Round float millimeters to uint16; invalid and out of range values become 0.
+ * Sets a bit in @p valid for every non-zero value, which must be zero on input.
+ */
+void quantize(const float *in, uint16_t *out, uint64_t *valid, size_t n)
+{
+  size_t i = 0;
+#ifdef LIBFREENECT2_WITH_SSE2
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 upper = _mm_set1_ps(65535.5f);
+  const __m128 half = _mm_set1_ps(0.5f);
+  const __m128i bias = _mm_set1_epi32(32768);
+  const __m128i sign = _mm_set1_epi16((short)0x8000);
+
+  for (; i + 8 <= n; i += 8)
+  {
+    __m128 a = _mm_loadu_ps(in + i);
+    __m128 b = _mm_loadu_ps(in + i + 4);
+    // Comparisons are false for NaN, so NaN is masked out too.
+    __m128 va = _mm_and_ps(_mm_cmpgt_ps(a, zero), _mm_cmplt_ps(a, upper));
+    __m128 vb = _mm_and_ps(_mm_cmpgt_ps(b, zero), _mm_cmplt_ps(b, upper));
+    __m128i ia = _mm_and_si128(_mm_cvttps_epi32(_mm_add_ps(a, half)), _mm_castps_si128(va));
+    __m128i ib = _mm_and_si128(_mm_cvttps_epi32(_mm_add_ps(b, half)), _mm_castps_si128(vb));
+    // packs_epi32 saturates to signed 16 bits: shift into signed range and back.
+    __m128i packed = _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(ia, bias), _mm_sub_epi32(ib, bias)), sign);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), packed);
+    __m128i zeros = _mm_cmpeq_epi16(packed, _mm_setzero_si128());
+    valid[i / 64] |= (uint64_t)(~_mm_movemask_epi8(_mm_packs_epi16(zeros, zeros)) & 0xff) << (i % 64);
+  }
+#endif
+  for (; i < n; ++i)
+  {
+    const float d = in[i];
+    out[i] = (d > 0.0f && d < 65535.5f) ? (uint16_t)(d + 0.5f) : 0;
+    valid[i / 64] |= (uint64_t)(out[i] != 0) << (i % 64);
+  }
+}
+
+/** Length of the run of zero (or non-zero) values starting at @p i, from the bits of quantize(). */
+size_t runLength(const uint64_t *valid, size_t i, size_t n, bool zeros)
+{
+  // the run ends at the first bit that differs; the unused bits of the last word end a run of zeros
+  // past the end, which is clamped
+  const uint64_t flip = zeros ? 0 : ~(uint64_t)0;
+  for (size_t j = i; j < n; j = (j / 64 + 1) * 64)
+  {
+    const uint64_t ends = (valid[j / 64] ^ flip) >> (j % 64);
+    if (ends != 0)
+      return std::min(j + countTrailingZeros64(ends), n) - i;
+  }
+  return n - i;
+}
+
+/** Packs 4-bit nibbles into little-endian 32-bit words, low nibble first. */
+class NibbleWriter
+{
+public:
+  NibbleWriter(unsigned char *begin, unsigned char *end):
+    p_(begin), end_(end), bits_(0), count_(0), overflow_(false)
+  {
+  }
+
+  void writeVLE(uint32_t value)
+  {
+    if (value < 0x40000)
+    {
+      uint32_t code;
+      const unsigned int bits = shortCode(value, code);
+      append(code, bits);
+      return;
+    }
+    do
+    {
+      uint32_t nibble = value & 0x7;
+      value >>= 3;
+      if (value)
+        nibble |= 0x8;
+      append(nibble, 4);
+    }
+    while (value);
+  }
+
+  void writeDeltas(const uint16_t *p, size_t n, int &previous);
+
+  /** Write out a partially filled word. @return Pointer past the written data, 0 on overflow. */
+  unsigned char *finish()
+  {
+    if (count_ > 0)
+      flush();
+    return overflow_ ? 0 : p_;
+  }
+
+private:
+  /** Append whole nibbles, see shortCode(). */
+  void append(uint32_t code, unsigned int bits)
+  {
+    bits_ |= (uint64_t)code << count_;
+    count_ += bits;
+    if (end_ - p_ >= 4)
+    {
+      // unconditional store of the low word, kept only once it is full
+      writeU32(p_, (uint32_t)bits_);
+      const unsigned int full = count_ >> 5;
+      p_ += 4 * full;
+      bits_ >>= 32 * full;
+      count_ -= 32 * full;
+    }
+    else if (count_ >= 32)
+    {
+      flush();
+    }
+  }
+
+  /** Write the low word of the bit buffer. */
+  void flush()
+  {
+    if (end_ - p_ >= 4)
+    {
+      writeU32(p_, (uint32_t)bits_);
+      p_ += 4;
+    }
+    else
+    {
+      overflow_ = true;
+    }
+    bits_ >>= 32;
+    count_ = count_ > 32 ? count_ - 32 : 0;
+  }
+
+  unsigned char *p_;
+  unsigned char *end_;
+  uint64_t bits_;       ///< Nibbles not written yet, the oldest in the low bits.
+  unsigned int count_;  ///< Bits used in bits_, less than 32 between calls.
+  bool overflow_;
+};
+
+/** Write a run of valid pixels as zigzag deltas to the previous one.
+ * Reads up to three values past the run, the caller pads the array.
+ */
+void NibbleWriter::writeDeltas(const uint16_t *p, size_t n, int &previous)
+{
+  // a local copy stays in registers; the members would be reloaded after every byte written
+  NibbleWriter w(*this);
+  size_t i = 0;
+#ifdef LIBFREENECT2_WITH_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  uint32_t codes[4], bits[4];
+
+  // the last group of a run also codes up to three values past it, which are dropped
+  while (i < n)
+  {
+    const int last = i > 0 ? p[i - 1] : previous;
+
+    if (n - i >= 8)
+    {
+      // eight deltas in 16-bit lanes while they are below 256 and have codes of at most three
+      // nibbles; the absolute differences are taken without wrapping
+      const __m128i cur = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+      const __m128i prev = _mm_or_si128(_mm_slli_si128(cur, 2), _mm_cvtsi32_si128(last));
+      const __m128i distance = _mm_or_si128(_mm_subs_epu16(cur, prev), _mm_subs_epu16(prev, cur));
+      if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_srli_epi16(distance, 8), zero)) == 0xffff)
+      {
+        const __m128i delta = _mm_sub_epi16(cur, prev);
+        const __m128i v = _mm_xor_si128(_mm_slli_epi16(delta, 1), _mm_srai_epi16(delta, 15));
+        const __m128i more1 = _mm_cmpgt_epi16(v, _mm_set1_epi16(0x7));
+        const __m128i more2 = _mm_cmpgt_epi16(v, _mm_set1_epi16(0x3f));
+        __m128i code = _mm_and_si128(v, _mm_set1_epi16(0x7));
+        code = _mm_or_si128(code, _mm_and_si128(_mm_slli_epi16(v, 1), _mm_set1_epi16(0x70)));
+        code = _mm_or_si128(code, _mm_and_si128(_mm_slli_epi16(v, 2), _mm_set1_epi16(0x700)));
+        code = _mm_or_si128(code, _mm_and_si128(more1, _mm_set1_epi16(0x8)));
+        code = _mm_or_si128(code, _mm_and_si128(more2, _mm_set1_epi16(0x80)));
+
+        // pairs of codes are joined by a multiply-add, the odd code scaled by 16 to the
+        // power of the nibbles of the even one
+        const __m128i scale = _mm_add_epi16(_mm_set1_epi16(16), _mm_add_epi16(_mm_and_si128(more1, _mm_set1_epi16(0xf0)), _mm_and_si128(more2, _mm_set1_epi16(0xf00))));
+        const __m128i length = _mm_sub_epi16(_mm_set1_epi16(4), _mm_slli_epi16(_mm_add_epi16(more1, more2), 2));
+        const __m128i pair = _mm_madd_epi16(code, _mm_or_si128(_mm_slli_epi32(scale, 16), _mm_set1_epi32(1)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(codes), pair);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(bits), _mm_madd_epi16(length, _mm_set1_epi16(1)));
+        w.append(codes[0], bits[0]);
+        w.append(codes[1], bits[1]);
+        w.append(codes[2], bits[2]);
+        w.append(codes[3], bits[3]);
+        i += 8;
+        continue;
+      }
+    }
+
+    // four deltas of any size in 32-bit lanes
+    const __m128i cur = _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(p + i)), zero);
+    const __m128i delta = _mm_sub_epi32(cur, _mm_or_si128(_mm_slli_si128(cur, 4), _mm_cvtsi32_si128(last)));
+    const __m128i v = _mm_xor_si128(_mm_slli_epi32(delta, 1), _mm_srai_epi32(delta, 31));
+
+    // spread the groups of 3 bits to nibbles: halves of 9 bits into 12-bit fields, then
+    // 6 + 3 bits in each field, then 3 + 3
+    __m128i code = _mm_or_si128(_mm_and_si128(v, _mm_set1_epi32(0x1ff)), _mm_slli_epi32(_mm_and_si128(v, _mm_set1_epi32(0x3fe00)), 3));
+    code = _mm_or_si128(_mm_and_si128(code, _mm_set1_epi32(0x3f03f)), _mm_slli_epi32(_mm_and_si128(code, _mm_set1_epi32(0x1c01c0)), 2));
+    code = _mm_or_si128(_mm_and_si128(code, _mm_set1_epi32(0x707707)), _mm_slli_epi32(_mm_and_si128(code, _mm_set1_epi32(0x38038)), 1));
+
+    // a nibble continues if any nibble above it is non-zero
+    __m128i above = _mm_srli_epi32(code, 4);
+    above = _mm_or_si128(above, _mm_srli_epi32(above, 4));
+    above = _mm_or_si128(above, _mm_srli_epi32(above, 8));
+    above = _mm_or_si128(above, _mm_srli_epi32(above, 16));
+    const __m128i more = _mm_and_si128(_mm_add_epi32(above, _mm_set1_epi32(0x777777)), _mm_set1_epi32(0x888888));
+    code = _mm_or_si128(code, more);
+
+    // the highest continuation bit is bit 4k+3 of a code of k+2 nibbles; its float exponent
+    // gives the length, and the 4 added to a code of one nibble rounds down to it
+    const __m128i exponent = _mm_srli_epi32(_mm_castps_si128(_mm_cvtepi32_ps(_mm_or_si128(more, _mm_set1_epi32(0x4)))), 23);
+    const __m128i length = _mm_and_si128(_mm_sub_epi32(exponent, _mm_set1_epi32(122)), _mm_set1_epi32(~3));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(codes), code);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(bits), length);
+    const size_t count = std::min(n - i, (size_t)4);
+    for (size_t k = 0; k < count; ++k)
+      w.append(codes[k], bits[k]);
+    i += 4;
+  }
+  i = std::min(i, n);
+  if (i > 0)
+    previous = p[i - 1];
+#endif
+  for (; i < n; ++i)
+  {
+    const int delta = p[i] - previous;
+    previous = p[i];
+    uint32_t code;
+    const unsigned int bits = shortCode(((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31), code);
+    w.append(code, bits);
+  }
+  *this = w;
+}
+
+class NibbleReader
+{
+public:
+  NibbleReader(const unsigned char *begin, const unsigned char *end):
+    p_(begin), end_(end), bits_(0), count_(0)
+  {
+  }
+
+  /** @return false on truncated or malformed data. */
+  bool readVLE(uint32_t &value)
+  {
+    value = 0;
+    for (unsigned int shift = 0; shift < 32; shift += 3)
+    {
+      if (count_ == 0 && !refill())
+        return false;
+      uint32_t nibble = bits_ & 0xf;
+      bits_ >>= 4;
+      count_ -= 4;
+      value |= (nibble & 0x7) << shift;
+      if (!(nibble & 0x8))
+        return true;
+    }
+    return false;
+  }
+
+  bool readCodes(uint32_t *codes, size_t n);
+
+private:
+  /** Load the next word above the buffered bits, if there is one. */
+  bool refill()
+  {
+    if (end_ - p_ < 4)
+      return false;
+    bits_ |= (uint64_t)readU32(p_) << count_;
+    p_ += 4;
+    count_ += 32;
+    return true;
+  }
+
+  const unsigned char *p_;
+  const unsigned char *end_;
+  uint64_t bits_;       ///< Nibbles not read yet, the next one in the low bits; zero above count_.
+  unsigned int count_;  ///< Bits buffered in bits_.
+};
+
+/** Read the codes of @p n zigzag deltas, the inner loop of decoding.
+ * Up to three more codes are written past @p n without being consumed.
+ */
+bool NibbleReader::readCodes(uint32_t *codes, size_t n)
+{
+  // local copies of the members stay in registers
+  const unsigned char *p = p_;
+  uint64_t buffer = bits_;
+  unsigned int count = count_;
+
+  for (size_t i = 0; i < n;)
+  {
+    if (count < 32 && end_ - p >= 4)
+    {
+      buffer |= (uint64_t)readU32(p) << count;
+      p += 4;
+      count += 32;
+    }
+
+    if (count >= 32 && (buffer & 0x88888888) == 0 && n - i >= 8)
+    {
+      // eight codes of one nibble, as in flat low noise areas
+      const uint32_t word = (uint32_t)buffer;
+      for (int k = 0; k < 8; ++k)
+        codes[i + k] = (word >> (4 * k)) & 0xf;
+      buffer >>= 32;
+      count -= 32;
+      i += 8;
+      continue;
+    }
+
+    // every nibble without continuation bit ends a code; the codes are cut apart without
+    // waiting for the length of one to find the next. Codes longer than 32 bits are cut to
+    // 32 bits with continuation bits set, which expandCodes() rejects
+    const uint64_t stops0 = ~buffer & STOP_BITS & (((uint64_t)1 << count) - 1);
+    const uint64_t stops1 = stops0 & (stops0 - 1);
+    const uint64_t stops2 = stops1 & (stops1 - 1);
+    const uint64_t stops3 = stops2 & (stops2 - 1);
+    if (stops3 != 0)
+    {
+      // the common case of four buffered codes takes no branch per code; past the end of
+      // a block they are cut anyway and left in the buffer
+      const unsigned int end0 = countTrailingZeros64(stops0) + 1;
+      const unsigned int end1 = countTrailingZeros64(stops1) + 1;
+      const unsigned int end2 = countTrailingZeros64(stops2) + 1;
+      const unsigned int end3 = countTrailingZeros64(stops3) + 1;
+      codes[i] = (uint32_t)(buffer & (((uint64_t)1 << end0) - 1));
+      codes[i + 1] = (uint32_t)((buffer >> end0) & (((uint64_t)1 << (end1 - end0)) - 1));
+      codes[i + 2] = (uint32_t)((buffer >> end1) & (((uint64_t)1 << (end2 - end1)) - 1));
+      codes[i + 3] = (uint32_t)((buffer >> end2) & (((uint64_t)1 << (end3 - end2)) - 1));
+      const size_t left = n - i;
+      const unsigned int taken = left >= 4 ? end3 : left == 3 ? end2 : left == 2 ? end1 : end0;
+      buffer >>= taken;
+      count -= taken;
+      i += std::min(left, (size_t)4);
+      continue;
+    }
+    if (stops0 == 0)
+      return false;
+    const unsigned int end = countTrailingZeros64(stops0) + 1;
+    codes[i++] = (uint32_t)(buffer & (((uint64_t)1 << end) - 1));
+    buffer >>= end;
+    count -= end;
+  }
+
+  p_ = p;
+  bits_ = buffer;
+  count_ = count;
+  return true;
+}
+
+/** Turn zigzag delta codes into depth values, starting from @p previous.
+ * @return false if a code is longer than the 6 nibbles of a valid delta or a value leaves 1..65535.
+ */
+bool expandCodes(const uint32_t *codes, size_t n, int &previous, float *out)
+{
+  size_t i = 0;
+#ifdef LIBFREENECT2_WITH_SSE2
+  __m128i sum = _mm_set1_epi32(previous);
+  __m128i invalid = _mm_setzero_si128();
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one = _mm_set1_epi32(1);
+  const __m128i max = _mm_set1_epi32(0xffff);
+
+  for (; i + 4 <= n; i += 4)
+  {
+    // gatherNibbles() and unzigzag()
+    const __m128i code = _mm_loadu_si128(reinterpret_cast<const __m128i *>(codes + i));
+    __m128i x = _mm_or_si128(_mm_and_si128(code, _mm_set1_epi32(0x07070707)), _mm_and_si128(_mm_srli_epi32(code, 1), _mm_set1_epi32(0x38383838)));
+    x = _mm_or_si128(_mm_and_si128(x, _mm_set1_epi32(0x003f003f)), _mm_and_si128(_mm_srli_epi32(x, 2), _mm_set1_epi32(0x0fc00fc0)));
+    x = _mm_or_si128(_mm_and_si128(x, _mm_set1_epi32(0x00000fff)), _mm_and_si128(_mm_srli_epi32(x, 4), _mm_set1_epi32(0x00fff000)));
+    x = _mm_xor_si128(_mm_srli_epi32(x, 1), _mm_sub_epi32(zero, _mm_and_si128(x, one)));
+
+    // prefix sums of the four lanes, carried over to the next vector
+    x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+    x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+    x = _mm_add_epi32(x, sum);
+    // a lane can only wrap into range from a lane that is out of range
+    invalid = _mm_or_si128(invalid, _mm_and_si128(code, _mm_set1_epi32(0xff800000)));
+    invalid = _mm_or_si128(invalid, _mm_or_si128(_mm_cmplt_epi32(x, one), _mm_cmpgt_epi32(x, max)));
+    _mm_storeu_ps(out + i, _mm_cvtepi32_ps(x));
+    sum = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+  }
+  if (_mm_movemask_epi8(_mm_cmpeq_epi8(invalid, zero)) != 0xffff)
+    return false;
+  previous = _mm_cvtsi128_si32(sum);
+#endif
+  for (; i < n; ++i)
+  {
+    if (codes[i] >= 0x800000)
+      return false;
+    previous = (int32_t)((uint32_t)previous + (uint32_t)unzigzag(gatherNibbles(codes[i])));
+    if (previous <= 0 || previous > 0xffff)
+      return false;
+    out[i] = (float)previous;
+  }
+  return true;
+}
+
+} // namespace
+
+class DepthCodecImpl
+{
+public:
+  std::vector<uint16_t> values; ///< Quantized frame, kept for the next frame of the same size.
+  std::vector<uint64_t> valid;  ///< Bit set of the non-zero values.
+};
+
+DepthCodec::DepthCodec():
+  impl_(new DepthCodecImpl)
+{
+}
+
+DepthCodec::~DepthCodec()
+{
+  delete impl_;
+}
+
+size_t DepthCodec::maxEncodedSize(size_t width, size_t height)
+{
+  const size_t n = width * height;
+  // Per pixel at most 6 nibbles for the value; run lengths amortize to at
+  // most 3 nibbles per pixel, plus one final pair of runs.
+  const size_t nibbles = 9 * n + 2 * 11;
+  return HeaderSize + (nibbles + 7) / 8 * 4;
+}
+
+size_t DepthCodec::encode(const Frame *depth, unsigned char *buffer, size_t capacity)
+{
+  if (depth == 0 || depth->format != Frame::Float || depth->bytes_per_pixel != 4 ||
+      depth->width == 0 || depth->height == 0 || depth->width > 0xffff || depth->height > 0xffff)
+  {
+    LOG_ERROR << "cannot encode frame: not a float depth frame";
+    return 0;
+  }
+  if (capacity < HeaderSize)
+    return 0;
+
+  const size_t n = depth->width * depth->height;
+  impl_->values.resize(n + 3);
+  uint16_t *values = &impl_->values[0];
+  impl_->valid.assign((n + 63) / 64, 0);
+  const uint64_t *valid = &impl_->valid[0];
+  quantize(reinterpret_cast<const float *>(depth->data), values, &impl_->valid[0], n);
+
+  NibbleWriter writer(buffer + HeaderSize, buffer + capacity);
+  int previous = 0;
+
+  for (size_t i = 0; i < n;)
+  {
+    size_t zeros = runLength(valid, i, n, true);
+    i += zeros;
+    size_t nonzeros = runLength(valid, i, n, false);
+    writer.writeVLE(zeros);
+    writer.writeVLE(nonzeros);
+    writer.writeDeltas(values + i, nonzeros, previous);
+    i += nonzeros;
+  }
+
+  unsigned char *data_end = writer.finish();
+  if (data_end == 0)
+    return 0;
+
+  const size_t payload = data_end - buffer - HeaderSize;
+  std::memcpy(buffer, magic, sizeof(magic));
+  writeU16(buffer + 4, depth->width);
+  writeU16(buffer + 6, depth->height);
+  writeU32(buffer + 8, depth->timestamp);
+  writeU32(buffer + 12, depth->sequence);
+  writeU32(buffer + 16, payload);
+  return HeaderSize + payload;
+}
+
+bool DepthCodec::getFrameSize(const unsigned char *buffer, size_t length, size_t &width, size_t &height)
+{
+  if (buffer == 0 || length < HeaderSize || std::memcmp(buffer, magic, sizeof(magic)) != 0)
+    return false;
+  width = readU16(buffer + 4);
+  height = readU16(buffer + 6);
+  return true;
+}
+
+bool DepthCodec::decode(const unsigned char *buffer, size_t length, Frame *depth)
+{
+  size_t width, height;
+  if (!getFrameSize(buffer, length, width, height))
+  {
+    LOG_ERROR << "cannot decode depth: invalid header";
+    return false;
+  }
+  if (depth == 0 || depth->width != width || depth->height != height || depth->bytes_per_pixel != 4)
+  {
+    LOG_ERROR << "cannot decode depth: frame does not match " << width << "x" << height;
+    return false;
+  }
+  const size_t payload = readU32(buffer + 16);
+  if (payload > length - HeaderSize)
+  {
+    LOG_ERROR << "cannot decode depth: truncated data";
+    return false;
+  }
+
+  NibbleReader reader(buffer + HeaderSize, buffer + HeaderSize + payload);
+  float *out = reinterpret_cast<float *>(depth->data);
+  float *end = out + width * height;
+  int previous = 0;
+
+  while (out < end)
+  {
+    uint32_t zeros, nonzeros;
+    if (!reader.readVLE(zeros) || !reader.readVLE(nonzeros) ||
+        zeros > (size_t)(end - out) || nonzeros > (size_t)(end - out) - zeros)
+    {
+      LOG_ERROR << "cannot decode depth: corrupted data";
+      return false;
+    }
+
+    std::memset(out, 0, zeros * sizeof(float));
+    out += zeros;
+
+    // the bitstream is read serially; the deltas are summed and converted in blocks
+    while (nonzeros > 0)
+    {
+      uint32_t codes[64 + 3];
+      const size_t block = nonzeros < 64 ? nonzeros : 64;
+      if (!reader.readCodes(codes, block) || !expandCodes(codes, block, previous, out))
+      {
+        LOG_ERROR << "cannot decode depth: corrupted data";
+        return false;
+      }
+      out += block;
+      nonzeros -= block;
+    }
+  }
+
+  depth->timestamp = readU32(buffer + 8);
+  depth->sequence = readU32(buffer + 12);
+  depth->format = Frame::Float;
+  return true;
+}
+
+} /* namespace libfreenect2 */
@@ -28,6 +28,7 @@
 
 #include <libfreenect2/depth_packet_processor.h>
 #include <libfreenect2/async_packet_processor.h>
+#include <libfreenect2/logging.h>
 
 #include <cstring>
 
@@ -109,6 +110,11 @@ DepthPacketProcessor::~DepthPacketProcessor()
 void DepthPacketProcessor::setConfiguration(const libfreenect2::DepthPacketProcessor::Config &config)
 {
   config_ = config;
+
+  if (config.EnableUndistortion && !supportsUndistortion())
+    LOG_WARNING << name() << " depth processing does not support undistortion";
+  if (config.EnablePointCloud && !supportsPointCloud())
+    LOG_WARNING << name() << " depth processing does not support point clouds";
 }
 
 void DepthPacketProcessor::setFrameListener(libfreenect2::FrameListener *listener)
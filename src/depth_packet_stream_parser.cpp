@@ -35,6 +35,7 @@ namespace libfreenect2
 
 DepthPacketStreamParser::DepthPacketStreamParser() :
     processor_(noopProcessor<DepthPacket>()),
+    tap_(0),
     processed_packets_(-1),
     current_sequence_(0),
     current_subsequence_(0)
@@ -61,6 +62,12 @@ void DepthPacketStreamParser::setPacketProcessor(libfreenect2::BaseDepthPacketPr
   processor_->allocateBuffer(packet_, buffer_size_);
 }
 
+void DepthPacketStreamParser::setPacketTap(PacketTap<DepthPacket> *tap)
+{
+  libfreenect2::lock_guard l(tap_mutex_);
+  tap_ = tap;
+}
+
 void DepthPacketStreamParser::onDataReceived(unsigned char* buffer, size_t in_length)
 {
   if (packet_.memory == NULL || packet_.memory->data == NULL)
@@ -109,14 +116,20 @@ void DepthPacketStreamParser::onDataReceived(unsigned char* buffer, size_t in_le
         {
           if(current_subsequence_ == 0x3ff)
           {
-            if(processor_->ready())
+            DepthPacket &packet = packet_;
+            packet.sequence = current_sequence_;
+            packet.timestamp = footer->timestamp;
+            packet.buffer = packet_.memory->data;
+            packet.buffer_length = packet_.memory->capacity;
+
             {
-              DepthPacket &packet = packet_;
-              packet.sequence = current_sequence_;
-              packet.timestamp = footer->timestamp;
-              packet.buffer = packet_.memory->data;
-              packet.buffer_length = packet_.memory->capacity;
+              libfreenect2::lock_guard l(tap_mutex_);
+              if (tap_ != 0)
+                tap_->onPacket(packet);
+            }
 
+            if(processor_->ready())
+            {
               processor_->process(packet);
               processor_->allocateBuffer(packet_, buffer_size_);
 
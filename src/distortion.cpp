@@ -0,0 +1,106 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+
+/** @file distortion.cpp Pixel mapping tables of the depth camera. */
+
+#include <libfreenect2/distortion.h>
+
+namespace libfreenect2
+{
+
+// these seem to be hardcoded in the original SDK
+static const float depth_q = 0.01;
+static const float color_q = 0.002199;
+
+static void distort(const Freenect2Device::IrCameraParams &depth, int mx, int my, float& x, float& y)
+{
+  // see http://en.wikipedia.org/wiki/Distortion_(optics) for description
+  float dx = ((float)mx - depth.cx) / depth.fx;
+  float dy = ((float)my - depth.cy) / depth.fy;
+  float dx2 = dx * dx;
+  float dy2 = dy * dy;
+  float r2 = dx2 + dy2;
+  float dxdy2 = 2 * dx * dy;
+  float kr = 1 + ((depth.k3 * r2 + depth.k2) * r2 + depth.k1) * r2;
+  x = depth.fx * (dx * kr + depth.p2 * (r2 + 2 * dx2) + depth.p1 * dxdy2) + depth.cx;
+  y = depth.fy * (dy * kr + depth.p1 * (r2 + 2 * dy2) + depth.p2 * dxdy2) + depth.cy;
+}
+
+void computeDistortMap(const Freenect2Device::IrCameraParams &depth, int *map, int y_begin, int y_end)
+{
+  float mx, my;
+
+  map += y_begin * 512;
+  for (int y = y_begin; y < y_end; y++) {
+    for (int x = 0; x < 512; x++) {
+      // compute the distorted coordinate for current pixel
+      distort(depth, x, y, mx, my);
+      // rounding the values and check if the pixel is inside the image
+      int ix = (int)(mx + 0.5f);
+      int iy = (int)(my + 0.5f);
+      if(ix < 0 || ix >= 512 || iy < 0 || iy >= 424)
+        *map++ = -1;
+      else
+        // computing the index from the coordinates for faster access to the data
+        *map++ = iy * 512 + ix;
+    }
+  }
+}
+
+static void depth_to_color(const Freenect2Device::IrCameraParams &depth, const Freenect2Device::ColorCameraParams &color, float mx, float my, float& rx, float& ry)
+{
+  mx = (mx - depth.cx) * depth_q;
+  my = (my - depth.cy) * depth_q;
+
+  float wx =
+    (mx * mx * mx * color.mx_x3y0) + (my * my * my * color.mx_x0y3) +
+    (mx * mx * my * color.mx_x2y1) + (my * my * mx * color.mx_x1y2) +
+    (mx * mx * color.mx_x2y0) + (my * my * color.mx_x0y2) + (mx * my * color.mx_x1y1) +
+    (mx * color.mx_x1y0) + (my * color.mx_x0y1) + (color.mx_x0y0);
+
+  float wy =
+    (mx * mx * mx * color.my_x3y0) + (my * my * my * color.my_x0y3) +
+    (mx * mx * my * color.my_x2y1) + (my * my * mx * color.my_x1y2) +
+    (mx * mx * color.my_x2y0) + (my * my * color.my_x0y2) + (mx * my * color.my_x1y1) +
+    (mx * color.my_x1y0) + (my * color.my_x0y1) + (color.my_x0y0);
+
+  rx = (wx / (color.fx * color_q)) - (color.shift_m / color.shift_d);
+  ry = (wy / color_q) + color.cy;
+}
+
+void computeDepthToColorMap(const Freenect2Device::IrCameraParams &depth, const Freenect2Device::ColorCameraParams &color, float *map_x, float *map_y, int y_begin, int y_end)
+{
+  map_x += y_begin * 512;
+  map_y += y_begin * 512;
+  for (int y = y_begin; y < y_end; y++) {
+    for (int x = 0; x < 512; x++) {
+      depth_to_color(depth, color, x, y, *map_x++, *map_y++);
+    }
+  }
+}
+
+} /* namespace libfreenect2 */
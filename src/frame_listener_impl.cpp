@@ -28,6 +28,21 @@
 
 #include <libfreenect2/frame_listener_impl.h>
 #include <libfreenect2/threading.h>
+#include <libfreenect2/logging.h>
+#include <deque>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#elif !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#endif
 
 namespace libfreenect2
 {
@@ -42,6 +57,8 @@ Frame::Frame(size_t width, size_t height, size_t bytes_per_pixel, unsigned char
   gamma(0.f),
   status(0),
   format(Frame::Invalid),
+  x_offset(0),
+  y_offset(0),
   rawdata(NULL)
 {
   if (data_)
@@ -191,4 +208,642 @@ bool SyncMultiFrameListener::onNewFrame(Frame::Type type, Frame *frame)
   return true;
 }
 
+/** Implementation class for matching frames by timestamp. */
+class TimestampSyncFrameListenerImpl
+{
+public:
+  static const size_t MaxTypes = 4; ///< Color, Ir, Depth and PointCloud.
+  typedef std::vector<Frame *> Queue;
+
+  libfreenect2::mutex mutex_;
+  libfreenect2::condition_variable condition_;
+
+  const unsigned int subscribed_frame_types_;
+  const uint32_t tolerance_;
+  const size_t queue_size_;
+
+  Queue queues_[MaxTypes];    ///< Frames waiting for a match per type, oldest first.
+  bool seen_[MaxTypes];       ///< Whether a frame of the type was received.
+  uint32_t newest_[MaxTypes]; ///< Timestamp of the newest frame received per type.
+
+  FrameMap next_frame_;
+  uint32_t next_skew_;
+  uint32_t last_skew_;
+  size_t dropped_;
+
+  TimestampSyncFrameListenerImpl(unsigned int frame_types, uint32_t tolerance, size_t queue_size) :
+    subscribed_frame_types_(frame_types),
+    tolerance_(tolerance),
+    queue_size_(queue_size > 0 ? queue_size : 1),
+    next_skew_(0),
+    last_skew_(0),
+    dropped_(0)
+  {
+    for(size_t i = 0; i < MaxTypes; ++i)
+    {
+      queues_[i].reserve(queue_size_);
+      seen_[i] = false;
+      newest_[i] = 0;
+    }
+  }
+
+  ~TimestampSyncFrameListenerImpl()
+  {
+    for(size_t i = 0; i < MaxTypes; ++i)
+      for(size_t k = 0; k < queues_[i].size(); ++k)
+        delete queues_[i][k];
+    for(FrameMap::iterator it = next_frame_.begin(); it != next_frame_.end(); ++it)
+      delete it->second;
+  }
+
+  static Frame::Type typeOf(size_t index)
+  {
+    return static_cast<Frame::Type>(1u << index);
+  }
+
+  bool subscribed(size_t index) const
+  {
+    return (subscribed_frame_types_ & typeOf(index)) != 0;
+  }
+
+  /** Distance of two timestamps, which can wrap around. */
+  static uint32_t distance(uint32_t a, uint32_t b)
+  {
+    return a - b < b - a ? a - b : b - a;
+  }
+
+  /** Whether timestamp a is later than b. */
+  static bool after(uint32_t a, uint32_t b)
+  {
+    return static_cast<int32_t>(a - b) > 0;
+  }
+
+  /** Index of the frame in the queue closest to the timestamp, or the queue size if none is within the tolerance. */
+  size_t closest(const Queue &queue, uint32_t timestamp) const
+  {
+    size_t best = queue.size();
+    for(size_t k = 0; k < queue.size(); ++k)
+    {
+      const uint32_t d = distance(queue[k]->timestamp, timestamp);
+      if(d <= tolerance_ && (best == queue.size() || d < distance(queue[best]->timestamp, timestamp)))
+        best = k;
+    }
+    return best;
+  }
+
+  /** Queue a frame and form a set with it if possible.
+   * @param[out] dropped Frames to delete once the lock is released.
+   * @return Whether a new set is ready.
+   */
+  bool add(size_t index, Frame *frame, std::vector<Frame *> &dropped)
+  {
+    Queue &queue = queues_[index];
+    if(queue.size() == queue_size_)
+    {
+      dropped.push_back(queue.front());
+      queue.erase(queue.begin());
+    }
+    queue.push_back(frame);
+
+    if(!seen_[index] || after(frame->timestamp, newest_[index]))
+      newest_[index] = frame->timestamp;
+    seen_[index] = true;
+
+    // a set that can be formed now contains the new frame, or it would have been formed before
+    bool formed = match(index, dropped);
+    expire(dropped);
+    return formed;
+  }
+
+  bool match(size_t index, std::vector<Frame *> &dropped)
+  {
+    const uint32_t timestamp = queues_[index].back()->timestamp;
+    size_t chosen[MaxTypes];
+    uint32_t first = timestamp, last = timestamp;
+
+    for(size_t i = 0; i < MaxTypes; ++i)
+    {
+      if(!subscribed(i))
+        continue;
+      chosen[i] = i == index ? queues_[i].size() - 1 : closest(queues_[i], timestamp);
+      if(chosen[i] == queues_[i].size())
+        return false;
+
+      const uint32_t t = queues_[i][chosen[i]]->timestamp;
+      if(after(first, t))
+        first = t;
+      if(after(t, last))
+        last = t;
+    }
+
+    if(last - first > tolerance_)
+      return false;
+
+    // an untaken set is replaced
+    for(FrameMap::iterator it = next_frame_.begin(); it != next_frame_.end(); ++it)
+      dropped.push_back(it->second);
+    next_frame_.clear();
+
+    // older frames would only form older sets
+    for(size_t i = 0; i < MaxTypes; ++i)
+    {
+      if(!subscribed(i))
+        continue;
+      Queue &queue = queues_[i];
+      dropped.insert(dropped.end(), queue.begin(), queue.begin() + chosen[i]);
+      next_frame_[typeOf(i)] = queue[chosen[i]];
+      queue.erase(queue.begin(), queue.begin() + chosen[i] + 1);
+    }
+    next_skew_ = last - first;
+    return true;
+  }
+
+  /** Drop the frames another type has moved past without a match. Streams arrive in timestamp order. */
+  void expire(std::vector<Frame *> &dropped)
+  {
+    for(size_t i = 0; i < MaxTypes; ++i)
+    {
+      Queue &queue = queues_[i];
+      for(size_t k = 0; k < queue.size();)
+      {
+        bool expired = false;
+        for(size_t j = 0; j < MaxTypes && !expired; ++j)
+        {
+          if(j == i || !subscribed(j) || !seen_[j])
+            continue;
+          const uint32_t timestamp = queue[k]->timestamp;
+          expired = after(newest_[j], timestamp + tolerance_) && closest(queues_[j], timestamp) == queues_[j].size();
+        }
+
+        if(expired)
+        {
+          dropped.push_back(queue[k]);
+          queue.erase(queue.begin() + k);
+        }
+        else
+        {
+          ++k;
+        }
+      }
+    }
+  }
+
+  void take(FrameMap &frame)
+  {
+    frame = next_frame_;
+    next_frame_.clear();
+    last_skew_ = next_skew_;
+  }
+};
+
+TimestampSyncFrameListener::TimestampSyncFrameListener(unsigned int frame_types, uint32_t tolerance, size_t queue_size) :
+    impl_(new TimestampSyncFrameListenerImpl(frame_types, tolerance, queue_size))
+{
+}
+
+TimestampSyncFrameListener::~TimestampSyncFrameListener()
+{
+  delete impl_;
+}
+
+bool TimestampSyncFrameListener::hasNewFrame() const
+{
+  libfreenect2::lock_guard l(impl_->mutex_);
+
+  return !impl_->next_frame_.empty();
+}
+
+bool TimestampSyncFrameListener::waitForNewFrame(FrameMap &frame, int milliseconds)
+{
+#ifdef LIBFREENECT2_THREADING_STDLIB
+  libfreenect2::unique_lock l(impl_->mutex_);
+
+  auto predicate = [this]{ return !impl_->next_frame_.empty(); };
+
+  if(impl_->condition_.wait_for(l, std::chrono::milliseconds(milliseconds), predicate))
+  {
+    impl_->take(frame);
+    return true;
+  }
+  else
+  {
+    return false;
+  }
+#else
+  waitForNewFrame(frame);
+  return true;
+#endif // LIBFREENECT2_THREADING_STDLIB
+}
+
+void TimestampSyncFrameListener::waitForNewFrame(FrameMap &frame)
+{
+  libfreenect2::unique_lock l(impl_->mutex_);
+
+  while(impl_->next_frame_.empty())
+  {
+    WAIT_CONDITION(impl_->condition_, impl_->mutex_, l)
+  }
+
+  impl_->take(frame);
+}
+
+void TimestampSyncFrameListener::release(FrameMap &frame)
+{
+  for(FrameMap::iterator it = frame.begin(); it != frame.end(); ++it)
+  {
+    delete it->second;
+    it->second = 0;
+  }
+
+  frame.clear();
+}
+
+uint32_t TimestampSyncFrameListener::getLastSkew() const
+{
+  libfreenect2::lock_guard l(impl_->mutex_);
+  return impl_->last_skew_;
+}
+
+size_t TimestampSyncFrameListener::getDroppedFrames() const
+{
+  libfreenect2::lock_guard l(impl_->mutex_);
+  return impl_->dropped_;
+}
+
+bool TimestampSyncFrameListener::onNewFrame(Frame::Type type, Frame *frame)
+{
+  if((impl_->subscribed_frame_types_ & type) == 0) return false;
+
+  size_t index = 0;
+  while((1u << index) != (unsigned int)type && index < TimestampSyncFrameListenerImpl::MaxTypes)
+    ++index;
+  if(index == TimestampSyncFrameListenerImpl::MaxTypes) return false;
+
+  // deleting frames can take a while, it is done after the lock is released
+  std::vector<Frame *> dropped;
+  bool formed;
+  {
+    libfreenect2::lock_guard l(impl_->mutex_);
+    formed = impl_->add(index, frame, dropped);
+    impl_->dropped_ += dropped.size();
+  }
+
+  if(formed)
+    impl_->condition_.notify_one();
+
+  for(size_t i = 0; i < dropped.size(); ++i)
+    delete dropped[i];
+
+  return true;
+}
+
+/** Implementation class for sharing frames between subscribers. */
+class FanOutFrameListenerImpl
+{
+public:
+  struct Subscriber
+  {
+    unsigned int frame_types;
+    size_t queue_depth;
+    FanOutFrameListener::DropPolicy policy;
+    std::deque<std::pair<Frame::Type, Frame *> > queue;
+    libfreenect2::condition_variable condition;
+    size_t dropped;
+    bool removed;
+    size_t waiting; ///< Threads waiting in waitForNewFrame(), the subscriber is deleted when the last leaves.
+  };
+
+  libfreenect2::mutex mutex_;
+  std::vector<Subscriber *> subscribers_;
+  std::map<const Frame *, size_t> references_; ///< Subscribers holding or queueing each frame.
+
+  ~FanOutFrameListenerImpl()
+  {
+    for(std::map<const Frame *, size_t>::iterator it = references_.begin(); it != references_.end(); ++it)
+      delete it->first;
+    for(size_t i = 0; i < subscribers_.size(); ++i)
+      delete subscribers_[i];
+  }
+
+  Subscriber *get(size_t subscriber) const
+  {
+    if(subscriber >= subscribers_.size() || subscribers_[subscriber] == 0 || subscribers_[subscriber]->removed)
+      return 0;
+    return subscribers_[subscriber];
+  }
+
+  /** Drop a reference. @param[out] unused Frames to delete once the lock is released. */
+  void unreference(const Frame *frame, std::vector<const Frame *> &unused)
+  {
+    std::map<const Frame *, size_t>::iterator it = references_.find(frame);
+    if(it == references_.end())
+      return;
+    if(--it->second == 0)
+    {
+      unused.push_back(frame);
+      references_.erase(it);
+    }
+  }
+
+  static void deleteFrames(const std::vector<const Frame *> &frames)
+  {
+    for(size_t i = 0; i < frames.size(); ++i)
+      delete frames[i];
+  }
+};
+
+FanOutFrameListener::FanOutFrameListener() :
+    impl_(new FanOutFrameListenerImpl())
+{
+}
+
+FanOutFrameListener::~FanOutFrameListener()
+{
+  delete impl_;
+}
+
+size_t FanOutFrameListener::subscribe(unsigned int frame_types, size_t queue_depth, DropPolicy policy)
+{
+  FanOutFrameListenerImpl::Subscriber *s = new FanOutFrameListenerImpl::Subscriber();
+  s->frame_types = frame_types;
+  s->queue_depth = queue_depth > 0 ? queue_depth : 1;
+  s->policy = policy;
+  s->dropped = 0;
+  s->removed = false;
+  s->waiting = 0;
+
+  libfreenect2::lock_guard l(impl_->mutex_);
+  impl_->subscribers_.push_back(s);
+  return impl_->subscribers_.size() - 1;
+}
+
+void FanOutFrameListener::unsubscribe(size_t subscriber)
+{
+  std::vector<const Frame *> unused;
+  {
+    libfreenect2::lock_guard l(impl_->mutex_);
+    FanOutFrameListenerImpl::Subscriber *s = impl_->get(subscriber);
+    if(s == 0)
+      return;
+
+    for(size_t i = 0; i < s->queue.size(); ++i)
+      impl_->unreference(s->queue[i].second, unused);
+    s->queue.clear();
+    s->removed = true;
+    s->condition.notify_all();
+
+    if(s->waiting == 0)
+    {
+      delete s;
+      impl_->subscribers_[subscriber] = 0;
+    }
+  }
+  FanOutFrameListenerImpl::deleteFrames(unused);
+}
+
+bool FanOutFrameListener::waitForNewFrame(size_t subscriber, Frame::Type &type, const Frame *&frame, int milliseconds)
+{
+  libfreenect2::unique_lock l(impl_->mutex_);
+  FanOutFrameListenerImpl::Subscriber *s = impl_->get(subscriber);
+  if(s == 0)
+    return false;
+
+  if(s->queue.empty() && milliseconds != 0)
+  {
+    s->waiting++;
+#ifdef LIBFREENECT2_THREADING_STDLIB
+    if(milliseconds > 0)
+      s->condition.wait_for(l, std::chrono::milliseconds(milliseconds), [s]{ return !s->queue.empty() || s->removed; });
+    else
+#endif // LIBFREENECT2_THREADING_STDLIB
+    while(s->queue.empty() && !s->removed)
+    {
+      WAIT_CONDITION(s->condition, impl_->mutex_, l)
+    }
+    s->waiting--;
+
+    if(s->removed)
+    {
+      if(s->waiting == 0)
+      {
+        delete s;
+        impl_->subscribers_[subscriber] = 0;
+      }
+      return false;
+    }
+  }
+
+  if(s->queue.empty())
+    return false;
+
+  type = s->queue.front().first;
+  frame = s->queue.front().second;
+  s->queue.pop_front();
+  return true;
+}
+
+void FanOutFrameListener::release(const Frame *frame)
+{
+  std::vector<const Frame *> unused;
+  {
+    libfreenect2::lock_guard l(impl_->mutex_);
+    impl_->unreference(frame, unused);
+  }
+  FanOutFrameListenerImpl::deleteFrames(unused);
+}
+
+size_t FanOutFrameListener::getDroppedFrames(size_t subscriber) const
+{
+  libfreenect2::lock_guard l(impl_->mutex_);
+  FanOutFrameListenerImpl::Subscriber *s = impl_->get(subscriber);
+  return s != 0 ? s->dropped : 0;
+}
+
+bool FanOutFrameListener::onNewFrame(Frame::Type type, Frame *frame)
+{
+  std::vector<const Frame *> unused;
+  size_t references = 0;
+  {
+    libfreenect2::lock_guard l(impl_->mutex_);
+
+    for(size_t i = 0; i < impl_->subscribers_.size(); ++i)
+    {
+      FanOutFrameListenerImpl::Subscriber *s = impl_->get(i);
+      if(s == 0 || (s->frame_types & type) == 0)
+        continue;
+
+      if(s->queue.size() >= s->queue_depth)
+      {
+        s->dropped++;
+        if(s->policy == DropNewest)
+          continue;
+        impl_->unreference(s->queue.front().second, unused);
+        s->queue.pop_front();
+      }
+
+      s->queue.push_back(std::make_pair(type, frame));
+      s->condition.notify_one();
+      references++;
+    }
+
+    if(references > 0)
+      impl_->references_[frame] = references;
+  }
+
+  FanOutFrameListenerImpl::deleteFrames(unused);
+
+  // not wanted by anyone, the caller reuses it
+  return references > 0;
+}
+
+/** Implementation class for queueing frames behind a file descriptor. */
+class PollableFrameListenerImpl
+{
+public:
+  libfreenect2::mutex mutex_;
+
+  const unsigned int subscribed_frame_types_;
+  const size_t queue_depth_;
+  std::deque<std::pair<Frame::Type, Frame *> > queue_;
+  size_t dropped_;
+
+  int fd_;       ///< Readable while the queue is not empty.
+  int write_fd_; ///< Where fd_ is the read end of a pipe, its write end.
+
+  PollableFrameListenerImpl(unsigned int frame_types, size_t queue_depth) :
+    subscribed_frame_types_(frame_types),
+    queue_depth_(queue_depth > 0 ? queue_depth : 1),
+    dropped_(0),
+    fd_(-1),
+    write_fd_(-1)
+  {
+#if defined(__linux__)
+    fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    write_fd_ = fd_;
+    if(fd_ == -1)
+      LOG_ERROR << "eventfd failed: " << strerror(errno);
+#elif !defined(_WIN32)
+    int fds[2];
+    if(pipe(fds) == 0)
+    {
+      for(int i = 0; i < 2; ++i)
+      {
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+      }
+      fd_ = fds[0];
+      write_fd_ = fds[1];
+    }
+    else
+    {
+      LOG_ERROR << "pipe failed: " << strerror(errno);
+    }
+#endif
+  }
+
+  ~PollableFrameListenerImpl()
+  {
+    for(size_t i = 0; i < queue_.size(); ++i)
+      delete queue_[i].second;
+#ifndef _WIN32
+    if(write_fd_ != fd_ && write_fd_ != -1)
+      close(write_fd_);
+    if(fd_ != -1)
+      close(fd_);
+#endif
+  }
+
+  /** Make the descriptor readable, when the queue becomes non-empty. */
+  void signal()
+  {
+#if defined(__linux__)
+    uint64_t one = 1;
+    if(write_fd_ != -1 && write(write_fd_, &one, sizeof(one)) != sizeof(one))
+      LOG_ERROR << "eventfd write failed: " << strerror(errno);
+#elif !defined(_WIN32)
+    char one = 1;
+    if(write_fd_ != -1 && write(write_fd_, &one, sizeof(one)) != sizeof(one))
+      LOG_ERROR << "pipe write failed: " << strerror(errno);
+#endif
+  }
+
+  /** Make the descriptor unreadable, when the queue becomes empty. */
+  void clear()
+  {
+#if defined(__linux__)
+    uint64_t count;
+    if(fd_ != -1 && read(fd_, &count, sizeof(count)) != sizeof(count))
+      LOG_ERROR << "eventfd read failed: " << strerror(errno);
+#elif !defined(_WIN32)
+    char byte;
+    if(fd_ != -1 && read(fd_, &byte, sizeof(byte)) != sizeof(byte))
+      LOG_ERROR << "pipe read failed: " << strerror(errno);
+#endif
+  }
+};
+
+PollableFrameListener::PollableFrameListener(unsigned int frame_types, size_t queue_depth) :
+    impl_(new PollableFrameListenerImpl(frame_types, queue_depth))
+{
+}
+
+PollableFrameListener::~PollableFrameListener()
+{
+  delete impl_;
+}
+
+int PollableFrameListener::getFd() const
+{
+  return impl_->fd_;
+}
+
+bool PollableFrameListener::tryPop(Frame::Type &type, Frame *&frame)
+{
+  libfreenect2::lock_guard l(impl_->mutex_);
+
+  if(impl_->queue_.empty())
+    return false;
+
+  type = impl_->queue_.front().first;
+  frame = impl_->queue_.front().second;
+  impl_->queue_.pop_front();
+
+  if(impl_->queue_.empty())
+    impl_->clear();
+
+  return true;
+}
+
+size_t PollableFrameListener::getDroppedFrames() const
+{
+  libfreenect2::lock_guard l(impl_->mutex_);
+  return impl_->dropped_;
+}
+
+bool PollableFrameListener::onNewFrame(Frame::Type type, Frame *frame)
+{
+  if((impl_->subscribed_frame_types_ & type) == 0) return false;
+
+  Frame *dropped = 0;
+  {
+    libfreenect2::lock_guard l(impl_->mutex_);
+
+    // the descriptor stays readable until the queue is emptied, as level-triggered polling expects
+    if(impl_->queue_.empty())
+      impl_->signal();
+
+    if(impl_->queue_.size() >= impl_->queue_depth_)
+    {
+      dropped = impl_->queue_.front().second;
+      impl_->queue_.pop_front();
+      impl_->dropped_++;
+    }
+    impl_->queue_.push_back(std::make_pair(type, frame));
+  }
+
+  delete dropped;
+
+  return true;
+}
+
 } /* namespace libfreenect2 */
@@ -0,0 +1,127 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+
+/** @file lazy_color_frame.cpp Decoding color frames on demand. */
+
+#include <libfreenect2/lazy_color_frame.h>
+#include <libfreenect2/libfreenect2.hpp>
+#include <libfreenect2/rgb_packet_processor.h>
+#include <libfreenect2/threading.h>
+#include <libfreenect2/logging.h>
+
+namespace libfreenect2
+{
+
+class LazyColorFrameImpl: public FrameListener
+{
+public:
+  Frame *jpeg;
+  Frame::Format format;
+  int downscale;
+
+  libfreenect2::mutex decode_mutex;
+  bool decoded; ///< Whether decoding was tried, successful or not.
+  Frame *image;
+
+  LazyColorFrameImpl(Frame *jpeg, Frame::Format format, int downscale) :
+    jpeg(jpeg), format(format), downscale(downscale), decoded(false), image(0)
+  {
+  }
+
+  virtual ~LazyColorFrameImpl()
+  {
+    delete image;
+    delete jpeg;
+  }
+
+  virtual bool onNewFrame(Frame::Type, Frame *frame)
+  {
+    image = frame;
+    return true;
+  }
+
+  void decode()
+  {
+    if (jpeg == 0 || jpeg->format != Frame::Raw)
+    {
+      LOG_ERROR << "lazy color frames need Frame::Raw frames";
+      return;
+    }
+    if (format == Frame::Raw)
+    {
+      LOG_ERROR << "lazy color frames can not decode to Frame::Raw";
+      return;
+    }
+
+    // a decoder of its own keeps frames decodable from any thread; a TurboJPEG handle is cheap next to decoding
+    TurboJpegRgbPacketProcessor decoder;
+    Freenect2Device::Config config;
+    config.ColorFormat = format;
+    config.ColorDownscale = downscale;
+    decoder.setConfiguration(config);
+    decoder.setFrameListener(this);
+
+    RgbPacket packet;
+    packet.sequence = jpeg->sequence;
+    packet.timestamp = jpeg->timestamp;
+    packet.jpeg_buffer = jpeg->data;
+    packet.jpeg_buffer_length = jpeg->bytes_per_pixel;
+    packet.exposure = jpeg->exposure;
+    packet.gain = jpeg->gain;
+    packet.gamma = jpeg->gamma;
+    packet.memory = 0;
+    decoder.process(packet);
+  }
+};
+
+LazyColorFrame::LazyColorFrame(Frame *jpeg, Frame::Format format, int downscale) :
+  impl_(new LazyColorFrameImpl(jpeg, format, downscale))
+{
+}
+
+LazyColorFrame::~LazyColorFrame()
+{
+  delete impl_;
+}
+
+const Frame *LazyColorFrame::jpeg() const
+{
+  return impl_->jpeg;
+}
+
+Frame *LazyColorFrame::get()
+{
+  libfreenect2::lock_guard l(impl_->decode_mutex);
+  if (!impl_->decoded)
+  {
+    impl_->decoded = true;
+    impl_->decode();
+  }
+  return impl_->image;
+}
+
+} /* namespace libfreenect2 */
@@ -43,6 +43,7 @@
 #include <libfreenect2/usb/event_loop.h>
 #include <libfreenect2/usb/transfer_pool.h>
 #include <libfreenect2/depth_packet_processor.h>
+#include <libfreenect2/distortion.h>
 #include <libfreenect2/rgb_packet_processor.h>
 #include <libfreenect2/protocol/usb_control.h>
 #include <libfreenect2/protocol/command.h>
@@ -105,12 +106,16 @@ struct IrCameraTables: Freenect2Device::IrCameraParams
   std::vector<float> xtable;
   std::vector<float> ztable;
   std::vector<short> lut;
+  std::vector<int> distort_map;
+  std::vector<float> rays;
 
   IrCameraTables(const Freenect2Device::IrCameraParams &parent):
     Freenect2Device::IrCameraParams(parent),
     xtable(DepthPacketProcessor::TABLE_SIZE),
     ztable(DepthPacketProcessor::TABLE_SIZE),
-    lut(DepthPacketProcessor::LUT_SIZE)
+    lut(DepthPacketProcessor::LUT_SIZE),
+    distort_map(DepthPacketProcessor::TABLE_SIZE),
+    rays(DepthPacketProcessor::TABLE_SIZE * 2)
   {
     const double scaling_factor = 8192;
     const double unambigious_dist = 6250.0/3;
@@ -124,6 +129,8 @@ struct IrCameraTables: Freenect2Device::IrCameraParams
       double xu, yu;
       divergence += !undistort(xd, yd, xu, yu);
       xtable[i] = scaling_factor*xu;
+      rays[2*i] = xu;
+      rays[2*i + 1] = yu;
       ztable[i] = unambigious_dist/sqrt(xu*xu + yu*yu + 1);
     }
 
@@ -139,6 +146,8 @@ struct IrCameraTables: Freenect2Device::IrCameraParams
       y += inc;
     }
     lut[1024] = 32767;
+
+    computeDistortMap(parent, &distort_map[0]);
   }
 
   //x,y: undistorted, normalized coordinates
@@ -724,6 +733,8 @@ void Freenect2DeviceImpl::setIrCameraParams(const Freenect2Device::IrCameraParam
     IrCameraTables tables(params);
     proc->loadXZTables(&tables.xtable[0], &tables.ztable[0]);
     proc->loadLookupTable(&tables.lut[0]);
+    proc->loadDistortMap(&tables.distort_map[0]);
+    proc->loadRayTable(&tables.rays[0]);
   }
 }
 
@@ -731,13 +742,24 @@ Freenect2Device::Config::Config() :
   MinDepth(0.5f),
   MaxDepth(4.5f), //set to > 8000 for best performance when using the kde pipeline
   EnableBilateralFilter(true),
-  EnableEdgeAwareFilter(true) {}
+  EnableEdgeAwareFilter(true),
+  EnableUndistortion(false),
+  EnablePointCloud(false),
+  ColorDownscale(1),
+  ColorFormat(Frame::BGRX),
+  ColorRoiX(0),
+  ColorRoiY(0),
+  ColorRoiWidth(0),
+  ColorRoiHeight(0) {}
 
 void Freenect2DeviceImpl::setConfiguration(const Freenect2Device::Config &config)
 {
   DepthPacketProcessor *proc = pipeline_->getDepthPacketProcessor();
   if (proc != 0)
     proc->setConfiguration(config);
+  RgbPacketProcessor *rgb_proc = pipeline_->getRgbPacketProcessor();
+  if (rgb_proc != 0)
+    rgb_proc->setConfiguration(config);
 }
 
 void Freenect2DeviceImpl::setColorFrameListener(libfreenect2::FrameListener* rgb_frame_listener)
@@ -1353,6 +1375,8 @@ void Freenect2ReplayDevice::setIrCameraParams(const Freenect2Device::IrCameraPar
     IrCameraTables tables(params);
     proc->loadXZTables(&tables.xtable[0], &tables.ztable[0]);
     proc->loadLookupTable(&tables.lut[0]);
+    proc->loadDistortMap(&tables.distort_map[0]);
+    proc->loadRayTable(&tables.rays[0]);
   }
 }
 
@@ -1361,6 +1385,9 @@ void Freenect2ReplayDevice::setConfiguration(const Freenect2Device::Config &conf
   DepthPacketProcessor *proc = pipeline_->getDepthPacketProcessor();
   if (proc != 0)
     proc->setConfiguration(config);
+  RgbPacketProcessor *rgb_proc = pipeline_->getRgbPacketProcessor();
+  if (rgb_proc != 0)
+    rgb_proc->setConfiguration(config);
 }
 
 void Freenect2ReplayDevice::setColorFrameListener(FrameListener* listener)
@@ -1447,6 +1474,7 @@ void Freenect2ReplayDevice::processRgbFrame(Frame* frame)
   packet.exposure = frame->exposure;
   packet.gain = frame->gain;
   packet.gamma = frame->gamma;
+  packet.memory = NULL;
 
   pipeline_->getRgbPacketProcessor()->process(packet);
 }
@@ -1519,11 +1547,14 @@ bool parseFrameFilename(const std::string& frame_filename, size_t timestamp_sequ
     return false;
   }
   
-  size_t ix1 = frame_filename.find("_");
+  // Directories may contain '_' too; only parse the file name.
+  size_t ix0 = frame_filename.find_last_of("/\\");
+  ix0 = ix0 == std::string::npos ? 0 : ix0 + 1;
+  size_t ix1 = frame_filename.find("_", ix0);
   size_t ix2 = frame_filename.find("_", ix1 + 1);
   size_t ix3 = frame_filename.find(".", ix2 + 1);
 
-  std::string ts = frame_filename.substr(0, ix1);
+  std::string ts = frame_filename.substr(ix0, ix1 - ix0);
   std::string seq = frame_filename.substr(ix2 + 1, ix3);
 
   LOG_DEBUG << "ts: " << ts << ", seq: " << seq;
@@ -1548,6 +1579,38 @@ bool parseFrameFilename(const std::string& frame_filename, size_t timestamp_sequ
   return true;
 }
 
+static bool readDepthPacketFile(const std::string& frame, unsigned char* buffer, size_t buffer_size)
+{
+  std::ifstream fd(frame.c_str(), std::ios::binary);
+
+  if(!fd)
+  {
+    LOG_ERROR << "failed to open replay frame: " << frame << ", skipping...";
+    return false;
+  }
+
+  fd.seekg(0, fd.end);
+  size_t length = fd.tellg();
+  fd.seekg(0, fd.beg);
+
+  if(length != buffer_size)
+  {
+    LOG_ERROR << "file length: " << length
+              << "exceeds depth image buffer size: "
+              << buffer_size << "; skipping...";
+    return false;
+  }
+
+  fd.read(reinterpret_cast<char*>(buffer), length);
+  if(!fd || (size_t)fd.gcount() != length)
+  {
+    LOG_ERROR << "failed to read replay frame: " << frame << ": "
+              << fd.gcount() << " vs. " << length << " bytes";
+    return false;
+  }
+  return true;
+}
+
 void Freenect2ReplayDevice::run()
 {
   size_t timestamp_sequence[2] = {0};
@@ -1564,40 +1627,15 @@ void Freenect2ReplayDevice::run()
 
     if (hasSuffix(frame, ".depth"))
     {
-      std::ifstream fd(frame.c_str());
-      
-      if(!fd)
-      {
-        LOG_ERROR << "failed to open replay frame: " << frame << ", skipping...";
-        continue;
-      }
-
-      fd.seekg(0, fd.end);
-      size_t length = fd.tellg();
-      fd.seekg(0, fd.beg);
-
-      if(length != buffer_size_)
-      {
-        LOG_ERROR << "file length: " << length
-                  << "exceeds depth image buffer size: "
-                  << buffer_size_ << "; skipping...";
-        continue;
-      }
-
-      fd.read(reinterpret_cast<char*>(packet_.memory->data), length);
-      if(!fd || (size_t)fd.gcount() != length)
-      {
-        LOG_ERROR << "failed to read replay frame: " << frame << ": "
-                  << fd.gcount() << " vs. " << length << " bytes";
+      if(!readDepthPacketFile(frame, packet_.memory->data, buffer_size_))
         continue;
-      }
 
       if(pipeline_->getDepthPacketProcessor()->ready())
       {
         packet_.timestamp = timestamp_sequence[0];
         packet_.sequence = timestamp_sequence[1];
         packet_.buffer = packet_.memory->data;
-        packet_.buffer_length = length;
+        packet_.buffer_length = buffer_size_;
 
         pipeline_->getDepthPacketProcessor()->process(packet_);
         pipeline_->getDepthPacketProcessor()->allocateBuffer(packet_, buffer_size_);
@@ -1647,4 +1685,307 @@ Freenect2Device *Freenect2ReplayImpl::openDevice(const std::vector<std::string>&
   return device;
 }
 
+Freenect2BatchReplay::PipelineFactory::~PipelineFactory()
+{
+}
+
+/** Replays stored depth packets on a set of worker threads, each with its own pipeline. */
+class Freenect2BatchReplayImpl
+{
+public:
+  /** Output of one stored packet. */
+  struct Result
+  {
+    Frame *ir;
+    Frame *depth;
+    Frame *points;
+    bool done;
+  };
+
+  /** Collects the frames of the packet currently processed by a worker. */
+  class WorkerListener : public FrameListener
+  {
+  public:
+    Result result;
+
+    WorkerListener()
+    {
+      result.ir = 0;
+      result.depth = 0;
+      result.points = 0;
+      result.done = false;
+    }
+
+    virtual bool onNewFrame(Frame::Type type, Frame *frame)
+    {
+      Frame **slot = type == Frame::Ir ? &result.ir : type == Frame::Depth ? &result.depth :
+                     type == Frame::PointCloud ? &result.points : 0;
+      if (slot == 0)
+        return false;
+      delete *slot;
+      *slot = frame;
+      return true;
+    }
+  };
+
+  Freenect2BatchReplay::PipelineFactory *factory_;
+  size_t num_workers_;
+  size_t buffer_size_;
+
+  Freenect2Device::Config config_;
+  IrCameraTables *tables_;
+  std::vector<unsigned char> p0_tables_;
+  FrameListener *listener_;
+
+  // State of a run, protected by mutex_.
+  const std::vector<std::string> *frame_filenames_;
+  std::vector<Result> window_;
+  size_t next_index_;
+  size_t delivered_;
+  size_t processed_;
+  size_t active_workers_;
+  libfreenect2::mutex mutex_;
+  libfreenect2::condition_variable condition_;
+
+  Freenect2BatchReplayImpl(Freenect2BatchReplay::PipelineFactory *factory, size_t num_workers):
+    factory_(factory),
+    num_workers_(num_workers),
+    buffer_size_(10 * 512 * 424 * 11 / 8),
+    tables_(0),
+    listener_(0),
+    frame_filenames_(0),
+    next_index_(0),
+    delivered_(0),
+    processed_(0),
+    active_workers_(0)
+  {
+    if (num_workers_ == 0)
+      num_workers_ = libfreenect2::thread::hardware_concurrency();
+    if (num_workers_ == 0)
+      num_workers_ = 1;
+  }
+
+  ~Freenect2BatchReplayImpl()
+  {
+    delete tables_;
+  }
+
+  static void static_execute(void *arg)
+  {
+    static_cast<Freenect2BatchReplayImpl *>(arg)->runWorker();
+  }
+
+  void runWorker()
+  {
+    this_thread::set_name("BatchReplay");
+
+    PacketPipeline *pipeline = factory_ != 0 ? factory_->createPipeline() : new CpuPacketPipeline();
+    DepthPacketProcessor *proc = pipeline != 0 ? pipeline->getDepthPacketProcessor() : 0;
+
+    if (proc == 0 || !proc->good())
+    {
+      LOG_ERROR << "failed to create a depth packet processor for batch replay";
+      delete pipeline;
+      libfreenect2::lock_guard l(mutex_);
+      active_workers_--;
+      condition_.notify_all();
+      return;
+    }
+
+    WorkerListener listener;
+    proc->setFrameListener(&listener);
+    proc->setConfiguration(config_);
+    if (tables_ != 0)
+    {
+      proc->loadXZTables(&tables_->xtable[0], &tables_->ztable[0]);
+      proc->loadLookupTable(&tables_->lut[0]);
+      proc->loadDistortMap(&tables_->distort_map[0]);
+      proc->loadRayTable(&tables_->rays[0]);
+    }
+    if (!p0_tables_.empty())
+    {
+      // The processor only reads the buffer; copy to keep it unique per worker anyway.
+      std::vector<unsigned char> p0_tables(p0_tables_);
+      proc->loadP0TablesFromCommandResponse(&p0_tables[0], p0_tables.size());
+    }
+
+    DepthPacket packet;
+    proc->allocateBuffer(packet, buffer_size_);
+
+    size_t timestamp_sequence[2] = {0};
+    const size_t window_size = window_.size();
+
+    for (;;)
+    {
+      size_t index;
+      {
+        libfreenect2::unique_lock l(mutex_);
+        while (next_index_ < frame_filenames_->size() && next_index_ >= delivered_ + window_size)
+          WAIT_CONDITION(condition_, mutex_, l)
+        if (next_index_ >= frame_filenames_->size())
+          break;
+        index = next_index_++;
+      }
+
+      const std::string &frame = (*frame_filenames_)[index];
+      bool ok = hasSuffix(frame, ".depth") &&
+        parseFrameFilename(frame, timestamp_sequence) &&
+        readDepthPacketFile(frame, packet.memory->data, buffer_size_);
+
+      if (ok)
+      {
+        packet.timestamp = timestamp_sequence[0];
+        packet.sequence = timestamp_sequence[1];
+        packet.buffer = packet.memory->data;
+        packet.buffer_length = buffer_size_;
+        proc->process(packet);
+      }
+
+      {
+        libfreenect2::lock_guard l(mutex_);
+        Result &result = window_[index % window_size];
+        result = listener.result;
+        result.done = true;
+        if (ok)
+          processed_++;
+      }
+      condition_.notify_all();
+
+      listener.result.ir = 0;
+      listener.result.depth = 0;
+      listener.result.points = 0;
+    }
+
+    proc->releaseBuffer(packet);
+    proc->setFrameListener(0);
+    delete pipeline;
+
+    libfreenect2::lock_guard l(mutex_);
+    active_workers_--;
+    condition_.notify_all();
+  }
+
+  size_t run(const std::vector<std::string> &frame_filenames)
+  {
+    if (tables_ == 0)
+      LOG_WARNING << "batch replay without IR camera parameters";
+    if (p0_tables_.empty())
+      LOG_WARNING << "batch replay without P0 tables";
+
+    frame_filenames_ = &frame_filenames;
+    next_index_ = 0;
+    delivered_ = 0;
+    processed_ = 0;
+    active_workers_ = num_workers_;
+
+    // Each worker can run ahead by one window slot while waiting for delivery.
+    Result empty = {0, 0, 0, false};
+    window_.assign(2 * num_workers_, empty);
+
+    std::vector<libfreenect2::thread *> threads;
+    for (size_t i = 0; i < num_workers_; i++)
+      threads.push_back(new libfreenect2::thread(static_execute, this));
+
+    LOG_INFO << "batch replay of " << frame_filenames.size() << " files with " << num_workers_ << " workers";
+
+    while (delivered_ < frame_filenames.size())
+    {
+      Result result;
+      {
+        libfreenect2::unique_lock l(mutex_);
+        Result &slot = window_[delivered_ % window_.size()];
+        while (!slot.done && active_workers_ > 0)
+          WAIT_CONDITION(condition_, mutex_, l)
+        if (!slot.done)
+        {
+          LOG_ERROR << "no batch replay worker left; stopping at " << frame_filenames[delivered_];
+          break;
+        }
+        result = slot;
+        slot = empty;
+      }
+
+      if (result.ir != 0 && (listener_ == 0 || !listener_->onNewFrame(Frame::Ir, result.ir)))
+        delete result.ir;
+      if (result.depth != 0 && (listener_ == 0 || !listener_->onNewFrame(Frame::Depth, result.depth)))
+        delete result.depth;
+      if (result.points != 0 && (listener_ == 0 || !listener_->onNewFrame(Frame::PointCloud, result.points)))
+        delete result.points;
+
+      {
+        libfreenect2::lock_guard l(mutex_);
+        delivered_++;
+      }
+      condition_.notify_all();
+    }
+
+    if (delivered_ < frame_filenames.size())
+    {
+      // Let the remaining workers finish without waiting for delivery.
+      libfreenect2::lock_guard l(mutex_);
+      next_index_ = frame_filenames.size();
+      condition_.notify_all();
+    }
+
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+      threads[i]->join();
+      delete threads[i];
+    }
+
+    for (size_t i = 0; i < window_.size(); i++)
+    {
+      delete window_[i].ir;
+      delete window_[i].depth;
+      delete window_[i].points;
+    }
+    window_.clear();
+    frame_filenames_ = 0;
+
+    LOG_INFO << "batch replay processed " << processed_ << " packets";
+    return processed_;
+  }
+};
+
+Freenect2BatchReplay::Freenect2BatchReplay(PipelineFactory *factory, size_t num_workers) :
+    impl_(new Freenect2BatchReplayImpl(factory, num_workers))
+{
+}
+
+Freenect2BatchReplay::~Freenect2BatchReplay()
+{
+  delete impl_;
+}
+
+size_t Freenect2BatchReplay::getNumWorkers() const
+{
+  return impl_->num_workers_;
+}
+
+void Freenect2BatchReplay::setIrCameraParams(const Freenect2Device::IrCameraParams &params)
+{
+  delete impl_->tables_;
+  impl_->tables_ = new IrCameraTables(params);
+}
+
+void Freenect2BatchReplay::setConfiguration(const Freenect2Device::Config &config)
+{
+  impl_->config_ = config;
+}
+
+void Freenect2BatchReplay::loadP0Tables(const unsigned char *buffer, size_t buffer_length)
+{
+  impl_->p0_tables_.assign(buffer, buffer + buffer_length);
+}
+
+void Freenect2BatchReplay::setIrAndDepthFrameListener(FrameListener *listener)
+{
+  impl_->listener_ = listener;
+}
+
+size_t Freenect2BatchReplay::run(const std::vector<std::string> &frame_filenames)
+{
+  return impl_->run(frame_filenames);
+}
+
 } /* namespace libfreenect2 */
@@ -172,15 +172,41 @@ void kernel filterPixelStage1(global const float3 *a, global const float3 *b, gl
   }
 }
 
+/*******************************************************************************
+ * Point of a final depth value, with the scaling and validity check of Registration::getPointXYZ()
+ ******************************************************************************/
+float4 depthToPoint(const float depth, const float2 ray)
+{
+  const float z = depth / 1000.0f;
+  return z > 0.001f ? (float4)(ray * z, z, 1.0f) : (float4)(NAN);
+}
+
 /*******************************************************************************
  * Process pixel stage 2
  ******************************************************************************/
 void kernel processPixelStage2(global const float3 *a_in, global const float3 *b_in, global const float *x_table, global const float *z_table,
-                               global float *depth, global float *ir_sums)
+                               global float *depth, global float *ir_sums, global const int *distort_map,
+                               global const float2 *rays, global float4 *points)
 {
   const uint i = get_global_id(0);
-  float3 a = a_in[i];
-  float3 b = b_in[i];
+#ifdef UNDISTORT_PROCESS_STAGE2
+  // without the edge filter this is the last stage, so it samples the undistorted image directly
+  const int index = distort_map[i];
+  if(index < 0)
+  {
+    depth[i] = 0.0f;
+    ir_sums[i] = 0.0f;
+#ifdef POINT_CLOUD_PROCESS_STAGE2
+    points[i] = (float4)(NAN);
+#endif
+    return;
+  }
+  const uint j = index;
+#else
+  const uint j = i;
+#endif
+  float3 a = a_in[j];
+  float3 b = b_in[j];
 
   float3 phase = atan2(b, a);
   phase = select(phase, phase + 2.0f * M_PI_F, isless(phase, (float3)(0.0f)));
@@ -261,8 +287,8 @@ void kernel processPixelStage2(global const float3 *a_in, global const float3 *b
     phase_final = true/*(modeMask & 2) != 0*/ ? t11 : t10;
   }
 
-  float zmultiplier = z_table[i];
-  float xmultiplier = x_table[i];
+  float zmultiplier = z_table[j];
+  float xmultiplier = x_table[j];
 
   phase_final = 0.0f < phase_final ? phase_final + PHASE_OFFSET : phase_final;
 
@@ -279,21 +305,40 @@ void kernel processPixelStage2(global const float3 *a_in, global const float3 *b
   float d = cond1 ? depth_fit : depth_linear; // r1.y -> later r2.z
   depth[i] = d;
   ir_sums[i] = ir_sum;
+#ifdef POINT_CLOUD_PROCESS_STAGE2
+  points[i] = depthToPoint(d, rays[j]);
+#endif
 }
 
 /*******************************************************************************
  * Filter pixel stage 2
  ******************************************************************************/
-void kernel filterPixelStage2(global const float *depth, global const float *ir_sums, global const uchar *max_edge_test, global float *filtered)
+void kernel filterPixelStage2(global const float *depth, global const float *ir_sums, global const uchar *max_edge_test, global float *filtered,
+                              global const int *distort_map, global const float2 *rays, global float4 *points)
 {
   const uint i = get_global_id(0);
+#ifdef UNDISTORT_FILTER_STAGE2
+  // filter the pixel sampled by the undistorted image, straight into it
+  const int index = distort_map[i];
+  if(index < 0)
+  {
+    filtered[i] = 0.0f;
+#ifdef POINT_CLOUD_FILTER_STAGE2
+    points[i] = (float4)(NAN);
+#endif
+    return;
+  }
+  const uint j = index;
+#else
+  const uint j = i;
+#endif
 
-  const uint x = i % 512;
-  const uint y = i / 512;
+  const uint x = j % 512;
+  const uint y = j / 512;
 
-  const float raw_depth = depth[i];
-  const float ir_sum = ir_sums[i];
-  const uchar edge_test = max_edge_test[i];
+  const float raw_depth = depth[j];
+  const float ir_sum = ir_sums[j];
+  const uchar edge_test = max_edge_test[j];
 
   if(raw_depth >= MIN_DEPTH && raw_depth <= MAX_DEPTH)
   {
@@ -314,7 +359,7 @@ void kernel filterPixelStage2(global const float *depth, global const float *ir_
 
         for(int xi = -1; xi < 2; ++xi, ++i_other)
         {
-          if(i_other == i)
+          if(i_other == j)
           {
             continue;
           }
@@ -375,4 +420,8 @@ void kernel filterPixelStage2(global const float *depth, global const float *ir_
   {
     filtered[i] = 0.0f;
   }
+
+#ifdef POINT_CLOUD_FILTER_STAGE2
+  points[i] = depthToPoint(filtered[i], rays[j]);
+#endif
 }
@@ -30,8 +30,10 @@
 #include <libfreenect2/resource.h>
 #include <libfreenect2/protocol/response.h>
 #include <libfreenect2/logging.h>
+#include <libfreenect2/threading.h>
 
 #include <sstream>
+#include <vector>
 
 #define _USE_MATH_DEFINES
 #include <math.h>
@@ -82,6 +84,8 @@ class OpenCLBuffer: public Buffer
 {
 public:
   cl::Buffer buffer;
+  /** Device copy of the data, only created for depth frames. */
+  cl::Buffer device_buffer;
 };
 
 class OpenCLAllocator: public Allocator
@@ -145,8 +149,10 @@ private:
   OpenCLBuffer *buffer;
 
 public:
-  OpenCLFrame(OpenCLBuffer *buffer)
-    : Frame(512, 424, 4, (unsigned char*)-1)
+  OpenCLBuffer *getBuffer() const { return buffer; }
+
+  OpenCLFrame(OpenCLBuffer *buffer, size_t bytes_per_pixel = 4)
+    : Frame(512, 424, bytes_per_pixel, (unsigned char*)-1)
     , buffer(buffer)
   {
     data = buffer->data;
@@ -168,10 +174,12 @@ public:
   libfreenect2::DepthPacketProcessor::Config config;
   DepthPacketProcessor::Parameters params;
 
-  Frame *ir_frame, *depth_frame;
+  Frame *ir_frame, *depth_frame, *point_cloud_frame;
+  cl::Buffer depth_frame_buffer;
   Allocator *input_buffer_allocator;
   Allocator *ir_buffer_allocator;
   Allocator *depth_buffer_allocator;
+  Allocator *point_cloud_buffer_allocator;
 
   cl::Context context;
   cl::Device device;
@@ -189,12 +197,16 @@ public:
   size_t buf_p0_table_size;
   size_t buf_x_table_size;
   size_t buf_z_table_size;
+  size_t buf_distort_map_size;
+  size_t buf_rays_size;
   size_t buf_packet_size;
 
   cl::Buffer buf_lut11to16;
   cl::Buffer buf_p0_table;
   cl::Buffer buf_x_table;
   cl::Buffer buf_z_table;
+  cl::Buffer buf_distort_map;
+  cl::Buffer buf_rays;
   cl::Buffer buf_packet;
 
   // Read-Write buffers
@@ -207,7 +219,7 @@ public:
   size_t buf_edge_test_size;
   size_t buf_depth_size;
   size_t buf_ir_sum_size;
-  size_t buf_filtered_size;
+  size_t buf_points_size;
 
   cl::Buffer buf_a;
   cl::Buffer buf_b;
@@ -218,14 +230,29 @@ public:
   cl::Buffer buf_edge_test;
   cl::Buffer buf_depth;
   cl::Buffer buf_ir_sum;
-  cl::Buffer buf_filtered;
+  cl::Buffer buf_points;
 
   bool deviceInitialized;
+  bool distortMapLoaded;
+  bool raysLoaded;
   bool programBuilt;
   bool programInitialized;
   bool runtimeOk;
   std::string sourceCode;
 
+  /** Device copy of a pooled depth buffer and the sequence of the frame last computed into it. */
+  struct DepthDeviceBuffer
+  {
+    const unsigned char *data;
+    cl::Buffer buffer;
+    uint32_t sequence;
+    bool filled;
+  };
+
+  /** Device buffers behind the depth frames, for sharing with OpenCLRegistration. */
+  std::vector<DepthDeviceBuffer> depth_device_buffers;
+  libfreenect2::mutex depth_device_buffers_mutex;
+
 #ifdef LIBFREENECT2_WITH_PROFILING_CL
   std::vector<double> timings;
   int count;
@@ -233,6 +260,8 @@ public:
 
   OpenCLDepthPacketProcessorImpl(const int deviceId = -1)
     : deviceInitialized(false)
+    , distortMapLoaded(false)
+    , raysLoaded(false)
     , programBuilt(false)
     , programInitialized(false)
     , runtimeOk(true)
@@ -247,9 +276,11 @@ public:
     input_buffer_allocator = new PoolAllocator(new OpenCLAllocator(context, queue, true));
     ir_buffer_allocator = new PoolAllocator(new OpenCLAllocator(context, queue, false));
     depth_buffer_allocator = new PoolAllocator(new OpenCLAllocator(context, queue, false));
+    point_cloud_buffer_allocator = new PoolAllocator(new OpenCLAllocator(context, queue, false));
 
     newIrFrame();
     newDepthFrame();
+    point_cloud_frame = NULL;
 
     const int CL_ICDL_VERSION = 2;
     typedef cl_int (*icdloader_func)(int, size_t, void*, size_t*);
@@ -281,9 +312,23 @@ public:
   {
     delete ir_frame;
     delete depth_frame;
+    delete point_cloud_frame;
     delete input_buffer_allocator;
     delete ir_buffer_allocator;
     delete depth_buffer_allocator;
+    delete point_cloud_buffer_allocator;
+  }
+
+  /** Whether the last stage samples the undistorted image. */
+  bool undistort() const
+  {
+    return config.EnableUndistortion && distortMapLoaded;
+  }
+
+  /** Whether the last stage also writes the point cloud. */
+  bool points() const
+  {
+    return config.EnablePointCloud && raysLoaded;
   }
 
   void generateOptions(std::string &options) const
@@ -337,6 +382,11 @@ public:
     oss << " -D MIN_DEPTH=" << config.MinDepth * 1000.0f << "f";
     oss << " -D MAX_DEPTH=" << config.MaxDepth * 1000.0f << "f";
 
+    if(undistort())
+      oss << (config.EnableEdgeAwareFilter ? " -D UNDISTORT_FILTER_STAGE2" : " -D UNDISTORT_PROCESS_STAGE2");
+    if(points())
+      oss << (config.EnableEdgeAwareFilter ? " -D POINT_CLOUD_FILTER_STAGE2" : " -D POINT_CLOUD_PROCESS_STAGE2");
+
     oss << " -cl-mad-enable -cl-no-signed-zeros -cl-fast-relaxed-math";
     options = oss.str();
   }
@@ -468,12 +518,16 @@ public:
     buf_p0_table_size = IMAGE_SIZE * sizeof(cl_float3);
     buf_x_table_size = IMAGE_SIZE * sizeof(cl_float);
     buf_z_table_size = IMAGE_SIZE * sizeof(cl_float);
+    buf_distort_map_size = IMAGE_SIZE * sizeof(cl_int);
+    buf_rays_size = IMAGE_SIZE * sizeof(cl_float2);
     buf_packet_size = ((IMAGE_SIZE * 11) / 16) * 10 * sizeof(cl_ushort);
 
     CHECK_CL_PARAM(buf_lut11to16 = cl::Buffer(context, CL_MEM_READ_ONLY, buf_lut11to16_size, NULL, &err));
     CHECK_CL_PARAM(buf_p0_table = cl::Buffer(context, CL_MEM_READ_ONLY, buf_p0_table_size, NULL, &err));
     CHECK_CL_PARAM(buf_x_table = cl::Buffer(context, CL_MEM_READ_ONLY, buf_x_table_size, NULL, &err));
     CHECK_CL_PARAM(buf_z_table = cl::Buffer(context, CL_MEM_READ_ONLY, buf_z_table_size, NULL, &err));
+    CHECK_CL_PARAM(buf_distort_map = cl::Buffer(context, CL_MEM_READ_ONLY, buf_distort_map_size, NULL, &err));
+    CHECK_CL_PARAM(buf_rays = cl::Buffer(context, CL_MEM_READ_ONLY, buf_rays_size, NULL, &err));
     CHECK_CL_PARAM(buf_packet = cl::Buffer(context, CL_MEM_READ_ONLY, buf_packet_size, NULL, &err));
 
     //Read-Write
@@ -486,7 +540,7 @@ public:
     buf_edge_test_size = IMAGE_SIZE * sizeof(cl_uchar);
     buf_depth_size = IMAGE_SIZE * sizeof(cl_float);
     buf_ir_sum_size = IMAGE_SIZE * sizeof(cl_float);
-    buf_filtered_size = IMAGE_SIZE * sizeof(cl_float);
+    buf_points_size = IMAGE_SIZE * sizeof(cl_float4);
 
     CHECK_CL_PARAM(buf_a = cl::Buffer(context, CL_MEM_READ_WRITE, buf_a_size, NULL, &err));
     CHECK_CL_PARAM(buf_b = cl::Buffer(context, CL_MEM_READ_WRITE, buf_b_size, NULL, &err));
@@ -497,7 +551,7 @@ public:
     CHECK_CL_PARAM(buf_edge_test = cl::Buffer(context, CL_MEM_READ_WRITE, buf_edge_test_size, NULL, &err));
     CHECK_CL_PARAM(buf_depth = cl::Buffer(context, CL_MEM_READ_WRITE, buf_depth_size, NULL, &err));
     CHECK_CL_PARAM(buf_ir_sum = cl::Buffer(context, CL_MEM_READ_WRITE, buf_ir_sum_size, NULL, &err));
-    CHECK_CL_PARAM(buf_filtered = cl::Buffer(context, CL_MEM_WRITE_ONLY, buf_filtered_size, NULL, &err));
+    CHECK_CL_PARAM(buf_points = cl::Buffer(context, CL_MEM_WRITE_ONLY, buf_points_size, NULL, &err));
 
     return true;
   }
@@ -538,12 +592,17 @@ public:
     CHECK_CL_RETURN(kernel_processPixelStage2.setArg(3, buf_z_table));
     CHECK_CL_RETURN(kernel_processPixelStage2.setArg(4, buf_depth));
     CHECK_CL_RETURN(kernel_processPixelStage2.setArg(5, buf_ir_sum));
+    CHECK_CL_RETURN(kernel_processPixelStage2.setArg(6, buf_distort_map));
+    CHECK_CL_RETURN(kernel_processPixelStage2.setArg(7, buf_rays));
+    CHECK_CL_RETURN(kernel_processPixelStage2.setArg(8, buf_points));
 
     CHECK_CL_PARAM(kernel_filterPixelStage2 = cl::Kernel(program, "filterPixelStage2", &err));
     CHECK_CL_RETURN(kernel_filterPixelStage2.setArg(0, buf_depth));
     CHECK_CL_RETURN(kernel_filterPixelStage2.setArg(1, buf_ir_sum));
     CHECK_CL_RETURN(kernel_filterPixelStage2.setArg(2, buf_edge_test));
-    CHECK_CL_RETURN(kernel_filterPixelStage2.setArg(3, buf_filtered));
+    CHECK_CL_RETURN(kernel_filterPixelStage2.setArg(4, buf_distort_map));
+    CHECK_CL_RETURN(kernel_filterPixelStage2.setArg(5, buf_rays));
+    CHECK_CL_RETURN(kernel_filterPixelStage2.setArg(6, buf_points));
 
     programInitialized = true;
     return true;
@@ -552,7 +611,7 @@ public:
   bool run(const DepthPacket &packet)
   {
     std::vector<cl::Event> eventWrite(1), eventPPS1(1), eventFPS1(1), eventPPS2(1), eventFPS2(1);
-    cl::Event eventReadIr, eventReadDepth;
+    cl::Event eventReadIr, eventReadDepth, eventReadPoints;
 
     CHECK_CL_RETURN(queue.enqueueWriteBuffer(buf_packet, CL_FALSE, 0, buf_packet_size, packet.buffer, NULL, &eventWrite[0]));
     CHECK_CL_RETURN(queue.enqueueNDRangeKernel(kernel_processPixelStage1, cl::NullRange, cl::NDRange(IMAGE_SIZE), cl::NullRange, &eventWrite, &eventPPS1[0]));
@@ -567,6 +626,15 @@ public:
       eventFPS1[0] = eventPPS1[0];
     }
 
+    // The last stage writes straight into the device copy of the depth frame.
+    if(depth_frame_buffer() == NULL)
+    {
+      LOG_ERROR << "depth frame has no device buffer";
+      return false;
+    }
+    CHECK_CL_RETURN(kernel_processPixelStage2.setArg(4, config.EnableEdgeAwareFilter ? buf_depth : depth_frame_buffer));
+    CHECK_CL_RETURN(kernel_filterPixelStage2.setArg(3, depth_frame_buffer));
+
     CHECK_CL_RETURN(queue.enqueueNDRangeKernel(kernel_processPixelStage2, cl::NullRange, cl::NDRange(IMAGE_SIZE), cl::NullRange, &eventFPS1, &eventPPS2[0]));
 
     if(config.EnableEdgeAwareFilter)
@@ -578,9 +646,17 @@ public:
       eventFPS2[0] = eventPPS2[0];
     }
 
-    CHECK_CL_RETURN(queue.enqueueReadBuffer(config.EnableEdgeAwareFilter ? buf_filtered : buf_depth, CL_FALSE, 0, buf_depth_size, depth_frame->data, &eventFPS2, &eventReadDepth));
+    CHECK_CL_RETURN(queue.enqueueReadBuffer(depth_frame_buffer, CL_FALSE, 0, buf_depth_size, depth_frame->data, &eventFPS2, &eventReadDepth));
+    if(points())
+    {
+      CHECK_CL_RETURN(queue.enqueueReadBuffer(buf_points, CL_FALSE, 0, buf_points_size, point_cloud_frame->data, &eventFPS2, &eventReadPoints));
+    }
     CHECK_CL_RETURN(eventReadIr.wait());
     CHECK_CL_RETURN(eventReadDepth.wait());
+    if(points())
+    {
+      CHECK_CL_RETURN(eventReadPoints.wait());
+    }
 
 #ifdef LIBFREENECT2_WITH_PROFILING_CL
     if(count == 0)
@@ -650,8 +726,69 @@ public:
 
   void newDepthFrame()
   {
-    depth_frame = new OpenCLFrame(static_cast<OpenCLBuffer *>(depth_buffer_allocator->allocate(IMAGE_SIZE * sizeof(cl_float))));
+    OpenCLBuffer *buffer = static_cast<OpenCLBuffer *>(depth_buffer_allocator->allocate(IMAGE_SIZE * sizeof(cl_float)));
+    depth_frame = new OpenCLFrame(buffer);
     depth_frame->format = Frame::Float;
+
+    // The pool hands out the same few buffers over and over, so each gets its device copy once.
+    if(deviceInitialized && buffer->device_buffer() == NULL && buffer->data != NULL)
+    {
+      cl_int err = CL_SUCCESS;
+      buffer->device_buffer = cl::Buffer(context, CL_MEM_READ_WRITE, IMAGE_SIZE * sizeof(cl_float), NULL, &err);
+      if(err != CL_SUCCESS)
+      {
+        LOG_ERROR << "failed to create depth device buffer: " << err;
+        buffer->device_buffer = cl::Buffer();
+      }
+      else
+      {
+        DepthDeviceBuffer entry;
+        entry.data = buffer->data;
+        entry.buffer = buffer->device_buffer;
+        entry.sequence = 0;
+        entry.filled = false;
+        libfreenect2::lock_guard guard(depth_device_buffers_mutex);
+        depth_device_buffers.push_back(entry);
+      }
+    }
+    depth_frame_buffer = buffer->device_buffer;
+  }
+
+  /** Record which frame the device buffer behind @p frame now holds, or that it holds nothing usable. */
+  void setDepthBufferContent(const Frame *frame, bool filled)
+  {
+    libfreenect2::lock_guard guard(depth_device_buffers_mutex);
+    for(size_t i = 0; i < depth_device_buffers.size(); ++i)
+    {
+      if(depth_device_buffers[i].data == frame->data)
+      {
+        depth_device_buffers[i].sequence = frame->sequence;
+        depth_device_buffers[i].filled = filled;
+        return;
+      }
+    }
+  }
+
+  bool getDepthBuffer(const Frame *frame, cl::Buffer &buffer)
+  {
+    libfreenect2::lock_guard guard(depth_device_buffers_mutex);
+    for(size_t i = 0; i < depth_device_buffers.size(); ++i)
+    {
+      // The pool reuses host buffers, so the data pointer alone may name a later frame's device copy.
+      const DepthDeviceBuffer &entry = depth_device_buffers[i];
+      if(entry.data == frame->data && entry.filled && entry.sequence == frame->sequence)
+      {
+        buffer = entry.buffer;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void newPointCloudFrame()
+  {
+    point_cloud_frame = new OpenCLFrame(static_cast<OpenCLBuffer *>(point_cloud_buffer_allocator->allocate(IMAGE_SIZE * sizeof(cl_float4))), 16);
+    point_cloud_frame->format = Frame::Float4;
   }
 
   bool fill_trig_table(const libfreenect2::protocol::P0TablesResponse *p0table)
@@ -702,6 +839,50 @@ public:
     return true;
   }
 
+  bool fill_distort_map(const int *map)
+  {
+    if(!deviceInitialized)
+    {
+      LOG_ERROR << "OpenCLDepthPacketProcessor is not initialized!";
+      return false;
+    }
+
+    cl::Event event;
+    CHECK_CL_RETURN(queue.enqueueWriteBuffer(buf_distort_map, CL_FALSE, 0, buf_distort_map_size, map, NULL, &event));
+    CHECK_CL_RETURN(event.wait());
+
+    if(!distortMapLoaded && config.EnableUndistortion)
+    {
+      // the undistorting kernels are only built once there is a map
+      programBuilt = false;
+      programInitialized = false;
+    }
+    distortMapLoaded = true;
+    return true;
+  }
+
+  bool fill_rays(const float *rays)
+  {
+    if(!deviceInitialized)
+    {
+      LOG_ERROR << "OpenCLDepthPacketProcessor is not initialized!";
+      return false;
+    }
+
+    cl::Event event;
+    CHECK_CL_RETURN(queue.enqueueWriteBuffer(buf_rays, CL_FALSE, 0, buf_rays_size, rays, NULL, &event));
+    CHECK_CL_RETURN(event.wait());
+
+    if(!raysLoaded && config.EnablePointCloud)
+    {
+      // the kernels only write points once there are rays
+      programBuilt = false;
+      programInitialized = false;
+    }
+    raysLoaded = true;
+    return true;
+  }
+
   bool fill_lut(const short *lut)
   {
     if(!deviceInitialized)
@@ -732,7 +913,10 @@ void OpenCLDepthPacketProcessor::setConfiguration(const libfreenect2::DepthPacke
   DepthPacketProcessor::setConfiguration(config);
 
   if ( impl_->config.MaxDepth != config.MaxDepth
-    || impl_->config.MinDepth != config.MinDepth)
+    || impl_->config.MinDepth != config.MinDepth
+    || impl_->config.EnableUndistortion != config.EnableUndistortion
+    || impl_->config.EnablePointCloud != config.EnablePointCloud
+    || ((config.EnableUndistortion || config.EnablePointCloud) && impl_->config.EnableEdgeAwareFilter != config.EnableEdgeAwareFilter))
   {
     // OpenCL program needs to be rebuilt, then reinitialized
     impl_->programBuilt = false;
@@ -773,6 +957,16 @@ void OpenCLDepthPacketProcessor::loadLookupTable(const short *lut)
   impl_->fill_lut(lut);
 }
 
+void OpenCLDepthPacketProcessor::loadDistortMap(const int *map)
+{
+  impl_->fill_distort_map(map);
+}
+
+void OpenCLDepthPacketProcessor::loadRayTable(const float *rays)
+{
+  impl_->fill_rays(rays);
+}
+
 bool OpenCLDepthPacketProcessor::good()
 {
   return impl_->deviceInitialized && impl_->runtimeOk;
@@ -797,7 +991,17 @@ void OpenCLDepthPacketProcessor::process(const DepthPacket &packet)
   impl_->ir_frame->sequence = packet.sequence;
   impl_->depth_frame->sequence = packet.sequence;
 
+  const bool points = impl_->points();
+  if(points)
+  {
+    if(impl_->point_cloud_frame == NULL)
+      impl_->newPointCloudFrame();
+    impl_->point_cloud_frame->timestamp = packet.timestamp;
+    impl_->point_cloud_frame->sequence = packet.sequence;
+  }
+
   impl_->runtimeOk = impl_->run(packet);
+  impl_->setDepthBufferContent(impl_->depth_frame, impl_->runtimeOk);
 
   impl_->stopTiming(LOG_INFO);
 
@@ -805,17 +1009,37 @@ void OpenCLDepthPacketProcessor::process(const DepthPacket &packet)
   {
     impl_->ir_frame->status = 1;
     impl_->depth_frame->status = 1;
+    if(points)
+      impl_->point_cloud_frame->status = 1;
   }
 
   if(listener_->onNewFrame(Frame::Ir, impl_->ir_frame))
     impl_->newIrFrame();
   if(listener_->onNewFrame(Frame::Depth, impl_->depth_frame))
     impl_->newDepthFrame();
+  if(points && listener_->onNewFrame(Frame::PointCloud, impl_->point_cloud_frame))
+    impl_->newPointCloudFrame();
 }
 
 Allocator *OpenCLDepthPacketProcessor::getAllocator()
 {
   return impl_->input_buffer_allocator;
 }
+
+bool OpenCLDepthPacketProcessor::getContext(cl::Context &context, cl::Device &device)
+{
+  if(!impl_->deviceInitialized)
+    return false;
+  context = impl_->context;
+  device = impl_->device;
+  return true;
+}
+
+bool OpenCLDepthPacketProcessor::getDepthBuffer(const Frame *frame, cl::Buffer &buffer)
+{
+  if(frame == NULL || frame->format != Frame::Float || frame->width != 512 || frame->height != 424)
+    return false;
+  return impl_->getDepthBuffer(frame, buffer);
+}
 } /* namespace libfreenect2 */
 
@@ -0,0 +1,134 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+
+/*
+ * Registration of color onto depth, see Registration::apply() in registration.cpp.
+ * The host defines COLOR_FX, COLOR_CX (with 0.5 added for rounding), SHIFT_M,
+ * FILTER_WIDTH_HALF, FILTER_HEIGHT_HALF and FILTER_TOLERANCE.
+ */
+
+// the same arithmetic as the CPU path, so that both pick the same color pixels
+#pragma OPENCL FP_CONTRACT OFF
+
+#define COLOR_SIZE (1920 * 1080)
+// the filter map has FILTER_HEIGHT_HALF rows of border on top and bottom
+#define FILTER_MAP_OFFSET (1920 * FILTER_HEIGHT_HALF)
+#define FILTER_MAP_SIZE (COLOR_SIZE + 2 * FILTER_MAP_OFFSET)
+
+/*******************************************************************************
+ * Reset the filter map to infinity
+ ******************************************************************************/
+void kernel clearFilterMap(global int *filter_map)
+{
+  filter_map[get_global_id(0)] = as_int(INFINITY);
+}
+
+/*******************************************************************************
+ * Undistort depth and map it to color pixels
+ ******************************************************************************/
+void kernel mapDepth(global const float *depth, global const int *distort_map, global const float *map_x, global const int *map_yi,
+                     global float *undistorted, global int *color_offsets, global int *filter_map, const int enable_filter)
+{
+  const uint i = get_global_id(0);
+
+  const int index = distort_map[i];
+  if(index < 0)
+  {
+    color_offsets[i] = -1;
+    undistorted[i] = 0.0f;
+    return;
+  }
+
+  const float z = depth[index];
+  undistorted[i] = z;
+
+  // also rejects NaN
+  if(!(z > 0.0f))
+  {
+    color_offsets[i] = -1;
+    return;
+  }
+
+  const float rx = (map_x[i] + (SHIFT_M / z)) * COLOR_FX + COLOR_CX;
+  const int cx = rx; // same as round for positive numbers (0.5f was already added to COLOR_CX)
+  const int cy = map_yi[i];
+  const int c_off = cx + cy * 1920;
+
+  if(c_off < 0 || c_off >= COLOR_SIZE)
+  {
+    color_offsets[i] = -1;
+    return;
+  }
+
+  color_offsets[i] = c_off;
+
+  if(enable_filter)
+  {
+    // keep the smallest z around the color pixel; positive floats order like their bits
+    const int z_bits = as_int(z);
+    int yi = FILTER_MAP_OFFSET + (cy - FILTER_HEIGHT_HALF) * 1920 + cx - FILTER_WIDTH_HALF;
+    for(int r = -FILTER_HEIGHT_HALF; r <= FILTER_HEIGHT_HALF; ++r, yi += 1920)
+    {
+      // windows at the first and last color pixel reach past the border rows, clamped as on the CPU
+      const int begin = max(yi, 0);
+      const int end = min(yi + 2 * FILTER_WIDTH_HALF + 1, FILTER_MAP_SIZE);
+      for(int k = begin; k < end; ++k)
+      {
+        atomic_min(filter_map + k, z_bits);
+      }
+    }
+  }
+}
+
+/*******************************************************************************
+ * Pick the color of each depth pixel, dropping pixels occluded in the color camera
+ ******************************************************************************/
+void kernel registerColor(global const uint *rgb, global const int *color_offsets, global const float *undistorted, global const int *filter_map,
+                          global uint *registered, const int enable_filter)
+{
+  const uint i = get_global_id(0);
+  const int c_off = color_offsets[i];
+
+  if(c_off < 0)
+  {
+    registered[i] = 0;
+    return;
+  }
+
+  if(enable_filter)
+  {
+    const float min_z = as_float(filter_map[FILTER_MAP_OFFSET + c_off]);
+    const float z = undistorted[i];
+
+    // check for allowed depth noise
+    registered[i] = (z - min_z) / z > FILTER_TOLERANCE ? 0 : rgb[c_off];
+  }
+  else
+  {
+    registered[i] = rgb[c_off];
+  }
+}
@@ -0,0 +1,387 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+/** @file opencl_registration.cpp Registration on an OpenCL device. */
+
+#include <libfreenect2/registration.h>
+#include <libfreenect2/packet_pipeline.h>
+#include <libfreenect2/depth_packet_processor.h>
+#include <libfreenect2/distortion.h>
+#include <libfreenect2/resource.h>
+#include <libfreenect2/logging.h>
+#include <libfreenect2/threading.h>
+
+#include <sstream>
+#include <vector>
+
+#define CL_USE_DEPRECATED_OPENCL_1_2_APIS
+#define CL_USE_DEPRECATED_OPENCL_2_0_APIS
+
+#ifdef LIBFREENECT2_OPENCL_ICD_LOADER_IS_OLD
+#define CL_USE_DEPRECATED_OPENCL_1_1_APIS
+#include <CL/cl.h>
+#ifdef CL_VERSION_1_2
+#undef CL_VERSION_1_2
+#endif //CL_VERSION_1_2
+#endif //LIBFREENECT2_OPENCL_ICD_LOADER_IS_OLD
+
+#include <CL/cl.hpp>
+
+#define CHECK_CL_PARAM(expr) do { cl_int err = CL_SUCCESS; (expr); if (err != CL_SUCCESS) { LOG_ERROR << #expr ": " << err; return false; } } while(0)
+#define CHECK_CL_RETURN(expr) do { cl_int err = (expr); if (err != CL_SUCCESS) { LOG_ERROR << #expr ": " << err; return false; } } while(0)
+#define CHECK_CL_ON_FAIL(expr, on_fail) do { cl_int err = (expr); if (err != CL_SUCCESS) { LOG_ERROR << #expr ": " << err; on_fail; return false; } } while(0)
+
+namespace libfreenect2
+{
+
+static std::string loadCLRegistrationSource(const std::string &filename)
+{
+  const unsigned char *data;
+  size_t length = 0;
+
+  if(!loadResource(filename, &data, &length))
+  {
+    LOG_ERROR << "failed to load cl source!";
+    return "";
+  }
+
+  return std::string(reinterpret_cast<const char *>(data), length);
+}
+
+class OpenCLRegistrationImpl
+{
+public:
+  static const size_t DEPTH_SIZE = 512 * 424;
+  static const size_t COLOR_SIZE = 1920 * 1080;
+
+  // same values as Registration
+  static const int FILTER_WIDTH_HALF = 2;
+  static const int FILTER_HEIGHT_HALF = 1;
+
+  Freenect2Device::IrCameraParams depth;
+  Freenect2Device::ColorCameraParams color;
+
+  OpenCLDepthPacketProcessor *processor;
+
+  cl::Context context;
+  cl::Device device;
+
+  cl::Program program;
+  cl::CommandQueue queue;
+
+  cl::Kernel kernel_clearFilterMap;
+  cl::Kernel kernel_mapDepth;
+  cl::Kernel kernel_registerColor;
+
+  // Read only buffers
+  size_t buf_distort_map_size;
+  size_t buf_map_x_size;
+  size_t buf_map_yi_size;
+  size_t buf_depth_size;
+  size_t buf_rgb_size;
+
+  cl::Buffer buf_distort_map;
+  cl::Buffer buf_map_x;
+  cl::Buffer buf_map_yi;
+  cl::Buffer buf_depth;
+  cl::Buffer buf_rgb;
+
+  // Read-Write buffers
+  size_t buf_undistorted_size;
+  size_t buf_color_offsets_size;
+  size_t buf_filter_map_size;
+  size_t buf_registered_size;
+
+  cl::Buffer buf_undistorted;
+  cl::Buffer buf_color_offsets;
+  cl::Buffer buf_filter_map;
+  cl::Buffer buf_registered;
+
+  bool initialized;
+  libfreenect2::mutex mutex;
+
+  OpenCLRegistrationImpl(Freenect2Device::IrCameraParams depth_p, Freenect2Device::ColorCameraParams rgb_p, OpenCLPacketPipeline *pipeline, const int deviceId)
+    : depth(depth_p)
+    , color(rgb_p)
+    , processor(NULL)
+    , initialized(false)
+  {
+    if(pipeline != NULL)
+      processor = static_cast<OpenCLDepthPacketProcessor *>(pipeline->getDepthPacketProcessor());
+
+    initialized = init(deviceId);
+  }
+
+  void generateOptions(std::string &options) const
+  {
+    std::ostringstream oss;
+    oss.precision(16);
+    oss << std::scientific;
+    oss << " -D COLOR_FX=" << color.fx << "f";
+    oss << " -D COLOR_CX=" << color.cx + 0.5f << "f";
+    oss << " -D SHIFT_M=" << color.shift_m << "f";
+
+    oss << " -D FILTER_WIDTH_HALF=" << FILTER_WIDTH_HALF;
+    oss << " -D FILTER_HEIGHT_HALF=" << FILTER_HEIGHT_HALF;
+    oss << " -D FILTER_TOLERANCE=" << 0.01f << "f";
+
+    options = oss.str();
+  }
+
+  bool selectDevice(const int deviceId)
+  {
+    std::vector<cl::Platform> platforms;
+    CHECK_CL_RETURN(cl::Platform::get(&platforms));
+
+    std::vector<cl::Device> devices;
+    for(size_t i = 0; i < platforms.size(); ++i)
+    {
+      std::vector<cl::Device> devs;
+      if(platforms[i].getDevices(CL_DEVICE_TYPE_ALL, &devs) == CL_SUCCESS)
+        devices.insert(devices.end(), devs.begin(), devs.end());
+    }
+
+    if(devices.empty())
+    {
+      LOG_ERROR << "no opencl devices found.";
+      return false;
+    }
+
+    if(deviceId != -1 && devices.size() > (size_t)deviceId)
+    {
+      device = devices[deviceId];
+      return true;
+    }
+
+    // prefer the first GPU
+    device = devices[0];
+    for(size_t i = 0; i < devices.size(); ++i)
+    {
+      cl_device_type devTypeID = 0;
+      devices[i].getInfo(CL_DEVICE_TYPE, &devTypeID);
+      if(devTypeID == CL_DEVICE_TYPE_GPU)
+      {
+        device = devices[i];
+        break;
+      }
+    }
+    return true;
+  }
+
+  bool init(const int deviceId)
+  {
+    if(processor != NULL)
+    {
+      if(!processor->getContext(context, device))
+      {
+        LOG_ERROR << "the OpenCL depth processor is not initialized";
+        return false;
+      }
+    }
+    else
+    {
+      if(!selectDevice(deviceId))
+        return false;
+      CHECK_CL_PARAM(context = cl::Context(device, NULL, NULL, NULL, &err));
+    }
+
+    // a queue of our own, so registration does not wait for depth decoding
+    CHECK_CL_PARAM(queue = cl::CommandQueue(context, device, 0, &err));
+
+    if(!initBuffers() || !buildProgram() || !initKernels())
+      return false;
+
+    return fillTables();
+  }
+
+  bool initBuffers()
+  {
+    //Read only
+    buf_distort_map_size = DEPTH_SIZE * sizeof(cl_int);
+    buf_map_x_size = DEPTH_SIZE * sizeof(cl_float);
+    buf_map_yi_size = DEPTH_SIZE * sizeof(cl_int);
+    buf_depth_size = DEPTH_SIZE * sizeof(cl_float);
+    buf_rgb_size = COLOR_SIZE * sizeof(cl_uint);
+
+    CHECK_CL_PARAM(buf_distort_map = cl::Buffer(context, CL_MEM_READ_ONLY, buf_distort_map_size, NULL, &err));
+    CHECK_CL_PARAM(buf_map_x = cl::Buffer(context, CL_MEM_READ_ONLY, buf_map_x_size, NULL, &err));
+    CHECK_CL_PARAM(buf_map_yi = cl::Buffer(context, CL_MEM_READ_ONLY, buf_map_yi_size, NULL, &err));
+    CHECK_CL_PARAM(buf_depth = cl::Buffer(context, CL_MEM_READ_ONLY, buf_depth_size, NULL, &err));
+    CHECK_CL_PARAM(buf_rgb = cl::Buffer(context, CL_MEM_READ_ONLY, buf_rgb_size, NULL, &err));
+
+    //Read-Write
+    buf_undistorted_size = DEPTH_SIZE * sizeof(cl_float);
+    buf_color_offsets_size = DEPTH_SIZE * sizeof(cl_int);
+    // with a border of FILTER_HEIGHT_HALF rows on top and bottom, see Registration::apply()
+    buf_filter_map_size = (COLOR_SIZE + 1920 * FILTER_HEIGHT_HALF * 2) * sizeof(cl_int);
+    buf_registered_size = DEPTH_SIZE * sizeof(cl_uint);
+
+    CHECK_CL_PARAM(buf_undistorted = cl::Buffer(context, CL_MEM_READ_WRITE, buf_undistorted_size, NULL, &err));
+    CHECK_CL_PARAM(buf_color_offsets = cl::Buffer(context, CL_MEM_READ_WRITE, buf_color_offsets_size, NULL, &err));
+    CHECK_CL_PARAM(buf_filter_map = cl::Buffer(context, CL_MEM_READ_WRITE, buf_filter_map_size, NULL, &err));
+    CHECK_CL_PARAM(buf_registered = cl::Buffer(context, CL_MEM_WRITE_ONLY, buf_registered_size, NULL, &err));
+
+    return true;
+  }
+
+  bool buildProgram()
+  {
+    LOG_INFO << "building OpenCL registration program...";
+
+    const std::string sources = loadCLRegistrationSource("opencl_registration.cl");
+    if(sources.empty())
+      return false;
+
+    std::string options;
+    generateOptions(options);
+
+    cl::Program::Sources source(1, std::make_pair(sources.c_str(), sources.length()));
+    CHECK_CL_PARAM(program = cl::Program(context, source, &err));
+
+    CHECK_CL_ON_FAIL(program.build(options.c_str()),
+      LOG_ERROR << "failed to build program: " << err;
+      LOG_ERROR << "Build Status: " << program.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(device);
+      LOG_ERROR << "Build Options:\t" << program.getBuildInfo<CL_PROGRAM_BUILD_OPTIONS>(device);
+      LOG_ERROR << "Build Log:\t " << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device));
+
+    LOG_INFO << "OpenCL registration program built successfully";
+    return true;
+  }
+
+  bool initKernels()
+  {
+    CHECK_CL_PARAM(kernel_clearFilterMap = cl::Kernel(program, "clearFilterMap", &err));
+    CHECK_CL_RETURN(kernel_clearFilterMap.setArg(0, buf_filter_map));
+
+    // argument 0 (depth) and 7 (enable_filter) are set for every frame
+    CHECK_CL_PARAM(kernel_mapDepth = cl::Kernel(program, "mapDepth", &err));
+    CHECK_CL_RETURN(kernel_mapDepth.setArg(1, buf_distort_map));
+    CHECK_CL_RETURN(kernel_mapDepth.setArg(2, buf_map_x));
+    CHECK_CL_RETURN(kernel_mapDepth.setArg(3, buf_map_yi));
+    CHECK_CL_RETURN(kernel_mapDepth.setArg(4, buf_undistorted));
+    CHECK_CL_RETURN(kernel_mapDepth.setArg(5, buf_color_offsets));
+    CHECK_CL_RETURN(kernel_mapDepth.setArg(6, buf_filter_map));
+
+    // argument 5 (enable_filter) is set for every frame
+    CHECK_CL_PARAM(kernel_registerColor = cl::Kernel(program, "registerColor", &err));
+    CHECK_CL_RETURN(kernel_registerColor.setArg(0, buf_rgb));
+    CHECK_CL_RETURN(kernel_registerColor.setArg(1, buf_color_offsets));
+    CHECK_CL_RETURN(kernel_registerColor.setArg(2, buf_undistorted));
+    CHECK_CL_RETURN(kernel_registerColor.setArg(3, buf_filter_map));
+    CHECK_CL_RETURN(kernel_registerColor.setArg(4, buf_registered));
+
+    return true;
+  }
+
+  bool fillTables()
+  {
+    std::vector<cl_int> distort_map(DEPTH_SIZE), map_yi(DEPTH_SIZE);
+    std::vector<cl_float> map_x(DEPTH_SIZE), map_y(DEPTH_SIZE);
+
+    computeDistortMap(depth, &distort_map[0]);
+    computeDepthToColorMap(depth, color, &map_x[0], &map_y[0]);
+    for(size_t i = 0; i < DEPTH_SIZE; ++i)
+      map_yi[i] = (int)(map_y[i] + 0.5f);
+
+    cl::Event event0, event1, event2;
+    CHECK_CL_RETURN(queue.enqueueWriteBuffer(buf_distort_map, CL_FALSE, 0, buf_distort_map_size, &distort_map[0], NULL, &event0));
+    CHECK_CL_RETURN(queue.enqueueWriteBuffer(buf_map_x, CL_FALSE, 0, buf_map_x_size, &map_x[0], NULL, &event1));
+    CHECK_CL_RETURN(queue.enqueueWriteBuffer(buf_map_yi, CL_FALSE, 0, buf_map_yi_size, &map_yi[0], NULL, &event2));
+    CHECK_CL_RETURN(event0.wait());
+    CHECK_CL_RETURN(event1.wait());
+    CHECK_CL_RETURN(event2.wait());
+    return true;
+  }
+
+  bool run(const Frame *rgb, const Frame *depth, Frame *undistorted, Frame *registered, const bool enable_filter)
+  {
+    std::vector<cl::Event> eventWrite(2), eventClear(1), eventMap(1), eventRegister(1);
+    cl::Event eventReadUndistorted, eventReadRegistered;
+
+    // depth decoded by the pipeline is already on the device
+    cl::Buffer depth_buffer;
+    if(processor != NULL && processor->getDepthBuffer(depth, depth_buffer))
+    {
+      eventWrite.resize(1);
+    }
+    else
+    {
+      depth_buffer = buf_depth;
+      CHECK_CL_RETURN(queue.enqueueWriteBuffer(buf_depth, CL_FALSE, 0, buf_depth_size, depth->data, NULL, &eventWrite[1]));
+    }
+    CHECK_CL_RETURN(queue.enqueueWriteBuffer(buf_rgb, CL_FALSE, 0, buf_rgb_size, rgb->data, NULL, &eventWrite[0]));
+
+    if(enable_filter)
+    {
+      CHECK_CL_RETURN(queue.enqueueNDRangeKernel(kernel_clearFilterMap, cl::NullRange, cl::NDRange(buf_filter_map_size / sizeof(cl_int)), cl::NullRange, NULL, &eventClear[0]));
+      eventWrite.push_back(eventClear[0]);
+    }
+
+    const cl_int filter = enable_filter ? 1 : 0;
+    CHECK_CL_RETURN(kernel_mapDepth.setArg(0, depth_buffer));
+    CHECK_CL_RETURN(kernel_mapDepth.setArg(7, filter));
+    CHECK_CL_RETURN(kernel_registerColor.setArg(5, filter));
+
+    CHECK_CL_RETURN(queue.enqueueNDRangeKernel(kernel_mapDepth, cl::NullRange, cl::NDRange(DEPTH_SIZE), cl::NullRange, &eventWrite, &eventMap[0]));
+    CHECK_CL_RETURN(queue.enqueueReadBuffer(buf_undistorted, CL_FALSE, 0, buf_undistorted_size, undistorted->data, &eventMap, &eventReadUndistorted));
+
+    CHECK_CL_RETURN(queue.enqueueNDRangeKernel(kernel_registerColor, cl::NullRange, cl::NDRange(DEPTH_SIZE), cl::NullRange, &eventMap, &eventRegister[0]));
+    CHECK_CL_RETURN(queue.enqueueReadBuffer(buf_registered, CL_FALSE, 0, buf_registered_size, registered->data, &eventRegister, &eventReadRegistered));
+
+    CHECK_CL_RETURN(eventReadUndistorted.wait());
+    CHECK_CL_RETURN(eventReadRegistered.wait());
+    return true;
+  }
+};
+
+OpenCLRegistration::OpenCLRegistration(Freenect2Device::IrCameraParams depth_p, Freenect2Device::ColorCameraParams rgb_p, OpenCLPacketPipeline *pipeline, const int deviceId):
+    impl_(new OpenCLRegistrationImpl(depth_p, rgb_p, pipeline, deviceId)) {}
+
+OpenCLRegistration::~OpenCLRegistration()
+{
+  delete impl_;
+}
+
+bool OpenCLRegistration::good() const
+{
+  return impl_->initialized;
+}
+
+bool OpenCLRegistration::apply(const Frame *rgb, const Frame *depth, Frame *undistorted, Frame *registered, const bool enable_filter) const
+{
+  // Check if all frames are valid and have the correct size
+  if (!impl_->initialized || !rgb || !depth || !undistorted || !registered ||
+      rgb->width != 1920 || rgb->height != 1080 || rgb->bytes_per_pixel != 4 ||
+      depth->width != 512 || depth->height != 424 || depth->bytes_per_pixel != 4 ||
+      undistorted->width != 512 || undistorted->height != 424 || undistorted->bytes_per_pixel != 4 ||
+      registered->width != 512 || registered->height != 424 || registered->bytes_per_pixel != 4)
+    return false;
+
+  libfreenect2::lock_guard l(impl_->mutex);
+  return impl_->run(rgb, depth, undistorted, registered, enable_filter);
+}
+
+} /* namespace libfreenect2 */
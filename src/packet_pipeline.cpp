@@ -31,14 +31,50 @@
 #include <libfreenect2/data_callback.h>
 #include <libfreenect2/rgb_packet_stream_parser.h>
 #include <libfreenect2/depth_packet_stream_parser.h>
+#include <libfreenect2/packet_recorder.h>
+#include <libfreenect2/packet_recorder_impl.h>
 #include <libfreenect2/protocol/response.h>
 
+#include <cstdlib>
+#include <vector>
+
 namespace libfreenect2
 {
 
-static RgbPacketProcessor *getDefaultRgbPacketProcessor()
+RgbDecoderConfig::RgbDecoderConfig():
+  decoders(1),
+  streaming(false)
+{
+}
+
+#ifdef LIBFREENECT2_WITH_TURBOJPEG_SUPPORT
+/** TurboJPEG decoding, on several threads if more than one decoder is configured,
+ * or libjpeg decoding during reception if streaming is configured. */
+static RgbPacketProcessor *getTurboJpegRgbPacketProcessor(const RgbDecoderConfig &config)
+{
+#ifdef LIBFREENECT2_WITH_STREAMING_JPEG_SUPPORT
+  const char *streaming_env = std::getenv("LIBFREENECT2_RGB_STREAMING");
+  const bool streaming = streaming_env ? std::atoi(streaming_env) != 0 : config.streaming;
+  if (streaming)
+    return new StreamingJpegRgbPacketProcessor();
+#endif
+
+  const char *decoders_env = std::getenv("LIBFREENECT2_RGB_DECODERS");
+  const int count = decoders_env ? std::atoi(decoders_env) : config.decoders;
+  if (count <= 1)
+    return new TurboJpegRgbPacketProcessor();
+
+  std::vector<RgbPacketProcessor *> decoders;
+  for (int i = 0; i < count; ++i)
+    decoders.push_back(new TurboJpegRgbPacketProcessor());
+  return new ParallelRgbPacketProcessor(decoders);
+}
+#endif
+
+static RgbPacketProcessor *getDefaultRgbPacketProcessor(const RgbDecoderConfig &config)
 {
 #if defined(LIBFREENECT2_WITH_VT_SUPPORT)
+  (void)config;
   return new VTRgbPacketProcessor();
 #elif defined(LIBFREENECT2_WITH_VAAPI_SUPPORT)
   RgbPacketProcessor *vaapi = new VaapiRgbPacketProcessor();
@@ -46,16 +82,16 @@ static RgbPacketProcessor *getDefaultRgbPacketProcessor()
     return vaapi;
   else
     delete vaapi;
-  return new TurboJpegRgbPacketProcessor();
+  return getTurboJpegRgbPacketProcessor(config);
 #elif defined(LIBFREENECT2_WITH_TEGRAJPEG_SUPPORT)
   RgbPacketProcessor *tegra = new TegraJpegRgbPacketProcessor();
   if (tegra->good())
     return tegra;
   else
     delete tegra;
-  return new TurboJpegRgbPacketProcessor();
+  return getTurboJpegRgbPacketProcessor(config);
 #elif defined(LIBFREENECT2_WITH_TURBOJPEG_SUPPORT)
-  return new TurboJpegRgbPacketProcessor();
+  return getTurboJpegRgbPacketProcessor(config);
 #else
   #error No jpeg decoder is enabled
 #endif
@@ -72,6 +108,8 @@ public:
   DepthPacketProcessor *depth_processor_;
   BaseDepthPacketProcessor *async_depth_processor_;
 
+  PacketRingRecorderImpl *recorder_;
+
   ~PacketPipelineComponents();
   void initialize(RgbPacketProcessor *rgb, DepthPacketProcessor *depth);
 };
@@ -83,17 +121,24 @@ void PacketPipelineComponents::initialize(RgbPacketProcessor *rgb, DepthPacketPr
 
   rgb_processor_ = rgb;
   depth_processor_ = depth;
+  recorder_ = 0;
 
-  async_rgb_processor_ = new AsyncPacketProcessor<RgbPacket>(rgb_processor_);
+  // processors with threads of their own take packets straight from the parser
+  if (rgb_processor_->isAsynchronous())
+    async_rgb_processor_ = rgb_processor_;
+  else
+    async_rgb_processor_ = new AsyncPacketProcessor<RgbPacket>(rgb_processor_);
   async_depth_processor_ = new AsyncPacketProcessor<DepthPacket>(depth_processor_);
 
   rgb_parser_->setPacketProcessor(async_rgb_processor_);
+  rgb_parser_->setStreamTap(rgb_processor_->getStreamTap());
   depth_parser_->setPacketProcessor(async_depth_processor_);
 }
 
 PacketPipelineComponents::~PacketPipelineComponents()
 {
-  delete async_rgb_processor_;
+  if (async_rgb_processor_ != rgb_processor_)
+    delete async_rgb_processor_;
   delete async_depth_processor_;
   delete rgb_processor_;
   delete depth_processor_;
@@ -128,9 +173,26 @@ DepthPacketProcessor *PacketPipeline::getDepthPacketProcessor() const
   return comp_->depth_processor_;
 }
 
+void PacketPipeline::setPacketRecorder(PacketRingRecorder *recorder)
+{
+  PacketRingRecorderImpl *impl = recorder != 0 ? recorder->impl_ : 0;
+  comp_->rgb_parser_->setPacketTap(impl);
+  comp_->depth_parser_->setPacketTap(impl);
+
+  // the previous recorder gets no more packets to end its capture with
+  if (comp_->recorder_ != 0 && comp_->recorder_ != impl)
+    comp_->recorder_->endCapture();
+  comp_->recorder_ = impl;
+}
+
 CpuPacketPipeline::CpuPacketPipeline()
 {
-  comp_->initialize(getDefaultRgbPacketProcessor(), new CpuDepthPacketProcessor());
+  comp_->initialize(getDefaultRgbPacketProcessor(RgbDecoderConfig()), new CpuDepthPacketProcessor());
+}
+
+CpuPacketPipeline::CpuPacketPipeline(const RgbDecoderConfig &rgb_config)
+{
+  comp_->initialize(getDefaultRgbPacketProcessor(rgb_config), new CpuDepthPacketProcessor());
 }
 
 CpuPacketPipeline::~CpuPacketPipeline() { }
@@ -138,7 +200,12 @@ CpuPacketPipeline::~CpuPacketPipeline() { }
 #ifdef LIBFREENECT2_WITH_OPENGL_SUPPORT
 OpenGLPacketPipeline::OpenGLPacketPipeline(void *parent_opengl_context, bool debug) : parent_opengl_context_(parent_opengl_context), debug_(debug)
 {
-  comp_->initialize(getDefaultRgbPacketProcessor(), new OpenGLDepthPacketProcessor(parent_opengl_context_, debug_));
+  comp_->initialize(getDefaultRgbPacketProcessor(RgbDecoderConfig()), new OpenGLDepthPacketProcessor(parent_opengl_context_, debug_));
+}
+
+OpenGLPacketPipeline::OpenGLPacketPipeline(void *parent_opengl_context, bool debug, const RgbDecoderConfig &rgb_config) : parent_opengl_context_(parent_opengl_context), debug_(debug)
+{
+  comp_->initialize(getDefaultRgbPacketProcessor(rgb_config), new OpenGLDepthPacketProcessor(parent_opengl_context_, debug_));
 }
 
 OpenGLPacketPipeline::~OpenGLPacketPipeline() { }
@@ -148,7 +215,12 @@ OpenGLPacketPipeline::~OpenGLPacketPipeline() { }
 #ifdef LIBFREENECT2_WITH_OPENCL_SUPPORT
 OpenCLPacketPipeline::OpenCLPacketPipeline(const int deviceId) : deviceId(deviceId)
 {
-  comp_->initialize(getDefaultRgbPacketProcessor(), new OpenCLDepthPacketProcessor(deviceId));
+  comp_->initialize(getDefaultRgbPacketProcessor(RgbDecoderConfig()), new OpenCLDepthPacketProcessor(deviceId));
+}
+
+OpenCLPacketPipeline::OpenCLPacketPipeline(const int deviceId, const RgbDecoderConfig &rgb_config) : deviceId(deviceId)
+{
+  comp_->initialize(getDefaultRgbPacketProcessor(rgb_config), new OpenCLDepthPacketProcessor(deviceId));
 }
 
 OpenCLPacketPipeline::~OpenCLPacketPipeline() { }
@@ -156,7 +228,12 @@ OpenCLPacketPipeline::~OpenCLPacketPipeline() { }
 
 OpenCLKdePacketPipeline::OpenCLKdePacketPipeline(const int deviceId) : deviceId(deviceId)
 {
-  comp_->initialize(getDefaultRgbPacketProcessor(), new OpenCLKdeDepthPacketProcessor(deviceId));
+  comp_->initialize(getDefaultRgbPacketProcessor(RgbDecoderConfig()), new OpenCLKdeDepthPacketProcessor(deviceId));
+}
+
+OpenCLKdePacketPipeline::OpenCLKdePacketPipeline(const int deviceId, const RgbDecoderConfig &rgb_config) : deviceId(deviceId)
+{
+  comp_->initialize(getDefaultRgbPacketProcessor(rgb_config), new OpenCLKdeDepthPacketProcessor(deviceId));
 }
 
 OpenCLKdePacketPipeline::~OpenCLKdePacketPipeline() { }
@@ -165,14 +242,24 @@ OpenCLKdePacketPipeline::~OpenCLKdePacketPipeline() { }
 #ifdef LIBFREENECT2_WITH_CUDA_SUPPORT
 CudaPacketPipeline::CudaPacketPipeline(const int deviceId) : deviceId(deviceId)
 {
-  comp_->initialize(getDefaultRgbPacketProcessor(), new CudaDepthPacketProcessor(deviceId));
+  comp_->initialize(getDefaultRgbPacketProcessor(RgbDecoderConfig()), new CudaDepthPacketProcessor(deviceId));
+}
+
+CudaPacketPipeline::CudaPacketPipeline(const int deviceId, const RgbDecoderConfig &rgb_config) : deviceId(deviceId)
+{
+  comp_->initialize(getDefaultRgbPacketProcessor(rgb_config), new CudaDepthPacketProcessor(deviceId));
 }
 
 CudaKdePacketPipeline::~CudaKdePacketPipeline() { }
 
 CudaKdePacketPipeline::CudaKdePacketPipeline(const int deviceId) : deviceId(deviceId)
 {
-  comp_->initialize(getDefaultRgbPacketProcessor(), new CudaKdeDepthPacketProcessor(deviceId));
+  comp_->initialize(getDefaultRgbPacketProcessor(RgbDecoderConfig()), new CudaKdeDepthPacketProcessor(deviceId));
+}
+
+CudaKdePacketPipeline::CudaKdePacketPipeline(const int deviceId, const RgbDecoderConfig &rgb_config) : deviceId(deviceId)
+{
+  comp_->initialize(getDefaultRgbPacketProcessor(rgb_config), new CudaKdeDepthPacketProcessor(deviceId));
 }
 
 CudaPacketPipeline::~CudaPacketPipeline() { }
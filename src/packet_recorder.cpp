@@ -0,0 +1,414 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+/** @file packet_recorder.cpp Pre-trigger recording of raw packets in memory rings. */
+
+#include <libfreenect2/packet_recorder.h>
+#include <libfreenect2/packet_recorder_impl.h>
+#include <libfreenect2/logging.h>
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+namespace libfreenect2
+{
+
+/* Device timestamps count 0.125 ms. */
+static const float TICKS_PER_SECOND = 8000.0f;
+static const size_t DEPTH_PACKET_SIZE = 10 * 512 * 424 * 11 / 8;
+static const size_t TYPICAL_JPEG_SIZE = 400 * 1024;
+static const size_t SMALL_JPEG_SIZE = 16 * 1024;
+static const size_t NO_PROTECTION = (size_t)-1;
+/* A capture waiting for packets that stopped arriving ends after this long. */
+static const int STREAM_STOPPED_MS = 1000;
+static const int IDLE_POLL_MS = 100;
+
+PacketRing::PacketRing(size_t capacity, size_t max_records):
+  data_(new unsigned char[capacity]),
+  capacity_(capacity),
+  records_(max_records),
+  begin_(0),
+  end_(0)
+{
+}
+
+PacketRing::~PacketRing()
+{
+  delete[] data_;
+}
+
+bool PacketRing::push(const unsigned char *data, size_t length, uint32_t timestamp, uint32_t sequence, size_t protect)
+{
+  if (length > capacity_)
+    return false;
+
+  for (;;)
+  {
+    size_t offset = 0;
+    bool fits = false;
+
+    if (begin_ == end_)
+    {
+      fits = true;
+    }
+    else if (end_ - begin_ < records_.size())
+    {
+      const Record &oldest = record(begin_);
+      const Record &newest = record(end_ - 1);
+      size_t start = oldest.offset;
+      size_t stop = newest.offset + newest.length;
+
+      if (newest.offset >= start)
+      {
+        // Used space is [start, stop): try the tail first, then wrap around.
+        if (capacity_ - stop >= length)
+        {
+          offset = stop;
+          fits = true;
+        }
+        else if (start >= length)
+        {
+          fits = true;
+        }
+      }
+      else if (start - stop >= length)
+      {
+        // Used space wraps around; free space is [stop, start).
+        offset = stop;
+        fits = true;
+      }
+    }
+
+    if (fits)
+    {
+      std::memcpy(data_ + offset, data, length);
+      Record &r = records_[end_ % records_.size()];
+      r.offset = offset;
+      r.length = length;
+      r.timestamp = timestamp;
+      r.sequence = sequence;
+      end_++;
+      return true;
+    }
+
+    if (begin_ >= protect)
+      return false;
+    begin_++;
+  }
+}
+
+PacketRingRecorderImpl::PacketRingRecorderImpl(const std::string &directory, float pre_trigger_seconds, float post_trigger_seconds, size_t max_bytes):
+  directory_(directory),
+  pre_trigger_ticks_(pre_trigger_seconds * TICKS_PER_SECOND),
+  post_trigger_ticks_(post_trigger_seconds * TICKS_PER_SECOND),
+  capturing_(false),
+  collecting_(false),
+  have_timestamp_(false),
+  last_timestamp_(0),
+  capture_end_(0),
+  received_(0),
+  written_(0),
+  dropped_(0),
+  shutdown_(false)
+{
+  size_t depth_bytes, rgb_bytes;
+  if (max_bytes == 0)
+  {
+    size_t packets = pre_trigger_seconds * 30 + 2;
+    depth_bytes = packets * DEPTH_PACKET_SIZE;
+    rgb_bytes = packets * TYPICAL_JPEG_SIZE;
+  }
+  else
+  {
+    depth_bytes = max_bytes / (DEPTH_PACKET_SIZE + TYPICAL_JPEG_SIZE) * DEPTH_PACKET_SIZE;
+    if (depth_bytes < DEPTH_PACKET_SIZE)
+      depth_bytes = DEPTH_PACKET_SIZE;
+    rgb_bytes = max_bytes > depth_bytes + TYPICAL_JPEG_SIZE ? max_bytes - depth_bytes : TYPICAL_JPEG_SIZE;
+  }
+
+  streams_[DepthStream].ring = new PacketRing(depth_bytes, depth_bytes / DEPTH_PACKET_SIZE);
+  streams_[DepthStream].tag = "depth";
+  streams_[DepthStream].suffix = ".depth";
+  streams_[RgbStream].ring = new PacketRing(rgb_bytes, rgb_bytes / SMALL_JPEG_SIZE + 1);
+  streams_[RgbStream].tag = "rgb";
+  streams_[RgbStream].suffix = ".jpg";
+  for (size_t i = 0; i < NumStreams; i++)
+  {
+    streams_[i].next_write = 0;
+    streams_[i].end_write = 0;
+  }
+
+  LOG_INFO << "packet ring recorder: " << (depth_bytes + rgb_bytes) / (1024 * 1024) << " MB for "
+           << pre_trigger_seconds << " s before and " << post_trigger_seconds << " s after a trigger";
+
+  thread_ = new libfreenect2::thread(&PacketRingRecorderImpl::static_execute, this);
+}
+
+PacketRingRecorderImpl::~PacketRingRecorderImpl()
+{
+  {
+    libfreenect2::lock_guard l(mutex_);
+    shutdown_ = true;
+  }
+  condition_.notify_all();
+  thread_->join();
+  delete thread_;
+
+  for (size_t i = 0; i < NumStreams; i++)
+    delete streams_[i].ring;
+}
+
+void PacketRingRecorderImpl::onPacket(const RgbPacket &packet)
+{
+  push(streams_[RgbStream], packet.jpeg_buffer, packet.jpeg_buffer_length, packet.timestamp, packet.sequence);
+}
+
+void PacketRingRecorderImpl::onPacket(const DepthPacket &packet)
+{
+  push(streams_[DepthStream], packet.buffer, packet.buffer_length, packet.timestamp, packet.sequence);
+}
+
+void PacketRingRecorderImpl::push(Stream &stream, const unsigned char *data, size_t length, uint32_t timestamp, uint32_t sequence)
+{
+  bool notify = false;
+  {
+    libfreenect2::lock_guard l(mutex_);
+    last_timestamp_ = timestamp;
+    have_timestamp_ = true;
+    received_++;
+
+    if (collecting_ && (int32_t)(timestamp - capture_end_) > 0)
+    {
+      collecting_ = false;
+      notify = true;
+    }
+
+    // Packets of the capture not written yet must stay in the ring.
+    size_t protect = capturing_ && stream.next_write < stream.end_write ? stream.next_write : NO_PROTECTION;
+
+    if (!stream.ring->push(data, length, timestamp, sequence, protect))
+    {
+      dropped_++;
+    }
+    else if (collecting_)
+    {
+      stream.end_write = stream.ring->end();
+      notify = true;
+    }
+  }
+  if (notify)
+    condition_.notify_all();
+}
+
+bool PacketRingRecorderImpl::trigger()
+{
+  {
+    libfreenect2::lock_guard l(mutex_);
+    if (capturing_)
+    {
+      LOG_WARNING << "packet ring recorder: previous capture is still being written";
+      return false;
+    }
+    if (!have_timestamp_)
+    {
+      LOG_WARNING << "packet ring recorder: no packets received yet";
+      return false;
+    }
+
+    capturing_ = true;
+    collecting_ = true;
+    capture_end_ = last_timestamp_ + post_trigger_ticks_;
+    const uint32_t capture_start = last_timestamp_ - pre_trigger_ticks_;
+
+    for (size_t i = 0; i < NumStreams; i++)
+    {
+      Stream &stream = streams_[i];
+      size_t id = stream.ring->begin();
+      while (id < stream.ring->end() && (int32_t)(stream.ring->record(id).timestamp - capture_start) < 0)
+        id++;
+      stream.next_write = id;
+      stream.end_write = stream.ring->end();
+    }
+    LOG_INFO << "packet ring recorder: triggered at timestamp " << last_timestamp_;
+  }
+  condition_.notify_all();
+  return true;
+}
+
+void PacketRingRecorderImpl::endCapture()
+{
+  {
+    libfreenect2::lock_guard l(mutex_);
+    if (!collecting_)
+      return;
+    collecting_ = false;
+  }
+  condition_.notify_all();
+}
+
+bool PacketRingRecorderImpl::isCapturing()
+{
+  libfreenect2::lock_guard l(mutex_);
+  return capturing_;
+}
+
+size_t PacketRingRecorderImpl::getWrittenPackets()
+{
+  libfreenect2::lock_guard l(mutex_);
+  return written_;
+}
+
+size_t PacketRingRecorderImpl::getDroppedPackets()
+{
+  libfreenect2::lock_guard l(mutex_);
+  return dropped_;
+}
+
+void PacketRingRecorderImpl::static_execute(void *arg)
+{
+  static_cast<PacketRingRecorderImpl *>(arg)->run();
+}
+
+void PacketRingRecorderImpl::run()
+{
+  this_thread::set_name("RingRecorder");
+
+  size_t seen_received = 0;
+  int idle_ms = 0;
+
+  for (;;)
+  {
+    Stream *stream = 0;
+    PacketRing::Record record = PacketRing::Record();
+    const unsigned char *data = 0;
+    bool poll = false;
+    {
+      libfreenect2::unique_lock l(mutex_);
+      for (;;)
+      {
+        // Write the streams interleaved by timestamp.
+        for (size_t i = 0; i < NumStreams; i++)
+        {
+          Stream &s = streams_[i];
+          if (s.next_write < s.end_write && (stream == 0 ||
+              (int32_t)(s.ring->record(s.next_write).timestamp - stream->ring->record(stream->next_write).timestamp) < 0))
+            stream = &s;
+        }
+        if (stream != 0)
+          break;
+
+        if (capturing_ && !collecting_)
+        {
+          capturing_ = false;
+          LOG_INFO << "packet ring recorder: capture written, " << written_ << " packets in total";
+        }
+        if (shutdown_)
+          return;
+
+        if (collecting_)
+        {
+          // A capture ends with the first packet past its end, which never comes if
+          // the device stops streaming or the recorder is detached. Watch for that.
+          if (received_ != seen_received)
+          {
+            seen_received = received_;
+            idle_ms = 0;
+          }
+          else if (idle_ms >= STREAM_STOPPED_MS)
+          {
+            LOG_INFO << "packet ring recorder: no more packets, ending the capture";
+            collecting_ = false;
+            continue;
+          }
+          poll = true;
+          break;
+        }
+        WAIT_CONDITION(condition_, mutex_, l)
+      }
+      if (stream != 0)
+      {
+        record = stream->ring->record(stream->next_write);
+        data = stream->ring->data(stream->next_write);
+      }
+    }
+
+    if (poll)
+    {
+      this_thread::sleep_for(chrono::milliseconds(IDLE_POLL_MS));
+      idle_ms += IDLE_POLL_MS;
+      continue;
+    }
+
+    std::ostringstream filename;
+    filename << directory_ << "/" << record.timestamp << "_" << stream->tag << "_" << record.sequence << stream->suffix;
+    std::ofstream out(filename.str().c_str(), std::ios::binary);
+    out.write(reinterpret_cast<const char *>(data), record.length);
+    bool ok = out.good();
+    out.close();
+    if (!ok)
+      LOG_ERROR << "packet ring recorder: failed to write " << filename.str();
+
+    {
+      libfreenect2::lock_guard l(mutex_);
+      stream->next_write++;
+      if (ok)
+        written_++;
+    }
+  }
+}
+
+PacketRingRecorder::PacketRingRecorder(const std::string &directory, float pre_trigger_seconds, float post_trigger_seconds, size_t max_bytes):
+  impl_(new PacketRingRecorderImpl(directory, pre_trigger_seconds, post_trigger_seconds, max_bytes))
+{
+}
+
+PacketRingRecorder::~PacketRingRecorder()
+{
+  delete impl_;
+}
+
+bool PacketRingRecorder::trigger()
+{
+  return impl_->trigger();
+}
+
+bool PacketRingRecorder::isCapturing() const
+{
+  return impl_->isCapturing();
+}
+
+size_t PacketRingRecorder::getWrittenPackets() const
+{
+  return impl_->getWrittenPackets();
+}
+
+size_t PacketRingRecorder::getDroppedPackets() const
+{
+  return impl_->getDroppedPackets();
+}
+
+} /* namespace libfreenect2 */
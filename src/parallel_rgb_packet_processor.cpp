@@ -0,0 +1,233 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+/** @file parallel_rgb_packet_processor.cpp Color decoding on several threads. */
+
+#include <libfreenect2/rgb_packet_processor.h>
+#include <libfreenect2/async_packet_processor.h>
+#include <libfreenect2/threading.h>
+
+#include <algorithm>
+#include <deque>
+
+namespace libfreenect2
+{
+
+class ParallelRgbDecoder;
+
+class ParallelRgbPacketProcessorImpl
+{
+public:
+  std::vector<RgbPacketProcessor *> decoders;
+  std::vector<ParallelRgbDecoder *> slots;
+  std::vector<AsyncPacketProcessor<RgbPacket> *> workers;
+  size_t next_worker; ///< Where the search for an idle worker starts, so work is spread evenly.
+
+  /** Packet buffers: one per worker, one filled by the stream parser, and one a finished worker has not released yet. */
+  PoolAllocator allocator;
+
+  FrameListener *listener;
+
+  mutex order_mutex;
+  condition_variable order_condition;
+  std::deque<uint32_t> pending; ///< Sequence numbers of the packets being decoded, in the order they arrived.
+  /** Whether a worker has a packet. AsyncPacketProcessor::ready() can be true right after a packet was handed over. */
+  std::vector<bool> busy;
+
+  ParallelRgbPacketProcessorImpl(const std::vector<RgbPacketProcessor *> &decoders);
+  ~ParallelRgbPacketProcessorImpl();
+
+  /** Block until all packets received before this one are delivered or failed. */
+  void waitTurn(uint32_t sequence)
+  {
+    unique_lock l(order_mutex);
+    while (!pending.empty() && pending.front() != sequence)
+      WAIT_CONDITION(order_condition, order_mutex, l);
+  }
+
+  /** Let the packets after this one go, whether it produced a frame or not, and take new work. */
+  void finish(size_t worker, uint32_t sequence)
+  {
+    {
+      lock_guard l(order_mutex);
+      std::deque<uint32_t>::iterator it = std::find(pending.begin(), pending.end(), sequence);
+      if (it != pending.end())
+        pending.erase(it);
+      busy[worker] = false;
+    }
+    order_condition.notify_all();
+  }
+};
+
+/** Runs one decoder and holds back its frames until the earlier packets are done. */
+class ParallelRgbDecoder : public RgbPacketProcessor, public FrameListener
+{
+public:
+  ParallelRgbDecoder(ParallelRgbPacketProcessorImpl *parent, size_t index, RgbPacketProcessor *decoder) :
+    parent_(parent), index_(index), decoder_(decoder), sequence_(0)
+  {
+    decoder_->setFrameListener(this);
+  }
+
+  virtual bool good() { return decoder_->good(); }
+  virtual const char *name() { return decoder_->name(); }
+
+  virtual void process(const RgbPacket &packet)
+  {
+    sequence_ = packet.sequence;
+    decoder_->process(packet);
+  }
+
+  /** Called by the worker after every packet, also those process() skipped because the decoder is not good(). */
+  virtual void releaseBuffer(RgbPacket &packet)
+  {
+    const uint32_t sequence = packet.sequence;
+    RgbPacketProcessor::releaseBuffer(packet);
+    parent_->finish(index_, sequence);
+  }
+
+  virtual bool onNewFrame(Frame::Type type, Frame *frame)
+  {
+    parent_->waitTurn(sequence_);
+    return parent_->listener != 0 && parent_->listener->onNewFrame(type, frame);
+  }
+
+protected:
+  virtual Allocator *getAllocator() { return &parent_->allocator; }
+
+private:
+  ParallelRgbPacketProcessorImpl *parent_;
+  size_t index_;
+  RgbPacketProcessor *decoder_;
+  uint32_t sequence_;
+};
+
+ParallelRgbPacketProcessorImpl::ParallelRgbPacketProcessorImpl(const std::vector<RgbPacketProcessor *> &decoders) :
+  decoders(decoders),
+  next_worker(0),
+  allocator(NULL, decoders.size() + 2),
+  listener(0),
+  busy(decoders.size(), false)
+{
+  for (size_t i = 0; i < decoders.size(); ++i)
+  {
+    slots.push_back(new ParallelRgbDecoder(this, i, decoders[i]));
+    workers.push_back(new AsyncPacketProcessor<RgbPacket>(slots[i]));
+  }
+}
+
+ParallelRgbPacketProcessorImpl::~ParallelRgbPacketProcessorImpl()
+{
+  // joining a worker lets it finish its packet, which the later packets wait for
+  for (size_t i = 0; i < workers.size(); ++i)
+    delete workers[i];
+  for (size_t i = 0; i < slots.size(); ++i)
+    delete slots[i];
+  for (size_t i = 0; i < decoders.size(); ++i)
+    delete decoders[i];
+}
+
+ParallelRgbPacketProcessor::ParallelRgbPacketProcessor(const std::vector<RgbPacketProcessor *> &decoders) :
+  impl_(new ParallelRgbPacketProcessorImpl(decoders))
+{
+}
+
+ParallelRgbPacketProcessor::~ParallelRgbPacketProcessor()
+{
+  delete impl_;
+}
+
+bool ParallelRgbPacketProcessor::ready()
+{
+  // Frame::Raw frames can hold buffers of the pool
+  if (impl_->allocator.available() == 0)
+    return false;
+
+  lock_guard l(impl_->order_mutex);
+  return std::find(impl_->busy.begin(), impl_->busy.end(), false) != impl_->busy.end();
+}
+
+bool ParallelRgbPacketProcessor::good()
+{
+  return !impl_->workers.empty() && impl_->workers[0]->good();
+}
+
+const char *ParallelRgbPacketProcessor::name()
+{
+  return impl_->decoders.empty() ? "parallel color decoder" : impl_->decoders[0]->name();
+}
+
+void ParallelRgbPacketProcessor::process(const RgbPacket &packet)
+{
+  const size_t count = impl_->workers.size();
+  size_t worker = count;
+  {
+    lock_guard l(impl_->order_mutex);
+    for (size_t n = 0; n < count && worker == count; ++n)
+    {
+      const size_t i = (impl_->next_worker + n) % count;
+      if (!impl_->busy[i])
+        worker = i;
+    }
+    if (worker < count)
+    {
+      impl_->busy[worker] = true;
+      impl_->pending.push_back(packet.sequence);
+    }
+  }
+
+  // only reached if called without checking ready(); the caller still releases the buffer
+  if (worker == count)
+    return;
+
+  // The caller releases its buffer when this returns, while the worker may still decode it.
+  if (packet.memory != NULL)
+    packet.memory->allocator->hold(packet.memory);
+
+  // blocks at most until the worker is back waiting for packets
+  impl_->workers[worker]->process(packet);
+  impl_->next_worker = (worker + 1) % count;
+}
+
+void ParallelRgbPacketProcessor::setFrameListener(FrameListener *listener)
+{
+  listener_ = listener;
+  impl_->listener = listener;
+}
+
+void ParallelRgbPacketProcessor::setConfiguration(const Config &config)
+{
+  config_ = config;
+  for (size_t i = 0; i < impl_->decoders.size(); ++i)
+    impl_->decoders[i]->setConfiguration(config);
+}
+
+Allocator *ParallelRgbPacketProcessor::getAllocator()
+{
+  return &impl_->allocator;
+}
+
+} /* namespace libfreenect2 */
@@ -0,0 +1,498 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+/** @file point_cloud_fusion.cpp Voxel grid fusion of several point clouds. */
+
+#include <libfreenect2/point_cloud_fusion.h>
+#include <libfreenect2/threading.h>
+#include <libfreenect2/worker_pool.h>
+#include <libfreenect2/simd.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace libfreenect2
+{
+
+class PointCloudFusionImpl
+{
+public:
+  static const size_t SIZE_DEPTH = 512 * 424;
+
+  /** The grid is split into shards by key hash; each shard is filled by one worker without locking.
+   * The count is fixed, so the output order does not depend on the number of threads.
+   * Shards hold more than their share of max_voxels, and the global limit is applied when they are emitted.
+   */
+  static const size_t SHARDS = 16;
+  static const unsigned char NO_SHARD = 0xff;
+
+  /** Voxel coordinates are stored with 21 bits each, offset to be non-negative. */
+  static const int COORD_BITS = 21;
+  static const int COORD_OFFSET = 1 << (COORD_BITS - 1);
+
+  static const uint64_t EMPTY = ~(uint64_t)0;
+
+  /** Points of one device, binned by shard. */
+  struct Device
+  {
+    float ray_x[512]; ///< x/z of the ray through each undistorted depth column, as in Registration.
+    float ray_y[424]; ///< y/z of the ray through each undistorted depth row.
+    float m[12];      ///< First three rows of the extrinsics.
+
+    std::vector<uint64_t> keys;
+    std::vector<unsigned char> shards;
+    std::vector<float> offsets;  ///< x, y, z of each point relative to the corner of its voxel.
+    std::vector<unsigned> colors;
+    std::vector<unsigned> order; ///< Valid pixels sorted by shard.
+    size_t shard_begin[SHARDS + 1];
+  };
+
+  struct Voxel
+  {
+    uint64_t key;
+    float sx, sy, sz;
+    unsigned n;
+    unsigned nc, sb, sg, sr;
+  };
+
+  /** Open addressing hash table, at most half full. */
+  struct Shard
+  {
+    std::vector<Voxel> table;
+    std::vector<unsigned> used; ///< Occupied slots in insertion order.
+    size_t limit;
+    size_t dropped;             ///< Points without a voxel in this shard or past max_voxels.
+  };
+
+  class Pass;
+
+  const float leaf_size;
+  const float inv_leaf_size;
+  const size_t max_voxels;
+
+  std::vector<Device *> devices;
+  Shard shards[SHARDS];
+  size_t shard_offset[SHARDS + 1];
+  size_t dropped;
+
+  libfreenect2::mutex mutex;
+  WorkerPool *pool;
+
+  PointCloudFusionImpl(float leaf_size, size_t max_voxels):
+    leaf_size(leaf_size), inv_leaf_size(1.0f / leaf_size), max_voxels(max_voxels), dropped(0), pool(NULL)
+  {
+    for (size_t s = 0; s < SHARDS; ++s)
+    {
+      // hashing spreads voxels evenly, so a fifth more than the share only fills up far past max_voxels
+      Shard &shard = shards[s];
+      const size_t share = max_voxels / SHARDS + 1;
+      size_t capacity = 16;
+      while (capacity < (share + share / 5 + 64) * 2)
+        capacity *= 2;
+      shard.limit = capacity / 2;
+      Voxel empty = Voxel();
+      empty.key = EMPTY;
+      shard.table.resize(capacity, empty);
+      shard.used.reserve(shard.limit);
+      shard.dropped = 0;
+    }
+  }
+
+  ~PointCloudFusionImpl()
+  {
+    for (size_t i = 0; i < devices.size(); ++i)
+      delete devices[i];
+    delete pool;
+  }
+
+  static uint64_t hash(uint64_t key)
+  {
+    // Fibonacci hashing; the high bits are well mixed
+    const uint64_t golden = ((uint64_t)0x9e3779b9u << 32) | 0x7f4a7c15u;
+    return key * golden;
+  }
+
+  static uint64_t makeKey(int ix, int iy, int iz)
+  {
+    return ((uint64_t)(ix + COORD_OFFSET) << (2 * COORD_BITS)) |
+           ((uint64_t)(iy + COORD_OFFSET) << COORD_BITS) |
+           (uint64_t)(iz + COORD_OFFSET);
+  }
+
+  void addPoint(Device &dev, size_t i, float x, float y, float z, unsigned color) const;
+  void transformDevice(Device &dev, const float *depth_data, const unsigned *color_data) const;
+  void fuseShard(size_t s);
+  void emitShard(size_t s, float *cloud);
+};
+
+/** One stage of fuse(), split into parts for the worker pool. */
+class PointCloudFusionImpl::Pass : public WorkerPool::Task
+{
+public:
+  enum Kind { Transform, Fuse, Emit };
+
+  Pass(PointCloudFusionImpl &impl, Kind kind, const std::vector<size_t> *active = NULL,
+       const Frame *const *undistorted = NULL, const Frame *const *registered = NULL, float *cloud = NULL):
+    impl_(impl), kind_(kind), active_(active), undistorted_(undistorted), registered_(registered), cloud_(cloud) {}
+
+  virtual void run(size_t index, size_t)
+  {
+    switch (kind_)
+    {
+    case Transform:
+    {
+      // one part per device with a frame
+      const size_t d = (*active_)[index];
+      const Frame *color = registered_ ? registered_[d] : NULL;
+      impl_.transformDevice(*impl_.devices[d], (const float *)undistorted_[d]->data,
+                            color ? (const unsigned *)color->data : NULL);
+      break;
+    }
+    case Fuse: impl_.fuseShard(index); break;
+    case Emit: impl_.emitShard(index, cloud_); break;
+    }
+  }
+
+private:
+  PointCloudFusionImpl &impl_;
+  const Kind kind_;
+  const std::vector<size_t> *active_;
+  const Frame *const *undistorted_;
+  const Frame *const *registered_;
+  float *cloud_;
+};
+
+/** Bin a transformed point, already scaled to voxel units. */
+void PointCloudFusionImpl::addPoint(Device &dev, size_t i, float x, float y, float z, unsigned color) const
+{
+  // floor; anything outside of the key range (including NaN) is dropped
+  const float range = (float)COORD_OFFSET;
+  if (!(std::fabs(x) < range && std::fabs(y) < range && std::fabs(z) < range))
+  {
+    dev.shards[i] = NO_SHARD;
+    return;
+  }
+
+  const float fx = std::floor(x), fy = std::floor(y), fz = std::floor(z);
+  const uint64_t key = makeKey((int)fx, (int)fy, (int)fz);
+
+  dev.keys[i] = key;
+  dev.shards[i] = (unsigned char)(hash(key) >> 60);
+  dev.offsets[3 * i + 0] = (x - fx) * leaf_size;
+  dev.offsets[3 * i + 1] = (y - fy) * leaf_size;
+  dev.offsets[3 * i + 2] = (z - fz) * leaf_size;
+  dev.colors[i] = color;
+}
+
+void PointCloudFusionImpl::transformDevice(Device &dev, const float *depth_data, const unsigned *color_data) const
+{
+  // the transform is scaled to voxel units, so that the voxel is the integer part
+  float m[12];
+  for (int k = 0; k < 12; ++k)
+    m[k] = dev.m[k] * inv_leaf_size;
+
+  for (int r = 0; r < 424; ++r)
+  {
+    int c = 0;
+
+#ifdef LIBFREENECT2_WITH_SSE2
+    const __m128 thousand = _mm_set1_ps(1000.0f);
+    const __m128 min_depth = _mm_set1_ps(0.001f);
+    const __m128 ray_y4 = _mm_set1_ps(dev.ray_y[r]);
+
+    for (; c < 512; c += 4)
+    {
+      const size_t i = r * 512 + c;
+
+      // same scaling and validity check as Registration::getPointCloud(); NaN compares false
+      const __m128 z = _mm_div_ps(_mm_loadu_ps(depth_data + i), thousand);
+      const int valid = _mm_movemask_ps(_mm_cmpge_ps(z, min_depth));
+      if (valid == 0)
+      {
+        memset(&dev.shards[i], NO_SHARD, 4);
+        continue;
+      }
+
+      const __m128 x = _mm_mul_ps(z, _mm_loadu_ps(dev.ray_x + c));
+      const __m128 y = _mm_mul_ps(z, ray_y4);
+
+      float w[3][4];
+      for (int k = 0; k < 3; ++k)
+      {
+        const __m128 t = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[4 * k + 0]), x), _mm_mul_ps(_mm_set1_ps(m[4 * k + 1]), y)),
+                                    _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[4 * k + 2]), z), _mm_set1_ps(m[4 * k + 3])));
+        _mm_storeu_ps(w[k], t);
+      }
+
+      for (int k = 0; k < 4; ++k)
+      {
+        if (valid & (1 << k))
+          addPoint(dev, i + k, w[0][k], w[1][k], w[2][k], color_data ? color_data[i + k] : 0);
+        else
+          dev.shards[i + k] = NO_SHARD;
+      }
+    }
+#endif
+
+    for (; c < 512; ++c)
+    {
+      const size_t i = r * 512 + c;
+      const float z = depth_data[i] / 1000.0f;
+      if (!(z >= 0.001f))
+      {
+        dev.shards[i] = NO_SHARD;
+        continue;
+      }
+
+      const float x = z * dev.ray_x[c];
+      const float y = z * dev.ray_y[r];
+      addPoint(dev, i,
+               (m[0] * x + m[1] * y) + (m[2] * z + m[3]),
+               (m[4] * x + m[5] * y) + (m[6] * z + m[7]),
+               (m[8] * x + m[9] * y) + (m[10] * z + m[11]),
+               color_data ? color_data[i] : 0);
+    }
+  }
+
+  // counting sort of the valid pixels by shard
+  size_t count[SHARDS + 1] = {0};
+  for (size_t i = 0; i < SIZE_DEPTH; ++i)
+    if (dev.shards[i] != NO_SHARD)
+      ++count[dev.shards[i] + 1];
+
+  dev.shard_begin[0] = 0;
+  for (size_t s = 0; s < SHARDS; ++s)
+  {
+    dev.shard_begin[s + 1] = dev.shard_begin[s] + count[s + 1];
+    count[s + 1] = dev.shard_begin[s];
+  }
+
+  for (size_t i = 0; i < SIZE_DEPTH; ++i)
+    if (dev.shards[i] != NO_SHARD)
+      dev.order[count[dev.shards[i] + 1]++] = (unsigned)i;
+}
+
+void PointCloudFusionImpl::fuseShard(size_t s)
+{
+  Shard &shard = shards[s];
+  const size_t mask = shard.table.size() - 1;
+  shard.dropped = 0;
+
+  for (size_t d = 0; d < devices.size(); ++d)
+  {
+    const Device &dev = *devices[d];
+
+    for (size_t k = dev.shard_begin[s]; k < dev.shard_begin[s + 1]; ++k)
+    {
+      const unsigned i = dev.order[k];
+      const uint64_t key = dev.keys[i];
+
+      // the shard is selected by the top bits, so probe with the next ones
+      size_t slot = (size_t)(hash(key) >> 32) & mask;
+      while (shard.table[slot].key != key && shard.table[slot].key != EMPTY)
+        slot = (slot + 1) & mask;
+
+      Voxel &v = shard.table[slot];
+      if (v.key == EMPTY)
+      {
+        if (shard.used.size() == shard.limit)
+        {
+          shard.dropped++;
+          continue;
+        }
+        v.key = key;
+        v.sx = v.sy = v.sz = 0.0f;
+        v.n = v.nc = v.sb = v.sg = v.sr = 0;
+        shard.used.push_back((unsigned)slot);
+      }
+
+      v.sx += dev.offsets[3 * i + 0];
+      v.sy += dev.offsets[3 * i + 1];
+      v.sz += dev.offsets[3 * i + 2];
+      v.n++;
+
+      // registered pixels without color are 0
+      const unsigned color = dev.colors[i];
+      if (color != 0)
+      {
+        v.nc++;
+        v.sb += color & 0xff;
+        v.sg += (color >> 8) & 0xff;
+        v.sr += (color >> 16) & 0xff;
+      }
+    }
+  }
+}
+
+void PointCloudFusionImpl::emitShard(size_t s, float *cloud)
+{
+  Shard &shard = shards[s];
+  float *out = cloud + 4 * shard_offset[s];
+  const size_t count = shard_offset[s + 1] - shard_offset[s];
+  const uint64_t coord_mask = ((uint64_t)1 << COORD_BITS) - 1;
+
+  for (size_t k = count; k < shard.used.size(); ++k)
+  {
+    Voxel &v = shard.table[shard.used[k]];
+    shard.dropped += v.n;
+    v.key = EMPTY;
+  }
+
+  for (size_t k = 0; k < count; ++k, out += 4)
+  {
+    Voxel &v = shard.table[shard.used[k]];
+
+    const int ix = (int)((v.key >> (2 * COORD_BITS)) & coord_mask) - COORD_OFFSET;
+    const int iy = (int)((v.key >> COORD_BITS) & coord_mask) - COORD_OFFSET;
+    const int iz = (int)(v.key & coord_mask) - COORD_OFFSET;
+    const float inv_n = 1.0f / v.n;
+
+    out[0] = ix * leaf_size + v.sx * inv_n;
+    out[1] = iy * leaf_size + v.sy * inv_n;
+    out[2] = iz * leaf_size + v.sz * inv_n;
+
+    unsigned color = 0;
+    if (v.nc > 0)
+      color = (v.sb / v.nc) | ((v.sg / v.nc) << 8) | ((v.sr / v.nc) << 16);
+    memcpy(out + 3, &color, sizeof(color));
+
+    // leave the table empty for the next frame set
+    v.key = EMPTY;
+  }
+  shard.used.clear();
+}
+
+PointCloudFusion::PointCloudFusion(float leaf_size, size_t max_voxels):
+  impl_(new PointCloudFusionImpl(leaf_size, max_voxels)) {}
+
+PointCloudFusion::~PointCloudFusion()
+{
+  delete impl_;
+}
+
+size_t PointCloudFusion::addDevice(const Freenect2Device::IrCameraParams &depth_p, const float extrinsics[16])
+{
+  PointCloudFusionImpl::Device *dev = new PointCloudFusionImpl::Device();
+
+  for (int x = 0; x < 512; x++)
+    dev->ray_x[x] = (x + 0.5 - depth_p.cx) / depth_p.fx;
+  for (int y = 0; y < 424; y++)
+    dev->ray_y[y] = (y + 0.5 - depth_p.cy) / depth_p.fy;
+
+  const size_t size = PointCloudFusionImpl::SIZE_DEPTH;
+  dev->keys.resize(size);
+  dev->shards.resize(size);
+  dev->offsets.resize(size * 3);
+  dev->colors.resize(size);
+  dev->order.resize(size);
+
+  libfreenect2::lock_guard l(impl_->mutex);
+  impl_->devices.push_back(dev);
+  const size_t index = impl_->devices.size() - 1;
+  memcpy(dev->m, extrinsics, sizeof(dev->m));
+  return index;
+}
+
+void PointCloudFusion::setExtrinsics(size_t device, const float extrinsics[16])
+{
+  libfreenect2::lock_guard l(impl_->mutex);
+  if (device < impl_->devices.size())
+    memcpy(impl_->devices[device]->m, extrinsics, sizeof(impl_->devices[device]->m));
+}
+
+size_t PointCloudFusion::getDeviceCount() const
+{
+  libfreenect2::lock_guard l(impl_->mutex);
+  return impl_->devices.size();
+}
+
+size_t PointCloudFusion::fuse(const Frame *const *undistorted, const Frame *const *registered, float *cloud)
+{
+  if (!undistorted || !cloud)
+    return 0;
+
+  libfreenect2::lock_guard l(impl_->mutex);
+
+  const size_t num_devices = impl_->devices.size();
+
+  // Check if all frames are valid and have the correct size
+  std::vector<size_t> active;
+  for (size_t d = 0; d < num_devices; ++d)
+  {
+    const Frame *depth = undistorted[d];
+    const Frame *color = registered ? registered[d] : NULL;
+    if ((depth && (depth->width != 512 || depth->height != 424 || depth->bytes_per_pixel != 4)) ||
+        (color && (color->width != 512 || color->height != 424 || color->bytes_per_pixel != 4)))
+      return 0;
+
+    if (depth)
+    {
+      active.push_back(d);
+    }
+    else
+    {
+      // skipped devices add no points
+      for (size_t s = 0; s <= PointCloudFusionImpl::SHARDS; ++s)
+        impl_->devices[d]->shard_begin[s] = 0;
+    }
+  }
+
+  if (!impl_->pool)
+    impl_->pool = new WorkerPool(WorkerPool::defaultSize() - 1, "PointCloudFusion");
+
+  PointCloudFusionImpl::Pass transform_pass(*impl_, PointCloudFusionImpl::Pass::Transform, &active, undistorted, registered);
+  impl_->pool->run(transform_pass, active.size());
+
+  PointCloudFusionImpl::Pass fuse_pass(*impl_, PointCloudFusionImpl::Pass::Fuse);
+  impl_->pool->run(fuse_pass, PointCloudFusionImpl::SHARDS);
+
+  // shards are written one after another; the voxels past max_voxels are dropped from the last ones
+  impl_->shard_offset[0] = 0;
+  for (size_t s = 0; s < PointCloudFusionImpl::SHARDS; ++s)
+  {
+    const size_t room = impl_->max_voxels - impl_->shard_offset[s];
+    impl_->shard_offset[s + 1] = impl_->shard_offset[s] + std::min(impl_->shards[s].used.size(), room);
+  }
+
+  PointCloudFusionImpl::Pass emit_pass(*impl_, PointCloudFusionImpl::Pass::Emit, NULL, NULL, NULL, cloud);
+  impl_->pool->run(emit_pass, PointCloudFusionImpl::SHARDS);
+
+  impl_->dropped = 0;
+  for (size_t s = 0; s < PointCloudFusionImpl::SHARDS; ++s)
+    impl_->dropped += impl_->shards[s].dropped;
+
+  return impl_->shard_offset[PointCloudFusionImpl::SHARDS];
+}
+
+size_t PointCloudFusion::getDroppedPoints() const
+{
+  libfreenect2::lock_guard l(impl_->mutex);
+  return impl_->dropped;
+}
+
+} /* namespace libfreenect2 */
@@ -29,7 +29,15 @@
 #define _USE_MATH_DEFINES
 #include <math.h>
 #include <libfreenect2/registration.h>
+#include <libfreenect2/threading.h>
+#include <libfreenect2/worker_pool.h>
+#include <libfreenect2/distortion.h>
+#include <libfreenect2/simd.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <limits>
+#include <vector>
 
 namespace libfreenect2
 {
@@ -39,71 +47,185 @@ namespace libfreenect2
  * provided by @sh0 in https://github.com/OpenKinect/libfreenect2/issues/41
  */
 
-// these seem to be hardcoded in the original SDK
-static const float depth_q = 0.01;
-static const float color_q = 0.002199;
+/** Lookup tables of one set of camera parameters.
+ * They are immutable once built, and shared by all registrations with the same parameters.
+ */
+struct RegistrationTables
+{
+  Freenect2Device::IrCameraParams depth;
+  Freenect2Device::ColorCameraParams color;
+  size_t refs; ///< Registrations using the tables, guarded by the cache mutex.
+
+  int distort_map[512 * 424];
+  float depth_to_color_map_x[512 * 424];
+  float depth_to_color_map_y[512 * 424];
+  int depth_to_color_map_yi[512 * 424];
+  int depth_to_color_map_yoff[512 * 424]; ///< Color row offset, depth_to_color_map_yi * 1920.
+  int depth_row_min_yi[424]; ///< Lowest color row a depth row maps to.
+  int depth_row_max_yi[424]; ///< Highest color row a depth row maps to.
+  float ray_x[512]; ///< x/z of the ray through each undistorted depth column.
+  float ray_y[424]; ///< y/z of the ray through each undistorted depth row.
+
+  class Build;
+
+  RegistrationTables(const Freenect2Device::IrCameraParams &depth_p, const Freenect2Device::ColorCameraParams &rgb_p, WorkerPool &pool);
+  void buildRows(int y_begin, int y_end);
+
+  bool matches(const Freenect2Device::IrCameraParams &depth_p, const Freenect2Device::ColorCameraParams &rgb_p) const
+  {
+    return memcmp(&depth, &depth_p, sizeof(depth)) == 0 && memcmp(&color, &rgb_p, sizeof(color)) == 0;
+  }
+
+  /** Get the shared tables of the parameters, building them on @p pool if needed. */
+  static RegistrationTables *acquire(const Freenect2Device::IrCameraParams &depth_p, const Freenect2Device::ColorCameraParams &rgb_p, WorkerPool &pool);
+  static void release(RegistrationTables *tables);
+};
 
 class RegistrationImpl
 {
 public:
   RegistrationImpl(Freenect2Device::IrCameraParams depth_p, Freenect2Device::ColorCameraParams rgb_p);
+  ~RegistrationImpl();
 
   void apply(int dx, int dy, float dz, float& cx, float &cy) const;
   void apply(const Frame* rgb, const Frame* depth, Frame* undistorted, Frame* registered, const bool enable_filter, Frame* bigdepth, int* color_depth_map) const;
+  void mapDepthToColor(const Frame *depth, Frame *color_depth, int max_hole) const;
   void undistortDepth(const Frame *depth, Frame *undistorted) const;
   void getPointXYZRGB (const Frame* undistorted, const Frame* registered, int r, int c, float& x, float& y, float& z, float& rgb) const;
   void getPointXYZ (const Frame* undistorted, int r, int c, float& x, float& y, float& z) const;
-  void distort(int mx, int my, float& dx, float& dy) const;
-  void depth_to_color(float mx, float my, float& rx, float& ry) const;
+  size_t getPointCloud(const Frame* undistorted, const Frame* registered, float* cloud, Registration::PointCloudLayout layout, bool compact) const;
+  size_t getNormals(const Frame* undistorted, float* normals, int step, float max_depth_change) const;
 
 private:
+  /** Color pixels covered by a depth pixel in mapDepthToColor(), inclusive bounds; z is 0 if none. */
+  struct Splat
+  {
+    float z;
+    short x0, x1, y0, y1;
+  };
+
+  /** Buffers of one apply() or mapDepthToColor() call, shared by the passes. */
+  struct Job
+  {
+    const float *depth_data;
+    const unsigned int *rgb_data;
+    int rgb_shift;                   ///< log2 of the downscale factor of rgb_data, see colorIndex().
+    float *undistorted_data;
+    unsigned int *registered_data;
+    int *c_off;
+    float *filter_map; ///< Start of the filter map including its border rows, or NULL.
+    /** Written columns [begin, end) of each filter map row, or NULL if the whole map is initialized (bigdepth).
+     * On entry they hold the columns written by the previous call, which are the only values not at infinity.
+     */
+    int *dirty_begin;
+    int *dirty_end;
+
+    float *color_depth;              ///< Depth-in-color z-buffer (mapDepthToColor).
+    unsigned short *color_depth16;   ///< uint16 output, converted from color_depth, or NULL.
+    int color_width;
+    int color_height;
+    float color_scale;               ///< Output resolution relative to 1920x1080.
+    int max_hole;
+    Splat *splats;                   ///< Footprint of each depth pixel.
+    int *splat_counts;               ///< Footprints per top row found by each part, then where each part puts them.
+    int *splat_spans;                ///< Most rows below its top row any footprint of each part reaches.
+    Splat *sorted_splats;            ///< Footprints that cover a pixel, sorted by their top row.
+    const int *splat_row_start;      ///< Start in sorted_splats of each top row, color_height + 1 entries.
+    int splat_span;                  ///< Most rows below its top row any footprint reaches.
+
+    float *normals;                  ///< Normal map, 3 floats per depth pixel (getNormals).
+    int normal_step;
+    float max_depth_change;
+    size_t *normal_counts;           ///< Valid normals found by each part.
+  };
+
+  /** Working memory reused between calls; each call in flight has its own. */
+  struct Scratch
+  {
+    std::vector<int> c_off;
+    std::vector<float> filter_map;
+    std::vector<int> dirty_begin;
+    std::vector<int> dirty_end;
+    std::vector<float> color_depth;
+    std::vector<Splat> splats;
+    std::vector<int> splat_counts;
+    std::vector<int> splat_spans;
+    std::vector<Splat> sorted_splats;
+    std::vector<int> splat_row_start;
+  };
+
+  class Pass;
+
+  Scratch *acquireScratch() const;
+  void releaseScratch(Scratch *scratch) const;
+
+  void mapRows(const Job &job, int y_begin, int y_end) const;
+  void filterRows(const Job &job, int row_begin, int row_end) const;
+  void registerRows(const Job &job, int y_begin, int y_end) const;
+  void footprintRows(const Job &job, int y_begin, int y_end, int *counts, int &span) const;
+  void bucketRows(const Job &job, int y_begin, int y_end, int *next) const;
+  void splatRows(const Job &job, int row_begin, int row_end) const;
+  size_t normalRows(const Job &job, int y_begin, int y_end) const;
+
   Freenect2Device::IrCameraParams depth;    ///< Depth camera parameters.
   Freenect2Device::ColorCameraParams color; ///< Color camera parameters.
 
-  int distort_map[512 * 424];
-  float depth_to_color_map_x[512 * 424];
-  float depth_to_color_map_y[512 * 424];
-  int depth_to_color_map_yi[512 * 424];
+  // The pool comes first: it builds the tables, which are shared and aliased by the pointers below.
+  // All registrations share one pool.
+  WorkerPool *pool_;
+  RegistrationTables *tables_;
+
+  const int *distort_map;
+  const float *depth_to_color_map_x;
+  const float *depth_to_color_map_y;
+  const int *depth_to_color_map_yi;
+  const int *depth_to_color_map_yoff;
+  const int *depth_row_min_yi;
+  const int *depth_row_max_yi;
+  const float *ray_x;
+  const float *ray_y;
 
   const int filter_width_half;
   const int filter_height_half;
   const float filter_tolerance;
-};
 
-void RegistrationImpl::distort(int mx, int my, float& x, float& y) const
-{
-  // see http://en.wikipedia.org/wiki/Distortion_(optics) for description
-  float dx = ((float)mx - depth.cx) / depth.fx;
-  float dy = ((float)my - depth.cy) / depth.fy;
-  float dx2 = dx * dx;
-  float dy2 = dy * dy;
-  float r2 = dx2 + dy2;
-  float dxdy2 = 2 * dx * dy;
-  float kr = 1 + ((depth.k3 * r2 + depth.k2) * r2 + depth.k1) * r2;
-  x = depth.fx * (dx * kr + depth.p2 * (r2 + 2 * dx2) + depth.p1 * dxdy2) + depth.cx;
-  y = depth.fy * (dy * kr + depth.p1 * (r2 + 2 * dy2) + depth.p2 * dxdy2) + depth.cy;
-}
+  // Idle scratch buffers; the mutex is only held to take or return one, so concurrent calls run in parallel.
+  mutable libfreenect2::mutex mutex_;
+  mutable std::vector<Scratch *> scratch_;
+};
 
-void RegistrationImpl::depth_to_color(float mx, float my, float& rx, float& ry) const
+/** One pass of apply(), split into parts for the worker pool. */
+class RegistrationImpl::Pass : public WorkerPool::Task
 {
-  mx = (mx - depth.cx) * depth_q;
-  my = (my - depth.cy) * depth_q;
+public:
+  enum Kind { Map, Filter, Register, Footprint, Bucket, Splat, Normals };
 
-  float wx =
-    (mx * mx * mx * color.mx_x3y0) + (my * my * my * color.mx_x0y3) +
-    (mx * mx * my * color.mx_x2y1) + (my * my * mx * color.mx_x1y2) +
-    (mx * mx * color.mx_x2y0) + (my * my * color.mx_x0y2) + (mx * my * color.mx_x1y1) +
-    (mx * color.mx_x1y0) + (my * color.mx_x0y1) + (color.mx_x0y0);
+  Pass(const RegistrationImpl &impl, const Job &job, Kind kind, int size):
+    impl_(impl), job_(job), kind_(kind), size_(size) {}
 
-  float wy =
-    (mx * mx * mx * color.my_x3y0) + (my * my * my * color.my_x0y3) +
-    (mx * mx * my * color.my_x2y1) + (my * my * mx * color.my_x1y2) +
-    (mx * mx * color.my_x2y0) + (my * my * color.my_x0y2) + (mx * my * color.my_x1y1) +
-    (mx * color.my_x1y0) + (my * color.my_x0y1) + (color.my_x0y0);
+  virtual void run(size_t index, size_t count)
+  {
+    // contiguous blocks of rows; the filter map and splats are split by color rows, the others by depth rows
+    const int begin = size_ * index / count;
+    const int end = size_ * (index + 1) / count;
+    switch (kind_)
+    {
+    case Map: impl_.mapRows(job_, begin, end); break;
+    case Filter: impl_.filterRows(job_, begin, end); break;
+    case Register: impl_.registerRows(job_, begin, end); break;
+    case Footprint: impl_.footprintRows(job_, begin, end, job_.splat_counts + index * job_.color_height, job_.splat_spans[index]); break;
+    case Bucket: impl_.bucketRows(job_, begin, end, job_.splat_counts + index * job_.color_height); break;
+    case Splat: impl_.splatRows(job_, begin, end); break;
+    case Normals: job_.normal_counts[index] = impl_.normalRows(job_, begin, end); break;
+    }
+  }
 
-  rx = (wx / (color.fx * color_q)) - (color.shift_m / color.shift_d);
-  ry = (wy / color_q) + color.cy;
-}
+private:
+  const RegistrationImpl &impl_;
+  const Job &job_;
+  const Kind kind_;
+  const int size_;
+};
 
 void Registration::apply( int dx, int dy, float dz, float& cx, float &cy) const
 {
@@ -129,101 +251,217 @@ void RegistrationImpl::apply(const Frame *rgb, const Frame *depth, Frame *undist
 {
   // Check if all frames are valid and have the correct size
   if (!rgb || !depth || !undistorted || !registered ||
-      rgb->width != 1920 || rgb->height != 1080 || rgb->bytes_per_pixel != 4 ||
+      !((rgb->width == 1920 && rgb->height == 1080) || (rgb->width == 960 && rgb->height == 540) || (rgb->width == 480 && rgb->height == 270)) ||
+      rgb->bytes_per_pixel != 4 ||
       depth->width != 512 || depth->height != 424 || depth->bytes_per_pixel != 4 ||
       undistorted->width != 512 || undistorted->height != 424 || undistorted->bytes_per_pixel != 4 ||
       registered->width != 512 || registered->height != 424 || registered->bytes_per_pixel != 4)
     return;
 
-  const float *depth_data = (float*)depth->data;
-  const unsigned int *rgb_data = (unsigned int*)rgb->data;
-  float *undistorted_data = (float*)undistorted->data;
-  unsigned int *registered_data = (unsigned int*)registered->data;
-  const int *map_dist = distort_map;
-  const float *map_x = depth_to_color_map_x;
-  const int *map_yi = depth_to_color_map_yi;
-
   const int size_depth = 512 * 424;
   const int size_color = 1920 * 1080;
-  const float color_cx = color.cx + 0.5f; // 0.5f added for later rounding
 
   // size of filter map with a border of filter_height_half on top and bottom so that no check for borders is needed.
   // since the color image is wide angle no border to the sides is needed.
+  const int filter_rows = 1080 + filter_height_half * 2;
   const int size_filter_map = size_color + 1920 * filter_height_half * 2;
-  // offset to the important data
-  const int offset_filter_map = 1920 * filter_height_half;
 
-  // map for storing the min z values used for each color pixel
-  float *filter_map = NULL;
-  // pointer to the beginning of the important data
-  float *p_filter_map = NULL;
+  Scratch *scratch = acquireScratch();
 
-  // map for storing the color offset for each depth pixel
-  int *depth_to_c_off = color_depth_map ? color_depth_map : new int[size_depth];
-  int *map_c_off = depth_to_c_off;
+  Job job;
+  job.depth_data = (const float*)depth->data;
+  job.rgb_data = (const unsigned int*)rgb->data;
+  job.rgb_shift = rgb->width == 1920 ? 0 : rgb->width == 960 ? 1 : 2;
+  job.undistorted_data = (float*)undistorted->data;
+  job.registered_data = (unsigned int*)registered->data;
 
-  // initializing the depth_map with values outside of the Kinect2 range
-  if(enable_filter){
-    filter_map = bigdepth ? (float*)bigdepth->data : new float[size_filter_map];
-    p_filter_map = filter_map + offset_filter_map;
+  // map for storing the color offset for each depth pixel
+  if (color_depth_map)
+  {
+    job.c_off = color_depth_map;
+  }
+  else
+  {
+    scratch->c_off.resize(size_depth);
+    job.c_off = &scratch->c_off[0];
+  }
 
-    for(float *it = filter_map, *end = filter_map + size_filter_map; it != end; ++it){
-      *it = std::numeric_limits<float>::infinity();
+  // map for storing the min z values used for each color pixel
+  job.filter_map = NULL;
+  job.dirty_begin = NULL;
+  job.dirty_end = NULL;
+  if (enable_filter)
+  {
+    if (bigdepth)
+    {
+      // returned to the caller, so every value must be set
+      job.filter_map = (float*)bigdepth->data;
+    }
+    else
+    {
+      // initialized once; afterwards only the windows written by the previous call are reset
+      scratch->filter_map.resize(size_filter_map, std::numeric_limits<float>::infinity());
+      scratch->dirty_begin.resize(filter_rows, 0);
+      scratch->dirty_end.resize(filter_rows, 0);
+      job.filter_map = &scratch->filter_map[0];
+      job.dirty_begin = &scratch->dirty_begin[0];
+      job.dirty_end = &scratch->dirty_end[0];
     }
   }
 
+  // Rows are split into more parts than threads, so a slow thread does not hold up the pass.
+  const size_t parts = pool_->size() * 4;
+
   /* Fix depth distortion, and compute pixel to use from 'rgb' based on depth measurement,
    * stored as x/y offset in the rgb data.
    */
+  Pass map_pass(*this, job, Pass::Map, 424);
+  pool_->run(map_pass, parts);
+
+  /* Filter drops duplicate pixels due to aspect of two cameras.
+   * Each part owns a band of color rows and only writes inside it, so the min-splat needs no locking.
+   */
+  if (enable_filter)
+  {
+    Pass filter_pass(*this, job, Pass::Filter, filter_rows);
+    pool_->run(filter_pass, parts);
+  }
+
+  /* Construct 'registered' image. */
+  Pass register_pass(*this, job, Pass::Register, 424);
+  pool_->run(register_pass, parts);
+
+  releaseScratch(scratch);
+}
+
+void RegistrationImpl::mapRows(const Job &job, int y_begin, int y_end) const
+{
+  const int size_color = 1920 * 1080;
+  const float color_cx = color.cx + 0.5f; // 0.5f added for later rounding
+
+  int i = y_begin * 512;
+  const int end = y_end * 512;
+
+#ifdef LIBFREENECT2_WITH_SSE2
+  const __m128 shift_m = _mm_set1_ps(color.shift_m);
+  const __m128 fx = _mm_set1_ps(color.fx);
+  const __m128 cx = _mm_set1_ps(color_cx);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128i minus_one = _mm_set1_epi32(-1);
+  const __m128i c_end = _mm_set1_epi32(size_color);
+
+  // rows are 512 pixels, so there is no remainder
+  for(; i < end; i += 4){
+    // the distorted pixels are scattered, load them one by one; pixels outside the depth image read index 0 and get z = 0
+    const __m128i index4 = _mm_loadu_si128((const __m128i*)(distort_map + i));
+    const __m128i inside = _mm_cmpgt_epi32(index4, minus_one);
+    int index[4];
+    _mm_storeu_si128((__m128i*)index, _mm_and_si128(inside, index4));
+    const __m128 z = _mm_and_ps(_mm_castsi128_ps(inside), _mm_setr_ps(job.depth_data[index[0]], job.depth_data[index[1]], job.depth_data[index[2]], job.depth_data[index[3]]));
+    _mm_storeu_ps(job.undistorted_data + i, z);
+
+    const __m128 rx = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_loadu_ps(depth_to_color_map_x + i), _mm_div_ps(shift_m, z)), fx), cx);
+    const __m128i c_off = _mm_add_epi32(_mm_cvttps_epi32(rx), _mm_loadu_si128((const __m128i*)(depth_to_color_map_yoff + i)));
+
+    // valid if z > 0 (also false for pixels outside the depth image and for NaN) and c_off inside the rgb image
+    __m128i valid = _mm_castps_si128(_mm_cmpgt_ps(z, zero));
+    valid = _mm_and_si128(valid, _mm_cmpgt_epi32(c_off, minus_one));
+    valid = _mm_and_si128(valid, _mm_cmplt_epi32(c_off, c_end));
+
+    _mm_storeu_si128((__m128i*)(job.c_off + i), _mm_or_si128(_mm_and_si128(valid, c_off), _mm_andnot_si128(valid, minus_one)));
+  }
+#endif
 
   // iterating over all pixels from undistorted depth and registered color image
-  // the four maps have the same structure as the images, so their pointers are increased each iteration as well
-  for(int i = 0; i < size_depth; ++i, ++undistorted_data, ++map_dist, ++map_x, ++map_yi, ++map_c_off){
+  for(; i < end; ++i){
     // getting index of distorted depth pixel
-    const int index = *map_dist;
+    const int index = distort_map[i];
 
     // check if distorted depth pixel is outside of the depth image
     if(index < 0){
-      *map_c_off = -1;
-      *undistorted_data = 0;
+      job.c_off[i] = -1;
+      job.undistorted_data[i] = 0;
       continue;
     }
 
     // getting depth value for current pixel
-    const float z = depth_data[index];
-    *undistorted_data = z;
+    const float z = job.depth_data[index];
+    job.undistorted_data[i] = z;
 
     // checking for invalid depth value
-    if(z <= 0.0f){
-      *map_c_off = -1;
+    if(!(z > 0.0f)){
+      job.c_off[i] = -1;
       continue;
     }
 
     // calculating x offset for rgb image based on depth value
-    const float rx = (*map_x + (color.shift_m / z)) * color.fx + color_cx;
+    const float rx = (depth_to_color_map_x[i] + (color.shift_m / z)) * color.fx + color_cx;
     const int cx = rx; // same as round for positive numbers (0.5f was already added to color_cx)
-    // getting y offset for depth image
-    const int cy = *map_yi;
     // combining offsets
-    const int c_off = cx + cy * 1920;
+    const int c_off = cx + depth_to_color_map_yoff[i];
 
     // check if c_off is outside of rgb image
     // checking rx/cx is not needed because the color image is much wider then the depth image
-    if(c_off < 0 || c_off >= size_color){
-      *map_c_off = -1;
-      continue;
+    job.c_off[i] = c_off < 0 || c_off >= size_color ? -1 : c_off;
+  }
+}
+
+void RegistrationImpl::filterRows(const Job &job, int row_begin, int row_end) const
+{
+  // this part owns filter map rows [row_begin, row_end)
+  float *filter_map = job.filter_map;
+  const int first = row_begin * 1920;
+  const int last = row_end * 1920;
+  const int filter_width = filter_width_half * 2 + 1;
+  const float infinity = std::numeric_limits<float>::infinity();
+  int *dirty_begin = job.dirty_begin;
+  int *dirty_end = job.dirty_end;
+
+  // initializing the depth_map with values outside of the Kinect2 range
+  if(!dirty_begin){
+    std::fill(filter_map + first, filter_map + last, infinity);
+  }
+  else{
+    // only the columns written by the previous call are not at infinity
+    for(int row = row_begin; row < row_end; ++row){
+      if(dirty_begin[row] < dirty_end[row])
+        std::fill(filter_map + row * 1920 + dirty_begin[row], filter_map + row * 1920 + dirty_end[row], infinity);
+      dirty_begin[row] = 1920;
+      dirty_end[row] = 0;
     }
+  }
 
-    // saving the offset for later
-    *map_c_off = c_off;
+  for(int y = 0; y < 424; ++y){
+    // The window of color row cy covers filter map rows cy to cy + 2 * filter_height_half.
+    // Windows near the left or right edge spill into the neighboring row, hence the extra row.
+    if(depth_row_max_yi[y] + filter_height_half * 2 + 1 < row_begin || depth_row_min_yi[y] - 1 >= row_end)
+      continue;
+
+    // color columns reached by this depth row, for resetting the filter map in the next call
+    int min_cx = std::numeric_limits<int>::max();
+    int max_cx = std::numeric_limits<int>::min();
+
+    for(int i = y * 512, end = i + 512; i < end; ++i){
+      const int c_off = job.c_off[i];
+      if(c_off < 0)
+        continue;
+
+      const float z = job.undistorted_data[i];
+      const int cx = c_off - depth_to_color_map_yoff[i];
+      min_cx = std::min(min_cx, cx);
+      max_cx = std::max(max_cx, cx);
 
-    if(enable_filter){
       // setting a window around the filter map pixel corresponding to the color pixel with the current z value
-      int yi = (cy - filter_height_half) * 1920 + cx - filter_width_half; // index of first pixel to set
+      // (the border of filter_height_half rows cancels the window's upward offset)
+      int yi = c_off - filter_width_half; // index of first pixel to set
       for(int r = -filter_height_half; r <= filter_height_half; ++r, yi += 1920) // index increased by a full row each iteration
       {
-        float *it = p_filter_map + yi;
-        for(int c = -filter_width_half; c <= filter_width_half; ++c, ++it)
+        const int begin = std::max(yi, first);
+        const int end = std::min(yi + filter_width, last);
+
+        float *it = filter_map + begin;
+        float *it_end = filter_map + end;
+        for(; it < it_end; ++it)
         {
           // only set if the current z is smaller
           if(z < *it)
@@ -231,46 +469,297 @@ void RegistrationImpl::apply(const Frame *rgb, const Frame *depth, Frame *undist
         }
       }
     }
+
+    // Recording the written columns as a rectangle around the windows of this depth row.
+    // Resetting a few extra values is harmless; this keeps the bookkeeping out of the pixel loop.
+    if(dirty_begin && min_cx <= max_cx){
+      for(int r = depth_row_min_yi[y]; r <= depth_row_max_yi[y] + filter_height_half * 2; ++r){
+        // windows at the left or right edge continue in the neighboring row
+        const int begin = std::max(r * 1920 + min_cx - filter_width_half, first);
+        const int end = std::min(r * 1920 + max_cx + filter_width_half + 1, last);
+        for(int row = begin / 1920; begin < end && row * 1920 < end; ++row){
+          dirty_begin[row] = std::min(dirty_begin[row], std::max(begin - row * 1920, 0));
+          dirty_end[row] = std::max(dirty_end[row], std::min(end - row * 1920, 1920));
+        }
+      }
+    }
   }
+}
 
-  /* Construct 'registered' image. */
+/** Index into a color frame downscaled by 2^shift of the pixel covering full resolution pixel c_off. */
+static inline int colorIndex(int c_off, int shift)
+{
+  if(shift == 0)
+    return c_off;
 
-  // reseting the pointers to the beginning
-  map_c_off = depth_to_c_off;
-  undistorted_data = (float*)undistorted->data;
+  const int row = c_off / 1920;
+  return (row >> shift) * (1920 >> shift) + ((c_off - row * 1920) >> shift);
+}
 
-  /* Filter drops duplicate pixels due to aspect of two cameras. */
-  if(enable_filter){
-    // run through all registered color pixels and set them based on filter results
-    for(int i = 0; i < size_depth; ++i, ++map_c_off, ++undistorted_data, ++registered_data){
-      const int c_off = *map_c_off;
+void RegistrationImpl::registerRows(const Job &job, int y_begin, int y_end) const
+{
+  // pointer to the beginning of the important data
+  const float *p_filter_map = job.filter_map ? job.filter_map + 1920 * filter_height_half : NULL;
 
-      // check if offset is out of image
-      if(c_off < 0){
-        *registered_data = 0;
-        continue;
-      }
+  int i = y_begin * 512;
+  const int end = y_end * 512;
+
+#ifdef LIBFREENECT2_WITH_SSE2
+  const __m128i minus_one = _mm_set1_epi32(-1);
+  const __m128 tolerance = _mm_set1_ps(filter_tolerance);
+
+  for(; i < end; i += 4){
+    const __m128i c_off4 = _mm_loadu_si128((const __m128i*)(job.c_off + i));
+    __m128i keep = _mm_cmpgt_epi32(c_off4, minus_one);
+
+    // the color pixels are scattered, load them one by one; pixels without color read index 0
+    int c_off[4];
+    _mm_storeu_si128((__m128i*)c_off, _mm_and_si128(keep, c_off4));
+    const __m128i rgb = _mm_setr_epi32(job.rgb_data[colorIndex(c_off[0], job.rgb_shift)], job.rgb_data[colorIndex(c_off[1], job.rgb_shift)],
+                                       job.rgb_data[colorIndex(c_off[2], job.rgb_shift)], job.rgb_data[colorIndex(c_off[3], job.rgb_shift)]);
+
+    if(p_filter_map){
+      const __m128 min_z = _mm_setr_ps(p_filter_map[c_off[0]], p_filter_map[c_off[1]], p_filter_map[c_off[2]], p_filter_map[c_off[3]]);
+      const __m128 z = _mm_loadu_ps(job.undistorted_data + i);
 
+      // check for allowed depth noise
+      const __m128 occluded = _mm_cmpgt_ps(_mm_div_ps(_mm_sub_ps(z, min_z), z), tolerance);
+      keep = _mm_andnot_si128(_mm_castps_si128(occluded), keep);
+    }
+
+    _mm_storeu_si128((__m128i*)(job.registered_data + i), _mm_and_si128(keep, rgb));
+  }
+#endif
+
+  // run through all registered color pixels and set them based on c_off and the filter results
+  for(; i < end; ++i){
+    const int c_off = job.c_off[i];
+
+    // check if offset is out of image
+    if(c_off < 0){
+      job.registered_data[i] = 0;
+      continue;
+    }
+
+    if(p_filter_map){
       const float min_z = p_filter_map[c_off];
-      const float z = *undistorted_data;
+      const float z = job.undistorted_data[i];
 
       // check for allowed depth noise
-      *registered_data = (z - min_z) / z > filter_tolerance ? 0 : *(rgb_data + c_off);
+      job.registered_data[i] = (z - min_z) / z > filter_tolerance ? 0 : job.rgb_data[colorIndex(c_off, job.rgb_shift)];
+    }
+    else
+    {
+      job.registered_data[i] = job.rgb_data[colorIndex(c_off, job.rgb_shift)];
     }
+  }
+}
+
+void Registration::mapDepthToColor(const Frame *depth, Frame *color_depth, int max_hole) const
+{
+  impl_->mapDepthToColor(depth, color_depth, max_hole);
+}
+
+void RegistrationImpl::mapDepthToColor(const Frame *depth, Frame *color_depth, int max_hole) const
+{
+  // Check if all frames are valid and have the correct size
+  if (!depth || !color_depth ||
+      depth->width != 512 || depth->height != 424 || depth->bytes_per_pixel != 4 ||
+      !((color_depth->width == 1920 && color_depth->height == 1080) || (color_depth->width == 960 && color_depth->height == 540)) ||
+      (color_depth->bytes_per_pixel != 4 && color_depth->bytes_per_pixel != 2))
+    return;
+
+  Scratch *scratch = acquireScratch();
 
-    if (!bigdepth) delete[] filter_map;
+  Job job;
+  job.depth_data = (const float*)depth->data;
+  job.color_width = color_depth->width;
+  job.color_height = color_depth->height;
+  job.color_scale = color_depth->width / 1920.0f;
+  job.max_hole = max_hole;
+
+  if (color_depth->bytes_per_pixel == 4)
+  {
+    // splat straight into the output
+    job.color_depth = (float*)color_depth->data;
+    job.color_depth16 = NULL;
+    color_depth->format = Frame::Float;
   }
   else
   {
-    // run through all registered color pixels and set them based on c_off
-    for(int i = 0; i < size_depth; ++i, ++map_c_off, ++registered_data){
-      const int c_off = *map_c_off;
+    scratch->color_depth.resize(color_depth->width * color_depth->height);
+    job.color_depth = &scratch->color_depth[0];
+    job.color_depth16 = (unsigned short*)color_depth->data;
+    color_depth->format = Frame::UInt16;
+  }
+
+  const size_t parts = pool_->size() * 4;
+
+  /* Bucket the footprints by their top row, so each band of the splat only visits the depth pixels reaching it.
+   * Every part counts the footprints of its depth rows, then copies them to its share of each bucket.
+   */
+  scratch->splats.resize(512 * 424);
+  scratch->splat_counts.assign(parts * job.color_height, 0);
+  scratch->splat_spans.assign(parts, 0);
+  job.splats = &scratch->splats[0];
+  job.splat_counts = &scratch->splat_counts[0];
+  job.splat_spans = &scratch->splat_spans[0];
+  Pass footprint_pass(*this, job, Pass::Footprint, 424);
+  pool_->run(footprint_pass, parts);
+
+  std::vector<int> &row_start = scratch->splat_row_start;
+  row_start.resize(job.color_height + 1);
+  int total = 0;
+  for (int yy = 0; yy < job.color_height; ++yy)
+  {
+    row_start[yy] = total;
+    for (size_t p = 0; p < parts; ++p)
+    {
+      int &count = job.splat_counts[p * job.color_height + yy];
+      const int n = count;
+      count = total;
+      total += n;
+    }
+  }
+  row_start[job.color_height] = total;
+  job.splat_span = *std::max_element(scratch->splat_spans.begin(), scratch->splat_spans.end());
+
+  scratch->sorted_splats.resize(total + 1);
+  job.sorted_splats = &scratch->sorted_splats[0];
+  job.splat_row_start = &row_start[0];
+  Pass bucket_pass(*this, job, Pass::Bucket, 424);
+  pool_->run(bucket_pass, parts);
+
+  // Each part owns a band of output rows, so the z-test needs no locking.
+  Pass splat_pass(*this, job, Pass::Splat, job.color_height);
+  pool_->run(splat_pass, parts);
+
+  releaseScratch(scratch);
+}
+
+// std::floor and std::ceil are library calls without SSE4.1
+static inline int floorToInt(float v)
+{
+  const int i = (int)v;
+  return i - (i > v);
+}
+
+static inline int ceilToInt(float v)
+{
+  const int i = (int)v;
+  return i + (i < v);
+}
+
+void RegistrationImpl::footprintRows(const Job &job, int y_begin, int y_end, int *counts, int &span) const
+{
+  const int width = job.color_width;
+  const int height = job.color_height;
+  const float scale = job.color_scale;
+
+  for(int y = y_begin; y < y_end; ++y){
+    for(int x = 0; x < 512; ++x){
+      const int i = y * 512 + x;
+      Splat &s = job.splats[i];
+      s.z = 0.0f;
+
+      const int index = distort_map[i];
+      if(index < 0)
+        continue;
+
+      const float z = job.depth_data[index];
+      if(!(z > 0.0f))
+        continue;
+
+      // center of the depth pixel in the color image, as in apply() but without rounding
+      const float rx = (depth_to_color_map_x[i] + (color.shift_m / z)) * color.fx + color.cx;
+      const float ry = depth_to_color_map_y[i];
+
+      // the footprint reaches halfway to the neighboring depth pixels, a little more against cracks on slanted surfaces
+      const int nx = x < 511 ? i + 1 : i - 1;
+      const int ny = y < 423 ? i + 512 : i - 512;
+      const float half_w = std::fabs(depth_to_color_map_x[nx] - depth_to_color_map_x[i]) * color.fx * 0.5f * scale + 0.25f;
+      const float half_h = std::fabs(depth_to_color_map_y[ny] - depth_to_color_map_y[i]) * 0.5f * scale + 0.25f;
+
+      // pixel centers are at integer coordinates in both resolutions
+      const float sx = (rx + 0.5f) * scale - 0.5f;
+      const float sy = (ry + 0.5f) * scale - 0.5f;
+      // clamped in float first, far off-image centers would overflow the int conversion
+      const float lim = 4096.0f;
+      const int x0 = std::max(ceilToInt(std::max(sx - half_w, -1.0f)), 0);
+      const int x1 = std::min(floorToInt(std::min(sx + half_w, lim)), width - 1);
+      const int y0 = std::max(ceilToInt(std::max(sy - half_h, -1.0f)), 0);
+      const int y1 = std::min(floorToInt(std::min(sy + half_h, lim)), height - 1);
+      if(x0 > x1 || y0 > y1)
+        continue;
+
+      s.z = z;
+      s.x0 = (short)x0;
+      s.x1 = (short)x1;
+      s.y0 = (short)y0;
+      s.y1 = (short)y1;
+      counts[y0]++;
+      span = std::max(span, y1 - y0);
+    }
+  }
+}
+
+void RegistrationImpl::bucketRows(const Job &job, int y_begin, int y_end, int *next) const
+{
+  const Splat *s = job.splats + y_begin * 512;
+  const Splat *end = job.splats + y_end * 512;
+  for(; s < end; ++s){
+    if(s->z > 0.0f)
+      job.sorted_splats[next[s->y0]++] = *s;
+  }
+}
+
+void RegistrationImpl::splatRows(const Job &job, int row_begin, int row_end) const
+{
+  const int width = job.color_width;
+  float *z_buffer = job.color_depth;
+
+  std::fill(z_buffer + row_begin * width, z_buffer + row_end * width, 0.0f);
+
+  // footprints reaching this band start at most splat_span rows above it
+  const int first = job.splat_row_start[std::max(row_begin - job.splat_span, 0)];
+  const int last = job.splat_row_start[row_end];
+  for(int k = first; k < last; ++k){
+    const Splat &s = job.sorted_splats[k];
+    const int y0 = std::max((int)s.y0, row_begin);
+    const int y1 = std::min((int)s.y1, row_end - 1);
+
+    for(int yy = y0; yy <= y1; ++yy){
+      float *it = z_buffer + yy * width + s.x0;
+      for(int xx = s.x0; xx <= s.x1; ++xx, ++it){
+        // only set if empty or the current z is smaller
+        if(*it == 0.0f || s.z < *it)
+          *it = s.z;
+      }
+    }
+  }
+
+  for(int yy = row_begin; yy < row_end; ++yy){
+    float *row = z_buffer + yy * width;
+
+    // filling short gaps between two depth values with the farther one, which is the uncovered background
+    if(job.max_hole > 0){
+      int last = -1;
+      for(int xx = 0; xx < width; ++xx){
+        if(row[xx] == 0.0f)
+          continue;
+        const int gap = xx - last - 1;
+        if(last >= 0 && gap > 0 && gap <= job.max_hole)
+          std::fill(row + last + 1, row + xx, std::max(row[last], row[xx]));
+        last = xx;
+      }
+    }
 
-      // check if offset is out of image
-      *registered_data = c_off < 0 ? 0 : *(rgb_data + c_off);
+    if(job.color_depth16){
+      unsigned short *out = job.color_depth16 + yy * width;
+      for(int xx = 0; xx < width; ++xx)
+        out[xx] = (unsigned short)std::min(row[xx] + 0.5f, 65535.0f);
     }
   }
-  if (!color_depth_map) delete[] depth_to_c_off;
 }
 
 void Registration::undistortDepth(const Frame *depth, Frame *undistorted) const
@@ -359,6 +848,334 @@ void RegistrationImpl::getPointXYZ (const Frame *undistorted, int r, int c, floa
   }
 }
 
+size_t Registration::getPointCloud(const Frame* undistorted, const Frame* registered, float* cloud, PointCloudLayout layout, bool compact) const
+{
+  return impl_->getPointCloud(undistorted, registered, cloud, layout, compact);
+}
+
+size_t RegistrationImpl::getPointCloud(const Frame* undistorted, const Frame* registered, float* cloud, Registration::PointCloudLayout layout, bool compact) const
+{
+  // Check if all frames are valid and have the correct size
+  if (!undistorted || !cloud ||
+      undistorted->width != 512 || undistorted->height != 424 || undistorted->bytes_per_pixel != 4 ||
+      (registered && (registered->width != 512 || registered->height != 424 || registered->bytes_per_pixel != 4)) ||
+      (layout == Registration::XYZRGB && !registered))
+    return 0;
+
+  const size_t size_depth = 512 * 424;
+  const float bad_point = std::numeric_limits<float>::quiet_NaN();
+  const float *depth_data = (const float*)undistorted->data;
+  const float *color_data = registered ? (const float*)registered->data : NULL;
+
+  // interleaved points are written with a stride, planes with a fixed distance between x, y, z and colors
+  const size_t stride = layout == Registration::XYZ ? 3 : layout == Registration::XYZRGB ? 4 : 1;
+  const size_t plane = layout == Registration::Planes ? size_depth : 1;
+  const bool with_color = color_data && layout != Registration::XYZ;
+
+  size_t n = 0;
+
+  for(int r = 0; r < 424; ++r){
+    int c = 0;
+
+#ifdef LIBFREENECT2_WITH_SSE2
+    const __m128 thousand = _mm_set1_ps(1000.0f);
+    const __m128 min_depth = _mm_set1_ps(0.001f);
+    const __m128 nan = _mm_set1_ps(bad_point);
+    const __m128 ray_y4 = _mm_set1_ps(ray_y[r]);
+
+    for(; c < 512; c += 4){
+      const int i = r * 512 + c;
+
+      // same scaling and validity check as getPointXYZ(); NaN compares false
+      __m128 z = _mm_div_ps(_mm_loadu_ps(depth_data + i), thousand);
+      const __m128 valid = _mm_cmpge_ps(z, min_depth);
+      __m128 x = _mm_mul_ps(z, _mm_loadu_ps(ray_x + c));
+      __m128 y = _mm_mul_ps(z, ray_y4);
+      __m128 rgb = color_data ? _mm_and_ps(valid, _mm_loadu_ps(color_data + i)) : _mm_setzero_ps();
+      const int mask = _mm_movemask_ps(valid);
+
+      if(!compact){
+        x = _mm_or_ps(_mm_and_ps(valid, x), _mm_andnot_ps(valid, nan));
+        y = _mm_or_ps(_mm_and_ps(valid, y), _mm_andnot_ps(valid, nan));
+        z = _mm_or_ps(_mm_and_ps(valid, z), _mm_andnot_ps(valid, nan));
+      }
+
+      if(layout == Registration::Planes && !compact){
+        _mm_storeu_ps(cloud + n, x);
+        _mm_storeu_ps(cloud + n + size_depth, y);
+        _mm_storeu_ps(cloud + n + 2 * size_depth, z);
+        if(with_color)
+          _mm_storeu_ps(cloud + n + 3 * size_depth, rgb);
+        n += 4;
+        continue;
+      }
+
+      if(compact && mask == 0)
+        continue;
+
+      if(layout == Registration::Planes){
+        float px[4], py[4], pz[4], pc[4];
+        _mm_storeu_ps(px, x);
+        _mm_storeu_ps(py, y);
+        _mm_storeu_ps(pz, z);
+        _mm_storeu_ps(pc, rgb);
+        for(int k = 0; k < 4; ++k){
+          if(!(mask & (1 << k)))
+            continue;
+          cloud[n] = px[k];
+          cloud[n + size_depth] = py[k];
+          cloud[n + 2 * size_depth] = pz[k];
+          if(with_color)
+            cloud[n + 3 * size_depth] = pc[k];
+          ++n;
+        }
+        continue;
+      }
+
+      // one vector per point: x, y, z, rgb
+      _MM_TRANSPOSE4_PS(x, y, z, rgb);
+      const __m128 points[4] = {x, y, z, rgb};
+      for(int k = 0; k < 4; ++k){
+        if(compact && !(mask & (1 << k)))
+          continue;
+        float *out = cloud + n * stride;
+        // for XYZ the fourth value lands on the next point, so it is only stored
+        // when that point is written too: a later valid lane here, or any next point of an organized cloud
+        if(stride == 4 || (compact ? (mask >> (k + 1)) != 0 : n + 1 < size_depth)){
+          _mm_storeu_ps(out, points[k]);
+        }
+        else{
+          float p[4];
+          _mm_storeu_ps(p, points[k]);
+          out[0] = p[0];
+          out[1] = p[1];
+          out[2] = p[2];
+        }
+        ++n;
+      }
+    }
+#endif
+
+    for(; c < 512; ++c){
+      const int i = r * 512 + c;
+      const float z = depth_data[i] / 1000.0f;
+      const bool valid = z >= 0.001f;
+
+      if(compact && !valid)
+        continue;
+
+      float *out = cloud + n * stride;
+      out[0] = valid ? z * ray_x[c] : bad_point;
+      out[plane] = valid ? z * ray_y[r] : bad_point;
+      out[2 * plane] = valid ? z : bad_point;
+      if(with_color)
+        out[3 * plane] = valid ? color_data[i] : 0.0f;
+      ++n;
+    }
+  }
+
+  return n;
+}
+
+size_t Registration::getNormals(const Frame* undistorted, float* normals, int step, float max_depth_change) const
+{
+  return impl_->getNormals(undistorted, normals, step, max_depth_change);
+}
+
+size_t RegistrationImpl::getNormals(const Frame* undistorted, float* normals, int step, float max_depth_change) const
+{
+  // Check if all frames are valid and have the correct size
+  if (!undistorted || !normals || step < 1 || step > 64 ||
+      undistorted->width != 512 || undistorted->height != 424 || undistorted->bytes_per_pixel != 4)
+    return 0;
+
+  const size_t parts = pool_->size() * 4;
+  std::vector<size_t> counts(parts, 0);
+
+  Job job;
+  job.depth_data = (const float*)undistorted->data;
+  job.normals = normals;
+  job.normal_step = step;
+  job.max_depth_change = max_depth_change;
+  job.normal_counts = &counts[0];
+
+  // Rows only read their neighbours, so parts are independent.
+  Pass normal_pass(*this, job, Pass::Normals, 424);
+  pool_->run(normal_pass, parts);
+
+  size_t n = 0;
+  for (size_t i = 0; i < parts; ++i)
+    n += counts[i];
+  return n;
+}
+
+size_t RegistrationImpl::normalRows(const Job &job, int y_begin, int y_end) const
+{
+  const float bad_point = std::numeric_limits<float>::quiet_NaN();
+  const float *depth_data = job.depth_data;
+  const int k = job.normal_step;
+  const float max_change = job.max_depth_change;
+
+  size_t n = 0;
+
+  for(int r = y_begin; r < y_end; ++r){
+    const bool has_up = r - k >= 0;
+    const bool has_down = r + k < 424;
+    const float *row = depth_data + r * 512;
+    const float *row_up = has_up ? row - k * 512 : row;
+    const float *row_down = has_down ? row + k * 512 : row;
+    const float ry = ray_y[r], ry_up = has_up ? ray_y[r - k] : ry, ry_down = has_down ? ray_y[r + k] : ry;
+    float *out = job.normals + r * 512 * 3;
+
+    int c = 0;
+    // the vectors need both horizontal neighbours inside the row; the borders are done below
+    const int vector_begin = k;
+    const int vector_end = 512 - k;
+
+    for(; c < 512; ++c){
+#ifdef LIBFREENECT2_WITH_SSE2
+      if(c == vector_begin){
+        const __m128 thousand = _mm_set1_ps(1000.0f);
+        const __m128 min_depth = _mm_set1_ps(0.001f);
+        const __m128 change = _mm_set1_ps(max_change);
+        const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 nan = _mm_set1_ps(bad_point);
+        const __m128 ry4 = _mm_set1_ps(ry), ry_up4 = _mm_set1_ps(ry_up), ry_down4 = _mm_set1_ps(ry_down);
+        const __m128 up_mask = has_up ? _mm_castsi128_ps(_mm_set1_epi32(-1)) : zero;
+        const __m128 down_mask = has_down ? _mm_castsi128_ps(_mm_set1_epi32(-1)) : zero;
+
+        // one more pixel is written than computed, so stop before the end of the row
+        for(; c + 4 <= vector_end; c += 4){
+          const __m128 z0 = _mm_div_ps(_mm_loadu_ps(row + c), thousand);
+          const __m128 zl = _mm_div_ps(_mm_loadu_ps(row + c - k), thousand);
+          const __m128 zr = _mm_div_ps(_mm_loadu_ps(row + c + k), thousand);
+          const __m128 zu = _mm_div_ps(_mm_loadu_ps(row_up + c), thousand);
+          const __m128 zd = _mm_div_ps(_mm_loadu_ps(row_down + c), thousand);
+          const __m128 rx = _mm_loadu_ps(ray_x + c);
+          const __m128 rxl = _mm_loadu_ps(ray_x + c - k);
+          const __m128 rxr = _mm_loadu_ps(ray_x + c + k);
+
+          // neighbours on the same surface; NaN compares false
+          const __m128 thr = _mm_mul_ps(change, z0);
+          const __m128 v0 = _mm_cmpge_ps(z0, min_depth);
+          const __m128 vl = _mm_and_ps(_mm_cmpge_ps(zl, min_depth), _mm_cmple_ps(_mm_and_ps(_mm_sub_ps(zl, z0), abs_mask), thr));
+          const __m128 vr = _mm_and_ps(_mm_cmpge_ps(zr, min_depth), _mm_cmple_ps(_mm_and_ps(_mm_sub_ps(zr, z0), abs_mask), thr));
+          const __m128 vu = _mm_and_ps(up_mask, _mm_and_ps(_mm_cmpge_ps(zu, min_depth), _mm_cmple_ps(_mm_and_ps(_mm_sub_ps(zu, z0), abs_mask), thr)));
+          const __m128 vd = _mm_and_ps(down_mask, _mm_and_ps(_mm_cmpge_ps(zd, min_depth), _mm_cmple_ps(_mm_and_ps(_mm_sub_ps(zd, z0), abs_mask), thr)));
+
+          const __m128 px = _mm_mul_ps(z0, rx), py = _mm_mul_ps(z0, ry4);
+
+          // tangents between the neighbours, or one neighbour and the center
+          const __m128 ax = _mm_or_ps(_mm_and_ps(vr, _mm_mul_ps(zr, rxr)), _mm_andnot_ps(vr, px));
+          const __m128 ay = _mm_or_ps(_mm_and_ps(vr, _mm_mul_ps(zr, ry4)), _mm_andnot_ps(vr, py));
+          const __m128 az = _mm_or_ps(_mm_and_ps(vr, zr), _mm_andnot_ps(vr, z0));
+          const __m128 bx = _mm_or_ps(_mm_and_ps(vl, _mm_mul_ps(zl, rxl)), _mm_andnot_ps(vl, px));
+          const __m128 by = _mm_or_ps(_mm_and_ps(vl, _mm_mul_ps(zl, ry4)), _mm_andnot_ps(vl, py));
+          const __m128 bz = _mm_or_ps(_mm_and_ps(vl, zl), _mm_andnot_ps(vl, z0));
+          const __m128 hx = _mm_sub_ps(ax, bx), hy = _mm_sub_ps(ay, by), hz = _mm_sub_ps(az, bz);
+
+          const __m128 cx = _mm_or_ps(_mm_and_ps(vd, _mm_mul_ps(zd, rx)), _mm_andnot_ps(vd, px));
+          const __m128 cy = _mm_or_ps(_mm_and_ps(vd, _mm_mul_ps(zd, ry_down4)), _mm_andnot_ps(vd, py));
+          const __m128 cz = _mm_or_ps(_mm_and_ps(vd, zd), _mm_andnot_ps(vd, z0));
+          const __m128 dx = _mm_or_ps(_mm_and_ps(vu, _mm_mul_ps(zu, rx)), _mm_andnot_ps(vu, px));
+          const __m128 dy = _mm_or_ps(_mm_and_ps(vu, _mm_mul_ps(zu, ry_up4)), _mm_andnot_ps(vu, py));
+          const __m128 dz = _mm_or_ps(_mm_and_ps(vu, zu), _mm_andnot_ps(vu, z0));
+          const __m128 tx = _mm_sub_ps(cx, dx), ty = _mm_sub_ps(cy, dy), tz = _mm_sub_ps(cz, dz);
+
+          __m128 nx = _mm_sub_ps(_mm_mul_ps(hy, tz), _mm_mul_ps(hz, ty));
+          __m128 ny = _mm_sub_ps(_mm_mul_ps(hz, tx), _mm_mul_ps(hx, tz));
+          __m128 nz = _mm_sub_ps(_mm_mul_ps(hx, ty), _mm_mul_ps(hy, tx));
+          const __m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz));
+          const __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, px), _mm_mul_ps(ny, py)), _mm_mul_ps(nz, z0));
+
+          // unit length, facing the camera
+          __m128 scale = _mm_div_ps(one, _mm_sqrt_ps(len2));
+          scale = _mm_xor_ps(scale, _mm_and_ps(_mm_cmpgt_ps(dot, zero), _mm_castsi128_ps(_mm_set1_epi32(0x80000000))));
+
+          const __m128 valid = _mm_and_ps(_mm_and_ps(v0, _mm_cmpgt_ps(len2, zero)), _mm_and_ps(_mm_or_ps(vl, vr), _mm_or_ps(vu, vd)));
+          nx = _mm_or_ps(_mm_and_ps(valid, _mm_mul_ps(nx, scale)), _mm_andnot_ps(valid, nan));
+          ny = _mm_or_ps(_mm_and_ps(valid, _mm_mul_ps(ny, scale)), _mm_andnot_ps(valid, nan));
+          nz = _mm_or_ps(_mm_and_ps(valid, _mm_mul_ps(nz, scale)), _mm_andnot_ps(valid, nan));
+
+          const int mask = _mm_movemask_ps(valid);
+          n += (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + ((mask >> 3) & 1);
+
+          // one vector per normal; the fourth value lands on the next normal, which is written later
+          __m128 w = nan;
+          _MM_TRANSPOSE4_PS(nx, ny, nz, w);
+          _mm_storeu_ps(out + 3 * c, nx);
+          _mm_storeu_ps(out + 3 * c + 3, ny);
+          _mm_storeu_ps(out + 3 * c + 6, nz);
+          _mm_storeu_ps(out + 3 * c + 9, w);
+        }
+      }
+#endif
+
+      const float z0 = row[c] / 1000.0f;
+      float *o = out + 3 * c;
+      if(!(z0 >= 0.001f)){
+        o[0] = o[1] = o[2] = bad_point;
+        continue;
+      }
+
+      const float thr = max_change * z0;
+      const float px = z0 * ray_x[c], py = z0 * ry;
+      float zl = 0.0f, zr = 0.0f, zu = 0.0f, zd = 0.0f;
+      bool vl = false, vr = false, vu = false, vd = false;
+      if(c - k >= 0){
+        zl = row[c - k] / 1000.0f;
+        vl = zl >= 0.001f && std::fabs(zl - z0) <= thr;
+      }
+      if(c + k < 512){
+        zr = row[c + k] / 1000.0f;
+        vr = zr >= 0.001f && std::fabs(zr - z0) <= thr;
+      }
+      if(has_up){
+        zu = row_up[c] / 1000.0f;
+        vu = zu >= 0.001f && std::fabs(zu - z0) <= thr;
+      }
+      if(has_down){
+        zd = row_down[c] / 1000.0f;
+        vd = zd >= 0.001f && std::fabs(zd - z0) <= thr;
+      }
+
+      if(!(vl || vr) || !(vu || vd)){
+        o[0] = o[1] = o[2] = bad_point;
+        continue;
+      }
+
+      const float hx = (vr ? zr * ray_x[c + k] : px) - (vl ? zl * ray_x[c - k] : px);
+      const float hy = (vr ? zr * ry : py) - (vl ? zl * ry : py);
+      const float hz = (vr ? zr : z0) - (vl ? zl : z0);
+      const float tx = (vd ? zd * ray_x[c] : px) - (vu ? zu * ray_x[c] : px);
+      const float ty = (vd ? zd * ry_down : py) - (vu ? zu * ry_up : py);
+      const float tz = (vd ? zd : z0) - (vu ? zu : z0);
+
+      const float nx = hy * tz - hz * ty;
+      const float ny = hz * tx - hx * tz;
+      const float nz = hx * ty - hy * tx;
+      const float len2 = (nx * nx + ny * ny) + nz * nz;
+      if(!(len2 > 0.0f)){
+        o[0] = o[1] = o[2] = bad_point;
+        continue;
+      }
+
+      const float dot = (nx * px + ny * py) + nz * z0;
+      float scale = 1.0f / std::sqrt(len2);
+      if(dot > 0.0f)
+        scale = -scale;
+      o[0] = nx * scale;
+      o[1] = ny * scale;
+      o[2] = nz * scale;
+      ++n;
+    }
+  }
+
+  return n;
+}
+
 Registration::Registration(Freenect2Device::IrCameraParams depth_p, Freenect2Device::ColorCameraParams rgb_p):
   impl_(new RegistrationImpl(depth_p, rgb_p)) {}
 
@@ -367,39 +1184,167 @@ Registration::~Registration()
   delete impl_;
 }
 
-RegistrationImpl::RegistrationImpl(Freenect2Device::IrCameraParams depth_p, Freenect2Device::ColorCameraParams rgb_p):
-  depth(depth_p), color(rgb_p), filter_width_half(2), filter_height_half(1), filter_tolerance(0.01f)
+/** Builds a band of table rows, see RegistrationTables::buildRows(). */
+class RegistrationTables::Build : public WorkerPool::Task
+{
+public:
+  Build(RegistrationTables &tables): tables_(tables) {}
+
+  virtual void run(size_t index, size_t count)
+  {
+    tables_.buildRows(424 * index / count, 424 * (index + 1) / count);
+  }
+
+private:
+  RegistrationTables &tables_;
+};
+
+RegistrationTables::RegistrationTables(const Freenect2Device::IrCameraParams &depth_p, const Freenect2Device::ColorCameraParams &rgb_p, WorkerPool &pool):
+  depth(depth_p), color(rgb_p), refs(0)
+{
+  // rays of the undistorted depth pixels; the image is a pinhole camera, so they are separable
+  for (int x = 0; x < 512; x++)
+    ray_x[x] = (x + 0.5 - depth.cx) / depth.fx;
+  for (int y = 0; y < 424; y++)
+    ray_y[y] = (y + 0.5 - depth.cy) / depth.fy;
+
+  // rows are independent, and evaluating the polynomials dominates the construction
+  Build build(*this);
+  pool.run(build, pool.size() * 4);
+}
+
+void RegistrationTables::buildRows(int y_begin, int y_end)
 {
-  float mx, my;
-  int ix, iy, index;
-  float rx, ry;
-  int *map_dist = distort_map;
-  float *map_x = depth_to_color_map_x;
-  float *map_y = depth_to_color_map_y;
-  int *map_yi = depth_to_color_map_yi;
+  computeDistortMap(depth, distort_map, y_begin, y_end);
+  computeDepthToColorMap(depth, color, depth_to_color_map_x, depth_to_color_map_y, y_begin, y_end);
 
-  for (int y = 0; y < 424; y++) {
+  const float *map_y = depth_to_color_map_y + y_begin * 512;
+  int *map_yi = depth_to_color_map_yi + y_begin * 512;
+  int *map_yoff = depth_to_color_map_yoff + y_begin * 512;
+
+  for (int y = y_begin; y < y_end; y++) {
     for (int x = 0; x < 512; x++) {
-      // compute the dirstored coordinate for current pixel
-      distort(x,y,mx,my);
-      // rounding the values and check if the pixel is inside the image
-      ix = (int)(mx + 0.5f);
-      iy = (int)(my + 0.5f);
-      if(ix < 0 || ix >= 512 || iy < 0 || iy >= 424)
-        index = -1;
-      else
-        // computing the index from the coordianted for faster access to the data
-        index = iy * 512 + ix;
-      *map_dist++ = index;
-
-      // compute the depth to color mapping entries for the current pixel
-      depth_to_color(x,y,rx,ry);
-      *map_x++ = rx;
-      *map_y++ = ry;
+      const float ry = *map_y++;
       // compute the y offset to minimize later computations
-      *map_yi++ = (int)(ry + 0.5f);
+      *map_yi = (int)(ry + 0.5f);
+      *map_yoff++ = *map_yi * 1920;
+
+      // range of color rows for splitting the filter map between threads
+      if (x == 0 || *map_yi < depth_row_min_yi[y])
+        depth_row_min_yi[y] = *map_yi;
+      if (x == 0 || *map_yi > depth_row_max_yi[y])
+        depth_row_max_yi[y] = *map_yi;
+      map_yi++;
+    }
+  }
+}
+
+// Registrations with the same camera parameters share their tables.
+static libfreenect2::mutex table_cache_mutex;
+static std::vector<RegistrationTables *> table_cache;
+
+RegistrationTables *RegistrationTables::acquire(const Freenect2Device::IrCameraParams &depth_p, const Freenect2Device::ColorCameraParams &rgb_p, WorkerPool &pool)
+{
+  {
+    libfreenect2::lock_guard l(table_cache_mutex);
+    for (size_t i = 0; i < table_cache.size(); ++i)
+    {
+      if (table_cache[i]->matches(depth_p, rgb_p))
+      {
+        table_cache[i]->refs++;
+        return table_cache[i];
+      }
     }
   }
+
+  // built without the lock, so registrations of different devices are constructed in parallel
+  RegistrationTables *tables = new RegistrationTables(depth_p, rgb_p, pool);
+
+  libfreenect2::lock_guard l(table_cache_mutex);
+  for (size_t i = 0; i < table_cache.size(); ++i)
+  {
+    // another thread built the same tables meanwhile
+    if (table_cache[i]->matches(depth_p, rgb_p))
+    {
+      delete tables;
+      table_cache[i]->refs++;
+      return table_cache[i];
+    }
+  }
+  tables->refs = 1;
+  table_cache.push_back(tables);
+  return tables;
+}
+
+void RegistrationTables::release(RegistrationTables *tables)
+{
+  libfreenect2::lock_guard l(table_cache_mutex);
+  if (--tables->refs > 0)
+    return;
+  table_cache.erase(std::find(table_cache.begin(), table_cache.end(), tables));
+  delete tables;
+}
+
+// One pool for all registrations, alive while any registration is.
+static WorkerPool *shared_pool = NULL;
+static size_t shared_pool_refs = 0;
+
+static WorkerPool *acquireSharedPool()
+{
+  libfreenect2::lock_guard l(table_cache_mutex);
+  if (shared_pool_refs++ == 0)
+    shared_pool = new WorkerPool(WorkerPool::defaultSize() - 1, "Registration");
+  return shared_pool;
+}
+
+static void releaseSharedPool()
+{
+  libfreenect2::lock_guard l(table_cache_mutex);
+  if (--shared_pool_refs > 0)
+    return;
+  delete shared_pool;
+  shared_pool = NULL;
+}
+
+RegistrationImpl::RegistrationImpl(Freenect2Device::IrCameraParams depth_p, Freenect2Device::ColorCameraParams rgb_p):
+  depth(depth_p), color(rgb_p),
+  pool_(acquireSharedPool()),
+  tables_(RegistrationTables::acquire(depth_p, rgb_p, *pool_)),
+  distort_map(tables_->distort_map),
+  depth_to_color_map_x(tables_->depth_to_color_map_x),
+  depth_to_color_map_y(tables_->depth_to_color_map_y),
+  depth_to_color_map_yi(tables_->depth_to_color_map_yi),
+  depth_to_color_map_yoff(tables_->depth_to_color_map_yoff),
+  depth_row_min_yi(tables_->depth_row_min_yi),
+  depth_row_max_yi(tables_->depth_row_max_yi),
+  ray_x(tables_->ray_x),
+  ray_y(tables_->ray_y),
+  filter_width_half(2), filter_height_half(1), filter_tolerance(0.01f)
+{
+}
+
+RegistrationImpl::~RegistrationImpl()
+{
+  RegistrationTables::release(tables_);
+  releaseSharedPool();
+  for (size_t i = 0; i < scratch_.size(); ++i)
+    delete scratch_[i];
+}
+
+RegistrationImpl::Scratch *RegistrationImpl::acquireScratch() const
+{
+  libfreenect2::lock_guard l(mutex_);
+  if (scratch_.empty())
+    return new Scratch;
+  Scratch *scratch = scratch_.back();
+  scratch_.pop_back();
+  return scratch;
+}
+
+void RegistrationImpl::releaseScratch(Scratch *scratch) const
+{
+  libfreenect2::lock_guard l(mutex_);
+  scratch_.push_back(scratch);
 }
 
 } /* namespace libfreenect2 */
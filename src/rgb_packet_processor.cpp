@@ -28,6 +28,7 @@
 
 #include <libfreenect2/rgb_packet_processor.h>
 #include <libfreenect2/async_packet_processor.h>
+#include <libfreenect2/logging.h>
 
 #include <cstring>
 #include <fstream>
@@ -36,8 +37,31 @@
 namespace libfreenect2
 {
 
+/** Frame::Raw color frame pointing into the buffer the packet was parsed into.
+ * The buffer is shared with the pool and returns to it when the frame is deleted.
+ * The pool outlives its processor until then.
+ */
+class JpegFrame: public Frame
+{
+public:
+  JpegFrame(const RgbPacket &packet) :
+    Frame(1, 1, packet.jpeg_buffer_length, packet.jpeg_buffer),
+    memory(packet.memory)
+  {
+  }
+
+  virtual ~JpegFrame()
+  {
+    memory->allocator->free(memory);
+  }
+
+private:
+  Buffer *memory;
+};
+
 RgbPacketProcessor::RgbPacketProcessor() :
-    listener_(0)
+    listener_(0),
+    packet_allocator_(NULL, 4)
 {
 }
 
@@ -50,6 +74,79 @@ void RgbPacketProcessor::setFrameListener(libfreenect2::FrameListener *listener)
   listener_ = listener;
 }
 
+void RgbPacketProcessor::setConfiguration(const libfreenect2::RgbPacketProcessor::Config &config)
+{
+  config_ = config;
+
+  if (config.ColorDownscale != 1 && config.ColorDownscale != 2 && config.ColorDownscale != 4)
+  {
+    LOG_WARNING << "invalid color downscale factor " << config.ColorDownscale << ", using 1";
+    config_.ColorDownscale = 1;
+  }
+  else if (config.ColorDownscale != 1 && !supportsDownscale())
+  {
+    LOG_WARNING << name() << " color processing does not support downscaling";
+    config_.ColorDownscale = 1;
+  }
+
+  if (config.ColorFormat != Frame::BGRX &&
+      !(config.ColorFormat == Frame::Raw ? supportsPassthrough() : supportsFormat(config.ColorFormat)))
+  {
+    LOG_WARNING << name() << " color processing does not support frame format " << config.ColorFormat << ", using BGRX";
+    config_.ColorFormat = Frame::BGRX;
+  }
+
+  if (config.ColorRoiWidth > 0 && config.ColorRoiHeight > 0 && !supportsRoi())
+  {
+    LOG_WARNING << name() << " color processing does not support decoding a region";
+    config_.ColorRoiWidth = config_.ColorRoiHeight = 0;
+  }
+  else if (config.ColorRoiX < 0 || config.ColorRoiY < 0 || config.ColorRoiWidth < 0 || config.ColorRoiHeight < 0)
+  {
+    LOG_WARNING << "invalid color region, decoding whole frames";
+    config_.ColorRoiWidth = config_.ColorRoiHeight = 0;
+  }
+}
+
+bool RgbPacketProcessor::ready()
+{
+  return packet_allocator_.available() > 0;
+}
+
+Allocator *RgbPacketProcessor::getAllocator()
+{
+  return &packet_allocator_;
+}
+
+bool RgbPacketProcessor::passthrough(const RgbPacket &packet)
+{
+  if (config_.ColorFormat != Frame::Raw)
+    return false;
+  if (listener_ == 0)
+    return true;
+
+  Frame *frame;
+  if (packet.memory != NULL && packet.memory->allocator->hold(packet.memory))
+  {
+    frame = new JpegFrame(packet);
+  }
+  else
+  {
+    frame = new Frame(1, 1, packet.jpeg_buffer_length);
+    std::memcpy(frame->data, packet.jpeg_buffer, packet.jpeg_buffer_length);
+  }
+  frame->sequence = packet.sequence;
+  frame->timestamp = packet.timestamp;
+  frame->exposure = packet.exposure;
+  frame->gain = packet.gain;
+  frame->gamma = packet.gamma;
+  frame->format = Frame::Raw;
+
+  if (!listener_->onNewFrame(Frame::Color, frame))
+    delete frame;
+  return true;
+}
+
 DumpRgbPacketProcessor::DumpRgbPacketProcessor() {}
 DumpRgbPacketProcessor::~DumpRgbPacketProcessor() {}
 
@@ -63,7 +63,9 @@ LIBFREENECT2_PACK(struct RgbPacketFooter {
 
 RgbPacketStreamParser::RgbPacketStreamParser() :
     buffer_size_(2*1024*1024),
-    processor_(noopProcessor<RgbPacket>())
+    processor_(noopProcessor<RgbPacket>()),
+    tap_(0),
+    stream_tap_(0)
 {
   processor_->allocateBuffer(packet_, buffer_size_);
 }
@@ -74,11 +76,36 @@ RgbPacketStreamParser::~RgbPacketStreamParser()
 
 void RgbPacketStreamParser::setPacketProcessor(BaseRgbPacketProcessor *processor)
 {
+  dropStream();
   processor_->releaseBuffer(packet_);
   processor_ = (processor != 0) ? processor : noopProcessor<RgbPacket>();
   processor_->allocateBuffer(packet_, buffer_size_);
 }
 
+void RgbPacketStreamParser::setPacketTap(PacketTap<RgbPacket> *tap)
+{
+  libfreenect2::lock_guard l(tap_mutex_);
+  tap_ = tap;
+}
+
+void RgbPacketStreamParser::setStreamTap(RgbStreamTap *tap)
+{
+  dropStream();
+  stream_tap_ = tap;
+}
+
+void RgbPacketStreamParser::dropStream()
+{
+  if (stream_tap_ != 0 && packet_.memory != NULL && packet_.memory->data != NULL)
+    stream_tap_->onStreamDropped(packet_.memory->data + sizeof(RawRgbPacket));
+}
+
+void RgbPacketStreamParser::resetBuffer()
+{
+  dropStream();
+  packet_.memory->length = 0;
+}
+
 void RgbPacketStreamParser::onDataReceived(unsigned char* buffer, size_t length)
 {
   if (packet_.memory == NULL || packet_.memory->data == NULL)
@@ -99,10 +126,13 @@ void RgbPacketStreamParser::onDataReceived(unsigned char* buffer, size_t length)
     else
     {
       LOG_INFO << "buffer overflow!";
-      fb.length = 0;
+      resetBuffer();
       return;
     }
 
+    if (stream_tap_ != 0 && fb.length > sizeof(RawRgbPacket))
+      stream_tap_->onStreamData(fb.data + sizeof(RawRgbPacket), fb.length - sizeof(RawRgbPacket));
+
     // not enough data to do anything
     if (fb.length <= sizeof(RawRgbPacket) + sizeof(RgbPacketFooter))
       return;
@@ -116,14 +146,14 @@ void RgbPacketStreamParser::onDataReceived(unsigned char* buffer, size_t length)
       if (fb.length != footer->packet_size || raw_packet->sequence != footer->sequence)
       {
         LOG_INFO << "packetsize or sequence doesn't match!";
-        fb.length = 0;
+        resetBuffer();
         return;
       }
 
       if (fb.length - sizeof(RawRgbPacket) - sizeof(RgbPacketFooter) < footer->filler_length)
       {
         LOG_INFO << "not enough space for packet filler!";
-        fb.length = 0;
+        resetBuffer();
         return;
       }
 
@@ -143,34 +173,40 @@ void RgbPacketStreamParser::onDataReceived(unsigned char* buffer, size_t length)
       if (jpeg_length == 0)
       {
         LOG_INFO << "no JPEG detected!";
-        fb.length = 0;
+        resetBuffer();
         return;
       }
 
+      RgbPacket &rgb_packet = packet_;
+      rgb_packet.sequence = raw_packet->sequence;
+      rgb_packet.timestamp = footer->timestamp;
+      rgb_packet.exposure = footer->exposure;
+      rgb_packet.gain = footer->gain;
+      rgb_packet.gamma = footer->gamma;
+      rgb_packet.jpeg_buffer = raw_packet->jpeg_buffer;
+      rgb_packet.jpeg_buffer_length = jpeg_length;
+
+      {
+        libfreenect2::lock_guard l(tap_mutex_);
+        if (tap_ != 0)
+          tap_->onPacket(rgb_packet);
+      }
+
       // can the processor handle the next image?
       if(processor_->ready())
       {
-        RgbPacket &rgb_packet = packet_;
-        rgb_packet.sequence = raw_packet->sequence;
-        rgb_packet.timestamp = footer->timestamp;
-        rgb_packet.exposure = footer->exposure;
-        rgb_packet.gain = footer->gain;
-        rgb_packet.gamma = footer->gamma;
-        rgb_packet.jpeg_buffer = raw_packet->jpeg_buffer;
-        rgb_packet.jpeg_buffer_length = jpeg_length;
-
         // call the processor
         processor_->process(rgb_packet);
         //allocatePacket() should never return NULL when processor is ready()
         processor_->allocateBuffer(packet_, buffer_size_);
+        // the packet is streamed on in the buffer handed over, this one is new
+        packet_.memory->length = 0;
       }
       else
       {
         LOG_DEBUG << "skipping rgb packet!";
+        resetBuffer();
       }
-
-      // reset front buffer
-      packet_.memory->length = 0;
     }
   }
 }
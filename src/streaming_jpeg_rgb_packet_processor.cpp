@@ -0,0 +1,525 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+/** @file streaming_jpeg_rgb_packet_processor.cpp JPEG decoder with libjpeg, running while the packet is received. */
+
+#include <libfreenect2/rgb_packet_processor.h>
+#include <libfreenect2/logging.h>
+#include <libfreenect2/threading.h>
+#include <csetjmp>
+#include <cstdio> //jpeglib.h does not include stdio.h
+#include <jpeglib.h>
+#include <vector>
+
+namespace libfreenect2
+{
+
+/** libjpeg output color space of a packed frame format. */
+static J_COLOR_SPACE toColorSpace(Frame::Format format)
+{
+  switch(format)
+  {
+    case Frame::RGBX: return JCS_EXT_RGBX;
+    case Frame::RGB: return JCS_RGB;
+    case Frame::Gray: return JCS_GRAYSCALE;
+    default: return JCS_EXT_BGRX;
+  }
+}
+
+static size_t bytesPerPixel(Frame::Format format)
+{
+  switch(format)
+  {
+    case Frame::RGB: return 3;
+    case Frame::Gray: return 1;
+    default: return 4;
+  }
+}
+
+struct StreamingJpegErrorManager
+{
+  struct jpeg_error_mgr pub;
+  jmp_buf setjmp_buffer;
+};
+
+/** Implementation of the streaming decoder.
+ *
+ * The parser shows the bytes of a packet as they arrive. The decoder thread
+ * feeds them to libjpeg through a suspending source manager: when it runs
+ * out of bytes, libjpeg returns to the thread, which waits for more.
+ */
+class StreamingJpegRgbPacketProcessorImpl: public RgbStreamTap, public WithPerfLogging
+{
+public:
+  enum State
+  {
+    Idle,      ///< No packet.
+    Receiving, ///< The parser is receiving the packet.
+    Complete,  ///< The parser handed the packet over; no more bytes will arrive.
+    Dropped    ///< The parser discards the packet, and waits for the decoder to let go of it.
+  };
+
+  StreamingJpegRgbPacketProcessor *processor;
+
+  mutex state_mutex;
+  condition_variable data_condition; ///< Bytes arrived or the state changed.
+  condition_variable idle_condition; ///< The decoder let go of a packet.
+  State state;
+  const unsigned char *jpeg;
+  size_t length;       ///< Bytes received, or the length of the JPEG once complete.
+  RgbPacket packet;    ///< The packet once complete, with the buffer to release.
+  FrameListener *listener;
+  RgbPacketProcessor::Config config;
+  bool shutdown;
+
+  // used by the decoder thread only
+  struct jpeg_decompress_struct dinfo;
+  StreamingJpegErrorManager jerr;
+  struct jpeg_source_mgr source;
+  size_t exposed;      ///< Bytes of #jpeg given to libjpeg so far.
+  size_t skip_pending; ///< Bytes libjpeg skipped past the received ones.
+  Frame *frame;
+  std::vector<JSAMPROW> rows;
+
+  thread *decoder_thread;
+
+  StreamingJpegRgbPacketProcessorImpl(StreamingJpegRgbPacketProcessor *processor) :
+    processor(processor),
+    state(Idle),
+    jpeg(0),
+    length(0),
+    listener(0),
+    shutdown(false),
+    exposed(0),
+    skip_pending(0),
+    frame(0)
+  {
+    dinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = StreamingJpegRgbPacketProcessorImpl::error_exit;
+    jerr.pub.output_message = StreamingJpegRgbPacketProcessorImpl::output_message;
+    jpeg_create_decompress(&dinfo);
+    dinfo.client_data = this;
+
+    source.init_source = StreamingJpegRgbPacketProcessorImpl::init_source;
+    source.fill_input_buffer = StreamingJpegRgbPacketProcessorImpl::fill_input_buffer;
+    source.skip_input_data = StreamingJpegRgbPacketProcessorImpl::skip_input_data;
+    source.resync_to_restart = jpeg_resync_to_restart;
+    source.term_source = StreamingJpegRgbPacketProcessorImpl::term_source;
+    dinfo.src = &source;
+
+    decoder_thread = new thread(StreamingJpegRgbPacketProcessorImpl::static_execute, this);
+  }
+
+  ~StreamingJpegRgbPacketProcessorImpl()
+  {
+    {
+      lock_guard l(state_mutex);
+      shutdown = true;
+    }
+    data_condition.notify_one();
+    decoder_thread->join();
+    delete decoder_thread;
+
+    if(state == Complete && packet.memory != 0)
+      processor->releaseBuffer(packet);
+
+    jpeg_destroy_decompress(&dinfo);
+    delete frame;
+  }
+
+  virtual void onStreamData(const unsigned char *data, size_t received)
+  {
+    {
+      lock_guard l(state_mutex);
+      if(state == Idle && config.ColorFormat != Frame::Raw)
+      {
+        state = Receiving;
+        jpeg = data;
+      }
+      // an earlier packet can still be finishing, this one is then decoded once complete
+      if(state != Receiving || jpeg != data)
+        return;
+      length = received;
+    }
+    data_condition.notify_one();
+  }
+
+  virtual void onStreamDropped(const unsigned char *data)
+  {
+    unique_lock l(state_mutex);
+    if(state != Receiving || jpeg != data)
+      return;
+    state = Dropped;
+    data_condition.notify_one();
+    while(state == Dropped)
+      WAIT_CONDITION(idle_condition, state_mutex, l);
+  }
+
+  /** Take over a complete packet. @return false if still busy with another one. */
+  bool complete(const RgbPacket &complete_packet)
+  {
+    {
+      unique_lock l(state_mutex);
+      // the decoder lets go of a dropped packet on its own, the same buffer may come back complete
+      while(state == Dropped)
+        WAIT_CONDITION(idle_condition, state_mutex, l);
+      if(!(state == Idle || (state == Receiving && jpeg == complete_packet.jpeg_buffer)))
+        return false;
+      state = Complete;
+      jpeg = complete_packet.jpeg_buffer;
+      length = complete_packet.jpeg_buffer_length;
+      packet = complete_packet;
+      startTiming();
+    }
+    data_condition.notify_one();
+    return true;
+  }
+
+  /** Block until the decoder lets go of the current packet. */
+  void waitIdle()
+  {
+    unique_lock l(state_mutex);
+    while(state != Idle)
+      WAIT_CONDITION(idle_condition, state_mutex, l);
+  }
+
+  static inline StreamingJpegRgbPacketProcessorImpl *owner(j_decompress_ptr dinfo)
+  {
+    return static_cast<StreamingJpegRgbPacketProcessorImpl *>(dinfo->client_data);
+  }
+
+  static void error_exit(j_common_ptr info)
+  {
+    {
+      char buffer[JMSG_LENGTH_MAX];
+      info->err->format_message(info, buffer);
+      LOG_ERROR << "Failed to decompress rgb image! libjpeg error: '" << buffer << "'";
+    }
+    longjmp(reinterpret_cast<StreamingJpegErrorManager *>(info->err)->setjmp_buffer, 1);
+  }
+
+  static void output_message(j_common_ptr info)
+  {
+    char buffer[JMSG_LENGTH_MAX];
+    info->err->format_message(info, buffer);
+    LOG_WARNING << "libjpeg: " << buffer;
+  }
+
+  static void init_source(j_decompress_ptr)
+  {
+  }
+
+  static boolean fill_input_buffer(j_decompress_ptr dinfo)
+  {
+    StreamingJpegRgbPacketProcessorImpl *self = owner(dinfo);
+    {
+      lock_guard l(self->state_mutex);
+      // the entropy decoder reads ahead of next_input_byte, all bytes given so far count as read
+      if(self->length > self->exposed && self->expose(self->exposed))
+        return TRUE;
+      // suspend until more bytes arrive, or waitForData() stops decoding;
+      // libjpeg resumes from next_input_byte, which must stay as is
+      if(self->state != Complete || self->shutdown)
+        return FALSE;
+    }
+
+    // the packet is complete but the image is not: end it, as libjpeg's own sources do
+    static const JOCTET eoi[2] = { 0xFF, JPEG_EOI };
+    LOG_WARNING << "premature end of JPEG data";
+    dinfo->src->next_input_byte = eoi;
+    dinfo->src->bytes_in_buffer = 2;
+    return TRUE;
+  }
+
+  static void skip_input_data(j_decompress_ptr dinfo, long num_bytes)
+  {
+    struct jpeg_source_mgr *src = dinfo->src;
+    if(num_bytes <= 0)
+      return;
+    if((size_t)num_bytes <= src->bytes_in_buffer)
+    {
+      src->next_input_byte += num_bytes;
+      src->bytes_in_buffer -= num_bytes;
+    }
+    else
+    {
+      // skipped once the bytes arrive
+      owner(dinfo)->skip_pending += num_bytes - src->bytes_in_buffer;
+      src->next_input_byte += src->bytes_in_buffer;
+      src->bytes_in_buffer = 0;
+    }
+  }
+
+  static void term_source(j_decompress_ptr)
+  {
+  }
+
+  /** Give libjpeg the received bytes from this offset on, minus those it skipped. Call with #state_mutex held.
+   * @return Whether there are bytes to read.
+   */
+  bool expose(size_t position)
+  {
+    position += skip_pending;
+    skip_pending = position > length ? position - length : 0;
+    position -= skip_pending;
+
+    source.next_input_byte = jpeg + position;
+    source.bytes_in_buffer = length - position;
+    exposed = length;
+    return source.bytes_in_buffer > 0;
+  }
+
+  /** Wait for more bytes after libjpeg suspended. @return false if the packet was dropped. */
+  bool waitForData()
+  {
+    unique_lock l(state_mutex);
+    while(state == Receiving && !shutdown && length <= exposed)
+      WAIT_CONDITION(data_condition, state_mutex, l);
+    if(state == Dropped || shutdown)
+      return false;
+    // libjpeg backed up to where it resumes
+    expose(source.next_input_byte - jpeg);
+    return true;
+  }
+
+  /** Wait until the parser hands the packet over or drops it. @return true if handed over. */
+  bool waitForPacket()
+  {
+    unique_lock l(state_mutex);
+    while(state == Receiving && !shutdown)
+      WAIT_CONDITION(data_condition, state_mutex, l);
+    return state == Complete;
+  }
+
+  void newFrame(const RgbPacketProcessor::Config &frame_config)
+  {
+    const size_t width = 1920 / frame_config.ColorDownscale;
+    const size_t height = 1080 / frame_config.ColorDownscale;
+    const size_t bpp = bytesPerPixel(frame_config.ColorFormat);
+
+    frame = new Frame(width, height, bpp);
+    frame->format = frame_config.ColorFormat;
+
+    rows.resize(height);
+    for(size_t y = 0; y < height; ++y)
+      rows[y] = frame->data + y * width * bpp;
+  }
+
+  /** Decode the packet into the frame, waiting whenever libjpeg runs out of bytes.
+   * Only trivial locals here, so that the longjmp of error_exit() skips no destructors.
+   * @return false on errors, or if the packet was dropped.
+   */
+  bool decode(const RgbPacketProcessor::Config &frame_config)
+  {
+    if(setjmp(jerr.setjmp_buffer))
+      return abortDecode();
+
+    source.next_input_byte = jpeg;
+    source.bytes_in_buffer = 0;
+    exposed = 0;
+    skip_pending = 0;
+
+    while(jpeg_read_header(&dinfo, TRUE) == JPEG_SUSPENDED)
+      if(!waitForData())
+        return abortDecode();
+
+    dinfo.out_color_space = toColorSpace(frame_config.ColorFormat);
+    dinfo.scale_num = 1;
+    dinfo.scale_denom = frame_config.ColorDownscale;
+
+    while(!jpeg_start_decompress(&dinfo))
+      if(!waitForData())
+        return abortDecode();
+
+    if(dinfo.output_width != frame->width || dinfo.output_height != frame->height)
+    {
+      LOG_ERROR << "Unexpected JPEG size " << dinfo.output_width << "x" << dinfo.output_height;
+      return abortDecode();
+    }
+
+    while(dinfo.output_scanline < dinfo.output_height)
+    {
+      if(jpeg_read_scanlines(&dinfo, &rows[dinfo.output_scanline], dinfo.output_height - dinfo.output_scanline) == 0)
+        if(!waitForData())
+          return abortDecode();
+    }
+
+    // all pixels are there, the end of the image can be left unread
+    jpeg_abort_decompress(&dinfo);
+    return true;
+  }
+
+  bool abortDecode()
+  {
+    jpeg_abort_decompress(&dinfo);
+    return false;
+  }
+
+  static void static_execute(void *data)
+  {
+    static_cast<StreamingJpegRgbPacketProcessorImpl *>(data)->execute();
+  }
+
+  void execute()
+  {
+    this_thread::set_name(processor->name());
+
+    for(;;)
+    {
+      RgbPacketProcessor::Config frame_config;
+      FrameListener *frame_listener;
+      bool dropped;
+      {
+        unique_lock l(state_mutex);
+        while(state == Idle && !shutdown)
+          WAIT_CONDITION(data_condition, state_mutex, l);
+        if(shutdown)
+          break;
+        frame_config = config;
+        frame_listener = listener;
+        dropped = state == Dropped;
+      }
+
+      // the frame is still ours if the size or format changed since
+      if(frame == 0 || frame->width != (size_t)(1920 / frame_config.ColorDownscale) || frame->format != frame_config.ColorFormat)
+      {
+        delete frame;
+        newFrame(frame_config);
+      }
+
+      bool ok = !dropped && decode(frame_config);
+      // after an error the packet still has to be waited for before its buffer is reused
+      if(!waitForPacket())
+        ok = false;
+
+      RgbPacket done;
+      bool complete;
+      {
+        lock_guard l(state_mutex);
+        complete = state == Complete;
+        done = packet;
+      }
+
+      if(complete)
+      {
+        if(ok)
+        {
+          stopTiming(LOG_INFO);
+
+          frame->timestamp = done.timestamp;
+          frame->sequence = done.sequence;
+          frame->exposure = done.exposure;
+          frame->gain = done.gain;
+          frame->gamma = done.gamma;
+
+          if(frame_listener != 0 && frame_listener->onNewFrame(Frame::Color, frame))
+          {
+            // the next packet allocates a new frame
+            frame = 0;
+          }
+        }
+        if(done.memory != 0)
+          processor->releaseBuffer(done);
+      }
+
+      {
+        lock_guard l(state_mutex);
+        state = Idle;
+        jpeg = 0;
+        length = 0;
+      }
+      idle_condition.notify_all();
+    }
+  }
+};
+
+StreamingJpegRgbPacketProcessor::StreamingJpegRgbPacketProcessor() :
+    impl_(new StreamingJpegRgbPacketProcessorImpl(this))
+{
+}
+
+StreamingJpegRgbPacketProcessor::~StreamingJpegRgbPacketProcessor()
+{
+  delete impl_;
+}
+
+bool StreamingJpegRgbPacketProcessor::supportsFormat(Frame::Format format) const
+{
+  return format == Frame::BGRX || format == Frame::RGBX || format == Frame::RGB || format == Frame::Gray;
+}
+
+bool StreamingJpegRgbPacketProcessor::ready()
+{
+  if(!RgbPacketProcessor::ready())
+    return false;
+
+  // a complete packet is decoded to its end before the next one starts
+  lock_guard l(impl_->state_mutex);
+  return impl_->state != StreamingJpegRgbPacketProcessorImpl::Complete;
+}
+
+RgbStreamTap *StreamingJpegRgbPacketProcessor::getStreamTap()
+{
+  return impl_;
+}
+
+void StreamingJpegRgbPacketProcessor::setFrameListener(FrameListener *listener)
+{
+  lock_guard l(impl_->state_mutex);
+  listener_ = listener;
+  impl_->listener = listener;
+}
+
+void StreamingJpegRgbPacketProcessor::setConfiguration(const Config &config)
+{
+  RgbPacketProcessor::setConfiguration(config);
+  lock_guard l(impl_->state_mutex);
+  impl_->config = config_;
+}
+
+void StreamingJpegRgbPacketProcessor::process(const RgbPacket &packet)
+{
+  if(config_.ColorFormat == Frame::Raw)
+  {
+    impl_->onStreamDropped(packet.jpeg_buffer);
+    passthrough(packet);
+    return;
+  }
+
+  if(!impl_->complete(packet))
+  {
+    // only reached if called without checking ready()
+    RgbPacket dropped = packet;
+    releaseBuffer(dropped);
+    return;
+  }
+
+  // without a pool buffer the caller owns the bytes, only for the duration of the call
+  if(packet.memory == 0)
+    impl_->waitIdle();
+}
+
+} /* namespace libfreenect2 */
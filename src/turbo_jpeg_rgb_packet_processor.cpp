@@ -29,10 +29,74 @@
 #include <libfreenect2/rgb_packet_processor.h>
 #include <libfreenect2/logging.h>
 #include <turbojpeg.h>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#ifdef LIBFREENECT2_WITH_JPEG_ROI_SUPPORT
+#include <csetjmp>
+#include <cstdio> //jpeglib.h does not include stdio.h
+#include <jpeglib.h>
+#endif
 
 namespace libfreenect2
 {
 
+/** TurboJPEG pixel format of a packed frame format. */
+static int toPixelFormat(Frame::Format format)
+{
+  switch(format)
+  {
+    case Frame::RGBX: return TJPF_RGBX;
+    case Frame::RGB: return TJPF_RGB;
+    case Frame::Gray: return TJPF_GRAY;
+    default: return TJPF_BGRX;
+  }
+}
+
+#ifdef LIBFREENECT2_WITH_JPEG_ROI_SUPPORT
+/** libjpeg output color space of a packed frame format. */
+static J_COLOR_SPACE toColorSpace(Frame::Format format)
+{
+  switch(format)
+  {
+    case Frame::RGBX: return JCS_EXT_RGBX;
+    case Frame::RGB: return JCS_RGB;
+    case Frame::Gray: return JCS_GRAYSCALE;
+    case Frame::I420: return JCS_YCbCr;
+    default: return JCS_EXT_BGRX;
+  }
+}
+
+struct TurboJpegRoiErrorManager
+{
+  struct jpeg_error_mgr pub;
+  jmp_buf setjmp_buffer;
+};
+#endif
+
+#ifdef LIBFREENECT2_WITH_TURBOJPEG_YUV_SUPPORT
+/** Average a chroma plane down by 1 or 2 in each direction. */
+static void averageChroma(const unsigned char *src, int src_stride, int sx, int sy, unsigned char *dst, int width, int height)
+{
+  for(int y = 0; y < height; ++y, dst += width)
+  {
+    const unsigned char *row0 = src + y * sy * src_stride;
+    const unsigned char *row1 = row0 + (sy - 1) * src_stride;
+
+    if(sx == 1)
+    {
+      for(int x = 0; x < width; ++x)
+        dst[x] = (row0[x] + row1[x] + 1) >> 1;
+    }
+    else
+    {
+      for(int x = 0; x < width; ++x)
+        dst[x] = (row0[2 * x] + row0[2 * x + 1] + row1[2 * x] + row1[2 * x + 1] + 2) >> 2;
+    }
+  }
+}
+#endif
+
 /** Implementation of the Turbo-Jpeg decoder processor. */
 class TurboJpegRgbPacketProcessorImpl: public WithPerfLogging
 {
@@ -41,8 +105,22 @@ public:
   tjhandle decompressor;
 
   Frame *frame;
+  size_t frame_width, frame_height; ///< Allocated size of the frame, which a cropped frame only partly uses.
+
+  std::vector<unsigned char> chroma; ///< U and V planes at the subsampling of the JPEG, for I420 output.
+
+#ifdef LIBFREENECT2_WITH_JPEG_ROI_SUPPORT
+  // TurboJPEG decodes whole images only, color regions are decoded with libjpeg
+  struct jpeg_decompress_struct dinfo;
+  TurboJpegRoiErrorManager jerr;
+  std::vector<unsigned char> row; ///< Scanline of the cropped JPEG, which is wider than the region.
+  std::vector<unsigned char> ycc; ///< Interleaved YCbCr of the region, for I420 output.
+#endif
 
-  TurboJpegRgbPacketProcessorImpl()
+  TurboJpegRgbPacketProcessorImpl() :
+    frame(0),
+    frame_width(0),
+    frame_height(0)
   {
     decompressor = tjInitDecompress();
     if(decompressor == 0)
@@ -50,13 +128,22 @@ public:
       LOG_ERROR << "Failed to initialize TurboJPEG decompressor! TurboJPEG error: '" << tjGetErrorStr() << "'";
     }
 
-    newFrame();
+#ifdef LIBFREENECT2_WITH_JPEG_ROI_SUPPORT
+    dinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = TurboJpegRgbPacketProcessorImpl::error_exit;
+    jerr.pub.output_message = TurboJpegRgbPacketProcessorImpl::output_message;
+    jpeg_create_decompress(&dinfo);
+#endif
   }
 
   ~TurboJpegRgbPacketProcessorImpl()
   {
     delete frame;
 
+#ifdef LIBFREENECT2_WITH_JPEG_ROI_SUPPORT
+    jpeg_destroy_decompress(&dinfo);
+#endif
+
     if(decompressor != 0)
     {
       if(tjDestroy(decompressor) == -1)
@@ -66,11 +153,175 @@ public:
     }
   }
 
-  void newFrame()
+  void newFrame(size_t width, size_t height, Frame::Format format)
   {
-    frame = new Frame(1920, 1080, tjPixelSize[TJPF_BGRX]);
-    frame->format = Frame::BGRX;
+    if(format == Frame::I420)
+    {
+      // allocate room for the chroma planes below the luma plane
+      frame = new Frame(width, height * 3 / 2, 1);
+      frame->height = height;
+    }
+    else
+    {
+      frame = new Frame(width, height, tjPixelSize[toPixelFormat(format)]);
+    }
+    frame->format = format;
+    frame_width = width;
+    frame_height = height;
   }
+
+#ifdef LIBFREENECT2_WITH_JPEG_ROI_SUPPORT
+  static void error_exit(j_common_ptr info)
+  {
+    {
+      char buffer[JMSG_LENGTH_MAX];
+      info->err->format_message(info, buffer);
+      LOG_ERROR << "Failed to decompress rgb image! libjpeg error: '" << buffer << "'";
+    }
+    longjmp(reinterpret_cast<TurboJpegRoiErrorManager *>(info->err)->setjmp_buffer, 1);
+  }
+
+  static void output_message(j_common_ptr info)
+  {
+    char buffer[JMSG_LENGTH_MAX];
+    info->err->format_message(info, buffer);
+    LOG_WARNING << "libjpeg: " << buffer;
+  }
+
+  /** Decode only the color region of the JPEG into the frame.
+   * Columns outside the region skip the inverse DCT and color conversion. The rows above it
+   * are still entropy decoded to find where the region starts, the rows below are not read.
+   * Only trivial locals here, so that the longjmp of error_exit() skips no destructors.
+   * @param[in,out] x, y, width, height The region in pixels of the full image, clipped to the image and
+   * rounded to whole output pixels, and for I420 to whole chroma samples.
+   * @return 0 on success, -1 on errors, which are already logged.
+   */
+  int decompressRegion(const RgbPacket &packet, Frame::Format format, int scale, int &x, int &y, int &width, int &height)
+  {
+    if(setjmp(jerr.setjmp_buffer))
+    {
+      jpeg_abort_decompress(&dinfo);
+      return -1;
+    }
+
+    jpeg_mem_src(&dinfo, packet.jpeg_buffer, packet.jpeg_buffer_length);
+    jpeg_read_header(&dinfo, TRUE);
+    dinfo.out_color_space = toColorSpace(format);
+    dinfo.scale_num = 1;
+    dinfo.scale_denom = scale;
+    jpeg_start_decompress(&dinfo);
+
+    // in output pixels; I420 takes whole chroma samples
+    const int output_width = dinfo.output_width;
+    const int output_height = dinfo.output_height;
+    const int align = format == Frame::I420 ? 2 : 1;
+    const int x0 = std::min(x / scale, output_width - 1) / align * align;
+    const int x1 = std::min(output_width, ((x + width + scale - 1) / scale + align - 1) / align * align);
+    const int y0 = std::min(y / scale, output_height - 1) / align * align;
+    const int y1 = std::min(output_height, ((y + height + scale - 1) / scale + align - 1) / align * align);
+
+    // The crop starts at a block boundary. Its first and last columns are upsampled as if they were
+    // the edge of the image, so it reaches one pixel past the region on both sides, and rows are copied out.
+    JDIMENSION crop_x = std::max(x0 - 1, 0);
+    JDIMENSION crop_width = std::min(x1 + 1, output_width) - crop_x;
+    jpeg_crop_scanline(&dinfo, &crop_x, &crop_width);
+    if(y0 > 0)
+      jpeg_skip_scanlines(&dinfo, y0);
+
+    const int bpp = dinfo.output_components;
+    const int stride = (x1 - x0) * bpp;
+    unsigned char *out = frame->data;
+    if(format == Frame::I420)
+    {
+      ycc.resize((size_t)stride * (y1 - y0));
+      out = &ycc[0];
+    }
+    row.resize(crop_width * bpp);
+    JSAMPROW rows[1] = { &row[0] };
+    const unsigned char *region = &row[0] + (x0 - crop_x) * bpp;
+
+    for(int i = 0; i < y1 - y0; ++i, out += stride)
+    {
+      jpeg_read_scanlines(&dinfo, rows, 1);
+      std::memcpy(out, region, stride);
+    }
+
+    // the rows below the region are left unread
+    jpeg_abort_decompress(&dinfo);
+
+    if(format == Frame::I420)
+      splitI420(&ycc[0], x1 - x0, y1 - y0);
+
+    x = x0 * scale;
+    y = y0 * scale;
+    width = (x1 - x0) * scale;
+    height = (y1 - y0) * scale;
+    return 0;
+  }
+
+  /** Split interleaved YCbCr into the I420 planes of the frame, averaging the chroma down by 2. */
+  void splitI420(const unsigned char *src, int width, int height)
+  {
+    unsigned char *luma = frame->data;
+    unsigned char *u = luma + width * height;
+    unsigned char *v = u + (width / 2) * (height / 2);
+    for(int i = 0; i < width * height; ++i)
+      luma[i] = src[i * 3];
+
+    for(int y = 0; y < height / 2; ++y)
+    {
+      const unsigned char *row0 = src + 2 * y * width * 3;
+      const unsigned char *row1 = row0 + width * 3;
+      for(int x = 0; x < width / 2; ++x, ++u, ++v)
+      {
+        *u = (row0[6 * x + 1] + row0[6 * x + 4] + row1[6 * x + 1] + row1[6 * x + 4] + 2) >> 2;
+        *v = (row0[6 * x + 2] + row0[6 * x + 5] + row1[6 * x + 2] + row1[6 * x + 5] + 2) >> 2;
+      }
+    }
+  }
+#endif
+
+#ifdef LIBFREENECT2_WITH_TURBOJPEG_YUV_SUPPORT
+  /** Decode to I420 without color conversion. JPEGs with other chroma subsampling are averaged down to 4:2:0. */
+  int decompressI420(unsigned char *jpeg, unsigned long length, int width, int height)
+  {
+    int jpeg_width, jpeg_height, subsamp;
+    if(tjDecompressHeader2(decompressor, jpeg, length, &jpeg_width, &jpeg_height, &subsamp) == -1)
+      return -1;
+
+    unsigned char *planes[3];
+    planes[0] = frame->data;
+    planes[1] = planes[0] + width * height;
+    planes[2] = planes[1] + (width / 2) * (height / 2);
+
+    if(subsamp == TJSAMP_420)
+    {
+      int strides[3] = {width, width / 2, width / 2};
+      return tjDecompressToYUVPlanes(decompressor, jpeg, length, planes, width, strides, height, 0);
+    }
+
+    const int chroma_width = subsamp == TJSAMP_GRAY ? 0 : tjPlaneWidth(1, width, subsamp);
+    const int chroma_height = subsamp == TJSAMP_GRAY ? 0 : tjPlaneHeight(1, height, subsamp);
+    const int sx = chroma_width / (width / 2);
+    const int sy = chroma_height / (height / 2);
+    if(sx < 1 || sx > 2 || sy < 1 || sy > 2)
+    {
+      LOG_ERROR << "Unsupported JPEG subsampling " << subsamp << " for I420";
+      return -1;
+    }
+
+    chroma.resize(chroma_width * chroma_height * 2);
+    unsigned char *native[3] = {planes[0], &chroma[0], &chroma[0] + chroma_width * chroma_height};
+    int strides[3] = {width, chroma_width, chroma_width};
+    int r = tjDecompressToYUVPlanes(decompressor, jpeg, length, native, width, strides, height, 0);
+    if(r == 0)
+    {
+      averageChroma(native[1], chroma_width, sx, sy, planes[1], width / 2, height / 2);
+      averageChroma(native[2], chroma_width, sx, sy, planes[2], width / 2, height / 2);
+    }
+    return r;
+  }
+#endif
 };
 
 TurboJpegRgbPacketProcessor::TurboJpegRgbPacketProcessor() :
@@ -83,10 +334,33 @@ TurboJpegRgbPacketProcessor::~TurboJpegRgbPacketProcessor()
   delete impl_;
 }
 
+bool TurboJpegRgbPacketProcessor::supportsFormat(Frame::Format format) const
+{
+#ifdef LIBFREENECT2_WITH_TURBOJPEG_YUV_SUPPORT
+  if(format == Frame::I420)
+    return true;
+#endif
+  return format == Frame::BGRX || format == Frame::RGBX || format == Frame::RGB || format == Frame::Gray;
+}
+
 void TurboJpegRgbPacketProcessor::process(const RgbPacket &packet)
 {
+  if(passthrough(packet))
+    return;
+
   if(impl_->decompressor != 0 && listener_ != 0)
   {
+    // TurboJPEG picks the largest DCT scaling factor that fits, 1/2 and 1/4 divide 1920x1080 exactly
+    const int scale = config_.ColorDownscale;
+    const Frame::Format format = config_.ColorFormat;
+
+    // allocated on the first packet for whole frames; the frame is still ours if the size or format changed since
+    if(impl_->frame == 0 || impl_->frame_width != (size_t)(1920 / scale) || impl_->frame_height != (size_t)(1080 / scale) || impl_->frame->format != format)
+    {
+      delete impl_->frame;
+      impl_->newFrame(1920 / scale, 1080 / scale, format);
+    }
+
     impl_->startTiming();
 
     impl_->frame->timestamp = packet.timestamp;
@@ -95,7 +369,43 @@ void TurboJpegRgbPacketProcessor::process(const RgbPacket &packet)
     impl_->frame->gain = packet.gain;
     impl_->frame->gamma = packet.gamma;
 
-    int r = tjDecompress2(impl_->decompressor, packet.jpeg_buffer, packet.jpeg_buffer_length, impl_->frame->data, 1920, 1920 * tjPixelSize[TJPF_BGRX], 1080, TJPF_BGRX, 0);
+    // the region in pixels of the full image; block boundaries and the image size are multiples of 4
+    int x = 0, y = 0, region_width = 1920, region_height = 1080;
+
+    int r;
+#ifdef LIBFREENECT2_WITH_JPEG_ROI_SUPPORT
+    if(config_.ColorRoiWidth > 0 && config_.ColorRoiHeight > 0)
+    {
+      x = config_.ColorRoiX;
+      y = config_.ColorRoiY;
+      region_width = config_.ColorRoiWidth;
+      region_height = config_.ColorRoiHeight;
+      r = impl_->decompressRegion(packet, format, scale, x, y, region_width, region_height);
+    }
+    else
+#endif
+    {
+      const int width = region_width / scale;
+      const int height = region_height / scale;
+#ifdef LIBFREENECT2_WITH_TURBOJPEG_YUV_SUPPORT
+      if(format == Frame::I420)
+      {
+        r = impl_->decompressI420(packet.jpeg_buffer, packet.jpeg_buffer_length, width, height);
+      }
+      else
+#endif
+      {
+        const int pixel_format = toPixelFormat(format);
+        r = tjDecompress2(impl_->decompressor, packet.jpeg_buffer, packet.jpeg_buffer_length, impl_->frame->data, width, width * tjPixelSize[pixel_format], height, pixel_format, 0);
+      }
+      if(r != 0)
+        LOG_ERROR << "Failed to decompress rgb image! TurboJPEG error: '" << tjGetErrorStr() << "'";
+    }
+
+    impl_->frame->width = region_width / scale;
+    impl_->frame->height = region_height / scale;
+    impl_->frame->x_offset = x / scale;
+    impl_->frame->y_offset = y / scale;
 
     impl_->stopTiming(LOG_INFO);
 
@@ -103,13 +413,10 @@ void TurboJpegRgbPacketProcessor::process(const RgbPacket &packet)
     {
       if(listener_->onNewFrame(Frame::Color, impl_->frame))
       {
-        impl_->newFrame();
+        // the next packet allocates a new frame
+        impl_->frame = 0;
       }
     }
-    else
-    {
-      LOG_ERROR << "Failed to decompress rgb image! TurboJPEG error: '" << tjGetErrorStr() << "'";
-    }
 
   }
 }
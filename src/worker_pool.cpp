@@ -0,0 +1,159 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+/** @file worker_pool.cpp Fork-join thread pool. */
+
+#include <libfreenect2/worker_pool.h>
+
+namespace libfreenect2
+{
+
+WorkerPool::WorkerPool(size_t num_threads, const char *name):
+  name_(name), task_(0), count_(0), next_(0), pending_(0), generation_(0), shutdown_(false)
+{
+  for (size_t i = 0; i < num_threads; i++)
+    threads_.push_back(new libfreenect2::thread(&WorkerPool::static_execute, this));
+}
+
+WorkerPool::~WorkerPool()
+{
+  {
+    libfreenect2::lock_guard l(mutex_);
+    shutdown_ = true;
+  }
+  start_condition_.notify_all();
+
+  for (size_t i = 0; i < threads_.size(); i++)
+  {
+    threads_[i]->join();
+    delete threads_[i];
+  }
+}
+
+size_t WorkerPool::size() const
+{
+  return threads_.size() + 1;
+}
+
+size_t WorkerPool::defaultSize()
+{
+  // beyond 4 threads, memory bandwidth limits the per-frame passes
+  size_t n = libfreenect2::thread::hardware_concurrency();
+  return n < 1 ? 1 : n > 4 ? 4 : n;
+}
+
+void WorkerPool::run(Task &task, size_t count)
+{
+  if (count == 0)
+    return;
+
+  bool busy;
+  {
+    libfreenect2::lock_guard l(mutex_);
+    busy = task_ != 0;
+    if (!busy)
+    {
+      task_ = &task;
+      count_ = count;
+      next_ = 0;
+      pending_ = count;
+      generation_++;
+    }
+  }
+
+  if (busy)
+  {
+    for (size_t i = 0; i < count; i++)
+      task.run(i, count);
+    return;
+  }
+
+  start_condition_.notify_all();
+
+  work();
+
+  libfreenect2::unique_lock l(mutex_);
+  while (pending_ > 0)
+  {
+    WAIT_CONDITION(done_condition_, mutex_, l)
+  }
+  task_ = 0;
+}
+
+void WorkerPool::static_execute(void *arg)
+{
+  static_cast<WorkerPool *>(arg)->execute();
+}
+
+void WorkerPool::execute()
+{
+  this_thread::set_name(name_);
+
+  unsigned seen = 0;
+  for (;;)
+  {
+    {
+      libfreenect2::unique_lock l(mutex_);
+      while (!shutdown_ && generation_ == seen)
+      {
+        WAIT_CONDITION(start_condition_, mutex_, l)
+      }
+      if (shutdown_)
+        return;
+      seen = generation_;
+    }
+    work();
+  }
+}
+
+void WorkerPool::work()
+{
+  for (;;)
+  {
+    Task *task;
+    size_t index, count;
+    {
+      libfreenect2::lock_guard l(mutex_);
+      if (next_ >= count_)
+        return;
+      task = task_;
+      index = next_++;
+      count = count_;
+    }
+
+    task->run(index, count);
+
+    bool done;
+    {
+      libfreenect2::lock_guard l(mutex_);
+      done = --pending_ == 0;
+    }
+    if (done)
+      done_condition_.notify_all();
+  }
+}
+
+} /* namespace libfreenect2 */
@@ -0,0 +1,256 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or not, you must retain
+ * the above copyright notice and this list of conditions and the following
+ * disclaimer.
+ *
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+
+
+/** @file color_roi_test.cpp Color regions decoded by the TurboJPEG processor, against whole frames decoded by libjpeg. */
+
+#include <libfreenect2/packet_pipeline.h>
+#include <libfreenect2/frame_listener.hpp>
+#include <libfreenect2/rgb_packet_processor.h>
+
+#include <cstdio> //jpeglib.h does not include stdio.h
+#include <cstdlib>
+#include <cstring>
+#include <jpeglib.h>
+
+#include "test.h"
+
+using libfreenect2::Frame;
+
+static const int WIDTH = 1920, HEIGHT = 1080;
+
+/** 4:2:2 JPEG like the ones of the device, with gradients and a checkerboard so that misplaced pixels show. */
+static std::vector<unsigned char> encodeJpeg()
+{
+  std::vector<unsigned char> row(WIDTH * 3);
+
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  cinfo.err = jpeg_std_error(&jerr);
+  jpeg_create_compress(&cinfo);
+
+  unsigned char *out = 0;
+  unsigned long length = 0;
+  jpeg_mem_dest(&cinfo, &out, &length);
+  cinfo.image_width = WIDTH;
+  cinfo.image_height = HEIGHT;
+  cinfo.input_components = 3;
+  cinfo.in_color_space = JCS_RGB;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, 90, TRUE);
+  cinfo.comp_info[0].h_samp_factor = 2;
+  cinfo.comp_info[0].v_samp_factor = 1;
+  jpeg_start_compress(&cinfo, TRUE);
+  while (cinfo.next_scanline < cinfo.image_height)
+  {
+    const int y = cinfo.next_scanline;
+    for (int x = 0; x < WIDTH; ++x)
+    {
+      const bool square = ((x / 32) + (y / 32)) % 2 != 0;
+      row[x * 3 + 0] = x * 255 / WIDTH;
+      row[x * 3 + 1] = y * 255 / HEIGHT;
+      row[x * 3 + 2] = square ? 200 : 40;
+    }
+    JSAMPROW rows[1] = { &row[0] };
+    jpeg_write_scanlines(&cinfo, rows, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+
+  std::vector<unsigned char> jpeg(out, out + length);
+  std::free(out);
+  return jpeg;
+}
+
+/** The whole image decoded with libjpeg. */
+static std::vector<unsigned char> decodeJpeg(std::vector<unsigned char> &jpeg, J_COLOR_SPACE color_space, int scale, int &bpp)
+{
+  struct jpeg_decompress_struct dinfo;
+  struct jpeg_error_mgr jerr;
+  dinfo.err = jpeg_std_error(&jerr);
+  jpeg_create_decompress(&dinfo);
+  jpeg_mem_src(&dinfo, &jpeg[0], jpeg.size());
+  jpeg_read_header(&dinfo, TRUE);
+  dinfo.out_color_space = color_space;
+  dinfo.scale_num = 1;
+  dinfo.scale_denom = scale;
+  jpeg_start_decompress(&dinfo);
+
+  bpp = dinfo.output_components;
+  const size_t stride = dinfo.output_width * bpp;
+  std::vector<unsigned char> image(stride * dinfo.output_height);
+  while (dinfo.output_scanline < dinfo.output_height)
+  {
+    JSAMPROW rows[1] = { &image[dinfo.output_scanline * stride] };
+    jpeg_read_scanlines(&dinfo, rows, 1);
+  }
+  jpeg_finish_decompress(&dinfo);
+  jpeg_destroy_decompress(&dinfo);
+  return image;
+}
+
+/** Keeps a copy of the last color frame. */
+class ColorListener: public libfreenect2::FrameListener
+{
+public:
+  size_t frames;
+  size_t width, height, x_offset, y_offset;
+  std::vector<unsigned char> data;
+
+  ColorListener(): frames(0), width(0), height(0), x_offset(0), y_offset(0) {}
+
+  virtual bool onNewFrame(libfreenect2::Frame::Type type, libfreenect2::Frame *frame)
+  {
+    if (type != libfreenect2::Frame::Color)
+      return false;
+    ++frames;
+    width = frame->width;
+    height = frame->height;
+    x_offset = frame->x_offset;
+    y_offset = frame->y_offset;
+    const size_t size = frame->format == Frame::I420 ? width * height * 3 / 2 : width * height * frame->bytes_per_pixel;
+    data.assign(frame->data, frame->data + size);
+    return false;
+  }
+};
+
+static libfreenect2::RgbPacket makePacket(std::vector<unsigned char> &jpeg, uint32_t sequence)
+{
+  libfreenect2::RgbPacket packet;
+  std::memset(&packet, 0, sizeof(packet));
+  packet.sequence = sequence;
+  packet.jpeg_buffer = &jpeg[0];
+  packet.jpeg_buffer_length = jpeg.size();
+  return packet;
+}
+
+/** Bytes of the frame that differ from the same place in the whole image. */
+static size_t countDifferent(const ColorListener &frame, const std::vector<unsigned char> &image, size_t image_width, int bpp)
+{
+  size_t different = 0;
+  for (size_t y = 0; y < frame.height; ++y)
+    for (size_t x = 0; x < frame.width * bpp; ++x)
+    {
+      if (frame.data[y * frame.width * bpp + x] != image[(frame.y_offset + y) * image_width * bpp + frame.x_offset * bpp + x])
+        ++different;
+    }
+  return different;
+}
+
+/** Decode the region and check where it landed and what it shows. */
+static void checkRegion(libfreenect2::RgbPacketProcessor *processor, ColorListener &listener, std::vector<unsigned char> &jpeg,
+                        Frame::Format format, J_COLOR_SPACE color_space, int scale, int x, int y, int width, int height)
+{
+  libfreenect2::Freenect2Device::Config config;
+  config.ColorFormat = format;
+  config.ColorDownscale = scale;
+  config.ColorRoiX = x;
+  config.ColorRoiY = y;
+  config.ColorRoiWidth = width;
+  config.ColorRoiHeight = height;
+  processor->setConfiguration(config);
+
+  const size_t frames = listener.frames;
+  processor->process(makePacket(jpeg, frames));
+  CHECK(listener.frames == frames + 1);
+  if (listener.frames != frames + 1)
+    return;
+
+  // clipped at the image border, I420 rounds to whole chroma samples
+  const int image_width = WIDTH / scale, image_height = HEIGHT / scale;
+  const size_t align = format == Frame::I420 ? 2 : 1;
+  const size_t x0 = x / scale, y0 = y / scale;
+  const size_t x1 = std::min(image_width, (x + width) / scale), y1 = std::min(image_height, (y + height) / scale);
+  CHECK(listener.x_offset == x0 / align * align);
+  CHECK(listener.y_offset == y0 / align * align);
+  CHECK(listener.x_offset + listener.width == (x1 + align - 1) / align * align);
+  CHECK(listener.y_offset + listener.height == (y1 + align - 1) / align * align);
+
+  int bpp;
+  std::vector<unsigned char> image = decodeJpeg(jpeg, color_space, scale, bpp);
+  if (format != Frame::I420)
+  {
+    CHECK(countDifferent(listener, image, image_width, bpp) == 0);
+    return;
+  }
+
+  // the luma plane, and one chroma plane averaged over 2x2 pixels
+  std::vector<unsigned char> luma(image_width * image_height), cb(luma.size());
+  for (size_t i = 0; i < luma.size(); ++i)
+  {
+    luma[i] = image[i * 3];
+    cb[i] = image[i * 3 + 1];
+  }
+  CHECK(countDifferent(listener, luma, image_width, 1) == 0);
+
+  size_t different = 0;
+  const unsigned char *u = &listener.data[listener.width * listener.height];
+  for (size_t cy = 0; cy < listener.height / 2; ++cy)
+    for (size_t cx = 0; cx < listener.width / 2; ++cx)
+    {
+      const size_t i = (listener.y_offset + 2 * cy) * image_width + listener.x_offset + 2 * cx;
+      const int expected = (cb[i] + cb[i + 1] + cb[i + image_width] + cb[i + image_width + 1] + 2) / 4;
+      if (u[cy * (listener.width / 2) + cx] != expected)
+        ++different;
+    }
+  CHECK(different == 0);
+}
+
+int main()
+{
+  ColorListener listener;
+  libfreenect2::CpuPacketPipeline pipeline;
+  libfreenect2::RgbPacketProcessor *processor = pipeline.getRgbPacketProcessor();
+  if (std::strcmp(processor->name(), "TurboJPEG") != 0)
+  {
+    std::cerr << "TurboJPEG color processing not selected, got " << processor->name() << std::endl;
+    return 1;
+  }
+  processor->setFrameListener(&listener);
+
+  std::vector<unsigned char> jpeg = encodeJpeg();
+
+  // inside the image, off the block grid of the JPEG
+  checkRegion(processor, listener, jpeg, Frame::BGRX, JCS_EXT_BGRX, 1, 501, 301, 640, 480);
+  // clipped at the bottom right corner, and downscaled
+  checkRegion(processor, listener, jpeg, Frame::RGB, JCS_RGB, 2, 1800, 1000, 400, 400);
+  // a small one at the top left corner
+  checkRegion(processor, listener, jpeg, Frame::Gray, JCS_GRAYSCALE, 4, 0, 0, 128, 64);
+  checkRegion(processor, listener, jpeg, Frame::RGBX, JCS_EXT_RGBX, 1, 1000, 700, 16, 8);
+#ifdef LIBFREENECT2_WITH_TURBOJPEG_YUV_SUPPORT
+  // odd position and size, I420 rounds them to whole chroma samples
+  checkRegion(processor, listener, jpeg, Frame::I420, JCS_YCbCr, 1, 333, 201, 101, 51);
+#endif
+
+  // a broken JPEG gives no frame, and the next one decodes again
+  std::vector<unsigned char> broken(jpeg.begin(), jpeg.begin() + 1000);
+  broken[0] = 0;
+  const size_t frames = listener.frames;
+  processor->process(makePacket(broken, 100));
+  CHECK(listener.frames == frames);
+  checkRegion(processor, listener, jpeg, Frame::BGRX, JCS_EXT_BGRX, 1, 64, 64, 64, 64);
+
+  return testResult();
+}
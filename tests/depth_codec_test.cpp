@@ -0,0 +1,243 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+
+/** @file depth_codec_test.cpp Round trip of DepthCodec. */
+
+#include <libfreenect2/depth_codec.h>
+#include <libfreenect2/frame_listener.hpp>
+#include <libfreenect2/simd.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <vector>
+#ifdef LIBFREENECT2_WITH_CXX11_SUPPORT
+#include <chrono>
+#endif
+
+#include "test.h"
+
+// the throughput of the SSE2 paths is only checked in optimized builds without sanitizers
+#if defined(LIBFREENECT2_WITH_CXX11_SUPPORT) && defined(LIBFREENECT2_WITH_SSE2) && defined(NDEBUG)
+#define CHECK_THROUGHPUT
+#endif
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+#undef CHECK_THROUGHPUT
+#endif
+#ifdef __has_feature
+#if __has_feature(address_sanitizer) || __has_feature(thread_sanitizer)
+#undef CHECK_THROUGHPUT
+#endif
+#endif
+
+using libfreenect2::DepthCodec;
+using libfreenect2::Frame;
+
+/** Depth as the codec restores it: rounded millimeters, 0 if not representable. */
+static float quantized(float d)
+{
+  return (d > 0.0f && d < 65535.5f) ? std::floor(d + 0.5f) : 0.0f;
+}
+
+/** Frame with runs of invalid pixels, noise, and values the codec cannot keep. */
+static void fill(Frame &frame, unsigned int seed)
+{
+  std::srand(seed);
+  float *depth = reinterpret_cast<float *>(frame.data);
+  const size_t n = frame.width * frame.height;
+  for (size_t i = 0; i < n; ++i)
+  {
+    const int r = std::rand() % 100;
+    if (r < 20)
+      depth[i] = 0.0f;
+    else if (r < 21)
+      depth[i] = -5.0f;
+    else if (r < 22)
+      depth[i] = std::numeric_limits<float>::quiet_NaN();
+    else if (r < 23)
+      depth[i] = 70000.0f;
+    else
+      depth[i] = 500.0f + (i % frame.width) + (std::rand() % 1000) / 100.0f;
+  }
+  // long runs across rows
+  for (size_t i = n / 3; i < n / 3 + 2 * frame.width; ++i)
+    depth[i] = 0.0f;
+  depth[n - 1] = 65535.0f;
+  frame.format = Frame::Float;
+  frame.timestamp = seed * 267;
+  frame.sequence = seed;
+}
+
+/** Flat frame with jumps to values over the whole range, for deltas of every length. */
+static void fillJumps(Frame &frame, unsigned int seed)
+{
+  std::srand(seed);
+  float *depth = reinterpret_cast<float *>(frame.data);
+  for (size_t i = 0; i < frame.width * frame.height; ++i)
+    depth[i] = (std::rand() % 8 == 0) ? 1.0f + (std::rand() * 7919u) % 65535 : 1000.0f + std::rand() % 5;
+  frame.format = Frame::Float;
+}
+
+/** Wall, floor and a sphere with noise growing with the distance, and a few invalid pixels. */
+static void fillScene(Frame &frame, unsigned int seed)
+{
+  std::srand(seed);
+  float *depth = reinterpret_cast<float *>(frame.data);
+  for (size_t y = 0; y < frame.height; ++y)
+  {
+    for (size_t x = 0; x < frame.width; ++x)
+    {
+      const float dx = x - frame.width * 0.6f, dy = y - frame.height * 0.5f;
+      float d;
+      if (dx * dx + dy * dy < 80 * 80)
+        d = 1500.0f - std::sqrt(80 * 80 - dx * dx - dy * dy) * 3.0f;
+      else if (y > frame.height * 0.7f)
+        d = 1200.0f + (frame.height - y) * 8.0f;
+      else
+        d = 3500.0f + x * 0.5f;
+      const int noise = 2 + (int)(d / 200);
+      d += std::rand() % (2 * noise + 1) - noise;
+      if (x < 8 || std::rand() % 100 < 4)
+        d = 0.0f;
+      depth[y * frame.width + x] = d;
+    }
+  }
+  frame.format = Frame::Float;
+}
+
+static void roundTrip(DepthCodec &codec, Frame &frame)
+{
+  const size_t width = frame.width, height = frame.height;
+
+  std::vector<unsigned char> buffer(DepthCodec::maxEncodedSize(width, height));
+  const size_t length = codec.encode(&frame, &buffer[0], buffer.size());
+  CHECK(length > DepthCodec::HeaderSize);
+  if (width * height >= 64 * 48)
+    CHECK(length < width * height * 2);
+
+  size_t decoded_width = 0, decoded_height = 0;
+  CHECK(DepthCodec::getFrameSize(&buffer[0], length, decoded_width, decoded_height));
+  CHECK(decoded_width == width && decoded_height == height);
+
+  Frame decoded(width, height, 4);
+  CHECK(DepthCodec::decode(&buffer[0], length, &decoded));
+  CHECK(decoded.format == Frame::Float);
+  CHECK(decoded.timestamp == frame.timestamp);
+  CHECK(decoded.sequence == frame.sequence);
+
+  const float *in = reinterpret_cast<const float *>(frame.data);
+  const float *out = reinterpret_cast<const float *>(decoded.data);
+  size_t mismatches = 0;
+  for (size_t i = 0; i < width * height; ++i)
+    if (out[i] != quantized(in[i]))
+      mismatches++;
+  CHECK(mismatches == 0);
+
+  // truncated data is rejected
+  CHECK(!DepthCodec::decode(&buffer[0], length - 1, &decoded));
+  CHECK(!DepthCodec::decode(&buffer[0], DepthCodec::HeaderSize - 1, &decoded));
+  // and corrupted data must not write past the frame, whatever the result
+  buffer[DepthCodec::HeaderSize] ^= 0xff;
+  buffer[DepthCodec::HeaderSize + 1] ^= 0xff;
+  DepthCodec::decode(&buffer[0], length, &decoded);
+}
+
+static void roundTrip(DepthCodec &codec, size_t width, size_t height, unsigned int seed)
+{
+  Frame frame(width, height, 4);
+  fill(frame, seed);
+  roundTrip(codec, frame);
+}
+
+#ifdef CHECK_THROUGHPUT
+/** Best encode and decode speeds on a 512x424 scene, in GB/s of float depth. */
+static void throughput(DepthCodec &codec, double &encode, double &decode)
+{
+  typedef std::chrono::high_resolution_clock clock;
+  Frame frame(512, 424, 4), decoded(512, 424, 4);
+  fillScene(frame, 7);
+  std::vector<unsigned char> buffer(DepthCodec::maxEncodedSize(frame.width, frame.height));
+  const double bytes = frame.width * frame.height * 4;
+  encode = decode = 0;
+  for (int i = 0; i < 100; ++i)
+  {
+    clock::time_point start = clock::now();
+    const size_t length = codec.encode(&frame, &buffer[0], buffer.size());
+    clock::time_point encoded = clock::now();
+    DepthCodec::decode(&buffer[0], length, &decoded);
+    clock::time_point end = clock::now();
+    encode = std::max(encode, bytes / std::chrono::duration<double>(encoded - start).count() / 1e9);
+    decode = std::max(decode, bytes / std::chrono::duration<double>(end - encoded).count() / 1e9);
+  }
+}
+#endif
+
+int main()
+{
+  DepthCodec codec;
+
+  // the same codec for frames of different sizes
+  roundTrip(codec, 512, 424, 1);
+  roundTrip(codec, 64, 48, 2);
+  roundTrip(codec, 512, 424, 3);
+  roundTrip(codec, 1, 1, 4);
+
+  // deltas of all lengths, and runs longer than the short codes of run lengths
+  Frame jumps(512, 424, 4);
+  fillJumps(jumps, 6);
+  roundTrip(codec, jumps);
+  Frame scene(640, 480, 4);
+  fillScene(scene, 7);
+  roundTrip(codec, scene);
+  float *depth = reinterpret_cast<float *>(scene.data);
+  for (size_t i = 0; i < scene.width * scene.height; ++i)
+    depth[i] = 1000.0f + i % 7;
+  roundTrip(codec, scene);
+
+  // a buffer too small fails instead of overflowing
+  Frame frame(512, 424, 4);
+  fill(frame, 5);
+  std::vector<unsigned char> small(1024);
+  CHECK(codec.encode(&frame, &small[0], small.size()) == 0);
+
+  // only float depth frames are encoded
+  Frame color(4, 4, 4);
+  color.format = Frame::BGRX;
+  std::vector<unsigned char> buffer(DepthCodec::maxEncodedSize(4, 4));
+  CHECK(codec.encode(&color, &buffer[0], buffer.size()) == 0);
+
+#ifdef CHECK_THROUGHPUT
+  // a floor well below the speed of the SSE2 paths, to hold on slower machines
+  double encode, decode;
+  throughput(codec, encode, decode);
+  std::cout << "encode " << encode << " GB/s, decode " << decode << " GB/s" << std::endl;
+  CHECK(encode > 0.6);
+  CHECK(decode > 0.6);
+#endif
+
+  return testResult();
+}
@@ -0,0 +1,144 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or not, you must retain
+ * the above copyright notice and this list of conditions and the following
+ * disclaimer.
+ *
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+
+
+/** @file fan_out_test.cpp Frames shared by FanOutFrameListener subscribers, and when they are deleted. */
+
+#include <libfreenect2/frame_listener_impl.h>
+#include <libfreenect2/threading.h>
+
+#include "test.h"
+
+using libfreenect2::Frame;
+using libfreenect2::FanOutFrameListener;
+
+/** Take a frame without waiting. @return The frame, or NULL if none is queued. */
+static const Frame *take(FanOutFrameListener &listener, size_t subscriber, Frame::Type expected)
+{
+  Frame::Type type;
+  const Frame *frame = 0;
+  if (!listener.waitForNewFrame(subscriber, type, frame, 0))
+    return 0;
+  CHECK(type == expected);
+  return frame;
+}
+
+struct Waiter
+{
+  FanOutFrameListener *listener;
+  size_t subscriber;
+  bool result;
+
+  static void run(void *arg)
+  {
+    Waiter *self = static_cast<Waiter *>(arg);
+    Frame::Type type;
+    const Frame *frame;
+    self->result = self->listener->waitForNewFrame(self->subscriber, type, frame);
+  }
+};
+
+int main()
+{
+  FanOutFrameListener listener;
+  const size_t a = listener.subscribe(Frame::Color | Frame::Depth, 2, FanOutFrameListener::DropOldest);
+  const size_t b = listener.subscribe(Frame::Color, 1, FanOutFrameListener::DropNewest);
+
+  // both subscribers get the same frame, deleted after the second release
+  Frame *color = new CountedFrame(1);
+  CHECK(listener.onNewFrame(Frame::Color, color));
+  CHECK(take(listener, a, Frame::Color) == color);
+  CHECK(take(listener, b, Frame::Color) == color);
+  listener.release(color);
+  CHECK(frames_deleted == 0);
+  listener.release(color);
+  CHECK(frames_deleted == 1);
+
+  // a frame nobody subscribed to is left to the caller
+  Frame ir(1, 1, 4);
+  CHECK(!listener.onNewFrame(Frame::Ir, &ir));
+  CHECK(take(listener, a, Frame::Ir) == 0);
+
+  // a full queue drops its oldest frame
+  Frame *depth[3];
+  for (int i = 0; i < 3; ++i)
+  {
+    depth[i] = new CountedFrame(2 + i);
+    CHECK(listener.onNewFrame(Frame::Depth, depth[i]));
+  }
+  CHECK(frames_deleted == 2);
+  CHECK(listener.getDroppedFrames(a) == 1);
+  CHECK(take(listener, a, Frame::Depth) == depth[1]);
+  CHECK(take(listener, a, Frame::Depth) == depth[2]);
+  CHECK(take(listener, a, Frame::Depth) == 0);
+  listener.release(depth[1]);
+  listener.release(depth[2]);
+  CHECK(frames_deleted == 4);
+
+  // or skips the new one, which lives on while another subscriber has it
+  Frame *first = new CountedFrame(5);
+  Frame *second = new CountedFrame(6);
+  listener.onNewFrame(Frame::Color, first);
+  listener.onNewFrame(Frame::Color, second);
+  CHECK(listener.getDroppedFrames(b) == 1);
+  CHECK(take(listener, b, Frame::Color) == first);
+  CHECK(take(listener, b, Frame::Color) == 0);
+  listener.release(first);
+  CHECK(frames_deleted == 4);
+  CHECK(take(listener, a, Frame::Color) == first);
+  CHECK(take(listener, a, Frame::Color) == second);
+  listener.release(first);
+  listener.release(second);
+  CHECK(frames_deleted == 6);
+
+  // unsubscribing drops the queued frames and wakes a waiting thread
+  Frame *queued = new CountedFrame(7);
+  listener.onNewFrame(Frame::Color, queued);
+  CHECK(take(listener, a, Frame::Color) == queued);
+  listener.unsubscribe(b);
+  CHECK(frames_deleted == 6);
+  listener.release(queued);
+  CHECK(frames_deleted == 7);
+
+  Waiter waiter = { &listener, a, true };
+  libfreenect2::thread thread(Waiter::run, &waiter);
+  libfreenect2::this_thread::sleep_for(libfreenect2::chrono::milliseconds(50));
+  listener.unsubscribe(a);
+  thread.join();
+  CHECK(!waiter.result);
+  CHECK(!listener.onNewFrame(Frame::Color, &ir));
+
+  // frames still held are deleted with the listener
+  {
+    FanOutFrameListener other;
+    const size_t c = other.subscribe(Frame::Depth);
+    other.onNewFrame(Frame::Depth, new CountedFrame(8));
+    other.onNewFrame(Frame::Depth, new CountedFrame(9));
+    CHECK(take(other, c, Frame::Depth) != 0);
+  }
+  CHECK(frames_deleted == 9);
+
+  return testResult();
+}
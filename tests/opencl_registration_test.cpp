@@ -0,0 +1,165 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or not, you must retain
+ * the above copyright notice and this list of conditions and the following
+ * disclaimer.
+ *
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+
+
+/** @file opencl_registration_test.cpp OpenCLRegistration::apply() against Registration::apply() on the same frames. */
+
+#include <libfreenect2/registration.h>
+
+#define CL_USE_DEPRECATED_OPENCL_1_2_APIS
+#include <CL/cl.h>
+
+#include <cmath>
+#include <vector>
+
+#include "test.h"
+
+using libfreenect2::Frame;
+
+static const size_t WIDTH = 512, HEIGHT = 424;
+
+static libfreenect2::Freenect2Device::IrCameraParams depthParams()
+{
+  libfreenect2::Freenect2Device::IrCameraParams p = libfreenect2::Freenect2Device::IrCameraParams();
+  p.fx = p.fy = 365.0f;
+  p.cx = 256.0f;
+  p.cy = 212.0f;
+  p.k1 = 0.09f;
+  p.k2 = -0.27f;
+  p.k3 = 0.09f;
+  return p;
+}
+
+/** Linear mapping onto the color camera, wide enough that the border of the depth image falls outside. */
+static libfreenect2::Freenect2Device::ColorCameraParams colorParams()
+{
+  libfreenect2::Freenect2Device::ColorCameraParams p = libfreenect2::Freenect2Device::ColorCameraParams();
+  p.fx = p.fy = 1081.37f;
+  p.cx = 959.5f;
+  p.cy = 539.5f;
+  p.shift_d = 863.0f;
+  p.shift_m = 52.0f;
+  p.mx_x1y0 = 0.63f;
+  p.my_x0y1 = 0.63f;
+  return p;
+}
+
+/** A slanted wall with a nearer box in front, which occludes color pixels for the filter, and a grid of holes. */
+static void fillDepth(Frame &depth)
+{
+  float *d = (float *)depth.data;
+  for (size_t y = 0; y < HEIGHT; ++y)
+    for (size_t x = 0; x < WIDTH; ++x)
+    {
+      float z = 1500.0f + 3.0f * x + 1.0f * y;
+      if (x >= 180 && x < 300 && y >= 150 && y < 260)
+        z = 700.0f;
+      if (x % 37 == 0 && y % 29 == 0)
+        z = 0.0f;
+      d[y * WIDTH + x] = z;
+    }
+}
+
+/** Every color pixel tells its own coordinates. */
+static void fillColor(Frame &color)
+{
+  unsigned *c = (unsigned *)color.data;
+  for (size_t y = 0; y < color.height; ++y)
+    for (size_t x = 0; x < color.width; ++x)
+      c[y * color.width + x] = (unsigned)((y & 0x7ff) << 11 | (x & 0x7ff));
+}
+
+static bool haveOpenCLDevice()
+{
+  cl_uint platforms = 0;
+  if (clGetPlatformIDs(0, NULL, &platforms) != CL_SUCCESS || platforms == 0)
+    return false;
+  std::vector<cl_platform_id> ids(platforms);
+  if (clGetPlatformIDs(platforms, &ids[0], NULL) != CL_SUCCESS)
+    return false;
+  for (size_t i = 0; i < ids.size(); ++i)
+  {
+    cl_uint devices = 0;
+    if (clGetDeviceIDs(ids[i], CL_DEVICE_TYPE_ALL, 0, NULL, &devices) == CL_SUCCESS && devices > 0)
+      return true;
+  }
+  return false;
+}
+
+/** Compare the outputs of both registrations, allowing a few pixels where the device rounds differently. */
+static void compare(bool enable_filter)
+{
+  const libfreenect2::Freenect2Device::IrCameraParams depth_p = depthParams();
+  const libfreenect2::Freenect2Device::ColorCameraParams color_p = colorParams();
+  libfreenect2::Registration cpu(depth_p, color_p);
+  libfreenect2::OpenCLRegistration cl(depth_p, color_p);
+  CHECK(cl.good());
+  if (!cl.good())
+    return;
+
+  Frame depth(WIDTH, HEIGHT, 4), color(1920, 1080, 4);
+  depth.format = Frame::Float;
+  color.format = Frame::BGRX;
+  fillDepth(depth);
+  fillColor(color);
+
+  Frame cpu_undistorted(WIDTH, HEIGHT, 4), cpu_registered(WIDTH, HEIGHT, 4);
+  Frame cl_undistorted(WIDTH, HEIGHT, 4), cl_registered(WIDTH, HEIGHT, 4);
+  cpu.apply(&color, &depth, &cpu_undistorted, &cpu_registered, enable_filter);
+  CHECK(cl.apply(&color, &depth, &cl_undistorted, &cl_registered, enable_filter));
+
+  const float *cpu_z = (const float *)cpu_undistorted.data, *cl_z = (const float *)cl_undistorted.data;
+  const unsigned *cpu_c = (const unsigned *)cpu_registered.data, *cl_c = (const unsigned *)cl_registered.data;
+  size_t depth_differ = 0, color_differ = 0, registered = 0;
+  for (size_t i = 0; i < WIDTH * HEIGHT; ++i)
+  {
+    if (std::fabs(cpu_z[i] - cl_z[i]) > 0.5f)
+      ++depth_differ;
+    if (cpu_c[i] != cl_c[i])
+      ++color_differ;
+    if (cpu_c[i] != 0)
+      ++registered;
+  }
+
+  std::cout << (enable_filter ? "filtered" : "unfiltered") << ": " << registered << " registered pixels, "
+            << depth_differ << " depth and " << color_differ << " color pixels differ" << std::endl;
+  // most of the scene must land inside the color image
+  CHECK(registered > WIDTH * HEIGHT / 2);
+  CHECK(depth_differ <= WIDTH * HEIGHT / 1000);
+  CHECK(color_differ <= WIDTH * HEIGHT / 200);
+}
+
+int main()
+{
+  if (!haveOpenCLDevice())
+  {
+    std::cout << "no OpenCL device, skipped" << std::endl;
+    return 0;
+  }
+
+  compare(false);
+  compare(true);
+  return testResult();
+}
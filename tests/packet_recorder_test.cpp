@@ -0,0 +1,157 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+
+/** @file packet_recorder_test.cpp Captures of PacketRingRecorder, and how they end. */
+
+#include <libfreenect2/packet_pipeline.h>
+#include <libfreenect2/packet_recorder.h>
+#include <libfreenect2/data_callback.h>
+#include <libfreenect2/frame_listener.hpp>
+#include <libfreenect2/rgb_packet_processor.h>
+#include <libfreenect2/threading.h>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "test.h"
+
+static const uint32_t TICKS_PER_FRAME = 267; // 30 Hz in 0.125 ms
+
+static std::string capturedFile(uint32_t sequence)
+{
+  std::ostringstream name;
+  name << "./" << sequence * TICKS_PER_FRAME << "_rgb_" << sequence << ".jpg";
+  return name.str();
+}
+
+static bool exists(const std::string &filename)
+{
+  std::ifstream in(filename.c_str(), std::ios::binary);
+  return in.good();
+}
+
+static void stream(libfreenect2::PacketPipeline &pipeline, uint32_t first, uint32_t count)
+{
+  std::vector<unsigned char> jpeg(1000, 0x11);
+  jpeg[0] = 0xff;
+  jpeg[1] = 0xd8;
+  jpeg[jpeg.size() - 2] = 0xff;
+  jpeg[jpeg.size() - 1] = 0xd9;
+  for (uint32_t sequence = first; sequence < first + count; ++sequence)
+  {
+    std::vector<unsigned char> packet = makeRgbPacket(jpeg, sequence, sequence * TICKS_PER_FRAME);
+    sendInChunks(pipeline.getRgbPacketParser(), packet, 0x4000);
+  }
+}
+
+/** Ignores the frames of the dump pipeline. */
+class NullListener: public libfreenect2::FrameListener
+{
+public:
+  virtual bool onNewFrame(libfreenect2::Frame::Type, libfreenect2::Frame *) { return false; }
+};
+
+/** Wait for the capture to be written. @return Milliseconds waited, or -1 on timeout. */
+static int waitCaptured(libfreenect2::PacketRingRecorder &recorder, int timeout_ms)
+{
+  for (int waited = 0; waited <= timeout_ms; waited += 10)
+  {
+    if (!recorder.isCapturing())
+      return waited;
+    libfreenect2::this_thread::sleep_for(libfreenect2::chrono::milliseconds(10));
+  }
+  return -1;
+}
+
+struct Streamer
+{
+  libfreenect2::PacketPipeline *pipeline;
+  uint32_t first;
+
+  static void run(void *arg)
+  {
+    Streamer *self = static_cast<Streamer *>(arg);
+    stream(*self->pipeline, self->first, 200);
+  }
+};
+
+int main()
+{
+  NullListener listener;
+  libfreenect2::DumpPacketPipeline pipeline;
+  pipeline.getRgbPacketProcessor()->setFrameListener(&listener);
+  libfreenect2::PacketRingRecorder recorder(".", 0.5f, 60.0f);
+  pipeline.setPacketRecorder(&recorder);
+
+  CHECK(!recorder.trigger()); // nothing received yet
+
+  // the stream stops long before the end of the capture: it ends once packets stop
+  stream(pipeline, 1, 30);
+  CHECK(recorder.trigger());
+  CHECK(recorder.isCapturing());
+  stream(pipeline, 31, 5);
+  const int waited = waitCaptured(recorder, 5000);
+  CHECK(waited >= 500);
+  CHECK(recorder.getWrittenPackets() == 20);
+  for (uint32_t sequence = 1; sequence < 36; ++sequence)
+  {
+    // half a second before the trigger, and everything after
+    CHECK(exists(capturedFile(sequence)) == (sequence >= 16));
+    std::remove(capturedFile(sequence).c_str());
+  }
+
+  // detaching the recorder ends its capture right away
+  stream(pipeline, 36, 5);
+  CHECK(recorder.trigger());
+  pipeline.setPacketRecorder(0);
+  const int waited_detached = waitCaptured(recorder, 5000);
+  CHECK(waited_detached >= 0 && waited_detached < 500);
+
+  // and it sees no more packets
+  stream(pipeline, 41, 5);
+  CHECK(recorder.trigger());
+  CHECK(waitCaptured(recorder, 5000) >= 0);
+  for (uint32_t sequence = 1; sequence < 46; ++sequence)
+  {
+    CHECK(!exists(capturedFile(sequence)) || sequence <= 40);
+    std::remove(capturedFile(sequence).c_str());
+  }
+
+  // attaching and detaching while the USB thread delivers packets
+  Streamer streamer = { &pipeline, 1000 };
+  libfreenect2::thread usb_thread(&Streamer::run, &streamer);
+  for (int i = 0; i < 100; ++i)
+  {
+    pipeline.setPacketRecorder(&recorder);
+    pipeline.setPacketRecorder(0);
+  }
+  usb_thread.join();
+  CHECK(recorder.getDroppedPackets() == 0);
+
+  return testResult();
+}
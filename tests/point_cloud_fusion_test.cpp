@@ -0,0 +1,217 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or not, you must retain
+ * the above copyright notice and this list of conditions and the following
+ * disclaimer.
+ *
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+
+
+/** @file point_cloud_fusion_test.cpp Voxel merging and the voxel limit of PointCloudFusion. */
+
+#include <libfreenect2/point_cloud_fusion.h>
+
+#include <cmath>
+#include <cstring>
+
+#include "test.h"
+
+using libfreenect2::Frame;
+using libfreenect2::PointCloudFusion;
+
+static const size_t WIDTH = 512, HEIGHT = 424;
+
+static libfreenect2::Freenect2Device::IrCameraParams cameraParams()
+{
+  libfreenect2::Freenect2Device::IrCameraParams p = libfreenect2::Freenect2Device::IrCameraParams();
+  p.fx = p.fy = 365.0f;
+  p.cx = 256.0f;
+  p.cy = 212.0f;
+  return p;
+}
+
+static void translation(float m[16], float x, float y, float z)
+{
+  const float t[16] = { 1, 0, 0, x,  0, 1, 0, y,  0, 0, 1, z,  0, 0, 0, 1 };
+  std::memcpy(m, t, sizeof(t));
+}
+
+/** Depth in millimeter inside the block of @p size pixels around the principal point, invalid outside. */
+static void fillBlock(Frame &depth, size_t size, float mm)
+{
+  float *d = (float *)depth.data;
+  for (size_t y = 0; y < HEIGHT; ++y)
+    for (size_t x = 0; x < WIDTH; ++x)
+    {
+      const bool inside = x >= 256 - size / 2 && x < 256 + size / 2 && y >= 212 - size / 2 && y < 212 + size / 2;
+      d[y * WIDTH + x] = inside ? mm : 0.0f;
+    }
+}
+
+static void fillColor(Frame &color, unsigned bgrx)
+{
+  unsigned *c = (unsigned *)color.data;
+  for (size_t i = 0; i < WIDTH * HEIGHT; ++i)
+    c[i] = bgrx;
+}
+
+static unsigned pointColor(const float *point)
+{
+  unsigned color;
+  std::memcpy(&color, point + 3, sizeof(color));
+  return color;
+}
+
+static bool near(float a, float b)
+{
+  return std::fabs(a - b) < 1e-3f;
+}
+
+/** Points of two devices in one voxel become a single averaged point. */
+static void testMerging()
+{
+  Frame depth(WIDTH, HEIGHT, 4), color0(WIDTH, HEIGHT, 4), color1(WIDTH, HEIGHT, 4);
+  fillBlock(depth, 64, 1000.0f);
+  fillColor(color0, 0x00102030);
+  fillColor(color1, 0x00304050);
+
+  // with 10 m voxels, the block at 1 m lies in [0, 10) once moved by 5 m
+  float m[16];
+  translation(m, 5.0f, 5.0f, 0.0f);
+  PointCloudFusion fusion(10.0f);
+  fusion.addDevice(cameraParams(), m);
+  fusion.addDevice(cameraParams(), m);
+
+  std::vector<float> cloud(512 * 424 * 4);
+  const Frame *undistorted[2] = { &depth, &depth };
+  const Frame *registered[2] = { &color0, &color1 };
+  CHECK(fusion.fuse(undistorted, registered, &cloud[0]) == 1);
+  CHECK(fusion.getDroppedPoints() == 0);
+  // the block is centered on the principal point
+  CHECK(near(cloud[0], 5.0f) && near(cloud[1], 5.0f) && near(cloud[2], 1.0f));
+  CHECK(pointColor(&cloud[0]) == 0x00203040);
+
+  // the color is averaged over the points that have one
+  const Frame *color_of_first[2] = { &color0, NULL };
+  CHECK(fusion.fuse(undistorted, color_of_first, &cloud[0]) == 1);
+  CHECK(pointColor(&cloud[0]) == 0x00102030);
+
+  // devices without a frame add nothing
+  const Frame *only_second[2] = { NULL, &depth };
+  CHECK(fusion.fuse(only_second, NULL, &cloud[0]) == 1);
+  CHECK(near(cloud[2], 1.0f) && pointColor(&cloud[0]) == 0);
+}
+
+/** The limit counts the voxels of the whole grid. */
+static void testVoxelLimit()
+{
+  // 1 mm voxels put every pixel of the 30x30 block at 1 m into a voxel of its own
+  Frame depth(WIDTH, HEIGHT, 4);
+  fillBlock(depth, 30, 1000.0f);
+  float m[16];
+  translation(m, 0.0f, 0.0f, 0.0f);
+  const Frame *undistorted[1] = { &depth };
+  std::vector<float> cloud(512 * 424 * 4);
+
+  PointCloudFusion roomy(0.001f, 1000);
+  roomy.addDevice(cameraParams(), m);
+  CHECK(roomy.fuse(undistorted, NULL, &cloud[0]) == 900);
+  CHECK(roomy.getDroppedPoints() == 0);
+
+  PointCloudFusion tight(0.001f, 500);
+  tight.addDevice(cameraParams(), m);
+  CHECK(tight.fuse(undistorted, NULL, &cloud[0]) == 500);
+  CHECK(tight.getDroppedPoints() == 400);
+
+  // a full grid is emptied for the next frame set
+  fillBlock(depth, 10, 1000.0f);
+  CHECK(tight.fuse(undistorted, NULL, &cloud[0]) == 100);
+  CHECK(tight.getDroppedPoints() == 0);
+}
+
+/** Several devices with overlapping points, fused repeatedly by separate instances. */
+static std::vector<float> fuseScene(size_t max_voxels)
+{
+  const size_t devices = 3;
+  std::vector<Frame *> depth;
+  for (size_t d = 0; d < devices; ++d)
+  {
+    Frame *frame = new Frame(WIDTH, HEIGHT, 4);
+    float *data = (float *)frame->data;
+    for (size_t y = 0; y < HEIGHT; ++y)
+      for (size_t x = 0; x < WIDTH; ++x)
+        data[y * WIDTH + x] = (x + y) % 17 == 0 ? 0.0f : 800.0f + (float)((x * 7 + y * 13 + d * 101) % 1500);
+    depth.push_back(frame);
+  }
+
+  PointCloudFusion fusion(0.02f, max_voxels);
+  for (size_t d = 0; d < devices; ++d)
+  {
+    float m[16];
+    translation(m, 0.05f * d, -0.03f * d, 0.1f * d);
+    fusion.addDevice(cameraParams(), m);
+  }
+
+  std::vector<float> cloud(devices * WIDTH * HEIGHT * 4);
+  const size_t n = fusion.fuse(&depth[0], NULL, &cloud[0]);
+  CHECK(n > 0 && n <= max_voxels);
+  CHECK(n == max_voxels || fusion.getDroppedPoints() == 0);
+  cloud.resize(n * 4);
+
+  // fusing again gives the same cloud
+  std::vector<float> again(devices * WIDTH * HEIGHT * 4);
+  CHECK(fusion.fuse(&depth[0], NULL, &again[0]) == n);
+  again.resize(n * 4);
+  CHECK(again == cloud);
+
+  for (size_t d = 0; d < devices; ++d)
+    delete depth[d];
+  return cloud;
+}
+
+static void testDeterminism()
+{
+  const std::vector<float> full = fuseScene(3 * WIDTH * HEIGHT);
+  for (int i = 0; i < 3; ++i)
+    CHECK(fuseScene(3 * WIDTH * HEIGHT) == full);
+
+  // a grid a little too small drops the last voxels of the full cloud
+  const size_t limit = full.size() / 4 * 9 / 10;
+  const std::vector<float> capped = fuseScene(limit);
+  CHECK(capped.size() == limit * 4);
+  CHECK(std::equal(capped.begin(), capped.end(), full.begin()));
+  for (int i = 0; i < 3; ++i)
+    CHECK(fuseScene(limit) == capped);
+
+  // a much smaller one also drops points in every shard, but still the same ones each time
+  const size_t small = full.size() / 4 / 4;
+  const std::vector<float> small_cloud = fuseScene(small);
+  CHECK(small_cloud.size() == small * 4);
+  for (int i = 0; i < 3; ++i)
+    CHECK(fuseScene(small) == small_cloud);
+}
+
+int main()
+{
+  testMerging();
+  testVoxelLimit();
+  testDeterminism();
+  return testResult();
+}
@@ -0,0 +1,141 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or not, you must retain
+ * the above copyright notice and this list of conditions and the following
+ * disclaimer.
+ *
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+
+
+/** @file pollable_listener_test.cpp The descriptor and queue of PollableFrameListener. */
+
+#include <libfreenect2/frame_listener_impl.h>
+#include <libfreenect2/threading.h>
+
+#ifndef _WIN32
+#include <poll.h>
+#endif
+
+#include "test.h"
+
+using libfreenect2::Frame;
+using libfreenect2::PollableFrameListener;
+
+/** Whether the descriptor is readable within the timeout. Always true without a descriptor. */
+static bool readable(PollableFrameListener &listener, int milliseconds = 0)
+{
+#ifndef _WIN32
+  struct pollfd fd;
+  fd.fd = listener.getFd();
+  fd.events = POLLIN;
+  fd.revents = 0;
+  return poll(&fd, 1, milliseconds) == 1 && (fd.revents & POLLIN) != 0;
+#else
+  return true;
+#endif
+}
+
+static Frame *pop(PollableFrameListener &listener, Frame::Type expected)
+{
+  Frame::Type type;
+  Frame *frame = 0;
+  if (!listener.tryPop(type, frame))
+    return 0;
+  CHECK(type == expected);
+  return frame;
+}
+
+struct Producer
+{
+  PollableFrameListener *listener;
+  Frame *frame;
+
+  static void run(void *arg)
+  {
+    Producer *self = static_cast<Producer *>(arg);
+    libfreenect2::this_thread::sleep_for(libfreenect2::chrono::milliseconds(50));
+    self->listener->onNewFrame(Frame::Depth, self->frame);
+  }
+};
+
+int main()
+{
+  PollableFrameListener listener(Frame::Color | Frame::Depth, 2);
+#ifndef _WIN32
+  CHECK(listener.getFd() >= 0);
+#endif
+  CHECK(!readable(listener));
+
+  // readable while frames are queued, however many there are
+  Frame *color = new CountedFrame(1);
+  Frame *depth = new CountedFrame(1);
+  CHECK(listener.onNewFrame(Frame::Color, color));
+  CHECK(readable(listener));
+  CHECK(listener.onNewFrame(Frame::Depth, depth));
+  CHECK(readable(listener));
+
+  // types not asked for are left to the caller
+  Frame ir(1, 1, 4);
+  CHECK(!listener.onNewFrame(Frame::Ir, &ir));
+
+  CHECK(pop(listener, Frame::Color) == color);
+  CHECK(readable(listener));
+  CHECK(pop(listener, Frame::Depth) == depth);
+  CHECK(!readable(listener));
+  CHECK(pop(listener, Frame::Color) == 0);
+  delete color;
+  delete depth;
+
+  // a full queue deletes its oldest frame
+  Frame *frames[3];
+  for (int i = 0; i < 3; ++i)
+  {
+    frames[i] = new CountedFrame(2 + i);
+    listener.onNewFrame(Frame::Color, frames[i]);
+  }
+  CHECK(frames_deleted == 3);
+  CHECK(listener.getDroppedFrames() == 1);
+  CHECK(readable(listener));
+  CHECK(pop(listener, Frame::Color) == frames[1]);
+  CHECK(pop(listener, Frame::Color) == frames[2]);
+  CHECK(!readable(listener));
+  delete frames[1];
+  delete frames[2];
+
+  // a poll waiting on another thread wakes up for a frame
+  Producer producer = { &listener, new CountedFrame(5) };
+  libfreenect2::thread thread(Producer::run, &producer);
+  CHECK(readable(listener, 5000));
+  thread.join();
+  CHECK(pop(listener, Frame::Depth) == producer.frame);
+  CHECK(!readable(listener));
+  delete producer.frame;
+
+  // frames still queued are deleted with the listener
+  const int before = frames_deleted;
+  {
+    PollableFrameListener other(Frame::Depth);
+    other.onNewFrame(Frame::Depth, new CountedFrame(6));
+    other.onNewFrame(Frame::Depth, new CountedFrame(7));
+  }
+  CHECK(frames_deleted == before + 2);
+
+  return testResult();
+}
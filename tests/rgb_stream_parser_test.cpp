@@ -0,0 +1,185 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or not, you must retain
+ * the above copyright notice and this list of conditions and the following
+ * disclaimer.
+ *
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+
+/** @file rgb_stream_parser_test.cpp Color packets decoded while they are received, through the packet pipeline. */
+
+#include <libfreenect2/packet_pipeline.h>
+#include <libfreenect2/data_callback.h>
+#include <libfreenect2/frame_listener.hpp>
+#include <libfreenect2/rgb_packet_processor.h>
+#include <libfreenect2/threading.h>
+
+#include <cstdio> //jpeglib.h does not include stdio.h
+#include <cstdlib>
+#include <cstring>
+#include <jpeglib.h>
+
+#include "test.h"
+
+/** Solid color 1920x1080 JPEG. */
+static std::vector<unsigned char> encodeJpeg(unsigned char r, unsigned char g, unsigned char b)
+{
+  const int width = 1920, height = 1080;
+  std::vector<unsigned char> row(width * 3);
+  for (int x = 0; x < width; ++x)
+  {
+    row[x * 3 + 0] = r;
+    row[x * 3 + 1] = g;
+    row[x * 3 + 2] = b;
+  }
+
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  cinfo.err = jpeg_std_error(&jerr);
+  jpeg_create_compress(&cinfo);
+
+  unsigned char *out = 0;
+  unsigned long length = 0;
+  jpeg_mem_dest(&cinfo, &out, &length);
+  cinfo.image_width = width;
+  cinfo.image_height = height;
+  cinfo.input_components = 3;
+  cinfo.in_color_space = JCS_RGB;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, 90, TRUE);
+  jpeg_start_compress(&cinfo, TRUE);
+  while (cinfo.next_scanline < cinfo.image_height)
+  {
+    JSAMPROW rows[1] = { &row[0] };
+    jpeg_write_scanlines(&cinfo, rows, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+
+  std::vector<unsigned char> jpeg(out, out + length);
+  std::free(out);
+  return jpeg;
+}
+
+/** Keeps the sequence and the center pixel of each color frame. */
+class ColorListener: public libfreenect2::FrameListener
+{
+public:
+  libfreenect2::mutex mutex;
+  std::vector<uint32_t> sequences;
+  std::vector<uint32_t> pixels;
+
+  virtual bool onNewFrame(libfreenect2::Frame::Type type, libfreenect2::Frame *frame)
+  {
+    if (type != libfreenect2::Frame::Color)
+      return false;
+    const unsigned char *bgrx = frame->data + (frame->height / 2 * frame->width + frame->width / 2) * 4;
+    libfreenect2::lock_guard l(mutex);
+    sequences.push_back(frame->sequence);
+    pixels.push_back(bgrx[2] << 16 | bgrx[1] << 8 | bgrx[0]);
+    return false;
+  }
+
+  size_t count()
+  {
+    libfreenect2::lock_guard l(mutex);
+    return sequences.size();
+  }
+
+  /** Wait for @p n frames in total. @return false on timeout. */
+  bool waitFor(size_t n)
+  {
+    for (int i = 0; i < 500 && count() < n; ++i)
+      libfreenect2::this_thread::sleep_for(libfreenect2::chrono::milliseconds(10));
+    return count() >= n;
+  }
+};
+
+static bool near(uint32_t rgb, unsigned char r, unsigned char g, unsigned char b)
+{
+  return std::abs((int)(rgb >> 16 & 0xff) - r) <= 2 && std::abs((int)(rgb >> 8 & 0xff) - g) <= 2 && std::abs((int)(rgb & 0xff) - b) <= 2;
+}
+
+int main()
+{
+  libfreenect2::RgbDecoderConfig config;
+  config.streaming = true;
+
+  ColorListener listener;
+  libfreenect2::CpuPacketPipeline pipeline(config);
+  libfreenect2::RgbPacketProcessor *processor = pipeline.getRgbPacketProcessor();
+  if (std::strcmp(processor->name(), "libjpeg streaming") != 0)
+  {
+    std::cerr << "color streaming not selected, got " << processor->name() << std::endl;
+    return 1;
+  }
+  processor->setFrameListener(&listener);
+  libfreenect2::DataCallback *parser = pipeline.getRgbPacketParser();
+
+  std::vector<unsigned char> red = encodeJpeg(200, 30, 30);
+  std::vector<unsigned char> blue = encodeJpeg(20, 40, 220);
+
+  // decoded while it arrives in USB transfer sized pieces
+  std::vector<unsigned char> packet = makeRgbPacket(red, 1, 267);
+  sendInChunks(parser, packet, 0x4000);
+  CHECK(listener.waitFor(1));
+
+  // the next packet goes to a new buffer and must not be dropped when the parser resets its own
+  packet = makeRgbPacket(blue, 2, 534);
+  sendInChunks(parser, packet, 0x4000);
+  CHECK(listener.waitFor(2));
+
+  // a footer that does not match drops the packet while it is being decoded
+  packet = makeRgbPacket(red, 3, 801);
+  packet[packet.size() - 14 * 4 + 4] ^= 0xff; // the footer's copy of the sequence
+  sendInChunks(parser, packet, 0x4000);
+
+  // the decoder takes the following packet after letting go of the dropped one
+  packet = makeRgbPacket(blue, 4, 1068);
+  sendInChunks(parser, packet, 0x4000);
+  CHECK(listener.waitFor(3));
+
+  // a whole packet in one piece
+  packet = makeRgbPacket(red, 5, 1335);
+  sendInChunks(parser, packet, packet.size());
+  CHECK(listener.waitFor(4));
+
+  // dropping the bytes of another buffer leaves the packet being received alone
+  packet = makeRgbPacket(blue, 6, 1602);
+  std::vector<unsigned char> head(packet.begin(), packet.begin() + packet.size() / 2);
+  std::vector<unsigned char> tail(packet.begin() + packet.size() / 2, packet.end());
+  sendInChunks(parser, head, 0x4000);
+  processor->getStreamTap()->onStreamDropped(&red[0]);
+  sendInChunks(parser, tail, 0x4000);
+  CHECK(listener.waitFor(5));
+
+  libfreenect2::this_thread::sleep_for(libfreenect2::chrono::milliseconds(50));
+  libfreenect2::lock_guard l(listener.mutex);
+  CHECK(listener.sequences.size() == 5);
+  if (listener.sequences.size() == 5)
+  {
+    CHECK(listener.sequences[0] == 1 && near(listener.pixels[0], 200, 30, 30));
+    CHECK(listener.sequences[1] == 2 && near(listener.pixels[1], 20, 40, 220));
+    CHECK(listener.sequences[2] == 4 && near(listener.pixels[2], 20, 40, 220));
+    CHECK(listener.sequences[3] == 5 && near(listener.pixels[3], 200, 30, 30));
+    CHECK(listener.sequences[4] == 6 && near(listener.pixels[4], 20, 40, 220));
+  }
+  return testResult();
+}
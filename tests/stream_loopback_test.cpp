@@ -0,0 +1,141 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or not, you must retain
+ * the above copyright notice and this list of conditions and the following
+ * disclaimer.
+ *
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+
+
+/** @file stream_loopback_test.cpp Frames sent by the streamer of tools/streamer_recorder to a local receiver. */
+
+#include <libfreenect2/frame_listener.hpp>
+
+#include <cstring>
+
+#include "receiver.h"
+#include "streamer.h"
+#include "test.h"
+
+using libfreenect2::Frame;
+
+static const unsigned short TEST_PORT = 47811;
+
+/** Wait for the next frame of @p stream. */
+static bool receiveFrame(StreamReceiver &receiver, StreamId stream, ReceivedFrame &frame)
+{
+  while (receiver.receive(frame, 2000))
+    if (frame.stream == stream)
+      return true;
+  return false;
+}
+
+/** Send a datagram of @p length bytes: a header, then payload bytes, if there is room. */
+static void sendFragment(UDPSocket &socket, const FragmentHeader &header, size_t length)
+{
+  std::vector<unsigned char> datagram(std::max(length, FRAGMENT_HEADER_SIZE), 0x5a);
+  writeFragmentHeader(header, datagram.data());
+  socket.sendTo(datagram.data(), length, "127.0.0.1", TEST_PORT);
+}
+
+int main()
+{
+  StreamReceiver receiver(TEST_PORT);
+  Streamer streamer;
+  CHECK(streamer.setCodec(STREAM_DEPTH, "rvl"));
+  CHECK(streamer.setCodec(STREAM_COLOR, "raw"));
+  CHECK(!streamer.setCodec(STREAM_IR, "png"));
+  streamer.initialize("127.0.0.1", TEST_PORT);
+
+  // depth goes through the lossless codec and comes back as the same millimeters
+  Frame depth(512, 424, 4);
+  depth.format = Frame::Float;
+  depth.sequence = 7;
+  depth.timestamp = 1234;
+  float *mm = (float *)depth.data;
+  for (size_t i = 0; i < 512 * 424; ++i)
+    mm[i] = (i % 13 == 0) ? 0.0f : (float)(500 + i % 4000);
+  streamer.stream(&depth, STREAM_DEPTH);
+
+  ReceivedFrame frame;
+  CHECK(receiveFrame(receiver, STREAM_DEPTH, frame));
+  CHECK(frame.codec == CODEC_RVL && frame.format == Frame::Float);
+  CHECK(frame.frame_id == 0 && frame.sequence == 7 && frame.timestamp == 1234);
+  CHECK(frame.width == 512 && frame.height == 424);
+  cv::Mat image;
+  CHECK(decodeFrame(frame, image));
+  CHECK(!image.empty() && std::memcmp(image.data, depth.data, 512 * 424 * 4) == 0);
+
+  // raw color spans several fragments and keeps every byte
+  Frame color(128, 96, 4);
+  color.format = Frame::BGRX;
+  for (size_t i = 0; i < 128 * 96 * 4; ++i)
+    color.data[i] = (unsigned char)(i * 31 + 5);
+  for (uint32_t n = 0; n < 2; ++n)
+  {
+    color.sequence = 100 + n;
+    streamer.stream(&color, STREAM_COLOR);
+    CHECK(receiveFrame(receiver, STREAM_COLOR, frame));
+    CHECK(frame.codec == CODEC_RAW && frame.format == Frame::BGRX);
+    CHECK(frame.frame_id == n && frame.sequence == 100 + n);
+    CHECK(frame.data.size() == 128 * 96 * 4 && std::memcmp(frame.data.data(), color.data, frame.data.size()) == 0);
+  }
+  streamer.close();
+
+  const StreamReceiver::Statistics before = receiver.getStatistics();
+  CHECK(before.frames == 3 && before.invalid_datagrams == 0 && before.lost_frames == 0);
+
+  UDPSocket socket;
+  FragmentHeader header = FragmentHeader();
+  header.stream = STREAM_IR;
+  header.codec = CODEC_RAW;
+  header.format = Frame::Float;
+  header.frame_id = 0;
+  header.fragment_count = 2;
+  header.frame_length = FRAGMENT_PAYLOAD_SIZE + 16;
+  header.width = 1;
+  header.height = 1;
+
+  // a datagram cut off inside the header
+  sendFragment(socket, header, FRAGMENT_HEADER_SIZE - 1);
+  // a payload running past the end of the frame
+  header.fragment_index = 1;
+  header.offset = FRAGMENT_PAYLOAD_SIZE;
+  sendFragment(socket, header, FRAGMENT_HEADER_SIZE + 17);
+  // the first half of a frame whose second half never arrives
+  header.fragment_index = 0;
+  header.offset = 0;
+  sendFragment(socket, header, FRAGMENT_HEADER_SIZE + FRAGMENT_PAYLOAD_SIZE);
+
+  CHECK(!receiver.receive(frame, 200));
+  const StreamReceiver::Statistics &after = receiver.getStatistics();
+  CHECK(after.datagrams == before.datagrams + 3);
+  CHECK(after.invalid_datagrams == 2);
+  CHECK(after.frames == 3);
+
+  // the last fragment completes the frame
+  header.fragment_index = 1;
+  header.offset = FRAGMENT_PAYLOAD_SIZE;
+  sendFragment(socket, header, FRAGMENT_HEADER_SIZE + 16);
+  CHECK(receiveFrame(receiver, STREAM_IR, frame));
+  CHECK(frame.data.size() == FRAGMENT_PAYLOAD_SIZE + 16 && frame.data[0] == 0x5a && frame.data.back() == 0x5a);
+
+  return testResult();
+}
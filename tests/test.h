@@ -0,0 +1,123 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+
+/** @file test.h Checks shared by the tests. */
+
+#ifndef TEST_H_
+#define TEST_H_
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <libfreenect2/frame_listener.hpp>
+
+static int test_failures = 0;
+
+/** Report a failed condition and go on with the test. */
+#define CHECK(cond) \
+  do \
+  { \
+    if (!(cond)) \
+    { \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond << std::endl; \
+      test_failures++; \
+    } \
+  } \
+  while (0)
+
+/** Exit status of the test. */
+static inline int testResult()
+{
+  if (test_failures > 0)
+    std::cerr << test_failures << " checks failed" << std::endl;
+  return test_failures > 0 ? 1 : 0;
+}
+
+static int frames_deleted = 0;
+
+/** Small frame that counts its deletions, which return the buffer of a real frame. */
+class CountedFrame: public libfreenect2::Frame
+{
+public:
+  CountedFrame(uint32_t timestamp) : libfreenect2::Frame(1, 1, 4)
+  {
+    this->timestamp = timestamp;
+  }
+
+  virtual ~CountedFrame()
+  {
+    frames_deleted++;
+  }
+};
+
+static inline void appendU32(std::vector<unsigned char> &out, uint32_t v)
+{
+  for (int i = 0; i < 4; ++i)
+    out.push_back((v >> (8 * i)) & 0xff);
+}
+
+/** Color packet as the device sends it: header, JPEG, alignment, filler and footer. */
+static inline std::vector<unsigned char> makeRgbPacket(const std::vector<unsigned char> &jpeg, uint32_t sequence, uint32_t timestamp)
+{
+  const size_t filler_length = 16;
+  std::vector<unsigned char> packet;
+  appendU32(packet, sequence);
+  appendU32(packet, 0x42424242);
+  packet.insert(packet.end(), jpeg.begin(), jpeg.end());
+  while (packet.size() % 4 != 0)
+    packet.push_back(0xa5);
+  packet.insert(packet.end(), filler_length, 'Z');
+
+  appendU32(packet, 0x39393939);
+  appendU32(packet, sequence);
+  appendU32(packet, filler_length);
+  appendU32(packet, 0);
+  appendU32(packet, 0);
+  appendU32(packet, timestamp);
+  appendU32(packet, 0x3f800000); // exposure 1.0f
+  appendU32(packet, 0x3f800000); // gain 1.0f
+  appendU32(packet, 0x42424242);
+  appendU32(packet, packet.size() + 4 + 16);
+  appendU32(packet, 0x3f800000); // gamma 1.0f
+  appendU32(packet, 0);
+  appendU32(packet, 0);
+  appendU32(packet, 0);
+  return packet;
+}
+
+/** Data the USB thread gives the parsers, in transfers of at most @p chunk bytes. */
+template<typename Callback>
+static inline void sendInChunks(Callback *callback, std::vector<unsigned char> &data, size_t chunk)
+{
+  for (size_t offset = 0; offset < data.size(); offset += chunk)
+    callback->onDataReceived(&data[offset], std::min(chunk, data.size() - offset));
+}
+
+#endif /* TEST_H_ */
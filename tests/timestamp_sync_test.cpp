@@ -0,0 +1,126 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or not, you must retain
+ * the above copyright notice and this list of conditions and the following
+ * disclaimer.
+ *
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+
+
+/** @file timestamp_sync_test.cpp Sets of TimestampSyncFrameListener, and when it deletes frames. */
+
+#include <libfreenect2/frame_listener_impl.h>
+
+#include "test.h"
+
+using libfreenect2::Frame;
+using libfreenect2::FrameMap;
+using libfreenect2::TimestampSyncFrameListener;
+
+/** Take the set that is ready. @return Timestamps of the color and depth frame, or 0 if no set is ready. */
+static uint64_t takeSet(TimestampSyncFrameListener &listener)
+{
+  if (!listener.hasNewFrame())
+    return 0;
+  FrameMap frames;
+  listener.waitForNewFrame(frames);
+  CHECK(frames.size() == 2);
+  const uint64_t timestamps = (uint64_t)frames[Frame::Color]->timestamp << 32 | frames[Frame::Depth]->timestamp;
+  listener.release(frames);
+  return timestamps;
+}
+
+static uint64_t pair(uint32_t color, uint32_t depth)
+{
+  return (uint64_t)color << 32 | depth;
+}
+
+int main()
+{
+  TimestampSyncFrameListener listener(Frame::Color | Frame::Depth, 133, 2);
+
+  // frames within the tolerance form a set
+  CHECK(listener.onNewFrame(Frame::Color, new CountedFrame(1000)));
+  CHECK(!listener.hasNewFrame());
+  CHECK(listener.onNewFrame(Frame::Depth, new CountedFrame(1040)));
+  CHECK(takeSet(listener) == pair(1000, 1040));
+  CHECK(listener.getLastSkew() == 40);
+  CHECK(frames_deleted == 2);
+
+  // types not asked for are left to the caller
+  Frame ir(1, 1, 4);
+  CHECK(!listener.onNewFrame(Frame::Ir, &ir));
+
+  // a depth frame too far off waits, and is dropped once a later one matches
+  listener.onNewFrame(Frame::Color, new CountedFrame(2000));
+  listener.onNewFrame(Frame::Depth, new CountedFrame(1800));
+  CHECK(!listener.hasNewFrame());
+  listener.onNewFrame(Frame::Depth, new CountedFrame(2010));
+  CHECK(frames_deleted == 3);
+  CHECK(takeSet(listener) == pair(2000, 2010));
+  CHECK(listener.getDroppedFrames() == 1);
+
+  // a set not taken is replaced by the next one
+  listener.onNewFrame(Frame::Color, new CountedFrame(3000));
+  listener.onNewFrame(Frame::Depth, new CountedFrame(3000));
+  listener.onNewFrame(Frame::Color, new CountedFrame(3267));
+  listener.onNewFrame(Frame::Depth, new CountedFrame(3267));
+  CHECK(frames_deleted == 7);
+  CHECK(listener.getDroppedFrames() == 3);
+  CHECK(takeSet(listener) == pair(3267, 3267));
+  CHECK(listener.getLastSkew() == 0);
+
+  // a full queue drops its oldest frame
+  listener.onNewFrame(Frame::Color, new CountedFrame(4000));
+  listener.onNewFrame(Frame::Color, new CountedFrame(4267));
+  CHECK(frames_deleted == 9);
+  listener.onNewFrame(Frame::Color, new CountedFrame(4534));
+  CHECK(frames_deleted == 10);
+  CHECK(listener.getDroppedFrames() == 4);
+
+  // once depth moved past them, the color frames left can not be matched anymore
+  listener.onNewFrame(Frame::Depth, new CountedFrame(5000));
+  CHECK(!listener.hasNewFrame());
+  CHECK(frames_deleted == 12);
+  CHECK(listener.getDroppedFrames() == 6);
+
+  // timestamps wrap around
+  TimestampSyncFrameListener wrapping(Frame::Color | Frame::Depth);
+  wrapping.onNewFrame(Frame::Color, new CountedFrame(0xffffff00));
+  wrapping.onNewFrame(Frame::Depth, new CountedFrame(0xffffff00));
+  CHECK(takeSet(wrapping) == pair(0xffffff00, 0xffffff00));
+  wrapping.onNewFrame(Frame::Depth, new CountedFrame(0xfffffff0));
+  wrapping.onNewFrame(Frame::Color, new CountedFrame(0x10));
+  CHECK(takeSet(wrapping) == pair(0x10, 0xfffffff0));
+  CHECK(wrapping.getLastSkew() == 0x20);
+  CHECK(wrapping.getDroppedFrames() == 0);
+
+  // frames still queued are deleted with the listener
+  const int before = frames_deleted;
+  {
+    TimestampSyncFrameListener other(Frame::Color | Frame::Depth);
+    other.onNewFrame(Frame::Color, new CountedFrame(100));
+    other.onNewFrame(Frame::Depth, new CountedFrame(100));
+    other.onNewFrame(Frame::Color, new CountedFrame(367));
+  }
+  CHECK(frames_deleted == before + 3);
+
+  return testResult();
+}
@@ -0,0 +1,310 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2017 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+/** @file batch_replay.cpp Parallel offline re-processing of recorded depth packets. */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+
+#if defined(_WIN32) || defined(__WIN32__) || defined(__WINDOWS__)
+  #include <msdirent.h>
+#else
+  #include <dirent.h>
+#endif
+
+#include <libfreenect2/libfreenect2.hpp>
+#include <libfreenect2/packet_pipeline.h>
+#include <libfreenect2/depth_codec.h>
+#include <libfreenect2/logger.h>
+
+/** Creates the pipeline selected on the command line for each worker. */
+class PipelineFactory: public libfreenect2::Freenect2BatchReplay::PipelineFactory
+{
+public:
+  std::string name;
+  int deviceId;
+
+  PipelineFactory(): name("cpu"), deviceId(-1) {}
+
+  bool supported() const
+  {
+    if (name == "cpu")
+      return true;
+#ifdef LIBFREENECT2_WITH_OPENGL_SUPPORT
+    if (name == "gl")
+      return true;
+#endif
+#ifdef LIBFREENECT2_WITH_OPENCL_SUPPORT
+    if (name == "cl" || name == "clkde")
+      return true;
+#endif
+#ifdef LIBFREENECT2_WITH_CUDA_SUPPORT
+    if (name == "cuda" || name == "cudakde")
+      return true;
+#endif
+    return false;
+  }
+
+  virtual libfreenect2::PacketPipeline *createPipeline()
+  {
+#ifdef LIBFREENECT2_WITH_OPENGL_SUPPORT
+    if (name == "gl")
+      return new libfreenect2::OpenGLPacketPipeline();
+#endif
+#ifdef LIBFREENECT2_WITH_OPENCL_SUPPORT
+    if (name == "cl")
+      return new libfreenect2::OpenCLPacketPipeline(deviceId);
+    if (name == "clkde")
+      return new libfreenect2::OpenCLKdePacketPipeline(deviceId);
+#endif
+#ifdef LIBFREENECT2_WITH_CUDA_SUPPORT
+    if (name == "cuda")
+      return new libfreenect2::CudaPacketPipeline(deviceId);
+    if (name == "cudakde")
+      return new libfreenect2::CudaKdePacketPipeline(deviceId);
+#endif
+    return new libfreenect2::CpuPacketPipeline();
+  }
+};
+
+/** Writes the delivered depth frames in order. */
+class DepthWriter: public libfreenect2::FrameListener
+{
+public:
+  std::string directory;
+  bool rvl;
+  size_t written;
+  size_t failed;
+
+  DepthWriter(): rvl(true), written(0), failed(0) {}
+
+  virtual bool onNewFrame(libfreenect2::Frame::Type type, libfreenect2::Frame *frame)
+  {
+    if (type != libfreenect2::Frame::Depth)
+      return false;
+
+    const char *data = reinterpret_cast<const char *>(frame->data);
+    size_t length = frame->width * frame->height * frame->bytes_per_pixel;
+    if (rvl)
+    {
+      buffer_.resize(libfreenect2::DepthCodec::maxEncodedSize(frame->width, frame->height));
+      length = codec_.encode(frame, &buffer_[0], buffer_.size());
+      data = reinterpret_cast<const char *>(&buffer_[0]);
+    }
+
+    std::ostringstream filename;
+    filename << directory << "/" << frame->timestamp << "_depth_" << frame->sequence << (rvl ? ".rvl" : ".float");
+    std::ofstream out(filename.str().c_str(), std::ios::binary);
+    out.write(data, length);
+
+    if (length > 0 && out.good())
+      written++;
+    else
+      failed++;
+    return false;
+  }
+
+private:
+  libfreenect2::DepthCodec codec_;
+  std::vector<unsigned char> buffer_;
+};
+
+static bool hasSuffix(const std::string& str, const std::string& suffix)
+{
+  if (str.length() < suffix.length())
+  {
+    return false;
+  }
+  return str.compare(str.length() - suffix.length(), suffix.length(), suffix) == 0;
+}
+
+/** Order stored packets by the timestamp at the start of the file name. */
+static bool compareTimestamp(const std::string &a, const std::string &b)
+{
+  unsigned long ta = strtoul(a.c_str() + a.find_last_of('/') + 1, NULL, 10);
+  unsigned long tb = strtoul(b.c_str() + b.find_last_of('/') + 1, NULL, 10);
+  return ta != tb ? ta < tb : a < b;
+}
+
+static bool readFile(const std::string &filename, std::vector<unsigned char> &data)
+{
+  std::ifstream in(filename.c_str(), std::ios::binary);
+  if (!in)
+    return false;
+  data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  return !data.empty();
+}
+
+int main(int argc, char *argv[])
+{
+  std::string program_path(argv[0]);
+  std::cerr << "Version: " << LIBFREENECT2_VERSION << std::endl;
+  std::cerr << "Usage: " << program_path << " [-gpu=<id>] [cpu | gl | cl | clkde | cuda | cudakde]" << std::endl;
+  std::cerr << "        [-workers <number>] [-p0 <file>] [-params <file>] [-out <directory>] [-float]" << std::endl;
+  std::cerr << "        [-nofilter] <directory>" << std::endl;
+  std::cerr << "  -p0 <file>      P0 tables command response stored from the device" << std::endl;
+  std::cerr << "  -params <file>  IR camera parameters: fx fy cx cy k1 k2 k3 p1 p2" << std::endl;
+  std::cerr << "  -float          Write raw float depth instead of RVL compressed depth" << std::endl;
+
+  PipelineFactory factory;
+  DepthWriter writer;
+  size_t workers = 0;
+  std::string input, p0_file, params_file;
+  std::string output(".");
+  libfreenect2::Freenect2Device::Config config;
+
+  for(int argI = 1; argI < argc; ++argI)
+  {
+    const std::string arg(argv[argI]);
+
+    if(arg == "-help" || arg == "--help" || arg == "-h")
+    {
+      return 0;
+    }
+    else if(arg.find("-gpu=") == 0)
+    {
+      factory.deviceId = atoi(argv[argI] + 5);
+    }
+    else if(arg == "cpu" || arg == "gl" || arg == "cl" || arg == "clkde" || arg == "cuda" || arg == "cudakde")
+    {
+      factory.name = arg;
+    }
+    else if(arg == "-workers" && argI + 1 < argc)
+    {
+      workers = strtoul(argv[++argI], NULL, 0);
+    }
+    else if(arg == "-p0" && argI + 1 < argc)
+    {
+      p0_file = argv[++argI];
+    }
+    else if(arg == "-params" && argI + 1 < argc)
+    {
+      params_file = argv[++argI];
+    }
+    else if(arg == "-out" && argI + 1 < argc)
+    {
+      output = argv[++argI];
+    }
+    else if(arg == "-float")
+    {
+      writer.rvl = false;
+    }
+    else if(arg == "-nofilter")
+    {
+      config.EnableBilateralFilter = false;
+      config.EnableEdgeAwareFilter = false;
+    }
+    else if(arg[0] != '-' && input.empty())
+    {
+      input = arg;
+    }
+    else
+    {
+      std::cout << "Unknown argument: " << arg << std::endl;
+    }
+  }
+
+  if (input.empty())
+  {
+    std::cerr << "No input directory given." << std::endl;
+    return -1;
+  }
+  if (!factory.supported())
+  {
+    std::cerr << "Pipeline " << factory.name << " is not supported!" << std::endl;
+    return -1;
+  }
+
+  std::vector<std::string> frame_filenames;
+  DIR *d = opendir(input.c_str());
+  if (!d)
+  {
+    std::cerr << "Could not open directory " << input << " for replay." << std::endl;
+    return -1;
+  }
+  struct dirent *dir;
+  while ((dir = readdir(d)) != NULL)
+  {
+    std::string name = dir->d_name;
+    if (hasSuffix(name, ".depth"))
+      frame_filenames.push_back(input + "/" + name);
+  }
+  closedir(d);
+  std::sort(frame_filenames.begin(), frame_filenames.end(), compareTimestamp);
+
+  libfreenect2::Freenect2BatchReplay replay(&factory, workers);
+  replay.setConfiguration(config);
+
+  if (!p0_file.empty())
+  {
+    std::vector<unsigned char> p0;
+    if (!readFile(p0_file, p0))
+    {
+      std::cerr << "Could not read P0 tables from " << p0_file << std::endl;
+      return -1;
+    }
+    replay.loadP0Tables(&p0[0], p0.size());
+  }
+
+  if (!params_file.empty())
+  {
+    libfreenect2::Freenect2Device::IrCameraParams params;
+    std::ifstream in(params_file.c_str());
+    in >> params.fx >> params.fy >> params.cx >> params.cy >> params.k1 >> params.k2 >> params.k3 >> params.p1 >> params.p2;
+    if (!in)
+    {
+      std::cerr << "Could not read IR camera parameters from " << params_file << std::endl;
+      return -1;
+    }
+    replay.setIrCameraParams(params);
+  }
+
+  writer.directory = output;
+  replay.setIrAndDepthFrameListener(&writer);
+
+  std::cout << "Processing " << frame_filenames.size() << " packets with " << replay.getNumWorkers()
+            << " " << factory.name << " pipelines" << std::endl;
+
+  time_t start = time(NULL);
+  size_t processed = replay.run(frame_filenames);
+  double seconds = difftime(time(NULL), start);
+
+  std::cout << "Processed " << processed << " packets, wrote " << writer.written << " frames";
+  if (seconds > 0)
+    std::cout << " (" << processed / seconds << " packets/s)";
+  std::cout << std::endl;
+  if (writer.failed > 0)
+    std::cerr << "Failed to write " << writer.failed << " frames." << std::endl;
+
+  return processed == frame_filenames.size() && writer.failed == 0 ? 0 : 1;
+}
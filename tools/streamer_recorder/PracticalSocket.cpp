@@ -33,6 +33,7 @@
   #include <unistd.h>          // For close()
   #include <netinet/in.h>      // For sockaddr_in
   #include <string.h>          // For strerror(), memset()
+  #include <sys/time.h>        // For timeval
   typedef void raw_type;       // Type used for raw data on this platform
 #endif
 
@@ -343,6 +344,13 @@ int UDPSocket::recvFrom(void *buffer, int bufferLen, string &sourceAddress,
   int rtn;
   if ((rtn = recvfrom(sockDesc, (raw_type *) buffer, bufferLen, 0,
                       (sockaddr *) &clntAddr, (socklen_t *) &addrLen)) < 0) {
+   #ifdef WIN32
+    if (WSAGetLastError() == WSAETIMEDOUT) {
+   #else
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+   #endif
+      return -1;  // Receive timeout expired
+    }
     throw SocketException("Receive failed (recvfrom())", true);
   }
   sourceAddress = inet_ntoa(clntAddr.sin_addr);
@@ -351,6 +359,27 @@ int UDPSocket::recvFrom(void *buffer, int bufferLen, string &sourceAddress,
   return rtn;
 }
 
+void UDPSocket::setReceiveTimeout(int timeoutMs) throw(SocketException) {
+ #ifdef WIN32
+  DWORD timeout = timeoutMs;
+ #else
+  timeval timeout;
+  timeout.tv_sec = timeoutMs / 1000;
+  timeout.tv_usec = (timeoutMs % 1000) * 1000;
+ #endif
+  if (setsockopt(sockDesc, SOL_SOCKET, SO_RCVTIMEO,
+                 (raw_type *) &timeout, sizeof(timeout)) < 0) {
+    throw SocketException("Receive timeout set failed (setsockopt())", true);
+  }
+}
+
+void UDPSocket::setReceiveBufferSize(int size) throw(SocketException) {
+  if (setsockopt(sockDesc, SOL_SOCKET, SO_RCVBUF,
+                 (raw_type *) &size, sizeof(size)) < 0) {
+    throw SocketException("Receive buffer set failed (setsockopt())", true);
+  }
+}
+
 void UDPSocket::setMulticastTTL(unsigned char multicastTTL) throw(SocketException) {
   if (setsockopt(sockDesc, IPPROTO_IP, IP_MULTICAST_TTL,
                  (raw_type *) &multicastTTL, sizeof(multicastTTL)) < 0) {
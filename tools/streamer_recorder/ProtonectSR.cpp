@@ -26,8 +26,10 @@
 
 /** @file ProtonectSR.cpp Main tool application file. */
 
+#include <algorithm>
 #include <iostream>
 #include <cstdlib>
+#include <memory>
 #include <signal.h>
 
 // For replay devices
@@ -41,10 +43,12 @@
 #include <libfreenect2/libfreenect2.hpp>
 #include <libfreenect2/frame_listener_impl.h>
 #include <libfreenect2/registration.h>
+#include <libfreenect2/lazy_color_frame.h>
 #include <libfreenect2/packet_pipeline.h>
 #include <libfreenect2/logger.h>
 #include "include/streamer.h"
 #include "include/recorder.h"
+#include "include/receiver.h"
 /// [headers]
 #ifdef EXAMPLES_WITH_OPENGL_SUPPORT
 #include "viewer.h"
@@ -104,6 +108,68 @@ public:
 };
 /// [logger]
 
+/**
+ * Receive the UDP stream and print frame rate, losses and latency every second.
+ * Latency is measured from Streamer::stream() to reassembly, so the clocks of
+ * both hosts must be synchronized; on one host it is exact.
+ */
+int receiveStream()
+{
+  StreamReceiver *receiver;
+  try
+  {
+    receiver = new StreamReceiver();
+  }
+  catch (SocketException &e)
+  {
+    std::cerr << e.what() << std::endl;
+    return -1;
+  }
+
+  static const char *names[STREAM_COUNT] = {"depth", "color", "ir", "registered"};
+  size_t frames[STREAM_COUNT] = {0}, decode_failures = 0, lost = 0;
+  double latency_sum[STREAM_COUNT] = {0}, latency_max[STREAM_COUNT] = {0};
+  ReceivedFrame frame;
+  cv::Mat image;
+  uint64_t last_report = currentTimeMicroseconds();
+
+  std::cout << "Receiving on port " << SERVER_PORT << ". Ctrl-C to stop." << std::endl;
+  while (!protonect_shutdown)
+  {
+    if (receiver->receive(frame, 200))
+    {
+      double latency = (double)(frame.receive_time_us - frame.send_time_us) / 1000.0;
+      frames[frame.stream]++;
+      latency_sum[frame.stream] += latency;
+      latency_max[frame.stream] = std::max(latency_max[frame.stream], latency);
+      if (!decodeFrame(frame, image))
+        decode_failures++;
+    }
+
+    uint64_t now = currentTimeMicroseconds();
+    if (now - last_report < 1000000)
+      continue;
+    double seconds = (now - last_report) / 1e6;
+    const StreamReceiver::Statistics &stats = receiver->getStatistics();
+    for (size_t i = 0; i < STREAM_COUNT; ++i)
+    {
+      if (frames[i] == 0)
+        continue;
+      std::cout << names[i] << ": " << frames[i] / seconds << " fps, latency avg "
+                << latency_sum[i] / frames[i] << " ms max " << latency_max[i] << " ms" << std::endl;
+      frames[i] = 0;
+      latency_sum[i] = latency_max[i] = 0;
+    }
+    std::cout << "lost frames: " << stats.lost_frames - lost << " (" << stats.incomplete_frames << " incomplete, "
+              << stats.invalid_datagrams << " invalid datagrams, " << decode_failures << " decode failures in total)" << std::endl;
+    lost = stats.lost_frames;
+    last_report = now;
+  }
+
+  delete receiver;
+  return 0;
+}
+
 bool hasSuffix(const std::string& str, const std::string& suffix)
 {
   if (str.length() < suffix.length())
@@ -126,6 +192,8 @@ bool hasSuffix(const std::string& str, const std::string& suffix)
  * - -streamer Enable UDP Streaming of captured images.
  * - -recorder Enable recording of captured images.
  * - -replay Enable replay of captured images.
+ * - -codec <raw|rvl|jpeg> Encoding of the streamed depth images.
+ * - -receive Receive a stream and print frame rate, losses and latency.
  */
 int main(int argc, char *argv[])
 /// [main]
@@ -135,7 +203,7 @@ int main(int argc, char *argv[])
   std::cerr << "Environment variables: LOGFILE=<protonect.log>" << std::endl;
   std::cerr << "Usage: " << program_path << " [-gpu=<id>] [gl | cl | clkde | cuda | cudakde | cpu] [<device serial>]" << std::endl;
   std::cerr << "        [-noviewer] [-norgb | -nodepth] [-help] [-version]" << std::endl;
-  std::cerr << "        [-recorder] [-streamer] [-replay]" << std::endl;
+  std::cerr << "        [-recorder] [-streamer [-codec <raw|rvl|jpeg>]] [-replay] [-receive]" << std::endl;
   std::cerr << "        [-frames <number of frames to process>]" << std::endl;
   std::cerr << "To pause and unpause: pkill -USR1 ProtonectSR" << std::endl;
   size_t executable_name_idx = program_path.rfind("ProtonectSR");
@@ -180,6 +248,8 @@ int main(int argc, char *argv[])
   bool streamer_enabled = false;
   bool recorder_enabled = false;
   bool replay_enabled = false;
+  bool receive_enabled = false;
+  std::string depth_codec = "jpeg";
   bool enable_rgb = true;
   bool enable_depth = true;
   int deviceId = -1;
@@ -292,6 +362,14 @@ int main(int argc, char *argv[])
     {
       replay_enabled = true;
     }
+    else if(arg == "-codec" && argI + 1 < argc)
+    {
+      depth_codec = argv[++argI];
+    }
+    else if(arg == "-receive" || arg == "--receive")
+    {
+      receive_enabled = true;
+    }
     else
     {
       std::cout << "Unknown argument: " << arg << std::endl;
@@ -304,6 +382,12 @@ int main(int argc, char *argv[])
     return -1;
   }
 
+  if (receive_enabled)
+  {
+    signal(SIGINT,sigint_handler);
+    return receiveStream();
+  }
+
 /// [discovery]
   if(replay_enabled == false)
   {
@@ -403,6 +487,17 @@ int main(int argc, char *argv[])
   dev->setIrAndDepthFrameListener(&listener);
 /// [listeners]
 
+#ifdef LIBFREENECT2_WITH_TURBOJPEG_SUPPORT
+  // the recorder writes the JPEG from the device unchanged, the others decode it when they need it
+  const bool raw_color = recorder_enabled && enable_rgb;
+  if (raw_color)
+  {
+    libfreenect2::Freenect2Device::Config config;
+    config.ColorFormat = libfreenect2::Frame::Raw;
+    dev->setConfiguration(config);
+  }
+#endif
+
 /// [start]
   if (enable_rgb && enable_depth)
   {
@@ -422,6 +517,8 @@ int main(int argc, char *argv[])
 /// [registration setup]
   libfreenect2::Registration* registration = new libfreenect2::Registration(dev->getIrCameraParams(), dev->getColorCameraParams());
   libfreenect2::Frame undistorted(512, 424, 4), registered(512, 424, 4);
+  // Registration::apply() copies the decoded color pixels, which are BGRX by default.
+  registered.format = libfreenect2::Frame::BGRX;
 /// [registration setup]
 
   size_t framecount = 0;
@@ -438,6 +535,11 @@ int main(int argc, char *argv[])
 
   if(streamer_enabled)
   {
+    if (!streamer.setCodec(STREAM_DEPTH, depth_codec))
+    {
+      std::cerr << "unknown codec '" << depth_codec << "'" << std::endl;
+      return -1;
+    }
     streamer.initialize();
   }
 
@@ -459,6 +561,27 @@ int main(int argc, char *argv[])
     libfreenect2::Frame *depth = frames[libfreenect2::Frame::Depth];
 /// [loop start]
 
+    // the color frame as received, the JPEG if the processor passes it through
+    libfreenect2::Frame *rgb_recorded = rgb;
+#ifdef LIBFREENECT2_WITH_TURBOJPEG_SUPPORT
+    std::unique_ptr<libfreenect2::LazyColorFrame> lazy_rgb;
+    if (raw_color && rgb->format == libfreenect2::Frame::Raw)
+    {
+      lazy_rgb.reset(new libfreenect2::LazyColorFrame(rgb));
+      frames.erase(libfreenect2::Frame::Color);
+      // only recording needs no decoding
+      if (enable_depth || streamer_enabled || viewer_enabled)
+      {
+        rgb = lazy_rgb->get();
+        if (rgb == 0)
+        {
+          listener.release(frames);
+          continue;
+        }
+      }
+    }
+#endif
+
     if (enable_rgb && enable_depth)
     {
 /// [registration]
@@ -470,18 +593,30 @@ int main(int argc, char *argv[])
 
     if (streamer_enabled)
     {
-      streamer.stream(depth);
+      if (enable_depth)
+        streamer.stream(depth, STREAM_DEPTH);
+      if (enable_rgb)
+        streamer.stream(rgb, STREAM_COLOR);
+
+      if (framecount % 100 == 0)
+        streamer.report();
     }
 
     if (recorder_enabled)
     {
-      // TODO: add recording timestamp if max frame number reached
-      // + avoid recording new ones
-      recorder.record(depth, "depth");
-      recorder.record(&registered, "registered");
-      // recorder.record(rgb,"rgb");
+      if (enable_depth)
+        recorder.record(depth, "depth");
+      if (enable_rgb && enable_depth)
+      {
+        registered.timestamp = depth->timestamp;
+        registered.sequence = depth->sequence;
+        recorder.record(&registered, "registered");
+      }
+      if (enable_rgb)
+        recorder.record(rgb_recorded, "rgb");
 
-      recorder.registTimeStamp();
+      if (framecount % 100 == 0)
+        recorder.report();
     }
 
     if (!viewer_enabled)
@@ -518,7 +653,12 @@ int main(int argc, char *argv[])
 
   if (recorder_enabled)
   {
-    recorder.saveTimeStamp();
+    recorder.close();
+  }
+
+  if (streamer_enabled)
+  {
+    streamer.close();
   }
 
   // TODO: restarting ir stream doesn't work!
@@ -39,6 +39,14 @@ import numpy
 import cv2
 # from PIL import Image
 import itertools
+import struct
+
+# Fragment header of the ProtonectSR stream, see include/stream_protocol.h
+FRAGMENT_HEADER = struct.Struct('<IBBBBIHHIIIIHHQ')
+FRAGMENT_MAGIC = 0x5346324b
+PROTOCOL_VERSION = 1
+STREAM_DEPTH = 0
+CODEC_JPEG = 2
 
 def init(controller):
     """
@@ -77,6 +85,10 @@ def init(controller):
 
         # logic.imageIndex = 0
 
+        # fragments of the depth frame being reassembled
+        logic.frame_id = None
+        logic.fragments = {}
+
 def run(controller):
     """
     Run, run once every frames
@@ -84,41 +96,54 @@ def run(controller):
     if controller.sensors[0].positive:
         try:
             buff_size = 4096
-            msg_raw = logic.socket.recv(buff_size)
+            frame_raw = None
+
+            # read the fragments waiting on the socket until a depth frame is complete
+            while frame_raw is None:
+                msg_raw = logic.socket.recv(buff_size)
+                if len(msg_raw) < FRAGMENT_HEADER.size:
+                    continue
+                (magic, version, stream, codec, fmt, frame_id, index, count,
+                 sequence, timestamp, length, offset, width, height,
+                 send_time) = FRAGMENT_HEADER.unpack_from(msg_raw)
+                if magic != FRAGMENT_MAGIC or version != PROTOCOL_VERSION:
+                    continue
+                if stream != STREAM_DEPTH or codec != CODEC_JPEG:
+                    continue
 
-            # check for header msg indicating the number of packet that'll follow
-            # containing a unique frame (image)
-            if len(msg_raw) == 4:
-                nb_of_packet_per_frame = msg_raw[0]
+                # a newer frame replaces an incomplete one
+                if frame_id != logic.frame_id:
+                    logic.frame_id = frame_id
+                    logic.fragments = {}
+                logic.fragments[index] = msg_raw[FRAGMENT_HEADER.size:]
 
-                # loop over next packets to reconstitute image
-                frame_raw = b''
-                for i in range(nb_of_packet_per_frame):
-                    frame_raw = frame_raw + logic.socket.recv(buff_size)
+                if len(logic.fragments) == count:
+                    frame_raw = b''.join(logic.fragments[i] for i in range(count))
+                    logic.fragments = {}
 
-                # frame = cv2.imdecode(numpy.fromstring(frame_raw, dtype=numpy.uint8), cv2.IMREAD_COLOR)
-                frame = cv2.imdecode(numpy.fromstring(frame_raw, dtype=numpy.uint8), cv2.IMREAD_GRAYSCALE)
+            # frame = cv2.imdecode(numpy.fromstring(frame_raw, dtype=numpy.uint8), cv2.IMREAD_COLOR)
+            frame = cv2.imdecode(numpy.fromstring(frame_raw, dtype=numpy.uint8), cv2.IMREAD_GRAYSCALE)
 
 
-                if not frame is None:
+            if not frame is None:
 
-                    width = frame.shape[1]
-                    height = frame.shape[0]
+                width = frame.shape[1]
+                height = frame.shape[0]
 
-                    l = frame.tolist()
-                    lll = list(itertools.chain(*l))
+                l = frame.tolist()
+                lll = list(itertools.chain(*l))
 
-                    # image_buffer = bgl.Buffer(bgl.GL_INT, [width*height*3], lll)
-                    image_buffer = bgl.Buffer(bgl.GL_BYTE, width*height, lll)
+                # image_buffer = bgl.Buffer(bgl.GL_INT, [width*height*3], lll)
+                image_buffer = bgl.Buffer(bgl.GL_BYTE, width*height, lll)
 
-                    source = texture.ImageBuff()
+                source = texture.ImageBuff()
 
-                    # Apply a filter, that way source.load does not except a 3(RGB) pixel image
-                    source.filter = texture.FilterBlueScreen()
-                    source.load(image_buffer, width, height)
+                # Apply a filter, that way source.load does not except a 3(RGB) pixel image
+                source.filter = texture.FilterBlueScreen()
+                source.load(image_buffer, width, height)
 
-                    logic.texture.source = source
-                    logic.texture.refresh(False)
+                logic.texture.source = source
+                logic.texture.refresh(False)
 
         except socket.timeout:
             pass
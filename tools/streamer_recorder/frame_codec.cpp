@@ -0,0 +1,173 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2017 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include "frame_codec.h"
+
+#include <libfreenect2/depth_codec.h>
+
+#include <cstring>
+
+size_t frameDataSize(const libfreenect2::Frame &frame)
+{
+  if (frame.format == libfreenect2::Frame::Raw)
+    return frame.bytes_per_pixel;
+  if (frame.format == libfreenect2::Frame::I420)
+    return frame.width * frame.height * 3 / 2;
+  return frame.width * frame.height * frame.bytes_per_pixel;
+}
+
+/** Frame::data unchanged; the receiver needs the format to interpret it. */
+class RawCodec : public FrameCodec
+{
+public:
+  virtual CodecId id() const { return CODEC_RAW; }
+
+  virtual bool encode(const libfreenect2::Frame &frame, std::vector<unsigned char> &encoded)
+  {
+    size_t size = frameDataSize(frame);
+    encoded.resize(size);
+    std::memcpy(encoded.data(), frame.data, size);
+    return true;
+  }
+};
+
+/** Lossless depth compression; a 512x424 frame typically shrinks to a quarter. */
+class RvlCodec : public FrameCodec
+{
+public:
+  virtual CodecId id() const { return CODEC_RVL; }
+
+  virtual bool encode(const libfreenect2::Frame &frame, std::vector<unsigned char> &encoded)
+  {
+    encoded.resize(libfreenect2::DepthCodec::maxEncodedSize(frame.width, frame.height));
+    size_t size = codec_.encode(&frame, encoded.data(), encoded.size());
+    encoded.resize(size);
+    return size > 0;
+  }
+
+private:
+  libfreenect2::DepthCodec codec_;
+};
+
+/**
+ * JPEG of the frame; depth is mapped to 8-bit gray over 0..4.5 m, which is
+ * what the Blender viewer displays. Raw color is already JPEG and is passed
+ * through.
+ */
+class JpegCodec : public FrameCodec
+{
+public:
+  JpegCodec()
+  {
+    params_.push_back(cv::IMWRITE_JPEG_QUALITY);
+    params_.push_back(ENCODE_QUALITY);
+  }
+
+  virtual CodecId id() const { return CODEC_JPEG; }
+
+  virtual bool encode(const libfreenect2::Frame &frame, std::vector<unsigned char> &encoded)
+  {
+    switch (frame.format)
+    {
+    case libfreenect2::Frame::Raw:
+      encoded.assign(frame.data, frame.data + frame.bytes_per_pixel);
+      return true;
+    case libfreenect2::Frame::Float:
+      cv::Mat(frame.height, frame.width, CV_32FC1, frame.data).convertTo(image_, CV_8U, 255.0 / 4500.0);
+      break;
+    case libfreenect2::Frame::BGRX:
+      cv::cvtColor(cv::Mat(frame.height, frame.width, CV_8UC4, frame.data), image_, cv::COLOR_BGRA2BGR);
+      break;
+    case libfreenect2::Frame::RGBX:
+      cv::cvtColor(cv::Mat(frame.height, frame.width, CV_8UC4, frame.data), image_, cv::COLOR_RGBA2BGR);
+      break;
+    case libfreenect2::Frame::RGB:
+      cv::cvtColor(cv::Mat(frame.height, frame.width, CV_8UC3, frame.data), image_, cv::COLOR_RGB2BGR);
+      break;
+    case libfreenect2::Frame::Gray:
+      image_ = cv::Mat(frame.height, frame.width, CV_8UC1, frame.data);
+      break;
+    case libfreenect2::Frame::I420:
+      cv::cvtColor(cv::Mat(frame.height * 3 / 2, frame.width, CV_8UC1, frame.data), image_, cv::COLOR_YUV2BGR_I420);
+      break;
+    default:
+      return false;
+    }
+    return cv::imencode(".jpg", image_, encoded, params_);
+  }
+
+private:
+  std::vector<int> params_;
+  cv::Mat image_;
+};
+
+FrameCodec *createFrameCodec(const std::string &name)
+{
+  if (name == "raw")
+    return new RawCodec();
+  if (name == "rvl")
+    return new RvlCodec();
+  if (name == "jpeg" || name == "jpg")
+    return new JpegCodec();
+  return NULL;
+}
+
+bool decodeFrame(uint8_t codec, uint8_t format, size_t width, size_t height,
+                 const std::vector<unsigned char> &data, cv::Mat &image)
+{
+  switch (codec)
+  {
+  case CODEC_RAW:
+    if (format == libfreenect2::Frame::Raw)
+    {
+      image = cv::imdecode(data, cv::IMREAD_COLOR);
+      return !image.empty();
+    }
+    else
+    {
+      // I420 stays planar, one channel with the chroma planes as extra rows
+      int type = (format == libfreenect2::Frame::Gray || format == libfreenect2::Frame::I420) ? CV_8UC1 :
+                 format == libfreenect2::Frame::RGB ? CV_8UC3 :
+                 (format == libfreenect2::Frame::BGRX || format == libfreenect2::Frame::RGBX) ? CV_8UC4 : CV_32FC1;
+      image.create(format == libfreenect2::Frame::I420 ? height * 3 / 2 : height, width, type);
+      if (data.size() != image.total() * image.elemSize())
+        return false;
+      std::memcpy(image.data, data.data(), data.size());
+      return true;
+    }
+  case CODEC_RVL:
+    {
+      image.create(height, width, CV_32FC1);
+      libfreenect2::Frame frame(width, height, 4, image.data);
+      return libfreenect2::DepthCodec::decode(data.data(), data.size(), &frame);
+    }
+  case CODEC_JPEG:
+    image = cv::imdecode(data, cv::IMREAD_UNCHANGED);
+    return !image.empty();
+  default:
+    return false;
+  }
+}
@@ -314,6 +314,22 @@ public:
   int recvFrom(void *buffer, int bufferLen, string &sourceAddress,
                unsigned short &sourcePort) throw(SocketException);
 
+  /**
+   *   Limit how long recvFrom() waits for a datagram.  When the timeout
+   *   expires, recvFrom() returns -1 instead of throwing
+   *   @param timeoutMs timeout in milliseconds, 0 to wait forever
+   *   @exception SocketException thrown if unable to set the timeout
+   */
+  void setReceiveTimeout(int timeoutMs) throw(SocketException);
+
+  /**
+   *   Set the size of the kernel receive buffer, so bursts of datagrams
+   *   are not dropped while the reader is busy
+   *   @param size buffer size in bytes
+   *   @exception SocketException thrown if unable to set the size
+   */
+  void setReceiveBufferSize(int size) throw(SocketException);
+
   /**
    *   Set the multicast TTL
    *   @param multicastTTL multicast TTL
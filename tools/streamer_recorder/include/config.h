@@ -31,4 +31,7 @@
 #define ENCODE_QUALITY 80
 #define SERVER_ADDRESS "127.0.0.1" // Server IP adress
 #define SERVER_PORT "10000"        // Server Port
-#define MAX_FRAME_ID 30000 // max number of recorded frames, 16.6min max at 30 FPS (max frame ID sort of hardcoded in image naming too, see below)
+#define RECORDER_QUEUE_SIZE 64 // frames waiting to be written before the recorder drops frames
+#define STREAM_MAX_RATE 50000000 // bytes per second the streamer paces its datagrams to
+#define STREAM_JITTER_FRAMES 4   // partial frames per stream the receiver reassembles at once
+#define STREAM_RECEIVE_BUFFER (8*1024*1024) // kernel receive buffer of the receiver socket
@@ -0,0 +1,81 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2017 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef FRAME_CODEC_H
+#define FRAME_CODEC_H
+
+#include <libfreenect2/frame_listener.hpp>
+#include <opencv2/opencv.hpp>
+
+#include <string>
+#include <vector>
+
+#include "stream_protocol.h"
+
+/**
+ * Encodes frames for the network stream.
+ *
+ * The streamer owns one codec per stream and calls it from its send thread
+ * only, so codecs may keep scratch buffers.
+ */
+class FrameCodec
+{
+public:
+  virtual ~FrameCodec() {}
+
+  /** CodecId written to the fragment headers. */
+  virtual CodecId id() const = 0;
+
+  /**
+   * @param frame Frame to encode.
+   * @param[out] encoded Encoded frame; resized as needed.
+   * @return false if the codec cannot encode this frame.
+   */
+  virtual bool encode(const libfreenect2::Frame &frame, std::vector<unsigned char> &encoded) = 0;
+};
+
+/** Bytes of Frame::data: the buffer size for Raw, chroma planes included for I420. */
+size_t frameDataSize(const libfreenect2::Frame &frame);
+
+/**
+ * @param name "raw", "rvl" or "jpeg".
+ * @return New codec, or NULL for an unknown name.
+ */
+FrameCodec *createFrameCodec(const std::string &name);
+
+/**
+ * Decode a received frame into an image.
+ * Depth and IR decode to CV_32FC1 except JPEG depth, which is 8-bit gray;
+ * color decodes to BGR(X), except raw RGB and I420 frames, which keep their layout;
+ * I420 is one channel with the chroma planes as extra rows.
+ * @param codec CodecId of the frame.
+ * @param format libfreenect2::Frame::Format of the source frame.
+ * @return false if the data is corrupted.
+ */
+bool decodeFrame(uint8_t codec, uint8_t format, size_t width, size_t height,
+                 const std::vector<unsigned char> &data, cv::Mat &image);
+
+#endif
@@ -0,0 +1,126 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2017 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef RECEIVER_H
+#define RECEIVER_H
+
+#include "PracticalSocket.h"
+#include "config.h"
+#include "frame_codec.h"
+#include "stream_protocol.h"
+
+#include <vector>
+
+/** A reassembled frame, still encoded. Use decodeFrame() to get the image. */
+struct ReceivedFrame
+{
+  StreamId stream;
+  uint8_t codec;             ///< CodecId
+  uint8_t format;            ///< libfreenect2::Frame::Format of the source frame
+  uint32_t frame_id;
+  uint32_t sequence;
+  uint32_t timestamp;
+  size_t width;
+  size_t height;
+  std::vector<unsigned char> data;
+  uint64_t send_time_us;     ///< Sender clock when the frame was queued
+  uint64_t receive_time_us;  ///< Receiver clock when the last fragment arrived
+};
+
+/**
+ * Receives the fragment stream sent by Streamer and reassembles frames.
+ *
+ * Each stream has a jitter buffer of a few partial frames, so reordered
+ * fragments of consecutive frames can still be completed. Frames are
+ * delivered in order: once a frame completes, older partial frames of the
+ * same stream are given up, and a full buffer evicts its oldest frame.
+ * Nothing is retransmitted; missing frames show up as gaps in frame_id and
+ * are counted in Statistics::lost_frames.
+ */
+class StreamReceiver
+{
+public:
+  struct Statistics
+  {
+    size_t datagrams;
+    size_t invalid_datagrams;  ///< Foreign or inconsistent datagrams
+    size_t late_datagrams;     ///< Fragments of frames already delivered or given up
+    size_t frames;             ///< Delivered frames
+    size_t incomplete_frames;  ///< Partial frames given up
+    size_t lost_frames;        ///< Frames never delivered, including incomplete ones
+  };
+
+  /**
+   * @param port Local port, 0 for SERVER_PORT.
+   * @param jitter_frames Partial frames per stream held for reassembly.
+   * @exception SocketException thrown if the port cannot be bound
+   */
+  StreamReceiver(unsigned short port = 0, size_t jitter_frames = STREAM_JITTER_FRAMES);
+
+  /**
+   * Wait for the next complete frame of any stream.
+   * @param[out] frame Received frame; its data buffer is recycled between calls.
+   * @param timeout_ms Timeout in milliseconds, 0 to wait forever.
+   * @return false on timeout.
+   */
+  bool receive(ReceivedFrame &frame, int timeout_ms = 1000);
+
+  const Statistics &getStatistics() const { return stats_; }
+
+private:
+  struct Partial
+  {
+    bool used;
+    FragmentHeader header;
+    std::vector<unsigned char> data;
+    std::vector<bool> fragments;
+    size_t received;
+  };
+
+  struct StreamState
+  {
+    std::vector<Partial> slots;
+    bool delivered;
+    uint32_t last_frame_id;
+  };
+
+  bool handleDatagram(size_t length, ReceivedFrame &frame);
+  Partial *findSlot(StreamState &state, const FragmentHeader &header);
+
+  UDPSocket socket_;
+  std::vector<unsigned char> datagram_;
+  StreamState streams_[STREAM_COUNT];
+  Statistics stats_;
+  int timeout_ms_;
+};
+
+/** Decode a received frame, see decodeFrame(). */
+inline bool decodeFrame(const ReceivedFrame &frame, cv::Mat &image)
+{
+  return decodeFrame(frame.codec, frame.format, frame.width, frame.height, frame.data, image);
+}
+
+#endif
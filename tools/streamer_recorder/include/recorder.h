@@ -31,55 +31,80 @@
 #include <opencv2/opencv.hpp>
 #include "config.h"
 
-#include <iomanip>
-#include <sstream>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
-#include <fstream>      // file input/output functions
-#include <cstdlib>      // time stamp
-#include <sys/timeb.h>  // time stamp
 
+/**
+ * Writes frames to disk on a pool of writer threads.
+ *
+ * record() copies the frame into a preallocated slot and returns; if all
+ * slots are queued, the frame is dropped and counted instead of stalling the
+ * frame loop. Depth is written as lossless 16-bit PNG in millimeters, raw
+ * (JPEG) color frames are written unchanged and other color frames as PNG.
+ * The device timestamp and sequence of every written frame is stored in
+ * timestamps.txt.
+ */
 class Recorder
 {
 public:
-  // methods
   Recorder();
-  void initialize();
-  void record(libfreenect2::Frame* frame, const std::string& frame_type);
+  ~Recorder();
 
-  void stream(libfreenect2::Frame* frame);
+  /**
+   * @param directory Recording directory with depth/, regist/ and rgb/ subdirectories.
+   * @param num_writers Number of writer threads.
+   * @param queue_size Number of frames that can wait for a writer.
+   */
+  void initialize(const std::string& directory = "../recordings", size_t num_writers = 2, size_t queue_size = RECORDER_QUEUE_SIZE);
 
-  void saveTimeStamp();
-  void registTimeStamp();
+  /** Queue a copy of the frame.
+   * @param frame_type "depth", "registered" or "rgb".
+   * @return false if the frame was dropped.
+   */
+  bool record(libfreenect2::Frame* frame, const std::string& frame_type);
 
-private:
-  /////// RECORD VIDEO, NOT READY YET (RECORD IMAGE FOR NOW) ///////
-  // cv::VideoWriter out_capture;
-  /////////////////////////////////////////////////////////////////
+  /** Write the queued frames and stop the writers. */
+  void close();
 
-  cv::Mat cvMat_frame;
+  /** Print queue depth and drops. */
+  void report();
 
-  // SAVE IMAGE
-  //cv::vector<int> img_comp_param; //vector that stores the compression parameters of the image
-  std::vector<int> img_comp_param; //vector that stores the compression parameters of the image
-  int frameID;
-  // int maxFrameID; //  16.6min max at 30 FPS (max frame ID sort of hardcoded in image naming too, see below)
+private:
+  /** Preallocated copy of a frame waiting to be written. */
+  struct Slot
+  {
+    std::vector<unsigned char> data;
+    std::string type;
+    size_t width, height, bytes_per_pixel;
+    libfreenect2::Frame::Format format;
+    uint32_t timestamp;
+    uint32_t sequence;
+  };
 
-  // static int timeStamps [MAX_FRAME_ID];
-  std::vector<int> timeStamps;
+  void run();
+  bool write(const Slot& slot);
 
-  int t_start;
-  int t_now;
+  std::string directory;
+  std::vector<Slot> slots;
+  std::vector<Slot*> free_slots;
+  std::deque<Slot*> queue;
 
-  std::ostringstream oss_recordPath;
-  std::string recordPath;
-  // -----------------
+  std::vector<std::thread> writers;
+  std::mutex mutex;
+  std::condition_variable condition;
+  bool shutdown;
 
-  // Timer
-  timeb tb;
-  int nSpan;
-  int getMilliSpan(int nTimeStart);
-  int getMilliCount();
+  std::ofstream timestamp_file;
+  size_t recorded;
+  size_t written;
+  size_t dropped;
+  size_t failed;
+  size_t max_queue_depth;
 };
 
 #endif
@@ -0,0 +1,98 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2017 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef STREAM_PROTOCOL_H
+#define STREAM_PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+
+/**
+ * Wire format of the UDP stream.
+ *
+ * Every frame is encoded by a codec and cut into fragments. Each fragment is
+ * sent as one datagram of at most PACK_SIZE bytes: a FragmentHeader followed
+ * by up to FRAGMENT_PAYLOAD_SIZE bytes of the encoded frame. All header
+ * fields are little-endian.
+ */
+
+/** Streams multiplexed on one socket. */
+enum StreamId
+{
+  STREAM_DEPTH = 0,
+  STREAM_COLOR = 1,
+  STREAM_IR = 2,
+  STREAM_REGISTERED = 3,
+  STREAM_COUNT = 4
+};
+
+/** Encodings of the frame payload. */
+enum CodecId
+{
+  CODEC_RAW = 0,  ///< Frame::data as is; the format field tells the pixel layout.
+  CODEC_RVL = 1,  ///< Lossless depth, see libfreenect2::DepthCodec.
+  CODEC_JPEG = 2  ///< JPEG image; depth is scaled to 8 bit gray.
+};
+
+static const uint32_t FRAGMENT_MAGIC = 0x5346324b; ///< "K2FS"
+static const uint8_t PROTOCOL_VERSION = 1;
+static const size_t FRAGMENT_HEADER_SIZE = 44;
+static const size_t FRAGMENT_PAYLOAD_SIZE = PACK_SIZE - FRAGMENT_HEADER_SIZE;
+/** Largest encoded frame: raw 1920x1080 color at 4 bytes per pixel plus room for a codec header. */
+static const size_t MAX_FRAME_LENGTH = 1920 * 1080 * 4 + 64;
+
+struct FragmentHeader
+{
+  uint8_t stream;          ///< StreamId
+  uint8_t codec;           ///< CodecId
+  uint8_t format;          ///< libfreenect2::Frame::Format of the source frame
+  uint32_t frame_id;       ///< Per stream counter of sent frames
+  uint16_t fragment_index;
+  uint16_t fragment_count;
+  uint32_t sequence;       ///< Frame::sequence
+  uint32_t timestamp;      ///< Frame::timestamp
+  uint32_t frame_length;   ///< Encoded frame size in bytes
+  uint32_t offset;         ///< Position of this fragment in the encoded frame
+  uint16_t width;
+  uint16_t height;
+  uint64_t send_time_us;   ///< Sender wall clock when the frame was queued
+};
+
+/** Serialize @p header into the first FRAGMENT_HEADER_SIZE bytes of @p out. */
+void writeFragmentHeader(const FragmentHeader &header, unsigned char *out);
+
+/** Parse a datagram header.
+ * @return false if the datagram is too short, from another protocol version,
+ * or describes a frame longer than MAX_FRAME_LENGTH or than its fragments can carry.
+ */
+bool readFragmentHeader(const unsigned char *in, size_t length, FragmentHeader &header);
+
+/** Wall clock in microseconds, for latency measurements between hosts with synchronized clocks. */
+uint64_t currentTimeMicroseconds();
+
+#endif
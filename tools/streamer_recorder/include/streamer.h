@@ -30,28 +30,90 @@
 #include <libfreenect2/frame_listener.hpp>
 
 #include "PracticalSocket.h"
-#include <opencv2/opencv.hpp>
 #include "config.h"
+#include "frame_codec.h"
+#include "stream_protocol.h"
 
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Sends frames over UDP using the fragment protocol of stream_protocol.h.
+ *
+ * stream() copies the frame and returns; a send thread encodes it, cuts it
+ * into fragments and paces the datagrams to a maximum rate so bursts do not
+ * overflow the receiver's socket buffer. Each stream keeps only its latest
+ * frame: if the network is slower than the camera, older frames are
+ * replaced (and counted) instead of queueing up latency.
+ */
 class Streamer
 {
 public:
-  // methods
-  void initialize();
-  void stream(libfreenect2::Frame* frame);
+  Streamer();
+  ~Streamer();
+
+  /**
+   * @param address Receiver host.
+   * @param port Receiver port, 0 for SERVER_PORT.
+   * @param max_rate Maximum send rate in bytes per second.
+   */
+  void initialize(const std::string &address = SERVER_ADDRESS, unsigned short port = 0, double max_rate = STREAM_MAX_RATE);
+
+  /** Select the codec of a stream ("raw", "rvl" or "jpeg"). Call before initialize().
+   * @return false for an unknown codec name.
+   */
+  bool setCodec(StreamId stream, const std::string &name);
+
+  /** Queue a copy of the frame, replacing a frame of the same stream that was not sent yet. */
+  void stream(libfreenect2::Frame* frame, StreamId stream = STREAM_DEPTH);
+
+  /** Print sent, replaced and failed frames and the bandwidth since the last report. */
+  void report();
+
+  /** Send the queued frames and stop the send thread. */
+  void close();
 
 private:
-  // frame related parameters
-  int jpegqual; // Compression Parameter
-  vector<int> compression_params;
-  vector<unsigned char> encoded;
-  int total_pack;
-  int ibuf[1];
-
-  // udp related parameters
-  string servAddress; // Server IP adress
-  unsigned short servPort; // Server port
-  UDPSocket sock;
+  /** Copy of a frame waiting to be sent. */
+  struct Pending
+  {
+    std::vector<unsigned char> data;
+    size_t width, height, bytes_per_pixel;
+    libfreenect2::Frame::Format format;
+    uint32_t timestamp, sequence;
+    uint64_t queued_us;
+    bool full;
+  };
+
+  void run();
+  void send(StreamId stream, const Pending &frame);
+  void pace(size_t bytes);
+
+  FrameCodec *codecs_[STREAM_COUNT];
+  Pending pending_[STREAM_COUNT];
+  Pending sending_;
+  uint32_t next_frame_id_[STREAM_COUNT];
+  std::vector<unsigned char> encoded_;
+  std::vector<unsigned char> datagram_;
+
+  std::string address_;
+  unsigned short port_;
+  UDPSocket sock_;
+  double max_rate_;
+  std::chrono::steady_clock::time_point next_send_;
+
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  bool running_;
+
+  size_t sent_frames_, replaced_frames_, failed_frames_;
+  uint64_t sent_bytes_;
+  std::chrono::steady_clock::time_point last_report_;
 };
 
 #endif
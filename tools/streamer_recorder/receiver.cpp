@@ -0,0 +1,189 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2017 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include "receiver.h"
+
+#include <cstring>
+
+/** Frame ids wrap around; a is newer than b if it is less than half the range ahead. */
+static bool isNewer(uint32_t a, uint32_t b)
+{
+  return (int32_t)(a - b) > 0;
+}
+
+StreamReceiver::StreamReceiver(unsigned short port, size_t jitter_frames):
+  socket_(port != 0 ? port : Socket::resolveService(SERVER_PORT, "udp")),
+  datagram_(PACK_SIZE),
+  timeout_ms_(-1)
+{
+  std::memset(&stats_, 0, sizeof(stats_));
+
+  for (size_t i = 0; i < STREAM_COUNT; ++i)
+  {
+    streams_[i].slots.resize(jitter_frames > 0 ? jitter_frames : 1);
+    for (size_t j = 0; j < streams_[i].slots.size(); ++j)
+      streams_[i].slots[j].used = false;
+    streams_[i].delivered = false;
+    streams_[i].last_frame_id = 0;
+  }
+
+  try
+  {
+    socket_.setReceiveBufferSize(STREAM_RECEIVE_BUFFER);
+  }
+  catch (SocketException &)
+  {
+    // The default buffer works, it only drops more under load.
+  }
+}
+
+bool StreamReceiver::receive(ReceivedFrame &frame, int timeout_ms)
+{
+  if (timeout_ms != timeout_ms_)
+  {
+    socket_.setReceiveTimeout(timeout_ms);
+    timeout_ms_ = timeout_ms;
+  }
+
+  for (;;)
+  {
+    string address;
+    unsigned short port;
+    int length = socket_.recvFrom(datagram_.data(), datagram_.size(), address, port);
+    if (length < 0)
+      return false;
+
+    stats_.datagrams++;
+    if (handleDatagram(length, frame))
+      return true;
+  }
+}
+
+StreamReceiver::Partial *StreamReceiver::findSlot(StreamState &state, const FragmentHeader &header)
+{
+  Partial *free_slot = NULL, *oldest = NULL;
+  for (size_t i = 0; i < state.slots.size(); ++i)
+  {
+    Partial &p = state.slots[i];
+    if (!p.used)
+      free_slot = &p;
+    else if (p.header.frame_id == header.frame_id)
+      return &p;
+    else if (oldest == NULL || isNewer(oldest->header.frame_id, p.header.frame_id))
+      oldest = &p;
+  }
+
+  if (free_slot == NULL)
+  {
+    // A fragment older than everything in a full buffer is too late to help.
+    if (!isNewer(header.frame_id, oldest->header.frame_id))
+      return NULL;
+    stats_.incomplete_frames++;
+    free_slot = oldest;
+  }
+
+  free_slot->used = true;
+  free_slot->header = header;
+  free_slot->data.resize(header.frame_length);
+  free_slot->fragments.assign(header.fragment_count, false);
+  free_slot->received = 0;
+  return free_slot;
+}
+
+bool StreamReceiver::handleDatagram(size_t length, ReceivedFrame &frame)
+{
+  FragmentHeader header;
+  if (!readFragmentHeader(datagram_.data(), length, header))
+  {
+    stats_.invalid_datagrams++;
+    return false;
+  }
+
+  StreamState &state = streams_[header.stream];
+  if (state.delivered && !isNewer(header.frame_id, state.last_frame_id))
+  {
+    stats_.late_datagrams++;
+    return false;
+  }
+
+  Partial *p = findSlot(state, header);
+  if (p == NULL)
+  {
+    stats_.late_datagrams++;
+    return false;
+  }
+
+  size_t payload = length - FRAGMENT_HEADER_SIZE;
+  if (p->header.fragment_count != header.fragment_count || p->header.frame_length != header.frame_length ||
+      header.offset + payload > header.frame_length)
+  {
+    stats_.invalid_datagrams++;
+    return false;
+  }
+
+  if (!p->fragments[header.fragment_index])
+  {
+    std::memcpy(p->data.data() + header.offset, datagram_.data() + FRAGMENT_HEADER_SIZE, payload);
+    p->fragments[header.fragment_index] = true;
+    p->received++;
+  }
+
+  if (p->received < p->header.fragment_count)
+    return false;
+
+  // Deliver in order: older frames still missing fragments are given up.
+  for (size_t i = 0; i < state.slots.size(); ++i)
+  {
+    Partial &q = state.slots[i];
+    if (q.used && isNewer(header.frame_id, q.header.frame_id))
+    {
+      q.used = false;
+      stats_.incomplete_frames++;
+    }
+  }
+
+  if (state.delivered)
+    stats_.lost_frames += header.frame_id - state.last_frame_id - 1;
+  state.delivered = true;
+  state.last_frame_id = header.frame_id;
+  stats_.frames++;
+
+  frame.stream = (StreamId)p->header.stream;
+  frame.codec = p->header.codec;
+  frame.format = p->header.format;
+  frame.frame_id = p->header.frame_id;
+  frame.sequence = p->header.sequence;
+  frame.timestamp = p->header.timestamp;
+  frame.width = p->header.width;
+  frame.height = p->header.height;
+  frame.send_time_us = p->header.send_time_us;
+  frame.receive_time_us = currentTimeMicroseconds();
+  // Hand the buffer over; the slot gets the caller's previous buffer.
+  frame.data.swap(p->data);
+  p->used = false;
+
+  return true;
+}
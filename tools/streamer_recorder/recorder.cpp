@@ -25,166 +25,193 @@
  */
 
 #include "recorder.h"
+#include "frame_codec.h"
 #include <cstdlib>
-#include <iomanip>
+#include <cstring>
+#include <iostream>
+#include <sstream>
 
-Recorder::Recorder() : timeStamps(MAX_FRAME_ID)
+Recorder::Recorder() :
+  shutdown(false), recorded(0), written(0), dropped(0), failed(0), max_queue_depth(0)
 {
 }
 
-// get initial time in ms
-int Recorder::getMilliCount()
+Recorder::~Recorder()
 {
-  ftime(&tb);
-  int nCount = tb.millitm + (tb.time & 0xfffff) * 1000;
-  return nCount;
+  close();
 }
 
-// get time diff from nTimeStart to now
-int Recorder::getMilliSpan(int nTimeStart)
-{
-  nSpan = Recorder::getMilliCount() - nTimeStart;
-  if(nSpan < 0)
-    nSpan += 0x100000 * 1000;
-  return nSpan;
-}
-
-// get time diff from nTimeStart to now
-void Recorder::registTimeStamp()
-{
-  // record time stamp for FPS syncing
-  timeStamps[frameID] = Recorder::getMilliSpan(t_start);
-  // printf("Elapsed time = %u ms \n", timeStamps[frameID]);
-
-  frameID++;
-}
-
-void Recorder::initialize()
+void Recorder::initialize(const std::string& directory, size_t num_writers, size_t queue_size)
 {
   std::cout << "Initialize Recorder." << std::endl;
 
-  /////// RECORD VIDEO, NOT READY YET (RECORD IMAGE FOR NOW) ///////
-
-  // // out_capture.open("TestVideo.avi", CV_FOURCC('M','J','P','G'), 30, cv::Size(depth->height, depth->width)); // JPEG
-  // out_capture.open("TestVideo.avi", CV_FOURCC('P','I','M','1'), 30, cv::Size(depth->height, depth->width),1); // MPEG, last argument defines image color yes o (channel 3 or 1)
-  // // out_capture.open("TestVideo.avi", CV_FOURCC('D','I','V','X'), 30, cv::Size(depth->height, depth->width));
-
-  // if( !out_capture.isOpened() )
-  // {
-  // std::cout << "AVI file can not open."  << std::endl;
-  // return 1;
-  // }
+  this->directory = directory;
+  shutdown = false;
 
-  /////////////////////////////////////////////////////////////////
+  // Slot buffers grow to the largest frame once and are reused afterwards.
+  slots.resize(queue_size);
+  for (size_t i = 0; i < slots.size(); i++)
+    free_slots.push_back(&slots[i]);
 
-  // record image: define compression parameters and frame counter
-  img_comp_param.push_back(CV_IMWRITE_JPEG_QUALITY); //specify the compression technique
-  img_comp_param.push_back(100); //specify the compression quality
-  frameID = 0;
+  timestamp_file.open((directory + "/timestamps.txt").c_str());
+  timestamp_file << "# type timestamp sequence filename; timestamp unit is 0.125 ms" << std::endl;
 
-  // record timeStamp
-  t_start = getMilliCount();
+  for (size_t i = 0; i < num_writers; i++)
+    writers.push_back(std::thread(&Recorder::run, this));
 }
 
-void Recorder::record(libfreenect2::Frame* frame, const std::string& frame_type)
+bool Recorder::record(libfreenect2::Frame* frame, const std::string& frame_type)
 {
-  if(frame_type == "depth")
+  Slot *slot;
   {
-    // std::cout << "Run Recorder." << std::endl;
-    cvMat_frame = cv::Mat(frame->height, frame->width, CV_32FC1, frame->data) / 10;
-    // TODO: handle relative path + check Windows / UNIX compat.
-    oss_recordPath << "../recordings/depth/" << std::setw( 5 ) << std::setfill( '0' ) << frameID << ".depth";
+    std::lock_guard<std::mutex> lock(mutex);
+    recorded++;
+    if (free_slots.empty())
+    {
+      dropped++;
+      return false;
+    }
+    slot = free_slots.back();
+    free_slots.pop_back();
   }
-  else if (frame_type == "registered" || frame_type == "rgb")
+
+  size_t length = frameDataSize(*frame);
+  slot->data.resize(length);
+  std::memcpy(&slot->data[0], frame->data, length);
+  slot->type = frame_type;
+  slot->width = frame->width;
+  slot->height = frame->height;
+  slot->bytes_per_pixel = frame->bytes_per_pixel;
+  slot->format = frame->format;
+  slot->timestamp = frame->timestamp;
+  slot->sequence = frame->sequence;
+
   {
-    cvMat_frame = cv::Mat(frame->height, frame->width, CV_8UC4, frame->data);
-    // TODO: handle relative path + check Windows / UNIX compat.
-    oss_recordPath << "../recordings/regist/" << std::setw( 5 ) << std::setfill( '0' ) << frameID << ".jpg";
-    // std::cout << frame->height << ":" << frame->width << ":" << frame->bytes_per_pixel << std::endl;
+    std::lock_guard<std::mutex> lock(mutex);
+    queue.push_back(slot);
+    if (queue.size() > max_queue_depth)
+      max_queue_depth = queue.size();
   }
+  condition.notify_one();
+  return true;
+}
 
-  recordPath = oss_recordPath.str();
-
-  // SAVE IMAGE
-  cv::imwrite(recordPath, cvMat_frame, img_comp_param); //write the image to file
-  // std::cout << recordPath << std::endl;
-
-  // show image
-  // cv::namedWindow( "recorded frame", CV_WINDOW_AUTOSIZE);
-  // cv::imshow("recorded frame", cvMat_frame);
-  // cv::waitKey(0);
-
-  // reset ostr
-  oss_recordPath.str("");
-  oss_recordPath.clear();
-
-  // feedback on current recording state
-  if(frameID % 100 == 0)
-    std::cout << "-> " << frameID << "/" << MAX_FRAME_ID << " recorded frames/maxFrameID (" << frame_type << ")" << std::endl;
-
-  /////// RECORD VIDEO, NOT READY YET (RECORD IMAGE FOR NOW) ///////
-
-  // cv::Mat frame_depth = cv::Mat(depth->height, depth->width, CV_32FC1, depth->data) / 4500.0f;
-  // cv::convertScaleAbs(frame_depth, frame_depth);
-
-  // DISPLAY INFOS
-  // std::cout << "kinect (h,w): " << depth->height <<  "," << depth->width << std::endl;
-
-  // cv::Size s = frame_depth.size();
-  // double rows = s.height;
-  // double cols = s.width;
-  // std::cout << "cvMat (h,w):  " << rows << "," << cols << std::endl;
-
-  // RECORD VIDEO
-  // std::cout << "11111" << std::endl;
-  // std::cout << "Img channels: " << frame_depth.channels() << std::endl;
-  // std::cout << "Img depth: " << frame_depth.depth() << std::endl;
-  // std::cout << "Img type: " << frame_depth.type() << std::endl;
-
-  // frame_depth.convertTo(frame_depth, CV_8UC1); // IPL_DEPTH_8U
-  // cv::cvtColor(frame_depth, frame_depth, CV_GRAY2BGR); // convert image to RGB
-
-  // CONVERT form CV_32FC1 to CV_8UC1
-  // double minVal, maxVal;
-  // minMaxLoc(frame_depth, &minVal, &maxVal); //find minimum and maximum intensities
-  // cv::Mat draw;
-  // frame_depth.convertTo(frame_depth, CV_8UC1, 255.0/(maxVal - minVal), -minVal * 255.0/(maxVal - minVal));
-
-  // out_capture.open("TestVideo.avi", CV_FOURCC('P','I','M','1'), 30, dest_rgb.size());
-  // cv::Mat imgY = cv::Mat(dest_rgb.size(), CV_32FC1);
-  // cv::cvtColor(frame_depth, frame_depth, CV_GRAY2BGR); // convert image to RGB
-  // std::cout << "111111" << std::endl;
-  // if( !frame_depth.empty() && frame_depth.data)
-  // {
-  //   std::cout << "Img channels: " << frame_depth.channels() << std::endl;
-  //   std::cout << "Img depth: " << frame_depth.depth() << std::endl;
-  //   std::cout << "Img type: " << frame_depth.type() << std::endl;
-
-  //   out_capture.write(frame_depth);
-  //   // out_capture << frame_depth; // same same
-  //   std::cout << "22222" << std::endl;
-  // }
-
-  /////////////////////////////////////////////////////////////////
+void Recorder::run()
+{
+  for (;;)
+  {
+    Slot *slot;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      while (queue.empty() && !shutdown)
+        condition.wait(lock);
+      if (queue.empty())
+        return;
+      slot = queue.front();
+      queue.pop_front();
+    }
+
+    bool ok = write(*slot);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (ok)
+      written++;
+    else
+      failed++;
+    free_slots.push_back(slot);
+  }
 }
 
-// save timeStamp file for FPS syncing
-void Recorder::saveTimeStamp()
+bool Recorder::write(const Slot& slot)
 {
-  // TODO: handle relative path + check Windows / UNIX compat.
-  std::ofstream fout("../recordings/timeStamp.txt");
-  if(fout.is_open())
+  std::string subdirectory = slot.type == "registered" ? "regist" : slot.type;
+  std::ostringstream path;
+  path << directory << "/" << subdirectory << "/" << slot.timestamp << "_" << slot.type << "_" << slot.sequence;
+
+  std::vector<int> png_params;
+  png_params.push_back(cv::IMWRITE_PNG_COMPRESSION);
+  png_params.push_back(1);
+
+  bool ok = false;
+  if (slot.format == libfreenect2::Frame::Raw)
   {
-      std::cout << "recording lasted " << ((timeStamps[frameID-1]-timeStamps[0])/1000.0) << " sec(s), writing timeStamp data..." << std::endl;
-      fout << "# Elapsed time in ms # \n";
-      for(int i = 0; i<frameID; i++)
-      {
-        fout << (float)timeStamps[i];
-        fout << '\n';
-      }
+    // Raw color frames are the JPEG stream from the device.
+    path << ".jpg";
+    std::ofstream out(path.str().c_str(), std::ios::binary);
+    out.write(reinterpret_cast<const char*>(&slot.data[0]), slot.data.size());
+    ok = out.good();
+  }
+  else if (slot.format == libfreenect2::Frame::Float)
+  {
+    // Depth in millimeters fits 16 bits without loss of the sensor resolution.
+    cv::Mat depth16(slot.height, slot.width, CV_16UC1);
+    const float *src = reinterpret_cast<const float*>(&slot.data[0]);
+    for (size_t i = 0; i < slot.width * slot.height; i++)
+    {
+      float d = src[i];
+      depth16.at<uint16_t>(i) = (d > 0.0f && d < 65535.5f) ? (uint16_t)(d + 0.5f) : 0;
+    }
+    path << ".png";
+    ok = cv::imwrite(path.str(), depth16, png_params);
+  }
+  else if (slot.format == libfreenect2::Frame::BGRX || slot.format == libfreenect2::Frame::RGBX)
+  {
+    cv::Mat color(slot.height, slot.width, CV_8UC4, const_cast<unsigned char*>(&slot.data[0])), bgr;
+    cv::cvtColor(color, bgr, slot.format == libfreenect2::Frame::BGRX ? cv::COLOR_BGRA2BGR : cv::COLOR_RGBA2BGR);
+    path << ".png";
+    ok = cv::imwrite(path.str(), bgr, png_params);
+  }
+  else if (slot.format == libfreenect2::Frame::RGB || slot.format == libfreenect2::Frame::Gray || slot.format == libfreenect2::Frame::I420)
+  {
+    cv::Mat bgr;
+    unsigned char *data = const_cast<unsigned char*>(&slot.data[0]);
+    if (slot.format == libfreenect2::Frame::RGB)
+      cv::cvtColor(cv::Mat(slot.height, slot.width, CV_8UC3, data), bgr, cv::COLOR_RGB2BGR);
+    else if (slot.format == libfreenect2::Frame::I420)
+      cv::cvtColor(cv::Mat(slot.height * 3 / 2, slot.width, CV_8UC1, data), bgr, cv::COLOR_YUV2BGR_I420);
+    else
+      bgr = cv::Mat(slot.height, slot.width, CV_8UC1, data);
+    path << ".png";
+    ok = cv::imwrite(path.str(), bgr, png_params);
   }
   else
   {
-    std::cout << "File could not be opened." << std::endl;
+    std::cerr << "Recorder: unsupported frame format " << slot.format << " (" << slot.type << ")" << std::endl;
+    return false;
   }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (ok)
+    timestamp_file << slot.type << " " << slot.timestamp << " " << slot.sequence << " " << path.str() << "\n";
+  else
+    std::cerr << "Recorder: failed to write " << path.str() << std::endl;
+  return ok;
+}
+
+void Recorder::report()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  std::cout << "-> recorder: " << written << "/" << recorded << " frames written, queue " << queue.size()
+            << "/" << slots.size() << " (max " << max_queue_depth << "), " << dropped << " dropped";
+  if (failed > 0)
+    std::cout << ", " << failed << " failed";
+  std::cout << std::endl;
+}
+
+void Recorder::close()
+{
+  if (writers.empty())
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    shutdown = true;
+  }
+  condition.notify_all();
+  for (size_t i = 0; i < writers.size(); i++)
+    writers[i].join();
+  writers.clear();
+
+  timestamp_file.close();
+  report();
 }
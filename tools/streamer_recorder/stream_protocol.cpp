@@ -0,0 +1,111 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2017 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include "stream_protocol.h"
+
+#include <chrono>
+
+static void put16(unsigned char *p, uint16_t v)
+{
+  p[0] = v & 0xff;
+  p[1] = v >> 8;
+}
+
+static void put32(unsigned char *p, uint32_t v)
+{
+  put16(p, v & 0xffff);
+  put16(p + 2, v >> 16);
+}
+
+static void put64(unsigned char *p, uint64_t v)
+{
+  put32(p, v & 0xffffffffu);
+  put32(p + 4, v >> 32);
+}
+
+static uint16_t get16(const unsigned char *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const unsigned char *p)
+{
+  return get16(p) | ((uint32_t)get16(p + 2) << 16);
+}
+
+static uint64_t get64(const unsigned char *p)
+{
+  return get32(p) | ((uint64_t)get32(p + 4) << 32);
+}
+
+void writeFragmentHeader(const FragmentHeader &h, unsigned char *out)
+{
+  put32(out, FRAGMENT_MAGIC);
+  out[4] = PROTOCOL_VERSION;
+  out[5] = h.stream;
+  out[6] = h.codec;
+  out[7] = h.format;
+  put32(out + 8, h.frame_id);
+  put16(out + 12, h.fragment_index);
+  put16(out + 14, h.fragment_count);
+  put32(out + 16, h.sequence);
+  put32(out + 20, h.timestamp);
+  put32(out + 24, h.frame_length);
+  put32(out + 28, h.offset);
+  put16(out + 32, h.width);
+  put16(out + 34, h.height);
+  put64(out + 36, h.send_time_us);
+}
+
+bool readFragmentHeader(const unsigned char *in, size_t length, FragmentHeader &h)
+{
+  if (length < FRAGMENT_HEADER_SIZE || get32(in) != FRAGMENT_MAGIC || in[4] != PROTOCOL_VERSION)
+    return false;
+
+  h.stream = in[5];
+  h.codec = in[6];
+  h.format = in[7];
+  h.frame_id = get32(in + 8);
+  h.fragment_index = get16(in + 12);
+  h.fragment_count = get16(in + 14);
+  h.sequence = get32(in + 16);
+  h.timestamp = get32(in + 20);
+  h.frame_length = get32(in + 24);
+  h.offset = get32(in + 28);
+  h.width = get16(in + 32);
+  h.height = get16(in + 34);
+  h.send_time_us = get64(in + 36);
+
+  // frame_length sizes the reassembly buffer, so bound it before anyone allocates.
+  return h.stream < STREAM_COUNT && h.fragment_index < h.fragment_count && h.offset <= h.frame_length &&
+         h.frame_length <= MAX_FRAME_LENGTH && h.frame_length <= (size_t)h.fragment_count * FRAGMENT_PAYLOAD_SIZE;
+}
+
+uint64_t currentTimeMicroseconds()
+{
+  using namespace std::chrono;
+  return duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+}
@@ -25,50 +25,208 @@
  */
 
 #include "streamer.h"
-#include <cstdlib>
 
-void Streamer::initialize()
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+Streamer::Streamer():
+  port_(0),
+  max_rate_(STREAM_MAX_RATE),
+  running_(false),
+  sent_frames_(0),
+  replaced_frames_(0),
+  failed_frames_(0),
+  sent_bytes_(0)
+{
+  codecs_[STREAM_DEPTH] = createFrameCodec("jpeg");
+  codecs_[STREAM_COLOR] = createFrameCodec("jpeg");
+  codecs_[STREAM_IR] = createFrameCodec("raw");
+  codecs_[STREAM_REGISTERED] = createFrameCodec("jpeg");
+
+  for (size_t i = 0; i < STREAM_COUNT; ++i)
+  {
+    pending_[i].full = false;
+    next_frame_id_[i] = 0;
+  }
+  sending_.full = false;
+  datagram_.resize(PACK_SIZE);
+}
+
+Streamer::~Streamer()
+{
+  close();
+  for (size_t i = 0; i < STREAM_COUNT; ++i)
+    delete codecs_[i];
+}
+
+void Streamer::initialize(const std::string &address, unsigned short port, double max_rate)
 {
   std::cout << "Initialize Streamer." << std::endl;
 
-  jpegqual =  ENCODE_QUALITY; // Compression Parameter
+  address_ = address;
+  port_ = port != 0 ? port : Socket::resolveService(SERVER_PORT, "udp");
+  max_rate_ = max_rate;
+  next_send_ = last_report_ = std::chrono::steady_clock::now();
 
-  servAddress = SERVER_ADDRESS;
-  servPort = Socket::resolveService(SERVER_PORT, "udp"); // Server port
+  running_ = true;
+  thread_ = std::thread(&Streamer::run, this);
+}
 
-  compression_params.push_back(CV_IMWRITE_JPEG_QUALITY);
-  compression_params.push_back(jpegqual);
+bool Streamer::setCodec(StreamId stream, const std::string &name)
+{
+  FrameCodec *codec = createFrameCodec(name);
+  if (!codec)
+    return false;
+  delete codecs_[stream];
+  codecs_[stream] = codec;
+  return true;
 }
 
-void Streamer::stream(libfreenect2::Frame* frame)
+void Streamer::stream(libfreenect2::Frame* frame, StreamId stream)
 {
-  try
+  size_t size = frameDataSize(*frame);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!running_)
+      return;
+    Pending &p = pending_[stream];
+    if (p.full)
+      replaced_frames_++;
+    // assign() reuses the capacity of the previous frame
+    p.data.assign(frame->data, frame->data + size);
+    p.width = frame->width;
+    p.height = frame->height;
+    p.bytes_per_pixel = frame->bytes_per_pixel;
+    p.format = frame->format;
+    p.timestamp = frame->timestamp;
+    p.sequence = frame->sequence;
+    p.queued_us = currentTimeMicroseconds();
+    p.full = true;
+  }
+  cond_.notify_one();
+}
+
+void Streamer::run()
+{
+  for (;;)
   {
-    // int total_pack = 1 + (encoded.size() - 1) / PACK_SIZE;
-    cv::Mat frame_depth = cv::Mat(frame->height, frame->width, CV_32FC1, frame->data) / 10;
-    cv::imencode(".jpg", frame_depth, encoded, compression_params);
+    StreamId stream = STREAM_COUNT;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      for (;;)
+      {
+        // oldest frame first, so a busy stream does not starve the others
+        for (size_t i = 0; i < STREAM_COUNT; ++i)
+          if (pending_[i].full && (stream == STREAM_COUNT || pending_[i].queued_us < pending_[stream].queued_us))
+            stream = (StreamId)i;
+        if (stream != STREAM_COUNT || !running_)
+          break;
+        cond_.wait(lock);
+      }
+      if (stream == STREAM_COUNT)
+        return;
+      std::swap(sending_, pending_[stream]);
+      pending_[stream].full = false;
+    }
+
+    send(stream, sending_);
+  }
+}
+
+void Streamer::send(StreamId stream, const Pending &frame)
+{
+  libfreenect2::Frame view(frame.width, frame.height, frame.bytes_per_pixel, const_cast<unsigned char *>(frame.data.data()));
+  view.format = frame.format;
+  view.timestamp = frame.timestamp;
+  view.sequence = frame.sequence;
 
-    // resize image
-    // resize(frame, encoded, Size(FRAME_WIDTH, FRAME_HEIGHT), 0, 0, INTER_LINEAR);
+  FrameCodec *codec = codecs_[stream];
+  if (!codec->encode(view, encoded_) || encoded_.size() > MAX_FRAME_LENGTH)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    failed_frames_++;
+    return;
+  }
 
-    // show encoded frame
-    // cv::namedWindow( "streamed frame", CV_WINDOW_AUTOSIZE);
-    // cv::imshow("streamed frame", encoded);
-    // cv::waitKey(0);
+  FragmentHeader header;
+  header.stream = stream;
+  header.codec = codec->id();
+  header.format = frame.format;
+  header.frame_id = next_frame_id_[stream]++;
+  header.fragment_count = std::max<size_t>(1, (encoded_.size() + FRAGMENT_PAYLOAD_SIZE - 1) / FRAGMENT_PAYLOAD_SIZE);
+  header.sequence = frame.sequence;
+  header.timestamp = frame.timestamp;
+  header.frame_length = encoded_.size();
+  header.width = frame.width;
+  header.height = frame.height;
+  header.send_time_us = frame.queued_us;
 
-    total_pack = 1 + (encoded.size() - 1) / PACK_SIZE;
+  try
+  {
+    for (size_t i = 0; i < header.fragment_count; ++i)
+    {
+      header.fragment_index = i;
+      header.offset = i * FRAGMENT_PAYLOAD_SIZE;
+      size_t length = std::min(FRAGMENT_PAYLOAD_SIZE, encoded_.size() - header.offset);
 
-    // send pre-info
-    ibuf[0] = total_pack;
-    sock.sendTo(ibuf, sizeof(int), servAddress, servPort);
+      writeFragmentHeader(header, datagram_.data());
+      std::memcpy(datagram_.data() + FRAGMENT_HEADER_SIZE, encoded_.data() + header.offset, length);
 
-    // send image data packet
-    for(int i = 0; i < total_pack; i++)
-      sock.sendTo( & encoded[i * PACK_SIZE], PACK_SIZE, servAddress, servPort);
+      pace(FRAGMENT_HEADER_SIZE + length);
+      sock_.sendTo(datagram_.data(), FRAGMENT_HEADER_SIZE + length, address_, port_);
+    }
   }
   catch (SocketException & e)
   {
     std::cerr << e.what() << std::endl;
-    // exit(1);
+    std::lock_guard<std::mutex> lock(mutex_);
+    failed_frames_++;
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  sent_frames_++;
+  sent_bytes_ += encoded_.size() + header.fragment_count * FRAGMENT_HEADER_SIZE;
+}
+
+void Streamer::pace(size_t bytes)
+{
+  using namespace std::chrono;
+  if (max_rate_ <= 0)
+    return;
+
+  // Datagrams may run up to 1 ms ahead of schedule; sleeping for less is too imprecise to be useful.
+  steady_clock::time_point now = steady_clock::now();
+  if (next_send_ > now + milliseconds(1))
+    std::this_thread::sleep_until(next_send_);
+  else if (next_send_ < now)
+    next_send_ = now;
+  next_send_ += duration_cast<steady_clock::duration>(duration<double>(bytes / max_rate_));
+}
+
+void Streamer::report()
+{
+  using namespace std::chrono;
+  std::lock_guard<std::mutex> lock(mutex_);
+  steady_clock::time_point now = steady_clock::now();
+  double seconds = duration<double>(now - last_report_).count();
+  std::cout << "Streamer: " << sent_frames_ << " frames sent, "
+            << replaced_frames_ << " replaced before sending, "
+            << failed_frames_ << " failed, "
+            << (seconds > 0 ? sent_bytes_ * 8 / seconds / 1e6 : 0) << " Mbit/s" << std::endl;
+  sent_bytes_ = 0;
+  last_report_ = now;
+}
+
+void Streamer::close()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!running_)
+      return;
+    running_ = false;
   }
+  cond_.notify_one();
+  thread_.join();
 }